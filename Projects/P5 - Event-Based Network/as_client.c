@@ -70,6 +70,10 @@ static int get_next_filename(int sockfd, char **filename) {
     char *parse_ptr = strtok(*filename, ":");
     int index = strtol(parse_ptr, NULL, 10);
     parse_ptr = strtok(NULL, ":");
+    // a file the server has removed from its library keeps its index, with no name
+    if (parse_ptr == NULL) {
+        parse_ptr = "";
+    }
     // moves the filename to the start of the string (overwriting the index)
     memmove(*filename, parse_ptr, strlen(parse_ptr) + 1);
 
@@ -130,7 +134,10 @@ int list_request(int sockfd, Library *library) {
     //print files in list.
     for (int i = 0; i < len; i++)
     {
-        printf("%d: %s\n", i, library->files[i]);
+        if (library->files[i][0] != '\0')
+        {
+            printf("%d: %s\n", i, library->files[i]);
+        }
     }
 
     return 0;
@@ -707,7 +714,8 @@ static int client_shell(int sockfd, const char *library_directory) {
                 continue;
             }
             file_index = strtol(file_index_str, NULL, 10);
-            if (file_index < 0 || file_index >= library.num_files) {
+            if (file_index < 0 || file_index >= library.num_files ||
+                library.files[file_index][0] == '\0') {
                 printf("Invalid file index\n");
                 continue;
             }
@@ -724,7 +732,8 @@ static int client_shell(int sockfd, const char *library_directory) {
                 continue;
             }
             file_index = strtol(file_index_str, NULL, 10);
-            if (file_index < 0 || file_index >= library.num_files) {
+            if (file_index < 0 || file_index >= library.num_files ||
+                library.files[file_index][0] == '\0') {
                 printf("Invalid file index\n");
                 continue;
             }
@@ -741,7 +750,8 @@ static int client_shell(int sockfd, const char *library_directory) {
                 continue;
             }
             file_index = strtol(file_index_str, NULL, 10);
-            if (file_index < 0 || file_index >= library.num_files) {
+            if (file_index < 0 || file_index >= library.num_files ||
+                library.files[file_index][0] == '\0') {
                 printf("Invalid file index\n");
                 continue;
             }
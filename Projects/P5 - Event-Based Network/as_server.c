@@ -16,7 +16,9 @@ int init_server_addr(int port, struct sockaddr_in *addr){
 }
 
 
-int set_up_server_socket(const struct sockaddr_in *server_options, int num_queue) {
+// set_up_server_socket, with SO_REUSEPORT too if reuse_port is set
+static int _set_up_listen_socket(const struct sockaddr_in *server_options, int num_queue,
+                                 uint8_t reuse_port) {
     int soc = socket(AF_INET, SOCK_STREAM, 0);
     if (soc < 0) {
         perror("socket");
@@ -35,6 +37,14 @@ int set_up_server_socket(const struct sockaddr_in *server_options, int num_queue
         exit(1);
     }
 
+    // Let the other workers' sockets bind the same port; the kernel then
+    // hands each new connection to one of them
+    if (reuse_port &&
+        setsockopt(soc, SOL_SOCKET, SO_REUSEPORT, (const char *) &on, sizeof(on)) < 0) {
+        perror("setsockopt");
+        exit(1);
+    }
+
     // Associate the process with the address and a port
     if (bind(soc, (struct sockaddr *)server_options, sizeof(*server_options)) < 0) {
         // bind failed; could be because port is in use.
@@ -57,6 +67,11 @@ int set_up_server_socket(const struct sockaddr_in *server_options, int num_queue
 }
 
 
+int set_up_server_socket(const struct sockaddr_in *server_options, int num_queue) {
+    return _set_up_listen_socket(server_options, num_queue, 0);
+}
+
+
 ClientSocket accept_connection(int listenfd) {
     ClientSocket client;
     socklen_t addr_size = sizeof(client.addr);
@@ -79,7 +94,10 @@ int response_len(char **file_names, int num_files)
     int response_len = 0;
     for (int i = 0; i < num_files; i++)
     {
-        response_len += strlen(file_names[i]);
+        if (file_names[i] != NULL)  // (removed from the library)
+        {
+            response_len += strlen(file_names[i]);
+        }
     }
 
     response_len += (2 * num_files); //take into account network newline characters.
@@ -104,32 +122,17 @@ int get_index_strlen(int index)
     return count;
 }
 
-char *file_index_string(int index)
+char *create_msg_string(char **file_names, int num_files)
 {
-    int num_digits = get_index_strlen(index);
-    char *index_str= malloc((num_digits + 2) * sizeof(char));
-    if (index_str == NULL)
+    //every entry's length is known up front, so the message is allocated once
+    //and written front to back (index, colon, name, network newline).
+    size_t msg_len = response_len(file_names, num_files);
+    for (int i = 0; i < num_files; i++)
     {
-        perror("malloc");
-        exit(EXIT_FAILURE);
+        msg_len += get_index_strlen(i) + 1;
     }
 
-    // Format a string using sprintf
-    sprintf(index_str, "%d", index);
-
-    // Add a colon to the end of the string
-    strcat(index_str, ":");
-
-    // Ensure the string is null-terminated after the colon
-    index_str[strlen(index_str)] = '\0';
-
-    return index_str;
-}
-
-char *create_msg_string(char **file_names, int num_files)
-{
-    //allocating memory for the message, and setting msg values
-    char *msg = malloc(sizeof(char));
+    char *msg = malloc((msg_len + 1) * sizeof(char));
     if (msg == NULL)
     {
         perror("malloc");
@@ -137,70 +140,79 @@ char *create_msg_string(char **file_names, int num_files)
     }
     msg[0] = '\0';
 
-    int old_msg_len = 0;
-    int curr_msg_len = 0;
-
+    char *end = msg;
     for (int i = (num_files - 1); i >= 0; i--)
     {
-        char *curr_index_str = file_index_string(i);
-        char *curr_file_name = file_names[i];
-
-        int index_len = strlen(curr_index_str);
-        int file_name_len = strlen(curr_file_name); //strlen does not include null terminator
+        end += sprintf(end, "%d:%s\r\n", i, file_names[i] != NULL ? file_names[i] : "");
+    }
 
-        curr_msg_len += index_len + file_name_len + 3;
-        msg = realloc(msg, curr_msg_len * sizeof(char));
-        if (msg == NULL)
-        {
-            perror("realloc");
-            exit(EXIT_FAILURE);
-        }
-        msg[old_msg_len] = '\0';
+    return msg;
+}
 
-        strncat(msg, curr_index_str, index_len);
-        free(curr_index_str);
+ListResponse *make_list_response(const Library *library)
+{
+    ListResponse *list = malloc(sizeof(ListResponse));
+    if (list == NULL)
+    {
+        perror("make_list_response");
+        return NULL;
+    }
+    list->msg = create_msg_string(library->files, library->num_files);
+    list->len = strlen(list->msg);
+    list->refs = 1;
+    list->in_index = 0;
+    list->snapshot = NULL;
+    list->snapshot_size = 0;
+    return list;
+}
 
-        strncat(msg, curr_file_name, file_name_len);
-        strncat(msg, "\r\n", 3);
+ListResponse *hold_list_response(ListResponse *list)
+{
+    list->refs++;
+    return list;
+}
 
-        //strncat(msg, '\r\n');
-        old_msg_len = curr_msg_len;
+void release_list_response(ListResponse *list)
+{
+    if (list == NULL || --list->refs > 0)
+    {
+        return;
     }
-
-    return msg;
+    if (list->snapshot != NULL)
+    {
+        munmap(list->snapshot, list->snapshot_size);
+    }
+    else if (!list->in_index)
+    {
+        free(list->msg);
+    }
+    free(list);
 }
 
-int list_request_response(const ClientSocket * client, const Library *library) {
-    if (library->num_files == 0)
+int list_request_response(const ClientSocket * client, const ListResponse *list) {
+    if (list->len == 0)
     {
         printf("No files in library");
         return -1;
     }
 
-    char *msg = create_msg_string(library->files, library->num_files);
-
-    ssize_t bytes_sent =  write_precisely(client->socket, msg, strlen(msg));
+    ssize_t bytes_sent =  write_precisely(client->socket, list->msg, list->len);
     if (bytes_sent < 0) {
         perror("Error sending data to client");
         return -1;
     }
 
-    free(msg);
-
     return 0;
 }
 
 
-static int _load_file_size_into_buffer(FILE *file, uint8_t *buffer) {
-    if (fseek(file, 0, SEEK_END) < 0) {
-        ERR_PRINT("Error seeking to end of file\n");
-        return -1;
-    }
-    uint32_t file_size = ftell(file);
-    if (fseek(file, 0, SEEK_SET) < 0) {
-        ERR_PRINT("Error seeking to start of file\n");
+static int _load_file_size_into_buffer(int file_fd, uint8_t *buffer) {
+    struct stat file_stat;
+    if (fstat(file_fd, &file_stat) < 0) {
+        ERR_PRINT("Error getting the size of the file\n");
         return -1;
     }
+    uint32_t file_size = file_stat.st_size;
     buffer[0] = (file_size >> 24) & 0xFF;
     buffer[1] = (file_size >> 16) & 0xFF;
     buffer[2] = (file_size >> 8) & 0xFF;
@@ -254,15 +266,20 @@ char *get_filepath_from_index(const Library *library, int file_index)
         printf("ERROR: file index %d is out of range\n", file_index);
         return NULL;
     }
+    if (library->files[file_index] == NULL)
+    {
+        printf("ERROR: file %d has been removed from the library\n", file_index);
+        return NULL;
+    }
 
     char *rel_path = _join_path(library->path, library->files[file_index]);
     return rel_path;
 }
 
-int send_filesize(int socket, FILE *file_ptr, uint8_t *buffer)
+int send_filesize(int socket, int file_fd, uint8_t *buffer)
 {
     //the following loads the file size into the buffer.
-    if (_load_file_size_into_buffer(file_ptr, buffer) < 0)
+    if (_load_file_size_into_buffer(file_fd, buffer) < 0)
     {
         printf("Error loading file size into buffer");
         return -1;
@@ -274,72 +291,117 @@ int send_filesize(int socket, FILE *file_ptr, uint8_t *buffer)
       return -1;
     }
 
-    if (ferror(file_ptr))
-    {
-       perror("Error reading from file");
-       return -1;
-    }
-
     //return file size
     return convert_uint8_to_uint32(buffer);
 }
 
-int send_stream(int socket, FILE *file_ptr, uint8_t *response_buffer, uint32_t num_to_write)
+void init_file_sender(FileSender *sender)
 {
-    uint32_t next_write_amt = 0;
-    while (num_to_write != 0)
+    sender->use_splice = 0;
+    sender->pipe_fds[0] = sender->pipe_fds[1] = -1;
+    sender->in_pipe = 0;
+}
+
+void close_file_sender(FileSender *sender)
+{
+    if (sender->pipe_fds[0] >= 0)
+    {
+        close(sender->pipe_fds[0]);
+        close(sender->pipe_fds[1]);
+    }
+    init_file_sender(sender);
+}
+
+ssize_t send_file_range(int out_fd, int in_fd, off_t *offset, size_t count, FileSender *sender)
+{
+    if (!sender->use_splice)
     {
-        //setting the next write size.
-        next_write_amt = STREAM_CHUNK_SIZE;
-        if  (num_to_write <= STREAM_CHUNK_SIZE)
+        ssize_t sent = sendfile(out_fd, in_fd, offset, MIN(count, SENDFILE_CHUNK_SIZE));
+        if (sent > 0) {return sent;}
+        if (sent == 0)
+        {
+            ERR_PRINT("send_file_range: the file ended early\n");
+            return -1;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {return 0;}
+        if (errno != EINVAL && errno != ENOSYS)
         {
-            next_write_amt = num_to_write;
+            perror("send_file_range: sendfile");
+            return -1;
         }
 
-        if (fread(response_buffer, 1, next_write_amt, file_ptr) != next_write_amt)
+        //this file can't be sent with sendfile(), so move it through a pipe instead.
+        if (pipe(sender->pipe_fds) < 0)
         {
-            if (feof(file_ptr)) {
-                printf("End of file reached.\n");
-            } else {
-                perror("Error reading from file");
-            }
+            perror("send_file_range: pipe");
             return -1;
         }
+        sender->use_splice = 1;
+    }
 
-        if (ferror(file_ptr))
+    //top the pipe up from the file (it may be full already), then empty what it can into the socket.
+    if (sender->in_pipe < count)
+    {
+        ssize_t filled = splice(in_fd, offset, sender->pipe_fds[1], NULL,
+                                MIN(count - sender->in_pipe, SENDFILE_CHUNK_SIZE),
+                                SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (filled == 0)
+        {
+            ERR_PRINT("send_file_range: the file ended early\n");
+            return -1;
+        }
+        if (filled < 0 && errno != EAGAIN && errno != EINTR)
         {
-            perror("Error reading from file");
+            perror("send_file_range: splice");
+            return -1;
         }
+        if (filled > 0) {sender->in_pipe += filled;}
+    }
+    if (sender->in_pipe == 0) {return 0;}
+
+    ssize_t sent = splice(sender->pipe_fds[0], NULL, out_fd, NULL, sender->in_pipe, SPLICE_F_MOVE);
+    if (sent < 0)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {return 0;}
+        perror("send_file_range: splice");
+        return -1;
+    }
+    sender->in_pipe -= sent;
+    return sent;
+}
+
+int send_stream(int socket, int file_fd, uint32_t num_to_write)
+{
+    FileSender sender;
+    init_file_sender(&sender);
+    off_t offset = 0;
 
-        if (write_precisely(socket, response_buffer, next_write_amt) != next_write_amt)
+    while (num_to_write != 0)
+    {
+        ssize_t sent = send_file_range(socket, file_fd, &offset, num_to_write, &sender);
+        if (sent < 0)
         {
             perror("Error sending data");
+            close_file_sender(&sender);
             return -1;
         }
-
-        num_to_write -= next_write_amt;
+        num_to_write -= sent;
     }
 
+    close_file_sender(&sender);
     return 0;
 }
 
-int send_response(const ClientSocket * client, FILE *file_ptr)
+int send_response(const ClientSocket * client, int file_fd)
 {
-        //the following initializes a response buffer of size STREAM_CHUNK_SIZE bytes
-        uint8_t *response_buffer = (uint8_t *)malloc(STREAM_CHUNK_SIZE);
-        if (response_buffer == NULL)
-        {
-            perror("malloc");
-            exit(EXIT_FAILURE);
-        }
+        uint8_t size_buffer[sizeof(uint32_t)];
 
         //the following loads the file size into the buffer.
-        uint32_t num_to_write = send_filesize(client->socket, file_ptr, response_buffer);
+        uint32_t num_to_write = send_filesize(client->socket, file_fd, size_buffer);
         if (num_to_write == 0){return -1;}
 
-        if (send_stream(client->socket, file_ptr, response_buffer, num_to_write) != 0){return -1;}
+        if (send_stream(client->socket, file_fd, num_to_write) != 0){return -1;}
         fprintf(stdout, "total size: %d\n", num_to_write);
-        free(response_buffer);
         return 0;
 }
 
@@ -353,35 +415,21 @@ int stream_request_response(const ClientSocket * client, const Library *library,
     char *file_path = get_filepath_from_index(library, file_index);
     if (file_path == NULL) {return -1;}
 
-    FILE *file_ptr = fopen(file_path, "r");
-    if (file_ptr == NULL)
+    int file_fd = open(file_path, O_RDONLY);
+    if (file_fd < 0)
     {
         perror("Error opening file");
         return -1;
     }
 
     free(file_path);
-    int send_success = send_response(client, file_ptr);
-    fclose(file_ptr);
+    int send_success = send_response(client, file_fd);
+    close(file_fd);
 
     return send_success;
 }
 
 
-static Library make_library(const char *path){
-    Library library;
-    library.path = path;
-    library.num_files = 0;
-    library.files = NULL;
-    library.name = "server";
-
-    printf("Initializing library\n");
-    printf("Library path: %s\n", library.path);
-
-    return library;
-}
-
-
 static void _wait_for_children(pid_t **client_conn_pids, int *num_connected_clients, uint8_t immediate) {
     int status;
     for (int i = 0; i < *num_connected_clients; i++) {
@@ -414,11 +462,13 @@ static void _wait_for_children(pid_t **client_conn_pids, int *num_connected_clie
 ** Create a server socket and listen for connections
 **
 ** port: the port number to listen on.
+** num_queue: how many connections may wait to be accepted.
+** reuse_port: share the port with other sockets that set it too (SO_REUSEPORT).
 ** 
 ** On success, returns the file descriptor of the socket.
 ** On failure, return -1.
 */
-static int initialize_server_socket(int port) {
+static int initialize_server_socket(int port, int num_queue, uint8_t reuse_port) {
 	struct sockaddr_in server_addr;
 
 	//initializing the sockaddr_in struct:
@@ -430,8 +480,8 @@ static int initialize_server_socket(int port) {
 	    return socket_fd;
 	}
 
-	//set up the socket using the sockaddr_in struct with MAX_PENDING num_queue.
-	socket_fd = set_up_server_socket(&server_addr, MAX_PENDING);
+	//set up the socket using the sockaddr_in struct.
+	socket_fd = _set_up_listen_socket(&server_addr, num_queue, reuse_port);
 
 	if (socket_fd == -1)
 	{
@@ -441,34 +491,83 @@ static int initialize_server_socket(int port) {
 	return socket_fd;
 }
 
+static void _raise_open_file_limit() {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &limit) < 0) {
+            perror("setrlimit");
+        }
+    }
+}
+
+
 int run_server(int port, const char *library_directory){
-    Library library = make_library(library_directory);
-    if (scan_library(&library) < 0) {
+    // the socket comes before the library walk, which can hold a lot of descriptors at once
+    _raise_open_file_limit();
+	int incoming_connections = initialize_server_socket(port, MAX_PENDING, 0);
+	if (incoming_connections == -1) {
+		return -1;	
+	}
+
+    // a saved index is served from straight away, and checked against the library meanwhile
+    LibraryIndex index;
+    if (make_library_index(&index, library_directory) < 0 ||
+        watch_library(&index, load_library_index(&index) == 0) < 0) {
         ERR_PRINT("Error scanning library\n");
+        free_library_index(&index);
+        close(incoming_connections);
+        return -1;
+    }
+    Library *library = &index.library;
+    // (the children are forked with it, so none of them builds its own)
+    ListResponse *list = make_index_list_response(&index);
+    index.changed = 0;
+    if (list == NULL) {
+        free_library_index(&index);
+        close(incoming_connections);
         return -1;
     }
 
     int num_connected_clients = 0;
     pid_t *client_conn_pids = NULL;
 
-	int incoming_connections = initialize_server_socket(port);
-	if (incoming_connections == -1) {
-		return -1;	
-	}
-	
-    int maxfd = incoming_connections;
     fd_set incoming;
-    SET_SERVER_FD_SET(incoming, incoming_connections);
     int num_intervals_without_scan = 0;
 
     while(1) {
-        if (num_intervals_without_scan >= LIBRARY_SCAN_INTERVAL) {
-            if (scan_library(&library) < 0) {
+        // without inotify, the library is rescanned every so often instead
+        if (index.inotify_fd < 0 && index.walk == NULL &&
+            num_intervals_without_scan >= LIBRARY_SCAN_INTERVAL) {
+            if (scan_library(&index) < 0) {
                 fprintf(stderr, "Error scanning library\n");
                 return 1;
             }
             num_intervals_without_scan = 0;
         }
+        if (index.changed) {
+            ListResponse *rescanned = make_list_response(library);
+            if (rescanned == NULL) {
+                return 1;
+            }
+            release_list_response(list);
+            list = rescanned;
+            index.changed = 0;
+        }
+        if (index.unsaved && time(NULL) - index.saved_at >= LIBRARY_SAVE_INTERVAL) {
+            save_library_index(&index);
+        }
+
+        SET_SERVER_FD_SET(incoming, incoming_connections);
+        int maxfd = incoming_connections;
+        // (changes are left queued until the scan that started watching is done)
+        if (index.walk != NULL) {
+            FD_SET(index.scan_done_fd, &incoming);
+            maxfd = MAX(maxfd, index.scan_done_fd);
+        } else if (index.inotify_fd >= 0) {
+            FD_SET(index.inotify_fd, &incoming);
+            maxfd = MAX(maxfd, index.inotify_fd);
+        }
 
         struct timeval select_timeout = SELECT_TIMEOUT;
         if(select(maxfd + 1, &incoming, NULL, NULL, &select_timeout) < 0){
@@ -488,8 +587,9 @@ int run_server(int port, const char *library_directory){
             if(pid == 0){
                 close(incoming_connections);
                 free(client_conn_pids);
-                int result = handle_client(&client_socket, &library);
-                _free_library(&library);
+                int result = handle_client(&client_socket, library, list);
+                release_list_response(list);
+                free_library_index(&index);
                 close(client_socket.socket);
                 return result;
             }
@@ -503,9 +603,18 @@ int run_server(int port, const char *library_directory){
         if (FD_ISSET(STDIN_FILENO, &incoming)) {
             if (getchar() == 'q') break;
         }
+        if (index.walk != NULL && FD_ISSET(index.scan_done_fd, &incoming)) {
+            if (finish_library_scan(&index) < 0) {
+                fprintf(stderr, "Error scanning library\n");
+                return 1;
+            }
+        } else if (index.walk == NULL && index.inotify_fd >= 0 &&
+                   FD_ISSET(index.inotify_fd, &incoming) && update_library(&index) < 0) {
+            fprintf(stderr, "Error updating library\n");
+            return 1;
+        }
 
         num_intervals_without_scan++;
-        SET_SERVER_FD_SET(incoming, incoming_connections);
 
         // Immediate return wait for client processes
         _wait_for_children(&client_conn_pids, &num_connected_clients, 1);
@@ -514,181 +623,2672 @@ int run_server(int port, const char *library_directory){
     printf("Quitting server\n");
     close(incoming_connections);
     _wait_for_children(&client_conn_pids, &num_connected_clients, 0);
-    _free_library(&library);
+    if (index.unsaved) {
+        save_library_index(&index);
+    }
+    release_list_response(list);
+    free_library_index(&index);
     return 0;
 }
 
+/*
+** Event-driven server
+** -------------------
+*/
 
-static uint8_t _is_file_extension_supported(const char *filename){
-    static const char *supported_file_exts[] = SUPPORTED_FILE_EXTS;
-
-    for (int i = 0; i < sizeof(supported_file_exts)/sizeof(char *); i++) {
-        char *files_ext = strrchr(filename, '.');
-        if (files_ext != NULL && strcmp(files_ext, supported_file_exts[i]) == 0) {
-            return 1;
-        }
+typedef struct event_server {
+    int epoll_fd;
+    int listen_fd;
+    Library *library;
+    ListResponse *list;         // the library's LIST response since it was last scanned
+    Connection **connections;   // indexed by socket fd, NULL where there is none
+    int connections_size;
+    int num_connections;
+    OpenFile **open_files;      // files being streamed
+    int num_open_files;
+    uint8_t accept_paused;      // out of file descriptors, stopped listening for a while
+    int num_accepted;           // clients served so far
+} EventServer;
+
+
+static int _set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        perror("fcntl");
+        return -1;
     }
-
     return 0;
 }
 
 
-static int _depth_scan_library(Library *library, char *current_path){
-
-    char *path_in_lib = _join_path(library->path, current_path);
-    if (path_in_lib == NULL) {
+// Register (op EPOLL_CTL_ADD) or re-register (EPOLL_CTL_MOD) fd for events
+static int _watch(int epoll_fd, int op, int fd, uint32_t events) {
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = events;
+    event.data.fd = fd;
+    if (epoll_ctl(epoll_fd, op, fd, &event) < 0) {
+        perror("epoll_ctl");
         return -1;
     }
+    return 0;
+}
 
-    DIR *dir = opendir(path_in_lib);
-    if (dir == NULL) {
-        perror("scan_library");
-        return -1;
-    }
-    free(path_in_lib);
 
-    struct dirent *entry;
-    while((entry = readdir(dir)) != NULL) {
-        if ((entry->d_type == DT_REG) &&
-            _is_file_extension_supported(entry->d_name)) {
-            library->files = (char **)realloc(library->files,
-                                              (library->num_files + 1)
-                                              * sizeof(char *));
-            if (library->files == NULL) {
-                perror("_depth_scan_library");
-                return -1;
-            }
+// Ask to be woken when the connection's socket is ready for events. Always returns 0.
+static int _wait_for(EventServer *server, Connection *conn, uint32_t events) {
+    if (conn->events != events &&
+        _watch(server->epoll_fd, EPOLL_CTL_MOD, conn->client.socket, events) == 0) {
+        conn->events = events;
+    }
+    return 0;
+}
 
-            library->files[library->num_files] = _join_path(current_path, entry->d_name);
-            if (library->files[library->num_files] == NULL) {
-                perror("scan_library");
-                return -1;
-            }
-            #ifdef DEBUG
-            printf("Found file: %s\n", library->files[library->num_files]);
-            #endif
-            library->num_files++;
 
-        } else if (entry->d_type == DT_DIR) {
-            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-                continue;
-            }
+// The shared descriptor for the file at path, opened if nobody is streaming it yet.
+// Files are told apart by inode, not name: a file renamed over another while it is
+// being streamed is a new file, and the old descriptor would send the old one.
+static OpenFile *_open_shared_file(EventServer *server, const char *path) {
+    struct stat path_stat;
+    if (stat(path, &path_stat) < 0) {
+        perror("Error opening file");
+        return NULL;
+    }
+    for (int i = 0; i < server->num_open_files; i++) {
+        if (server->open_files[i]->inode == path_stat.st_ino &&
+            server->open_files[i]->dev == path_stat.st_dev) {
+            server->open_files[i]->refs++;
+            return server->open_files[i];
+        }
+    }
 
-            char *new_path = _join_path(current_path, entry->d_name);
-            if (new_path == NULL) {
-                return -1;
-            }
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat fd_stat;
+    if (fd < 0 || fstat(fd, &fd_stat) < 0) {
+        perror("Error opening file");
+        if (fd >= 0) {
+            close(fd);
+        }
+        return NULL;
+    }
+    OpenFile *file = (OpenFile *)malloc(sizeof(OpenFile));
+    OpenFile **grown = (OpenFile **)realloc(server->open_files,
+                                            (server->num_open_files + 1) * sizeof(OpenFile *));
+    if (file == NULL || grown == NULL) {
+        perror("_open_shared_file");
+        free(file);
+        if (grown != NULL) {
+            server->open_files = grown;
+        }
+        close(fd);
+        return NULL;
+    }
+    file->dev = fd_stat.st_dev;     // (what was opened, if the path changed since the stat)
+    file->inode = fd_stat.st_ino;
+    file->fd = fd;
+    file->refs = 1;
+    server->open_files = grown;
+    server->open_files[server->num_open_files++] = file;
+    return file;
+}
 
-            #ifdef DEBUG
-            printf("Library scan descending into directory: %s\n", new_path);
-            #endif
 
-            int ret_code = _depth_scan_library(library, new_path);
-            free(new_path);
-            if (ret_code < 0) {
-                return -1;
-            }
+static void _release_shared_file(EventServer *server, OpenFile *file) {
+    if (--file->refs > 0) {
+        return;
+    }
+    for (int i = 0; i < server->num_open_files; i++) {
+        if (server->open_files[i] == file) {
+            server->open_files[i] = server->open_files[--server->num_open_files];
+            break;
         }
     }
-
-    closedir(dir);
-    return 0;
+    close(file->fd);
+    free(file);
 }
 
 
-// This function is implemented recursively and uses realloc to grow the files array
-// as it finds more files in the library. It ignores MAX_FILES.
-int scan_library(Library *library) {
-    // Maximal flexibility, free the old strings and start again
-    // A hash table leveraging inode number would be a better way to do this
-    #ifdef DEBUG
-    printf("^^^^ ----------------------------------- ^^^^\n");
-    printf("Freeing library\n");
-    #endif
-    _free_library(library);
-
-    #ifdef DEBUG
-    printf("Scanning library\n");
-    #endif
-    int result = _depth_scan_library(library, "");
-    #ifdef DEBUG
-    printf("vvvv ----------------------------------- vvvv\n");
-    #endif
-    return result;
+static void _close_connection(EventServer *server, Connection *conn) {
+    printf("Client on %s:%d disconnected\n",
+           inet_ntoa(conn->client.addr.sin_addr),
+           ntohs(conn->client.addr.sin_port));
+
+    // closing the socket also takes it out of the epoll set
+    server->connections[conn->client.socket] = NULL;
+    close(conn->client.socket);
+    if (conn->file != NULL) {
+        _release_shared_file(server, conn->file);
+    }
+    close_file_sender(&conn->sender);
+    release_list_response(conn->list);
+    free(conn);
+    server->num_connections--;
+
+    if (server->accept_paused &&
+        _watch(server->epoll_fd, EPOLL_CTL_ADD, server->listen_fd, EPOLLIN) == 0) {
+        server->accept_paused = 0;
+    }
 }
 
 
-int handle_client(const ClientSocket * client, Library *library) {
-    char *request = NULL;
-    uint8_t *request_buffer = (uint8_t *)malloc(REQUEST_BUFFER_SIZE);
-    if (request_buffer == NULL) {
-        perror("handle_client");
-        return 1;
+static int _add_connection(EventServer *server, ClientSocket client) {
+    int fd = client.socket;
+    if (fd >= server->connections_size) {
+        int new_size = server->connections_size ? server->connections_size : 64;
+        while (new_size <= fd) {
+            new_size *= 2;
+        }
+        Connection **grown = (Connection **)realloc(server->connections,
+                                                    new_size * sizeof(Connection *));
+        if (grown == NULL) {
+            perror("_add_connection");
+            return -1;
+        }
+        memset(grown + server->connections_size, 0,
+               (new_size - server->connections_size) * sizeof(Connection *));
+        server->connections = grown;
+        server->connections_size = new_size;
     }
-    uint8_t *buff_end = request_buffer;
 
-    int bytes_read = 0;
-    int bytes_in_buf = 0;
-    while((bytes_read = read(client->socket, buff_end, REQUEST_BUFFER_SIZE - bytes_in_buf)) > 0){
-        #ifdef DEBUG
-        printf("Read %d bytes from client\n", bytes_read);
-        #endif
-
-        bytes_in_buf += bytes_read;
+    Connection *conn = (Connection *)malloc(sizeof(Connection));
+    if (conn == NULL) {
+        perror("_add_connection");
+        return -1;
+    }
+    conn->client = client;
+    conn->state = CONN_READ_REQUEST;
+    conn->events = EPOLLIN;
+    conn->bytes_in_buf = 0;
+    conn->list = NULL;
+    conn->file = NULL;
+    conn->file_offset = 0;
+    conn->file_left = 0;
+    conn->header_sent = 0;
+    init_file_sender(&conn->sender);
+
+    if (_watch(server->epoll_fd, EPOLL_CTL_ADD, fd, EPOLLIN) < 0) {
+        free(conn);
+        return -1;
+    }
+    server->connections[fd] = conn;
+    server->num_connections++;
+    return 0;
+}
 
-        request = find_network_newline((char *)request_buffer, &bytes_in_buf);
 
-        if (request && strcmp(request, REQUEST_LIST) == 0) {
-            if (list_request_response(client, library) < 0) {
-                ERR_PRINT("Error handling LIST request\n");
-                goto client_error;
+static void _accept_connections(EventServer *server) {
+    while (1) {
+        ClientSocket client;
+        socklen_t addr_size = sizeof(client.addr);
+        client.socket = accept(server->listen_fd, (struct sockaddr *)&client.addr,
+                               &addr_size);
+        if (client.socket < 0) {
+            if (errno == EMFILE || errno == ENFILE) {
+                // stop listening until a client leaves (the backlog waits in the kernel)
+                fprintf(stderr, "Out of file descriptors with %d clients\n",
+                        server->num_connections);
+                if (epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, server->listen_fd, NULL) == 0) {
+                    server->accept_paused = 1;
+                }
+            } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR &&
+                       errno != ECONNABORTED) {
+                perror("_accept_connections: accept");
             }
+            return;
+        }
 
-        } else if (request && strcmp(request, REQUEST_STREAM) == 0) {
-            int num_pr_bytes = MIN(sizeof(uint32_t), (unsigned long)bytes_in_buf);
-            if (stream_request_response(client, library, request_buffer, num_pr_bytes) < 0) {
-                ERR_PRINT("Error handling STREAM request\n");
-                goto client_error;
-            }
-            bytes_in_buf -= num_pr_bytes;
-            memmove(request_buffer, request_buffer + num_pr_bytes, bytes_in_buf);
+        printf("Server got a connection from %s, port %d\n",
+               inet_ntoa(client.addr.sin_addr), ntohs(client.addr.sin_port));
 
-        } else if (request) {
-            ERR_PRINT("Unknown request: %s\n", request);
+        if (_set_nonblocking(client.socket) < 0 || _add_connection(server, client) < 0) {
+            close(client.socket);
+        } else {
+            server->num_accepted++;
         }
+    }
+}
 
-        free(request); request = NULL;
-        buff_end = request_buffer + bytes_in_buf;
 
-    }
+// Read what's waiting on the socket into the request buffer.
+// Returns 1 if anything was read, 0 if nothing is waiting, -1 on EOF or error.
+static int _read_some(Connection *conn) {
+    int bytes_read = read(conn->client.socket, conn->request_buffer + conn->bytes_in_buf,
+                          REQUEST_BUFFER_SIZE - conn->bytes_in_buf);
     if (bytes_read < 0) {
-        perror("handle_client");
-        goto client_error;
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            return 0;
+        }
+        perror("_read_some");
+        return -1;
     }
+    if (bytes_read == 0) {
+        return -1;
+    }
+    #ifdef DEBUG
+    printf("Read %d bytes from client\n", bytes_read);
+    #endif
+    conn->bytes_in_buf += bytes_read;
+    return 1;
+}
 
-    printf("Client on %s:%d disconnected\n",
-           inet_ntoa(client->addr.sin_addr),
-           ntohs(client->addr.sin_port));
 
-    free(request_buffer);
-    if (request != NULL) {
-        free(request);
-    }
-    return 0;
-client_error:
-    free(request_buffer);
-    if (request != NULL) {
-        free(request);
+// Write as much of buf as the socket takes.
+// Returns the number of bytes written (0 if the socket is full), -1 on error.
+static int _write_some(Connection *conn, const void *buf, size_t count) {
+    int written = send(conn->client.socket, buf, count, MSG_NOSIGNAL);
+    if (written < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            return 0;
+        }
+        perror("Error sending data to client");
+        return -1;
     }
-    return -1;
+    return written;
 }
 
 
-static void print_usage(){
-    printf("Usage: as_server [-h] [-p port] [-l library_directory]\n");
-    printf("  -h  Print this message\n");
-    printf("  -p  Port to listen on (default: " XSTR(DEFAULT_PORT) ")\n");
+// The file index is in the request buffer: open the file, and queue its size to be sent.
+static int _start_stream(EventServer *server, Connection *conn) {
+    uint32_t file_index = convert_uint8_to_uint32(conn->request_buffer);
+    conn->bytes_in_buf -= sizeof(uint32_t);
+    memmove(conn->request_buffer, conn->request_buffer + sizeof(uint32_t), conn->bytes_in_buf);
+
+    char *file_path = get_filepath_from_index(server->library, file_index);
+    if (file_path == NULL) {
+        return -1;
+    }
+    conn->file = _open_shared_file(server, file_path);
+    free(file_path);
+    if (conn->file == NULL) {
+        return -1;
+    }
+
+    struct stat file_stat;
+    if (fstat(conn->file->fd, &file_stat) < 0) {
+        perror("Error reading from file");
+        return -1;
+    }
+
+    conn->file_offset = 0;
+    conn->file_left = file_stat.st_size;
+    uint32_t size = htonl(conn->file_left);
+    memcpy(conn->size_header, &size, sizeof(size));
+    conn->header_sent = 0;
+    conn->state = CONN_SEND_FILE;
+    return 0;
+}
+
+
+/*
+** Take a connection as far as it can go without blocking: parse the requests that
+** have arrived, and send as much of the current response as the socket takes (or
+** SENDFILE_CHUNK_SIZE bytes of a stream, to be fair to the others). Then it
+** waits for whichever of EPOLLIN or EPOLLOUT it needs next.
+**
+** Returns 0 to keep the connection, -1 to close it (on EOF or error).
+*/
+static int _advance_connection(EventServer *server, Connection *conn) {
+    uint8_t streamed = 0;
+    while (1) {
+        switch (conn->state) {
+            case CONN_READ_REQUEST: {
+                char *request = find_network_newline((char *)conn->request_buffer,
+                                                     &conn->bytes_in_buf);
+                if (request == NULL) {
+                    if (conn->bytes_in_buf == REQUEST_BUFFER_SIZE) {
+                        ERR_PRINT("Request too long\n");
+                        return -1;
+                    }
+                    int result = _read_some(conn);
+                    if (result <= 0) {
+                        return result < 0 ? -1 : _wait_for(server, conn, EPOLLIN);
+                    }
+                    break;
+                }
+
+                if (strcmp(request, REQUEST_LIST) == 0) {
+                    if (server->list->len == 0) {
+                        printf("No files in library");
+                        ERR_PRINT("Error handling LIST request\n");
+                        free(request);
+                        return -1;
+                    }
+                    conn->list = hold_list_response(server->list);
+                    conn->list_sent = 0;
+                    conn->state = CONN_SEND_LIST;
+                } else if (strcmp(request, REQUEST_STREAM) == 0) {
+                    conn->state = CONN_READ_INDEX;
+                } else {
+                    ERR_PRINT("Unknown request: %s\n", request);
+                }
+                free(request);
+                break;
+            }
+
+            case CONN_READ_INDEX:
+                if (conn->bytes_in_buf < (int)sizeof(uint32_t)) {
+                    int result = _read_some(conn);
+                    if (result <= 0) {
+                        return result < 0 ? -1 : _wait_for(server, conn, EPOLLIN);
+                    }
+                    break;
+                }
+                if (_start_stream(server, conn) < 0) {
+                    ERR_PRINT("Error handling STREAM request\n");
+                    return -1;
+                }
+                break;
+
+            case CONN_SEND_LIST: {
+                int written = _write_some(conn, conn->list->msg + conn->list_sent,
+                                          conn->list->len - conn->list_sent);
+                if (written <= 0) {
+                    return written < 0 ? -1 : _wait_for(server, conn, EPOLLOUT);
+                }
+                conn->list_sent += written;
+                if (conn->list_sent == conn->list->len) {
+                    release_list_response(conn->list);
+                    conn->list = NULL;
+                    conn->state = CONN_READ_REQUEST;
+                }
+                break;
+            }
+
+            case CONN_SEND_FILE: {
+                if (conn->header_sent < (int)sizeof(conn->size_header)) {
+                    int written = _write_some(conn, conn->size_header + conn->header_sent,
+                                              sizeof(conn->size_header) - conn->header_sent);
+                    if (written <= 0) {
+                        return written < 0 ? -1 : _wait_for(server, conn, EPOLLOUT);
+                    }
+                    conn->header_sent += written;
+                    break;
+                }
+                if (conn->file_left == 0) {
+                    _release_shared_file(server, conn->file);
+                    conn->file = NULL;
+                    close_file_sender(&conn->sender);
+                    conn->state = CONN_READ_REQUEST;
+                    break;
+                }
+                if (streamed) {
+                    // the socket is still writable, so epoll comes straight back after the others
+                    return _wait_for(server, conn, EPOLLOUT);
+                }
+
+                ssize_t sent = send_file_range(conn->client.socket, conn->file->fd,
+                                               &conn->file_offset, conn->file_left,
+                                               &conn->sender);
+                if (sent <= 0) {
+                    return sent < 0 ? -1 : _wait_for(server, conn, EPOLLOUT);
+                }
+                conn->file_left -= sent;
+                streamed = 1;
+                break;
+            }
+        }
+    }
+}
+
+
+// Set in a worker by SIGTERM: close every connection and exit
+static volatile sig_atomic_t _worker_stopping = 0;
+
+static void _stop_worker(int signum) {
+    (void)signum;
+    _worker_stopping = 1;
+}
+
+
+// The library's part of an event loop's turn: rescan it if it's time to (only without
+// inotify), and save it if it's due. Returns -1 if a scan failed.
+static int _tend_library(LibraryIndex *index, time_t *last_scan) {
+    if (index->inotify_fd < 0 && index->walk == NULL &&
+        time(NULL) - *last_scan >= LIBRARY_SCAN_INTERVAL) {
+        if (scan_library(index) < 0) {
+            fprintf(stderr, "Error scanning library\n");
+            return -1;
+        }
+        *last_scan = time(NULL);
+    }
+    if (index->unsaved && time(NULL) - index->saved_at >= LIBRARY_SAVE_INTERVAL) {
+        save_library_index(index);
+    }
+    return 0;
+}
+
+
+// The descriptor that's readable when the library has changed: the background scan's
+// until it's done, then inotify's (-1 if there's neither)
+static int _library_fd(const LibraryIndex *index) {
+    return index->walk != NULL ? index->scan_done_fd : index->inotify_fd;
+}
+
+
+// Take in what made _library_fd readable. Returns -1 on error.
+static int _handle_library_fd(LibraryIndex *index) {
+    if (index->walk != NULL) {
+        // (its eventfd is closed, which takes it out of any epoll set)
+        if (finish_library_scan(index) < 0) {
+            fprintf(stderr, "Error scanning library\n");
+            return -1;
+        }
+    } else if (update_library(index) < 0) {
+        fprintf(stderr, "Error updating library\n");
+        return -1;
+    }
+    return 0;
+}
+
+
+// Pass the descriptor fd over the unix socket. Returns 0 on success, -1 on error
+// (errno EAGAIN if the socket is full).
+static int _send_fd(int socket, int fd) {
+    char byte = 0;
+    struct iovec data = {.iov_base = &byte, .iov_len = 1};
+    union {
+        struct cmsghdr header;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct msghdr msg = {.msg_iov = &data, .msg_iovlen = 1,
+                         .msg_control = control.buf, .msg_controllen = sizeof(control.buf)};
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    return sendmsg(socket, &msg, MSG_DONTWAIT | MSG_NOSIGNAL) == 1 ? 0 : -1;
+}
+
+
+// Receive a descriptor passed with _send_fd into *fd. Returns 1 if one came, 0 if the
+// other end has closed, -1 on error (errno EAGAIN if there's nothing to receive).
+static int _recv_fd(int socket, int *fd) {
+    char byte;
+    struct iovec data = {.iov_base = &byte, .iov_len = 1};
+    union {
+        struct cmsghdr header;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct msghdr msg = {.msg_iov = &data, .msg_iovlen = 1,
+                         .msg_control = control.buf, .msg_controllen = sizeof(control.buf)};
+    ssize_t got = recvmsg(socket, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+    if (got <= 0) {
+        return got == 0 ? 0 : -1;
+    }
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+        errno = EBADMSG;
+        return -1;
+    }
+    memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+    return 1;
+}
+
+
+// Serve the newest of the library snapshots the parent has sent on snapshot_fd.
+// Returns -1 if the parent has gone (or on error).
+static int _take_library_snapshot(EventServer *server, int snapshot_fd) {
+    int newest = -1;
+    int got;
+    int fd;
+    while ((got = _recv_fd(snapshot_fd, &fd)) > 0) {
+        // (only the newest matters)
+        if (newest >= 0) {
+            close(newest);
+        }
+        newest = fd;
+    }
+    uint8_t failed = got == 0;
+    if (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+        perror("_take_library_snapshot");
+        failed = 1;
+    }
+    if (newest >= 0) {
+        ListResponse *list = map_library_snapshot(newest, server->library);
+        close(newest);
+        if (list == NULL) {
+            return -1;
+        }
+        // (connections part way through sending the old response keep its snapshot until they finish)
+        release_list_response(server->list);
+        server->list = list;
+    }
+    return failed ? -1 : 0;
+}
+
+
+/*
+** Serve clients on listen_fd until an error occurs, SIGTERM arrives, or (if
+** watch_stdin is set) the user types q + enter. Either index is kept up to date
+** here as the library changes, and list (its LIST response) replaced whenever it
+** does; or, in a worker, index is NULL and library and list are replaced with each
+** snapshot the parent sends on snapshot_fd. Closes listen_fd and releases list when
+** done.
+**
+** Returns 0 once the loop has run, or -1 if it couldn't be set up.
+*/
+static int _serve_events(int listen_fd, LibraryIndex *index, Library *library,
+                         ListResponse *list, int snapshot_fd, uint8_t watch_stdin) {
+    EventServer server;
+    memset(&server, 0, sizeof(server));
+    server.library = library;
+    server.list = list;
+    server.listen_fd = listen_fd;
+
+    if (_set_nonblocking(server.listen_fd) < 0) {
+        close(server.listen_fd);
+        release_list_response(server.list);
+        return -1;
+    }
+    server.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (server.epoll_fd < 0) {
+        perror("epoll_create1");
+        close(server.listen_fd);
+        release_list_response(server.list);
+        return -1;
+    }
+    if (_watch(server.epoll_fd, EPOLL_CTL_ADD, server.listen_fd, EPOLLIN) < 0 ||
+        (snapshot_fd >= 0 && _watch(server.epoll_fd, EPOLL_CTL_ADD, snapshot_fd, EPOLLIN) < 0)) {
+        close(server.epoll_fd);
+        close(server.listen_fd);
+        release_list_response(server.list);
+        return -1;
+    }
+    // (stdin can't be watched if it's a regular file or /dev/null; then there's no q to quit)
+    struct epoll_event stdin_event = {.events = EPOLLIN, .data.fd = STDIN_FILENO};
+    uint8_t watching_stdin = watch_stdin &&
+        epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, STDIN_FILENO, &stdin_event) == 0;
+    // (changes are left queued until the scan that started watching is done)
+    int library_fd = index != NULL ? _library_fd(index) : -1;
+    if (library_fd >= 0) {
+        _watch(server.epoll_fd, EPOLL_CTL_ADD, library_fd, EPOLLIN);
+    }
+
+    struct epoll_event events[EVENT_MAX_EVENTS];
+    time_t last_scan = time(NULL);
+    uint8_t quit = 0;
+
+    while (!quit && !_worker_stopping) {
+        // without inotify, the library is rescanned on the clock, however busy the loop is
+        if (index != NULL && _tend_library(index, &last_scan) < 0) {
+            break;
+        }
+        if (index != NULL && index->changed) {
+            // (connections part way through sending the old response keep it until they finish)
+            ListResponse *rescanned = make_list_response(server.library);
+            if (rescanned == NULL) {
+                break;
+            }
+            release_list_response(server.list);
+            server.list = rescanned;
+            index->changed = 0;
+        }
+
+        int num_events = epoll_wait(server.epoll_fd, events, EVENT_MAX_EVENTS,
+                                    SELECT_TIMEOUT_SEC * 1000);
+        if (num_events < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("run_event_server");
+            break;
+        }
+
+        for (int i = 0; i < num_events; i++) {
+            int fd = events[i].data.fd;
+            if (fd == server.listen_fd) {
+                _accept_connections(&server);
+            } else if (fd == library_fd) {
+                if (_handle_library_fd(index) < 0) {
+                    quit = 1;
+                } else if (_library_fd(index) != library_fd) {
+                    // (the scan that was running is done: now for inotify's changes)
+                    library_fd = _library_fd(index);
+                    if (library_fd >= 0) {
+                        _watch(server.epoll_fd, EPOLL_CTL_ADD, library_fd, EPOLLIN);
+                    }
+                }
+            } else if (fd == snapshot_fd) {
+                if (_take_library_snapshot(&server, snapshot_fd) < 0) {
+                    quit = 1;
+                }
+            } else if (watching_stdin && fd == STDIN_FILENO) {
+                int c = getchar();
+                if (c == 'q') {
+                    quit = 1;
+                } else if (c == EOF) {
+                    epoll_ctl(server.epoll_fd, EPOLL_CTL_DEL, STDIN_FILENO, NULL);
+                    watching_stdin = 0;
+                }
+            } else if (fd < server.connections_size && server.connections[fd] != NULL) {
+                Connection *conn = server.connections[fd];
+                if (_advance_connection(&server, conn) < 0) {
+                    _close_connection(&server, conn);
+                }
+            }
+        }
+    }
+
+    printf("Quitting server after %d clients\n", server.num_accepted);
+    if (index != NULL && index->unsaved) {
+        save_library_index(index);
+    }
+    for (int fd = 0; fd < server.connections_size; fd++) {
+        if (server.connections[fd] != NULL) {
+            _close_connection(&server, server.connections[fd]);
+        }
+    }
+    free(server.connections);
+    free(server.open_files);
+    release_list_response(server.list);
+    close(server.epoll_fd);
+    close(server.listen_fd);
+    return 0;
+}
+
+
+// A forked worker: serve clients on its own socket, from the library snapshot it was
+// started with and those that come on snapshot_fd, until told to stop. Never returns.
+static void _run_worker(int worker, pid_t parent, int listen_fd, const char *library_directory,
+                        int snapshot, int snapshot_fd) {
+    // (no SA_RESTART, so the signal wakes epoll_wait)
+    struct sigaction stop;
+    memset(&stop, 0, sizeof(stop));
+    stop.sa_handler = _stop_worker;
+    sigemptyset(&stop.sa_mask);
+    sigaction(SIGTERM, &stop, NULL);
+
+    // stop too if the parent is killed, rather than keep the port without it
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    if (getppid() != parent) {
+        _worker_stopping = 1;
+    }
+
+    printf("Worker %d serving as process %d\n", worker, getpid());
+    Library library = {.name = "server", .path = library_directory, .files = NULL, .num_files = 0};
+    ListResponse *list = map_library_snapshot(snapshot, &library);
+    close(snapshot);
+    int status = -1;
+    if (list == NULL) {
+        close(listen_fd);
+    } else {
+        status = _serve_events(listen_fd, NULL, &library, list, snapshot_fd, 0);
+    }
+    free(library.files);
+    close(snapshot_fd);
+    exit(status < 0 ? 1 : 0);
+}
+
+
+// Reap the workers that have exited (waiting for all of them if block is set).
+// Their pids are set to 0. Returns how many were reaped.
+static int _reap_workers(pid_t *workers, int num_workers, uint8_t block) {
+    int reaped = 0;
+    for (int i = 0; i < num_workers; i++) {
+        int status;
+        if (workers[i] == 0 || waitpid(workers[i], &status, block ? 0 : WNOHANG) <= 0) {
+            continue;
+        }
+        if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+            printf("Worker %d terminated\n", i);
+        } else if (WIFEXITED(status)) {
+            fprintf(stderr, "Worker %d exited with status %d\n", i, WEXITSTATUS(status));
+        } else {
+            fprintf(stderr, "Worker %d terminated abnormally\n", i);
+        }
+        workers[i] = 0;
+        reaped++;
+    }
+    return reaped;
+}
+
+
+// Send every running worker SIGTERM, and wait for them all
+static void _stop_workers(pid_t *workers, int num_workers) {
+    int num_running = 0;
+    for (int i = 0; i < num_workers; i++) {
+        if (workers[i] != 0) {
+            kill(workers[i], SIGTERM);
+            num_running++;
+        }
+    }
+    printf("Stopping %d workers\n", num_running);
+    _reap_workers(workers, num_workers, 1);
+}
+
+
+/*
+** Keep the library index up to date, sending the workers (on worker_fds) a snapshot
+** of it each time it changes, until q + enter (or every worker dying); then stop the
+** workers. snapshot is the one they were started with.
+*/
+static void _supervise_workers(pid_t *workers, int *worker_fds, int num_workers,
+                               LibraryIndex *index, int snapshot) {
+    int num_running = num_workers;
+    uint8_t behind[EVENT_MAX_WORKERS] = {0};    // not yet sent the newest snapshot
+    uint8_t num_behind = 0;
+    uint8_t watching_stdin = 1;
+    uint8_t quit = 0;
+    time_t last_scan = time(NULL);
+
+    while (!quit && num_running > 0) {
+        if (_tend_library(index, &last_scan) < 0) {
+            break;
+        }
+        if (index->changed) {
+            int changed = snapshot_library_index(index);
+            if (changed < 0) {
+                break;
+            }
+            close(snapshot);
+            snapshot = changed;
+            index->changed = 0;
+            memset(behind, 1, num_workers);
+        }
+        // (a worker whose socket is full is sent it on a later turn; a dead one never is)
+        num_behind = 0;
+        for (int i = 0; i < num_workers; i++) {
+            if (behind[i] && workers[i] != 0 && _send_fd(worker_fds[i], snapshot) < 0 &&
+                (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                num_behind++;
+                continue;
+            }
+            behind[i] = 0;
+        }
+
+        struct pollfd input[2];
+        nfds_t num_input = 0;
+        if (watching_stdin) {
+            input[num_input++] = (struct pollfd){.fd = STDIN_FILENO, .events = POLLIN};
+        }
+        int library_fd = _library_fd(index);
+        if (library_fd >= 0) {
+            input[num_input++] = (struct pollfd){.fd = library_fd, .events = POLLIN};
+        }
+        int ready = poll(input, num_input, num_behind > 0 ? 10 : SELECT_TIMEOUT_SEC * 1000);
+        if (ready < 0 && errno != EINTR) {
+            perror("poll");
+            break;
+        }
+        for (nfds_t i = 0; ready > 0 && i < num_input; i++) {
+            if (input[i].revents == 0) {
+                continue;
+            }
+            if (input[i].fd == STDIN_FILENO) {
+                int c = (input[i].revents & (POLLIN | POLLHUP)) ? getchar() : EOF;
+                if (c == 'q') {
+                    quit = 1;
+                } else if (c == EOF) {
+                    watching_stdin = 0;
+                }
+            } else if (_handle_library_fd(index) < 0) {
+                quit = 1;
+            }
+        }
+        num_running -= _reap_workers(workers, num_workers, 0);
+    }
+
+    if (index->unsaved) {
+        save_library_index(index);
+    }
+    close(snapshot);
+    _stop_workers(workers, num_workers);
+}
+
+
+int run_event_server(int port, const char *library_directory, int num_workers) {
+    if (num_workers < 1 || num_workers > EVENT_MAX_WORKERS) {
+        ERR_PRINT("Number of workers must be between 1 and %d\n", EVENT_MAX_WORKERS);
+        return -1;
+    }
+
+    _raise_open_file_limit();
+    // a client that hangs up mid-stream makes sendfile() fail with EPIPE instead of killing us
+    signal(SIGPIPE, SIG_IGN);
+
+    // the sockets come before the library walk, which can hold a lot of descriptors at once.
+    // Every socket is bound before any worker starts, so a port in use is caught here.
+    int listen_fds[EVENT_MAX_WORKERS];
+    for (int i = 0; i < num_workers; i++) {
+        listen_fds[i] = initialize_server_socket(port, EVENT_LISTEN_BACKLOG, num_workers > 1);
+        if (listen_fds[i] == -1) {
+            while (--i >= 0) {
+                close(listen_fds[i]);
+            }
+            return -1;
+        }
+    }
+
+    // a saved index is served from straight away, and checked against the library meanwhile
+    // (with workers, once they've been forked: the walk's threads aren't to be forked with them)
+    LibraryIndex index;
+    int result = make_library_index(&index, library_directory);
+    uint8_t loaded = result == 0 && load_library_index(&index) == 0;
+    if (result == 0 && (num_workers == 1 || !loaded)) {
+        result = watch_library(&index, loaded);
+    }
+    ListResponse *list = NULL;
+    int snapshot = -1;
+    if (result < 0) {
+        ERR_PRINT("Error scanning library\n");
+    } else if (num_workers == 1) {
+        list = make_index_list_response(&index);
+    } else {
+        snapshot = snapshot_library_index(&index);
+    }
+    index.changed = 0;
+    if (list == NULL && snapshot < 0) {
+        free_library_index(&index);
+        for (int i = 0; i < num_workers; i++) {
+            close(listen_fds[i]);
+        }
+        return -1;
+    }
+
+    if (num_workers == 1) {
+        int status = _serve_events(listen_fds[0], &index, &index.library, list, -1, 1);
+        free_library_index(&index);
+        return status;
+    }
+
+    // (flushed so the workers don't print what's still buffered a second time)
+    fflush(stdout);
+    fflush(stderr);
+
+    // each worker is sent the library's snapshots on a socket of its own
+    pid_t workers[EVENT_MAX_WORKERS];
+    int worker_fds[EVENT_MAX_WORKERS];
+    pid_t parent = getpid();
+    int num_started = 0;
+    for (; num_started < num_workers; num_started++) {
+        int pair[2];
+        if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, pair) < 0) {
+            perror("socketpair");
+            break;
+        }
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            close(pair[0]);
+            close(pair[1]);
+            break;
+        }
+        if (pid == 0) {
+            // the sockets before ours were closed as their workers started
+            for (int j = num_started + 1; j < num_workers; j++) {
+                close(listen_fds[j]);
+            }
+            for (int j = 0; j < num_started; j++) {
+                close(worker_fds[j]);
+            }
+            close(pair[0]);
+            // (the library is watched by the parent alone)
+            if (index.inotify_fd >= 0) {
+                close(index.inotify_fd);
+            }
+            _run_worker(num_started, parent, listen_fds[num_started], library_directory,
+                        snapshot, pair[1]);
+        }
+        workers[num_started] = pid;
+        worker_fds[num_started] = pair[0];
+        close(pair[1]);
+        close(listen_fds[num_started]);
+    }
+    for (int i = num_started; i < num_workers; i++) {
+        close(listen_fds[i]);
+    }
+
+    int status = num_started > 0 ? 0 : -1;
+    if (num_started > 0 && loaded && watch_library(&index, 1) < 0) {
+        ERR_PRINT("Error scanning library\n");
+        close(snapshot);
+        _stop_workers(workers, num_started);
+        status = -1;
+    } else if (num_started > 0) {
+        _supervise_workers(workers, worker_fds, num_started, &index, snapshot);
+    } else {
+        close(snapshot);
+    }
+    for (int i = 0; i < num_started; i++) {
+        close(worker_fds[i]);
+    }
+    printf("Quitting server\n");
+    free_library_index(&index);
+    return status;
+}
+
+
+static uint8_t _is_file_extension_supported(const char *filename){
+    static const char *supported_file_exts[] = SUPPORTED_FILE_EXTS;
+
+    for (int i = 0; i < sizeof(supported_file_exts)/sizeof(char *); i++) {
+        char *files_ext = strrchr(filename, '.');
+        if (files_ext != NULL && strcmp(files_ext, supported_file_exts[i]) == 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+// FNV-1a
+static uint32_t _hash_path(const char *path) {
+    uint32_t hash = 2166136261u;
+    for (; *path != '\0'; path++) {
+        hash = (hash ^ (uint8_t)*path) * 16777619u;
+    }
+    return hash;
+}
+
+
+static uint32_t _hash_inode(ino_t inode, dev_t dev) {
+    uint64_t key = ((uint64_t)inode ^ ((uint64_t)dev << 40)) * 0x9e3779b97f4a7c15ull;
+    return (uint32_t)(key >> 32);
+}
+
+
+// The slot holding path, or else the empty slot that ends its probe sequence
+static uint32_t *_path_slot(const LibraryIndex *index, const char *path) {
+    uint32_t mask = index->path_slots - 1;
+    for (uint32_t slot = _hash_path(path) & mask; ; slot = (slot + 1) & mask) {
+        uint32_t i = index->by_path[slot];
+        if (i == LIBRARY_SLOT_EMPTY ||
+            (i != LIBRARY_SLOT_REMOVED && strcmp(index->library.files[i], path) == 0)) {
+            return &index->by_path[slot];
+        }
+    }
+}
+
+
+// The slot holding the inode, or else the empty slot that ends its probe sequence
+static uint32_t *_inode_slot(const LibraryIndex *index, ino_t inode, dev_t dev) {
+    uint32_t mask = index->inode_slots - 1;
+    for (uint32_t slot = _hash_inode(inode, dev) & mask; ; slot = (slot + 1) & mask) {
+        uint32_t i = index->by_inode[slot];
+        if (i == LIBRARY_SLOT_EMPTY ||
+            (index->ids[i].inode == inode && index->ids[i].dev == dev)) {
+            return &index->by_inode[slot];
+        }
+    }
+}
+
+
+// Whether p points into the index file the index was loaded from (so isn't to be freed)
+static uint8_t _is_saved(const LibraryIndex *index, const void *p) {
+    return index->saved != NULL && (const char *)p >= index->saved &&
+           (const char *)p < index->saved + index->saved_size;
+}
+
+
+// A file's modification time in nanoseconds
+static int64_t _mtime_ns(const struct stat *st) {
+    return (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+
+// Rebuild both tables from the files (dropping removed paths), big enough for
+// twice num_files (at least as many as there are now)
+static int _rehash_library(LibraryIndex *index, uint32_t num_files) {
+    num_files = MAX(num_files, index->library.num_files);
+    uint32_t num_slots = LIBRARY_MIN_SLOTS;
+    while (num_slots < 2 * (uint64_t)num_files) {
+        num_slots *= 2;
+    }
+    uint32_t *by_path = (uint32_t *)malloc(num_slots * sizeof(uint32_t));
+    uint32_t *by_inode = (uint32_t *)malloc(num_slots * sizeof(uint32_t));
+    if (by_path == NULL || by_inode == NULL) {
+        perror("_rehash_library");
+        free(by_path);
+        free(by_inode);
+        return -1;
+    }
+    if (!_is_saved(index, index->by_path)) {
+        free(index->by_path);
+        free(index->by_inode);
+    }
+    index->by_path = by_path;
+    index->by_inode = by_inode;
+    index->path_slots = num_slots;
+    index->inode_slots = num_slots;
+    index->paths_used = 0;
+    for (uint32_t slot = 0; slot < num_slots; slot++) {
+        by_path[slot] = LIBRARY_SLOT_EMPTY;
+        by_inode[slot] = LIBRARY_SLOT_EMPTY;
+    }
+
+    // (a removed file keeps its inode's slot, so the inode gets its index back)
+    for (uint32_t i = 0; i < index->library.num_files; i++) {
+        *_inode_slot(index, index->ids[i].inode, index->ids[i].dev) = i;
+        if (index->library.files[i] != NULL) {
+            *_path_slot(index, index->library.files[i]) = i;
+            index->paths_used++;
+        }
+    }
+    return 0;
+}
+
+
+// Put the hole at i at the end of the queue of holes, removed at removed_at
+static void _queue_hole(LibraryIndex *index, uint32_t i, time_t removed_at) {
+    index->ids[i].removed_at = removed_at;
+    index->ids[i].prev_hole = index->last_hole;
+    index->ids[i].next_hole = LIBRARY_SLOT_EMPTY;
+    if (index->last_hole != LIBRARY_SLOT_EMPTY) {
+        index->ids[index->last_hole].next_hole = i;
+    } else {
+        index->first_hole = i;
+    }
+    index->last_hole = i;
+}
+
+
+// Take the hole at i out of the queue of holes, as it's being filled
+static void _unqueue_hole(LibraryIndex *index, uint32_t i) {
+    FileId *id = &index->ids[i];
+    if (id->prev_hole != LIBRARY_SLOT_EMPTY) {
+        index->ids[id->prev_hole].next_hole = id->next_hole;
+    } else {
+        index->first_hole = id->next_hole;
+    }
+    if (id->next_hole != LIBRARY_SLOT_EMPTY) {
+        index->ids[id->next_hole].prev_hole = id->prev_hole;
+    } else {
+        index->last_hole = id->prev_hole;
+    }
+    id->removed_at = 0;
+}
+
+
+// Empty an inode's slot, moving back the entries after it that can't be found past
+// an empty slot otherwise (so by_inode needs no markers for removed inodes)
+static void _empty_inode_slot(LibraryIndex *index, uint32_t *slot) {
+    uint32_t mask = index->inode_slots - 1;
+    uint32_t empty = slot - index->by_inode;
+    for (uint32_t next = (empty + 1) & mask; index->by_inode[next] != LIBRARY_SLOT_EMPTY;
+         next = (next + 1) & mask) {
+        uint32_t i = index->by_inode[next];
+        uint32_t home = _hash_inode(index->ids[i].inode, index->ids[i].dev) & mask;
+        // (it can move back unless its home is between the empty slot and where it is)
+        if (((next - home) & mask) >= ((next - empty) & mask)) {
+            index->by_inode[empty] = i;
+            empty = next;
+        }
+    }
+    index->by_inode[empty] = LIBRARY_SLOT_EMPTY;
+}
+
+
+static void _remove_file(LibraryIndex *index, uint32_t i) {
+    #ifdef DEBUG
+    printf("Removed file %u: %s\n", i, index->library.files[i]);
+    #endif
+    *_path_slot(index, index->library.files[i]) = LIBRARY_SLOT_REMOVED;
+    if (!_is_saved(index, index->library.files[i])) {
+        free(index->library.files[i]);
+    }
+    index->library.files[i] = NULL;
+    _queue_hole(index, i, time(NULL));
+    index->changed = 1;
+    index->unsaved = 1;
+    index->saved_list = NULL;
+}
+
+
+static void _remove_path(LibraryIndex *index, const char *path) {
+    uint32_t i = *_path_slot(index, path);
+    if (i != LIBRARY_SLOT_EMPTY) {
+        _remove_file(index, i);
+    }
+}
+
+
+// Give the file at i the name path (copied)
+static int _name_file(LibraryIndex *index, uint32_t i, const char *path) {
+    char *name = strdup(path);
+    if (name == NULL) {
+        perror("_name_file");
+        return -1;
+    }
+    uint32_t other = *_path_slot(index, path);
+    if (other != LIBRARY_SLOT_EMPTY && other != i) {
+        _remove_file(index, other);    // replaced by a new file, e.g. one saved with a rename
+    }
+    if (index->ids[i].removed_at != 0) {
+        _unqueue_hole(index, i);       // (its file is back)
+    }
+    if (index->library.files[i] != NULL) {
+        *_path_slot(index, index->library.files[i]) = LIBRARY_SLOT_REMOVED;
+        if (!_is_saved(index, index->library.files[i])) {
+            free(index->library.files[i]);
+        }
+    }
+    // (removed paths are never matched, so this finds an empty slot)
+    *_path_slot(index, name) = i;
+    index->paths_used++;
+    index->library.files[i] = name;
+    index->changed = 1;
+    index->unsaved = 1;
+    index->saved_list = NULL;
+    return 0;
+}
+
+
+// Make room in files and ids for num_files entries
+static int _reserve_files(LibraryIndex *index, uint32_t num_files) {
+    if (num_files <= index->files_size) {
+        return 0;
+    }
+    uint32_t new_size = index->files_size ? index->files_size : LIBRARY_MIN_SLOTS;
+    while (new_size < num_files) {
+        new_size *= 2;
+    }
+    char **files = (char **)realloc(index->library.files, new_size * sizeof(char *));
+    if (files != NULL) {
+        index->library.files = files;
+    }
+    FileId *ids = (FileId *)realloc(index->ids, new_size * sizeof(FileId));
+    if (files == NULL || ids == NULL) {
+        perror("_reserve_files");
+        return -1;
+    }
+    index->ids = ids;
+    index->files_size = new_size;
+    return 0;
+}
+
+
+/*
+** Add the file at path, or note that it's still there (which, as it's the usual
+** case on a rescan, allocates nothing). An inode the library has seen before keeps
+** its index, whatever it is called now.
+**
+** size and mtime_ns are the file's (mtime_ns -1 if it wasn't looked at). Until a
+** loaded index has been walked, an inode it has with another size or time is taken
+** to have been reused by a new file: the old one is removed and this one added.
+*/
+static int _add_file(LibraryIndex *index, const char *path, ino_t inode, dev_t dev,
+                     off_t size, int64_t mtime_ns) {
+    uint32_t *slot = _inode_slot(index, inode, dev);
+    if (*slot != LIBRARY_SLOT_EMPTY && index->unverified && mtime_ns >= 0 &&
+        index->ids[*slot].mtime_ns >= 0 &&
+        (index->ids[*slot].size != size || index->ids[*slot].mtime_ns != mtime_ns)) {
+        #ifdef DEBUG
+        printf("Inode of file %u reused by: %s\n", *slot, path);
+        #endif
+        if (index->library.files[*slot] != NULL) {
+            _remove_file(index, *slot);
+        }
+    } else if (*slot != LIBRARY_SLOT_EMPTY) {
+        uint32_t i = *slot;
+        const char *name = index->library.files[i];
+        index->ids[i].seen = index->scan;
+        if (mtime_ns >= 0 &&
+            (index->ids[i].size != size || index->ids[i].mtime_ns != mtime_ns)) {
+            index->ids[i].size = size;
+            index->ids[i].mtime_ns = mtime_ns;
+            index->unsaved = 1;
+        }
+        if (name != NULL && strcmp(name, path) == 0) {
+            return 0;
+        }
+        if (name != NULL) {
+            // the old name still being there makes this a hard link, which isn't listed twice
+            struct stat old;
+            char *old_path = _join_path(index->library.path, name);
+            uint8_t linked = old_path != NULL && lstat(old_path, &old) == 0 &&
+                             old.st_ino == inode && old.st_dev == dev;
+            free(old_path);
+            if (linked) {
+                return 0;
+            }
+        }
+        #ifdef DEBUG
+        printf("File %u is now: %s\n", i, path);
+        #endif
+        return _name_file(index, i, path);
+    }
+
+    uint32_t i;
+    if (index->first_hole != LIBRARY_SLOT_EMPTY &&
+        time(NULL) - index->ids[index->first_hole].removed_at >= LIBRARY_HOLE_GRACE) {
+        // the file that had it has been gone long enough: its index (and its inode's slot,
+        // unless a file given the inode since has it) are for this one
+        i = index->first_hole;
+        _unqueue_hole(index, i);
+        uint32_t *old = _inode_slot(index, index->ids[i].inode, index->ids[i].dev);
+        if (*old == i) {
+            _empty_inode_slot(index, old);
+        }
+        slot = _inode_slot(index, inode, dev);
+        #ifdef DEBUG
+        printf("Reusing the index of removed file %u\n", i);
+        #endif
+    } else {
+        if (_reserve_files(index, index->library.num_files + 1) < 0) {
+            return -1;
+        }
+        i = index->library.num_files++;
+    }
+    index->library.files[i] = NULL;
+    index->ids[i].removed_at = 0;
+    index->ids[i].inode = inode;
+    index->ids[i].dev = dev;
+    index->ids[i].size = size;
+    index->ids[i].mtime_ns = mtime_ns;
+    index->ids[i].seen = index->scan;
+    *slot = i;
+    #ifdef DEBUG
+    printf("Found file %u: %s\n", i, path);
+    #endif
+    if (_name_file(index, i, path) < 0) {
+        return -1;
+    }
+
+    // keep both tables under three quarters full (removed paths count, until a rehash)
+    if (4 * (uint64_t)index->library.num_files >= 3 * (uint64_t)index->inode_slots ||
+        4 * (uint64_t)index->paths_used >= 3 * (uint64_t)index->path_slots) {
+        return _rehash_library(index, 0);
+    }
+    return 0;
+}
+
+
+static void _stop_watching(LibraryIndex *index) {
+    if (index->inotify_fd >= 0) {
+        close(index->inotify_fd);
+        index->inotify_fd = -1;
+    }
+    for (int wd = 0; wd < index->watched_size; wd++) {
+        free(index->watched[wd]);
+    }
+    free(index->watched);
+    index->watched = NULL;
+    index->watched_size = 0;
+}
+
+
+// There are no inotify watches left (see fs.inotify.max_user_watches), so rescan
+// the library on the clock instead
+static void _out_of_watches(LibraryIndex *index) {
+    fprintf(stderr, "Falling back to scanning the library every %d seconds\n",
+            LIBRARY_SCAN_INTERVAL);
+    _stop_watching(index);
+}
+
+
+// Note that wd watches the directory at path (relative to the library)
+static int _record_watch(LibraryIndex *index, int wd, const char *path) {
+    if (wd >= index->watched_size) {
+        int new_size = index->watched_size ? index->watched_size : 64;
+        while (new_size <= wd) {
+            new_size *= 2;
+        }
+        char **grown = (char **)realloc(index->watched, new_size * sizeof(char *));
+        if (grown == NULL) {
+            perror("_record_watch");
+            return -1;
+        }
+        memset(grown + index->watched_size, 0,
+               (new_size - index->watched_size) * sizeof(char *));
+        index->watched = grown;
+        index->watched_size = new_size;
+    }
+    free(index->watched[wd]);
+    index->watched[wd] = strdup(path);
+    if (index->watched[wd] == NULL) {
+        perror("_record_watch");
+        return -1;
+    }
+    return 0;
+}
+
+
+// Forget the directory at path, which has been moved away, and everything in it
+static void _remove_directory(LibraryIndex *index, const char *path) {
+    size_t len = strlen(path);
+    for (uint32_t i = 0; i < index->library.num_files; i++) {
+        const char *name = index->library.files[i];
+        if (name != NULL && strncmp(name, path, len) == 0 && name[len] == '/') {
+            _remove_file(index, i);
+        }
+    }
+    for (int wd = 0; wd < index->watched_size; wd++) {
+        const char *name = index->watched[wd];
+        if (name != NULL && strncmp(name, path, len) == 0 &&
+            (name[len] == '/' || name[len] == '\0')) {
+            inotify_rm_watch(index->inotify_fd, wd);
+            free(index->watched[wd]);
+            index->watched[wd] = NULL;
+        }
+    }
+}
+
+
+/*
+** Library walks
+** -------------
+** A walk is shared among threads, each with a deque of directories still to read.
+** A thread takes from the back of its own (so it goes depth first, and few of the
+** directories it has found are open at once) and, when that's empty, steals from
+** the front of another's. Directories are opened relative to the one they were
+** found in, while fewer than LIBRARY_WALK_MAX_OPEN are queued open (the rest are
+** opened by path when their turn comes), and read with getdents64, a large buffer
+** at a time. A directory that can't be opened for want of descriptors fails the
+** walk, rather than have its files taken for gone. What a thread finds
+** goes into its own arena, and the index takes it all in, in path order, once
+** every thread is done, so the walk never locks the index.
+*/
+
+// What getdents64 fills its buffer with (glibc has no wrapper before 2.30)
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+typedef struct walk_block {
+    struct walk_block *next;
+    size_t size;
+    size_t used;
+    char data[];
+} WalkBlock;
+
+typedef struct walk_file {
+    const char *path;           // in the library
+    ino_t inode;
+    off_t size;
+    int64_t mtime_ns;           // -1 if it wasn't looked at
+    struct walk_file *next;
+} WalkFile;
+
+// A directory read, and the files in it
+typedef struct walk_dir {
+    const char *path;           // in the library ("" for its top)
+    dev_t dev;
+    int wd;                     // -1 if not watched
+    WalkFile *files;            // in the order they were read
+} WalkDir;
+
+// A directory still to be read
+typedef struct walk_todo {
+    int fd;                     // -1 if it couldn't be opened yet (out of descriptors)
+    const char *path;
+} WalkTodo;
+
+typedef struct walk_thread {
+    struct library_walk *walk;
+    pthread_t thread;
+
+    pthread_mutex_t lock;       // for the deque
+    WalkTodo *todo;             // the deque: todo[head] up to todo[tail]
+    size_t head;
+    size_t tail;
+    size_t todo_size;
+
+    WalkBlock *arena;           // everything below, and the paths
+    WalkDir **dirs;
+    size_t num_dirs;
+    size_t dirs_size;
+    uint32_t num_files;
+    char *buffer;               // for getdents64
+    uint8_t failed;
+} WalkThread;
+
+typedef struct library_walk {
+    const LibraryIndex *index;  // only read while the threads run
+    WalkThread *threads;
+    int num_threads;
+    int num_started;            // threads[0] up to here are running (from 1 if not in_background)
+    uint8_t in_background;
+    pid_t pid;                  // the process they're running in
+    int done_fd;                // an eventfd, if in_background
+    long pending;               // directories found but not read yet (atomic)
+    int num_open;               // of those, queued with a descriptor (atomic)
+    int out_of_watches;         // (atomic)
+} LibraryWalk;
+
+
+// size bytes from the thread's arena, which are freed all at once with it
+static void *_walk_alloc(WalkThread *self, size_t size) {
+    size = (size + 7) & ~(size_t)7;
+    WalkBlock *block = self->arena;
+    if (block == NULL || block->used + size > block->size) {
+        size_t block_size = MAX(size, (size_t)LIBRARY_WALK_ARENA_SIZE);
+        block = (WalkBlock *)malloc(sizeof(WalkBlock) + block_size);
+        if (block == NULL) {
+            perror("_walk_alloc");
+            self->failed = 1;
+            return NULL;
+        }
+        block->next = self->arena;
+        block->size = block_size;
+        block->used = 0;
+        self->arena = block;
+    }
+    void *p = block->data + block->used;
+    block->used += size;
+    return p;
+}
+
+
+// _join_path, into the thread's arena
+static char *_walk_join(WalkThread *self, const char *path, const char *name) {
+    size_t path_len = strlen(path);
+    size_t name_len = strlen(name);
+    char *joined = (char *)_walk_alloc(self, path_len + name_len + 2);
+    if (joined == NULL) {
+        return NULL;
+    }
+    char *end = joined;
+    if (path_len) {
+        memcpy(end, path, path_len);
+        end += path_len;
+        *end++ = '/';
+    }
+    memcpy(end, name, name_len + 1);
+    return joined;
+}
+
+
+static int _push_todo(WalkThread *self, int fd, const char *path) {
+    pthread_mutex_lock(&self->lock);
+    if (self->tail == self->todo_size) {
+        if (self->head > 0) {
+            memmove(self->todo, self->todo + self->head,
+                    (self->tail - self->head) * sizeof(WalkTodo));
+            self->tail -= self->head;
+            self->head = 0;
+        } else {
+            size_t new_size = self->todo_size ? 2 * self->todo_size : 64;
+            WalkTodo *grown = (WalkTodo *)realloc(self->todo, new_size * sizeof(WalkTodo));
+            if (grown == NULL) {
+                pthread_mutex_unlock(&self->lock);
+                perror("_push_todo");
+                return -1;
+            }
+            self->todo = grown;
+            self->todo_size = new_size;
+        }
+    }
+    self->todo[self->tail].fd = fd;
+    self->todo[self->tail].path = path;
+    self->tail++;
+    __atomic_add_fetch(&self->walk->pending, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&self->lock);
+    return 0;
+}
+
+
+// Take a directory from the back of the thread's own deque, or (if steal) from the front
+static int _take_todo(WalkThread *from, uint8_t steal, WalkTodo *todo) {
+    int found = 0;
+    pthread_mutex_lock(&from->lock);
+    if (from->head < from->tail) {
+        *todo = steal ? from->todo[from->head++] : from->todo[--from->tail];
+        found = 1;
+    }
+    pthread_mutex_unlock(&from->lock);
+    return found;
+}
+
+
+// The next directory for the thread to read; 0 once there are none left anywhere
+static int _next_todo(WalkThread *self, WalkTodo *todo) {
+    LibraryWalk *walk = self->walk;
+    int me = self - walk->threads;
+    while (1) {
+        if (_take_todo(self, 0, todo)) {
+            return 1;
+        }
+        for (int i = 1; i < walk->num_threads; i++) {
+            if (_take_todo(&walk->threads[(me + i) % walk->num_threads], 1, todo)) {
+                return 1;
+            }
+        }
+        // (the rest are still being read, and may turn up more)
+        if (__atomic_load_n(&walk->pending, __ATOMIC_ACQUIRE) == 0) {
+            return 0;
+        }
+        sched_yield();
+    }
+}
+
+
+// Whether the entry is a directory or a regular file, if getdents64 didn't say
+static unsigned char _entry_type(int dir_fd, const struct linux_dirent64 *entry) {
+    struct stat entry_stat;
+    if (entry->d_type != DT_UNKNOWN ||
+        fstatat(dir_fd, entry->d_name, &entry_stat, AT_SYMLINK_NOFOLLOW) < 0) {
+        return entry->d_type;
+    }
+    return S_ISDIR(entry_stat.st_mode) ? DT_DIR : S_ISREG(entry_stat.st_mode) ? DT_REG : DT_UNKNOWN;
+}
+
+
+// Read one directory: note its files, and queue its subdirectories
+static void _walk_directory(WalkThread *self, const WalkTodo *todo) {
+    LibraryWalk *walk = self->walk;
+    const LibraryIndex *index = walk->index;
+    char full_path[PATH_MAX];
+    snprintf(full_path, sizeof(full_path), "%s/%s", index->library.path, todo->path);
+
+    int fd = todo->fd;
+    if (fd >= 0) {
+        __atomic_sub_fetch(&walk->num_open, 1, __ATOMIC_RELAXED);
+    } else if ((fd = open(full_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC | O_NOFOLLOW)) < 0) {
+        // a directory that went away, or can't be read, is just left out, but one that
+        // couldn't be opened for want of descriptors still has its files
+        int error = errno;
+        perror("scan_library");
+        if (error == EMFILE || error == ENFILE || error == ENOMEM) {
+            self->failed = 1;
+        }
+        return;
+    }
+
+    #ifdef DEBUG
+    printf("Library scan descending into directory: %s\n", todo->path);
+    #endif
+
+    struct stat dir_stat;
+    WalkDir *dir = (WalkDir *)_walk_alloc(self, sizeof(WalkDir));
+    if (dir == NULL || fstat(fd, &dir_stat) < 0) {
+        perror("scan_library");
+        self->failed = 1;
+        close(fd);
+        return;
+    }
+    dir->path = todo->path;
+    dir->dev = dir_stat.st_dev;
+    dir->files = NULL;
+    dir->wd = -1;
+
+    // (watched before it's read, so nothing made while it's being read is missed)
+    if (index->inotify_fd >= 0 && !__atomic_load_n(&walk->out_of_watches, __ATOMIC_RELAXED)) {
+        dir->wd = inotify_add_watch(index->inotify_fd, full_path, LIBRARY_WATCH_EVENTS);
+        if (dir->wd < 0 && (errno == ENOSPC || errno == ENOMEM)) {
+            perror("inotify_add_watch");
+            __atomic_store_n(&walk->out_of_watches, 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    if (self->num_dirs == self->dirs_size) {
+        size_t new_size = self->dirs_size ? 2 * self->dirs_size : 64;
+        WalkDir **grown = (WalkDir **)realloc(self->dirs, new_size * sizeof(WalkDir *));
+        if (grown == NULL) {
+            perror("scan_library");
+            self->failed = 1;
+            close(fd);
+            return;
+        }
+        self->dirs = grown;
+        self->dirs_size = new_size;
+    }
+    self->dirs[self->num_dirs++] = dir;
+
+    WalkFile **last = &dir->files;
+    long len;
+    while ((len = syscall(SYS_getdents64, fd, self->buffer, LIBRARY_WALK_BUFFER_SIZE)) > 0) {
+        const struct linux_dirent64 *entry;
+        for (long offset = 0; offset < len; offset += entry->d_reclen) {
+            entry = (const struct linux_dirent64 *)(self->buffer + offset);
+            const char *name = entry->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+                continue;
+            }
+            unsigned char type = _entry_type(fd, entry);
+
+            if (type == DT_REG && _is_file_extension_supported(name)) {
+                WalkFile *file = (WalkFile *)_walk_alloc(self, sizeof(WalkFile));
+                if (file == NULL || (file->path = _walk_join(self, todo->path, name)) == NULL) {
+                    close(fd);
+                    return;
+                }
+                file->inode = entry->d_ino;
+                file->size = 0;
+                file->mtime_ns = -1;
+                // (only what's new, or needs checking against a loaded index, is looked at)
+                struct stat file_stat;
+                if ((index->unverified ||
+                     *_inode_slot(index, entry->d_ino, dir->dev) == LIBRARY_SLOT_EMPTY) &&
+                    fstatat(fd, name, &file_stat, AT_SYMLINK_NOFOLLOW) == 0) {
+                    file->size = file_stat.st_size;
+                    file->mtime_ns = _mtime_ns(&file_stat);
+                }
+                file->next = NULL;
+                *last = file;
+                last = &file->next;
+                self->num_files++;
+
+            } else if (type == DT_DIR) {
+                char *path = _walk_join(self, todo->path, name);
+                if (path == NULL) {
+                    close(fd);
+                    return;
+                }
+                int sub_fd = -1;
+                if (__atomic_add_fetch(&walk->num_open, 1, __ATOMIC_RELAXED) <= LIBRARY_WALK_MAX_OPEN) {
+                    sub_fd = openat(fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC | O_NOFOLLOW);
+                    if (sub_fd < 0 && errno != EMFILE && errno != ENFILE && errno != ENOMEM) {
+                        __atomic_sub_fetch(&walk->num_open, 1, __ATOMIC_RELAXED);
+                        continue;
+                    }
+                }
+                if (sub_fd < 0) {
+                    // (to be opened by path when it's read)
+                    __atomic_sub_fetch(&walk->num_open, 1, __ATOMIC_RELAXED);
+                }
+                if (_push_todo(self, sub_fd, path) < 0) {
+                    self->failed = 1;
+                    if (sub_fd >= 0) {
+                        close(sub_fd);
+                    }
+                }
+            }
+        }
+    }
+    if (len < 0) {
+        // (only a directory that went away is missing files it still has)
+        int error = errno;
+        perror("getdents64");
+        if (error != ENOENT) {
+            self->failed = 1;
+        }
+    }
+    close(fd);
+}
+
+
+static void *_walk_thread(void *arg) {
+    WalkThread *self = (WalkThread *)arg;
+    LibraryWalk *walk = self->walk;
+    WalkTodo todo;
+    while (_next_todo(self, &todo)) {
+        _walk_directory(self, &todo);
+        // (the last directory read is the end of the walk)
+        if (__atomic_sub_fetch(&walk->pending, 1, __ATOMIC_RELEASE) == 0 && walk->done_fd >= 0) {
+            uint64_t one = 1;
+            if (write(walk->done_fd, &one, sizeof(one)) < 0) {
+                perror("_walk_thread");
+            }
+        }
+    }
+    return NULL;
+}
+
+
+static int _compare_walk_dirs(const void *a, const void *b) {
+    return strcmp((*(WalkDir * const *)a)->path, (*(WalkDir * const *)b)->path);
+}
+
+
+// Take in everything the walk found, a directory at a time in path order
+static int _merge_walk(LibraryIndex *index, LibraryWalk *walk) {
+    size_t num_dirs = 0;
+    uint32_t num_files = 0;
+    for (int t = 0; t < walk->num_threads; t++) {
+        num_dirs += walk->threads[t].num_dirs;
+        num_files += walk->threads[t].num_files;
+    }
+    WalkDir **dirs = (WalkDir **)malloc(MAX(num_dirs, 1) * sizeof(WalkDir *));
+    if (dirs == NULL) {
+        perror("scan_library");
+        return -1;
+    }
+    num_dirs = 0;
+    for (int t = 0; t < walk->num_threads; t++) {
+        memcpy(dirs + num_dirs, walk->threads[t].dirs,
+               walk->threads[t].num_dirs * sizeof(WalkDir *));
+        num_dirs += walk->threads[t].num_dirs;
+    }
+    qsort(dirs, num_dirs, sizeof(WalkDir *), _compare_walk_dirs);
+
+    // room for the lot up front, in case they're all new (as on the first scan)
+    uint32_t most_files = index->library.num_files + num_files;
+    int result = 0;
+    if (4 * (uint64_t)most_files >= 3 * (uint64_t)index->inode_slots) {
+        result = _rehash_library(index, most_files);
+    }
+    for (size_t d = 0; d < num_dirs && result == 0; d++) {
+        if (dirs[d]->wd >= 0 && index->inotify_fd >= 0) {
+            result = _record_watch(index, dirs[d]->wd, dirs[d]->path);
+        }
+        for (const WalkFile *file = dirs[d]->files; file != NULL && result == 0; file = file->next) {
+            result = _add_file(index, file->path, file->inode, dirs[d]->dev,
+                               file->size, file->mtime_ns);
+        }
+    }
+    free(dirs);
+    return result;
+}
+
+
+// Threads to walk the library with: index->scan_threads, or one per CPU
+static int _walk_threads(const LibraryIndex *index) {
+    if (index->scan_threads > 0) {
+        return MIN(index->scan_threads, LIBRARY_WALK_MAX_THREADS);
+    }
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus < 1 ? 1 : MIN(cpus, LIBRARY_WALK_MAX_THREADS);
+}
+
+
+// Join the walk's threads (if they're this process's: a forked child has only the
+// memory), and free it
+static void _free_walk(LibraryWalk *walk) {
+    if (walk->pid == getpid()) {
+        for (int t = walk->in_background ? 0 : 1; t < walk->num_started; t++) {
+            pthread_join(walk->threads[t].thread, NULL);
+        }
+    }
+    for (int t = 0; t < walk->num_threads; t++) {
+        WalkThread *thread = &walk->threads[t];
+        while (thread->arena != NULL) {
+            WalkBlock *next = thread->arena->next;
+            free(thread->arena);
+            thread->arena = next;
+        }
+        for (size_t i = thread->head; i < thread->tail; i++) {
+            if (thread->todo[i].fd >= 0) {
+                close(thread->todo[i].fd);
+            }
+        }
+        free(thread->todo);
+        free(thread->dirs);
+        free(thread->buffer);
+        pthread_mutex_destroy(&thread->lock);
+    }
+    if (walk->done_fd >= 0) {
+        close(walk->done_fd);
+    }
+    free(walk->threads);
+    free(walk);
+}
+
+
+/*
+** Start walking the library from the directory at path (relative to it, and kept
+** until the walk is done) with num_threads threads. In the background, the
+** threads all start now, and the walk's done_fd is readable once they're done;
+** otherwise the calling thread is to be the first of them. Returns NULL on error.
+*/
+static LibraryWalk *_start_walk(const LibraryIndex *index, const char *path, int num_threads,
+                                uint8_t in_background) {
+    char *top_path = _join_path(index->library.path, path);
+    if (top_path == NULL) {
+        return NULL;
+    }
+    int top_fd = open(top_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    free(top_path);
+    if (top_fd < 0) {
+        perror("scan_library");
+        return NULL;
+    }
+
+    LibraryWalk *walk = (LibraryWalk *)calloc(1, sizeof(LibraryWalk));
+    WalkThread *threads = (WalkThread *)calloc(num_threads, sizeof(WalkThread));
+    if (walk == NULL || threads == NULL) {
+        perror("scan_library");
+        free(walk);
+        free(threads);
+        close(top_fd);
+        return NULL;
+    }
+    walk->index = index;
+    walk->threads = threads;
+    walk->num_threads = num_threads;
+    walk->pid = getpid();
+    walk->in_background = in_background;
+    walk->num_started = in_background ? 0 : 1;
+    walk->done_fd = in_background ? eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC) : -1;
+    uint8_t failed = in_background && walk->done_fd < 0;
+    for (int t = 0; t < num_threads; t++) {
+        threads[t].walk = walk;
+        pthread_mutex_init(&threads[t].lock, NULL);
+        threads[t].buffer = (char *)malloc(LIBRARY_WALK_BUFFER_SIZE);
+        failed = failed || threads[t].buffer == NULL;
+    }
+    walk->num_open = 1;
+    if (failed || _push_todo(&threads[0], top_fd, path) < 0) {
+        perror("scan_library");
+        close(top_fd);
+        _free_walk(walk);
+        return NULL;
+    }
+
+    for (; walk->num_started < num_threads; walk->num_started++) {
+        if (pthread_create(&threads[walk->num_started].thread, NULL,
+                           _walk_thread, &threads[walk->num_started]) != 0) {
+            perror("pthread_create");
+            break;
+        }
+    }
+    if (in_background && walk->num_started == 0) {
+        // (then it's done before it's returned)
+        _walk_thread(&threads[0]);
+    }
+    return walk;
+}
+
+
+// Once the walk is done, take in what it found, and free it
+static int _finish_walk(LibraryIndex *index, LibraryWalk *walk) {
+    if (walk->pid == getpid()) {
+        for (int t = walk->in_background ? 0 : 1; t < walk->num_started; t++) {
+            pthread_join(walk->threads[t].thread, NULL);
+        }
+        walk->num_started = 0;
+    }
+    int result = 0;
+    for (int t = 0; t < walk->num_threads; t++) {
+        if (walk->threads[t].failed) {
+            result = -1;
+        }
+    }
+    if (result == 0) {
+        result = _merge_walk(index, walk);
+    }
+    if (walk->out_of_watches && index->inotify_fd >= 0) {
+        _out_of_watches(index);
+    }
+    _free_walk(walk);
+    return result;
+}
+
+
+// Walk the library from the directory at path (relative to it) with num_threads threads
+static int _walk_library(LibraryIndex *index, const char *path, int num_threads) {
+    LibraryWalk *walk = _start_walk(index, path, num_threads, 0);
+    if (walk == NULL) {
+        return -1;
+    }
+    _walk_thread(&walk->threads[0]);
+    return _finish_walk(index, walk);
+}
+
+
+int make_library_index(LibraryIndex *index, const char *path) {
+    memset(index, 0, sizeof(*index));
+    index->library.path = path;
+    index->library.name = "server";
+    index->inotify_fd = -1;
+    index->scan_done_fd = -1;
+    index->first_hole = LIBRARY_SLOT_EMPTY;
+    index->last_hole = LIBRARY_SLOT_EMPTY;
+
+    printf("Initializing library\n");
+    printf("Library path: %s\n", index->library.path);
+
+    index->save_path = _join_path(path, LIBRARY_INDEX_FILE);
+    if (index->save_path == NULL) {
+        return -1;
+    }
+    return _rehash_library(index, 0);
+}
+
+
+void free_library_index(LibraryIndex *index) {
+    if (index->walk != NULL) {
+        _free_walk(index->walk);
+        index->walk = NULL;
+        index->scan_done_fd = -1;
+    }
+    _stop_watching(index);
+    for (uint32_t i = 0; i < index->library.num_files; i++) {
+        if (_is_saved(index, index->library.files[i])) {
+            index->library.files[i] = NULL;
+        }
+    }
+    _free_library(&index->library);
+    free(index->ids);
+    if (!_is_saved(index, index->by_path)) {
+        free(index->by_path);
+        free(index->by_inode);
+    }
+    if (index->saved != NULL) {
+        munmap(index->saved, index->saved_size);
+        index->saved = NULL;
+        index->saved_list = NULL;
+    }
+    free(index->save_path);
+    index->ids = NULL;
+    index->by_path = NULL;
+    index->by_inode = NULL;
+    index->save_path = NULL;
+    index->files_size = 0;
+}
+
+
+// Remove whatever the last scan didn't find
+static void _sweep_library(LibraryIndex *index) {
+    for (uint32_t i = 0; i < index->library.num_files; i++) {
+        if (index->library.files[i] != NULL && index->ids[i].seen != index->scan) {
+            _remove_file(index, i);
+        }
+    }
+}
+
+
+// The walk adds what's new and marks what it finds; whatever it didn't find is removed.
+int scan_library(LibraryIndex *index) {
+    #ifdef DEBUG
+    printf("^^^^ ----------------------------------- ^^^^\n");
+    printf("Scanning library\n");
+    #endif
+    index->scan++;
+    int result = _walk_library(index, "", _walk_threads(index));
+    if (result == 0) {
+        _sweep_library(index);
+        index->unverified = 0;
+    }
+    #ifdef DEBUG
+    printf("vvvv ----------------------------------- vvvv\n");
+    #endif
+    return result;
+}
+
+
+int watch_library(LibraryIndex *index, uint8_t in_background) {
+    _stop_watching(index);
+    index->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (index->inotify_fd < 0) {
+        perror("inotify_init1");
+        fprintf(stderr, "Falling back to scanning the library every %d seconds\n",
+                LIBRARY_SCAN_INTERVAL);
+    }
+    if (!in_background) {
+        return scan_library(index);
+    }
+
+    index->walk = _start_walk(index, "", _walk_threads(index), 1);
+    if (index->walk == NULL) {
+        return -1;
+    }
+    index->scan_done_fd = index->walk->done_fd;
+    return 0;
+}
+
+
+int finish_library_scan(LibraryIndex *index) {
+    LibraryWalk *walk = index->walk;
+    index->walk = NULL;
+    index->scan_done_fd = -1;
+    index->scan++;
+    int result = _finish_walk(index, walk);
+    if (result == 0) {
+        _sweep_library(index);
+        index->unverified = 0;
+    }
+    return result;
+}
+
+
+// Apply one inotify event to the index
+static int _apply_library_event(LibraryIndex *index, const struct inotify_event *event) {
+    if (event->wd < 0 || event->wd >= index->watched_size || index->watched[event->wd] == NULL) {
+        return 0;
+    }
+    if (event->mask & IN_IGNORED) {
+        // (the directory was deleted)
+        free(index->watched[event->wd]);
+        index->watched[event->wd] = NULL;
+        return 0;
+    }
+    if (event->len == 0) {
+        return 0;
+    }
+
+    char *path = _join_path(index->watched[event->wd], event->name);
+    if (path == NULL) {
+        return -1;
+    }
+
+    if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+        char *full_path = _join_path(index->library.path, path);
+        struct stat file_stat;
+        int found = full_path != NULL ? lstat(full_path, &file_stat) : -1;
+        free(full_path);
+        if (found == 0 && S_ISREG(file_stat.st_mode) && _is_file_extension_supported(path)) {
+            int result = _add_file(index, path, file_stat.st_ino, file_stat.st_dev,
+                                   file_stat.st_size, _mtime_ns(&file_stat));
+            free(path);
+            return result;
+        }
+        if (found == 0 && S_ISDIR(file_stat.st_mode)) {
+            // a directory moved in comes with its files, which a walk picks up
+            _walk_library(index, path, 1);
+        }
+    } else if (event->mask & IN_CLOSE_WRITE) {
+        // a file was written: its new size and time are what it's to be known by
+        uint32_t i = *_path_slot(index, path);
+        char *full_path = _join_path(index->library.path, path);
+        struct stat file_stat;
+        if (i != LIBRARY_SLOT_EMPTY && full_path != NULL && lstat(full_path, &file_stat) == 0 &&
+            file_stat.st_ino == index->ids[i].inode && file_stat.st_dev == index->ids[i].dev) {
+            index->ids[i].size = file_stat.st_size;
+            index->ids[i].mtime_ns = _mtime_ns(&file_stat);
+            index->unsaved = 1;
+        }
+        free(full_path);
+    } else if ((event->mask & IN_MOVED_FROM) && (event->mask & IN_ISDIR)) {
+        _remove_directory(index, path);
+    } else if (!(event->mask & IN_ISDIR)) {
+        // (a deleted directory was already empty, its files removed one by one)
+        _remove_path(index, path);
+    }
+    free(path);
+    return 0;
+}
+
+
+int update_library(LibraryIndex *index) {
+    char buf[LIBRARY_EVENT_BUFFER_SIZE]
+        __attribute__((aligned(__alignof__(struct inotify_event))));
+    uint8_t overflowed = 0;
+
+    while (index->inotify_fd >= 0) {
+        ssize_t len = read(index->inotify_fd, buf, sizeof(buf));
+        if (len < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("update_library");
+            return -1;
+        }
+
+        const struct inotify_event *event;
+        for (char *next = buf; next < buf + len;
+             next += sizeof(struct inotify_event) + event->len) {
+            event = (const struct inotify_event *)next;
+            if (event->mask & IN_Q_OVERFLOW) {
+                overflowed = 1;
+            } else if (_apply_library_event(index, event) < 0) {
+                return -1;
+            }
+        }
+    }
+
+    if (overflowed) {
+        // some changes were lost, so find them the slow way
+        fprintf(stderr, "Library events overflowed, rescanning\n");
+        return scan_library(index);
+    }
+    return 0;
+}
+
+// Whether the table read from an index file can be probed: every entry an index
+// of a file (with a path, if it's by_path) or empty, and some of them empty
+static uint8_t _is_table_usable(const uint32_t *table, uint32_t num_slots,
+                                const IndexFileEntry *entries, uint32_t num_files,
+                                uint8_t by_path) {
+    uint32_t num_empty = 0;
+    for (uint32_t slot = 0; slot < num_slots; slot++) {
+        uint32_t i = table[slot];
+        if (i == LIBRARY_SLOT_EMPTY) {
+            num_empty++;
+        } else if (i == LIBRARY_SLOT_REMOVED ? !by_path :
+                   i >= num_files || (by_path && entries[i].path == LIBRARY_INDEX_HOLE)) {
+            return 0;
+        }
+    }
+    return num_empty > 0;
+}
+
+
+// The header of the index file mapped at map, or NULL if it isn't one that can be used.
+// (it could be anything, so everything's checked before it's used: the tables only if
+// with_tables is set, as a snapshot's reader has no use for them)
+static const IndexFileHeader *_check_index_file(const char *map, size_t size,
+                                                uint8_t with_tables) {
+    if (size < sizeof(IndexFileHeader)) {
+        return NULL;
+    }
+    const IndexFileHeader *header = (const IndexFileHeader *)map;
+    const IndexFileEntry *entries = (const IndexFileEntry *)(header + 1);
+    const uint32_t *by_path = (const uint32_t *)(entries + header->num_files);
+    const uint32_t *by_inode = by_path + header->path_slots;
+    const char *paths = (const char *)(by_inode + header->inode_slots);
+    uint64_t expected_size = sizeof(IndexFileHeader) +
+                             (uint64_t)header->num_files * sizeof(IndexFileEntry) +
+                             ((uint64_t)header->path_slots + header->inode_slots) * sizeof(uint32_t) +
+                             header->paths_size + header->list_size + 1;
+    uint8_t valid = header->magic == LIBRARY_INDEX_MAGIC &&
+                    header->version == LIBRARY_INDEX_VERSION &&
+                    expected_size == size && map[size - 1] == '\0' &&
+                    header->path_slots >= LIBRARY_MIN_SLOTS && header->inode_slots >= LIBRARY_MIN_SLOTS &&
+                    (header->path_slots & (header->path_slots - 1)) == 0 &&
+                    (header->inode_slots & (header->inode_slots - 1)) == 0 &&
+                    header->paths_used < header->path_slots &&
+                    (header->paths_size == 0 || paths[header->paths_size - 1] == '\0');
+    for (uint32_t i = 0; valid && i < header->num_files; i++) {
+        valid = entries[i].path == LIBRARY_INDEX_HOLE || entries[i].path < header->paths_size;
+    }
+    valid = valid && (!with_tables ||
+        (_is_table_usable(by_path, header->path_slots, entries, header->num_files, 1) &&
+         _is_table_usable(by_inode, header->inode_slots, entries, header->num_files, 0)));
+    return valid ? header : NULL;
+}
+
+
+// A hole in a loaded index, and when its file was removed
+typedef struct index_hole {
+    int64_t removed_at;
+    uint32_t i;
+} IndexHole;
+
+
+static int _compare_holes(const void *a, const void *b) {
+    const IndexHole *x = (const IndexHole *)a, *y = (const IndexHole *)b;
+    if (x->removed_at != y->removed_at) {
+        return x->removed_at < y->removed_at ? -1 : 1;
+    }
+    return (x->i > y->i) - (x->i < y->i);
+}
+
+
+int load_library_index(LibraryIndex *index) {
+    int fd = open(index->save_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno != ENOENT) {
+            perror(index->save_path);
+        }
+        return -1;
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) < 0 || file_stat.st_size < (off_t)sizeof(IndexFileHeader)) {
+        close(fd);
+        return -1;
+    }
+    // (private and writable: what the index changes is copied, the file left alone)
+    size_t size = file_stat.st_size;
+    char *map = (char *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("load_library_index");
+        return -1;
+    }
+    madvise(map, size, MADV_SEQUENTIAL);
+
+    const IndexFileHeader *header = _check_index_file(map, size, 1);
+    if (header == NULL) {
+        fprintf(stderr, "%s isn't a library index, ignoring it\n", index->save_path);
+        munmap(map, size);
+        return -1;
+    }
+    const IndexFileEntry *entries = (const IndexFileEntry *)(header + 1);
+    uint32_t *by_path = (uint32_t *)(entries + header->num_files);
+    uint32_t *by_inode = by_path + header->path_slots;
+    char *paths = (char *)(by_inode + header->inode_slots);
+    const char *list = paths + header->paths_size;
+    uint32_t num_holes = 0;
+    for (uint32_t i = 0; i < header->num_files; i++) {
+        num_holes += entries[i].path == LIBRARY_INDEX_HOLE;
+    }
+    IndexHole *holes = malloc((num_holes + 1) * sizeof(IndexHole));
+    if (holes == NULL) {
+        perror("malloc");
+        munmap(map, size);
+        return -1;
+    }
+    num_holes = 0;
+    if (_reserve_files(index, header->num_files) < 0) {
+        free(holes);
+        munmap(map, size);
+        return -1;
+    }
+
+    // the names and tables are used where they are (the hashes being the same from run
+    // to run), until they change
+    for (uint32_t i = 0; i < header->num_files; i++) {
+        index->library.files[i] = entries[i].path != LIBRARY_INDEX_HOLE ? paths + entries[i].path : NULL;
+        index->ids[i].inode = entries[i].inode;
+        index->ids[i].dev = entries[i].dev;
+        index->ids[i].size = entries[i].size;
+        index->ids[i].mtime_ns = entries[i].mtime_ns;
+        index->ids[i].seen = index->scan;
+        index->ids[i].removed_at = 0;
+        if (entries[i].path == LIBRARY_INDEX_HOLE) {
+            holes[num_holes].removed_at = entries[i].removed_at;
+            holes[num_holes++].i = i;
+        }
+    }
+    index->library.num_files = header->num_files;
+
+    // the holes go back in the queue in the order their files were removed
+    index->first_hole = LIBRARY_SLOT_EMPTY;
+    index->last_hole = LIBRARY_SLOT_EMPTY;
+    qsort(holes, num_holes, sizeof(IndexHole), _compare_holes);
+    time_t now = time(NULL);
+    for (uint32_t h = 0; h < num_holes; h++) {
+        _queue_hole(index, holes[h].i, holes[h].removed_at > 0 ? (time_t)holes[h].removed_at : now);
+    }
+    free(holes);
+    free(index->by_path);
+    free(index->by_inode);
+    index->by_path = by_path;
+    index->by_inode = by_inode;
+    index->path_slots = header->path_slots;
+    index->inode_slots = header->inode_slots;
+    index->paths_used = header->paths_used;
+    index->saved = map;
+    index->saved_size = size;
+    index->saved_list = list;
+    index->saved_list_len = header->list_size;
+
+    printf("Loaded %u files from %s\n", index->library.num_files, index->save_path);
+    index->changed = 1;
+    index->unsaved = 0;
+    index->unverified = 1;
+    index->saved_at = time(NULL);
+    return 0;
+}
+
+
+ListResponse *make_index_list_response(LibraryIndex *index) {
+    if (index->saved_list == NULL) {
+        return make_list_response(&index->library);
+    }
+    ListResponse *list = malloc(sizeof(ListResponse));
+    if (list == NULL) {
+        perror("make_index_list_response");
+        return NULL;
+    }
+    list->msg = (char *)index->saved_list;
+    list->len = index->saved_list_len;
+    list->refs = 1;
+    list->in_index = 1;
+    list->snapshot = NULL;
+    list->snapshot_size = 0;
+    return list;
+}
+
+
+// Write the index to file as an index file (see IndexFileHeader). Errors are left for
+// the caller to find with ferror.
+static void _write_library_index(const LibraryIndex *index, FILE *file) {
+    uint64_t paths_size = 0;
+    uint64_t list_size = 0;
+    for (uint32_t i = 0; i < index->library.num_files; i++) {
+        size_t len = index->library.files[i] != NULL ? strlen(index->library.files[i]) : 0;
+        if (index->library.files[i] != NULL) {
+            paths_size += len + 1;
+        }
+        list_size += get_index_strlen(i) + 1 + len + 2;   // as in create_msg_string
+    }
+
+    IndexFileHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = LIBRARY_INDEX_MAGIC;
+    header.version = LIBRARY_INDEX_VERSION;
+    header.num_files = index->library.num_files;
+    header.path_slots = index->path_slots;
+    header.inode_slots = index->inode_slots;
+    header.paths_used = index->paths_used;
+    header.paths_size = paths_size;
+    header.list_size = list_size;
+    fwrite(&header, sizeof(header), 1, file);
+    uint64_t offset = 0;
+    for (uint32_t i = 0; i < index->library.num_files; i++) {
+        const char *name = index->library.files[i];
+        IndexFileEntry entry;
+        entry.inode = index->ids[i].inode;
+        entry.dev = index->ids[i].dev;
+        entry.size = index->ids[i].size;
+        entry.mtime_ns = index->ids[i].mtime_ns;
+        entry.removed_at = name != NULL ? 0 : index->ids[i].removed_at;
+        entry.path = name != NULL ? offset : LIBRARY_INDEX_HOLE;
+        if (name != NULL) {
+            offset += strlen(name) + 1;
+        }
+        fwrite(&entry, sizeof(entry), 1, file);
+    }
+    fwrite(index->by_path, sizeof(uint32_t), index->path_slots, file);
+    fwrite(index->by_inode, sizeof(uint32_t), index->inode_slots, file);
+    for (uint32_t i = 0; i < index->library.num_files; i++) {
+        const char *name = index->library.files[i];
+        if (name != NULL) {
+            fwrite(name, 1, strlen(name) + 1, file);
+        }
+    }
+    for (int i = (int)index->library.num_files - 1; i >= 0; i--) {
+        const char *name = index->library.files[i];
+        fprintf(file, "%d:%s\r\n", i, name != NULL ? name : "");
+    }
+    fputc('\0', file);
+}
+
+
+int save_library_index(LibraryIndex *index) {
+    if (index->save_path == NULL) {
+        return 0;
+    }
+    char *tmp_path = (char *)malloc(strlen(index->save_path) + 5);
+    if (tmp_path == NULL) {
+        perror("save_library_index");
+        return -1;
+    }
+    sprintf(tmp_path, "%s.tmp", index->save_path);
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    FILE *file = fd >= 0 ? fdopen(fd, "w") : NULL;
+    if (file == NULL) {
+        perror(tmp_path);
+        if (fd >= 0) {
+            close(fd);
+            unlink(tmp_path);
+        }
+        free(tmp_path);
+        // (a library on a read-only disk, say: carry on without it)
+        fprintf(stderr, "Not saving the library index\n");
+        free(index->save_path);
+        index->save_path = NULL;
+        return -1;
+    }
+    setvbuf(file, NULL, _IOFBF, LIBRARY_INDEX_WRITE_BUFFER_SIZE);
+
+    // (written, not mapped, so a full disk is an error here rather than a SIGBUS)
+    _write_library_index(index, file);
+
+    // (on disk before it takes the old one's place, so a crash leaves one or the other)
+    int result = fflush(file) == 0 && !ferror(file) && fsync(fd) == 0 ? 0 : -1;
+    if (fclose(file) != 0) {
+        result = -1;
+    }
+    if (result == 0) {
+        result = rename(tmp_path, index->save_path);
+    }
+    if (result < 0) {
+        perror("save_library_index");
+        unlink(tmp_path);
+    } else {
+        index->unsaved = 0;
+    }
+    index->saved_at = time(NULL);   // (a failed save is tried again in as long)
+    free(tmp_path);
+    return result;
+}
+
+
+int snapshot_library_index(LibraryIndex *index) {
+    // (the file can't have changed since: anything that would have changed it clears saved_list)
+    if (index->saved_list != NULL && index->save_path != NULL) {
+        int fd = open(index->save_path, O_RDONLY | O_CLOEXEC);
+        if (fd >= 0) {
+            return fd;
+        }
+    }
+
+    int fd = memfd_create("as_server library", MFD_CLOEXEC);
+    if (fd < 0) {
+        perror("snapshot_library_index");
+        return -1;
+    }
+    int file_fd = dup(fd);
+    FILE *file = file_fd >= 0 ? fdopen(file_fd, "w") : NULL;
+    if (file == NULL) {
+        perror("snapshot_library_index");
+        if (file_fd >= 0) {
+            close(file_fd);
+        }
+        close(fd);
+        return -1;
+    }
+    setvbuf(file, NULL, _IOFBF, LIBRARY_INDEX_WRITE_BUFFER_SIZE);
+    _write_library_index(index, file);
+    int result = fflush(file) == 0 && !ferror(file) ? 0 : -1;
+    if (fclose(file) != 0 || result < 0) {
+        perror("snapshot_library_index");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+
+ListResponse *map_library_snapshot(int fd, Library *library) {
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) < 0) {
+        perror("map_library_snapshot");
+        return NULL;
+    }
+    size_t size = file_stat.st_size;
+    char *map = size > 0 ? (char *)mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    if (map == MAP_FAILED) {
+        perror("map_library_snapshot");
+        return NULL;
+    }
+    const IndexFileHeader *header = _check_index_file(map, size, 0);
+    ListResponse *list = malloc(sizeof(ListResponse));
+    char **files = malloc(MAX(header != NULL ? header->num_files : 0, 1) * sizeof(char *));
+    if (header == NULL || list == NULL || files == NULL) {
+        fprintf(stderr, "map_library_snapshot: can't use the library snapshot\n");
+        free(list);
+        free(files);
+        munmap(map, size);
+        return NULL;
+    }
+    const IndexFileEntry *entries = (const IndexFileEntry *)(header + 1);
+    const uint32_t *by_path = (const uint32_t *)(entries + header->num_files);
+    char *paths = (char *)(by_path + header->path_slots + header->inode_slots);
+    for (uint32_t i = 0; i < header->num_files; i++) {
+        files[i] = entries[i].path != LIBRARY_INDEX_HOLE ? paths + entries[i].path : NULL;
+    }
+    free(library->files);
+    library->files = files;
+    library->num_files = header->num_files;
+
+    list->msg = paths + header->paths_size;
+    list->len = header->list_size;
+    list->refs = 1;
+    list->in_index = 0;
+    list->snapshot = map;
+    list->snapshot_size = size;
+    return list;
+}
+
+
+// Make a library of num_files empty files at path: 100 to a directory ("albums"),
+// 100 of those to a directory ("artists"), and a cover image (left out of the index) in each
+static int _make_synthetic_library(const char *path, int num_files) {
+    char file_path[PATH_MAX];
+    printf("Making a library of %d files in %s\n", num_files, path);
+    if (mkdir(path, 0755) < 0) {
+        perror(path);
+        return -1;
+    }
+    for (int i = 0; i < num_files; i++) {
+        int album = i / 100;
+        if (i % 100 == 0) {
+            snprintf(file_path, sizeof(file_path), "%s/artist%04d", path, album / 100);
+            if (album % 100 == 0 && mkdir(file_path, 0755) < 0) {
+                perror(file_path);
+                return -1;
+            }
+            snprintf(file_path, sizeof(file_path), "%s/artist%04d/album%02d", path,
+                     album / 100, album % 100);
+            if (mkdir(file_path, 0755) < 0) {
+                perror(file_path);
+                return -1;
+            }
+            snprintf(file_path, sizeof(file_path), "%s/artist%04d/album%02d/cover.jpg", path,
+                     album / 100, album % 100);
+            int fd = open(file_path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+            if (fd < 0) {
+                perror(file_path);
+                return -1;
+            }
+            close(fd);
+        }
+        snprintf(file_path, sizeof(file_path), "%s/artist%04d/album%02d/track%02d.mp3", path,
+                 album / 100, album % 100, i % 100);
+        int fd = open(file_path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            perror(file_path);
+            return -1;
+        }
+        close(fd);
+    }
+    return 0;
+}
+
+
+static double _seconds_since(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+
+// Scan the library into a fresh index with num_threads threads (then scan it again
+// if rescan), and report how long it took
+static int _time_library_scan(const char *path, int num_threads, uint8_t rescan) {
+    LibraryIndex index;
+    if (make_library_index(&index, path) < 0) {
+        return -1;
+    }
+    index.scan_threads = num_threads;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int result = scan_library(&index);
+    double scan_time = _seconds_since(&start);
+    if (result == 0) {
+        printf("%2d thread(s): %u files in %.3f s", _walk_threads(&index),
+               index.library.num_files, scan_time);
+        if (rescan) {
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            result = scan_library(&index);
+            printf(", rescanned (nothing changed) in %.3f s", _seconds_since(&start));
+        }
+        printf("\n");
+    }
+    free_library_index(&index);
+    return result;
+}
+
+
+int benchmark_library_scan(const char *path, int num_files) {
+    struct stat path_stat;
+    if (stat(path, &path_stat) < 0 && _make_synthetic_library(path, num_files) < 0) {
+        return -1;
+    }
+
+    // (the first scan reads the directories into the cache, for the rest to be compared fairly)
+    if (_time_library_scan(path, 1, 0) < 0 ||
+        _time_library_scan(path, 1, 1) < 0 ||
+        _time_library_scan(path, 0, 1) < 0) {
+        return -1;
+    }
+
+    // then what a restart costs instead, with the index saved
+    LibraryIndex index;
+    struct timespec start;
+    if (make_library_index(&index, path) < 0 || scan_library(&index) < 0) {
+        free_library_index(&index);
+        return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int result = save_library_index(&index);
+    printf("Index saved in %.3f s\n", _seconds_since(&start));
+    free_library_index(&index);
+    if (result < 0 || make_library_index(&index, path) < 0) {
+        free_library_index(&index);
+        return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    result = load_library_index(&index);
+    ListResponse *list = result == 0 ? make_index_list_response(&index) : NULL;
+    if (list != NULL) {
+        printf("Index loaded and LIST built in %.3f s\n", _seconds_since(&start));
+    }
+    release_list_response(list);
+    free_library_index(&index);
+    return list != NULL ? 0 : -1;
+}
+
+
+
+int handle_client(const ClientSocket * client, Library *library, const ListResponse *list) {
+    char *request = NULL;
+    uint8_t *request_buffer = (uint8_t *)malloc(REQUEST_BUFFER_SIZE);
+    if (request_buffer == NULL) {
+        perror("handle_client");
+        return 1;
+    }
+    uint8_t *buff_end = request_buffer;
+
+    int bytes_read = 0;
+    int bytes_in_buf = 0;
+    while((bytes_read = read(client->socket, buff_end, REQUEST_BUFFER_SIZE - bytes_in_buf)) > 0){
+        #ifdef DEBUG
+        printf("Read %d bytes from client\n", bytes_read);
+        #endif
+
+        bytes_in_buf += bytes_read;
+
+        request = find_network_newline((char *)request_buffer, &bytes_in_buf);
+
+        if (request && strcmp(request, REQUEST_LIST) == 0) {
+            if (list_request_response(client, list) < 0) {
+                ERR_PRINT("Error handling LIST request\n");
+                goto client_error;
+            }
+
+        } else if (request && strcmp(request, REQUEST_STREAM) == 0) {
+            int num_pr_bytes = MIN(sizeof(uint32_t), (unsigned long)bytes_in_buf);
+            if (stream_request_response(client, library, request_buffer, num_pr_bytes) < 0) {
+                ERR_PRINT("Error handling STREAM request\n");
+                goto client_error;
+            }
+            bytes_in_buf -= num_pr_bytes;
+            memmove(request_buffer, request_buffer + num_pr_bytes, bytes_in_buf);
+
+        } else if (request) {
+            ERR_PRINT("Unknown request: %s\n", request);
+        }
+
+        free(request); request = NULL;
+        buff_end = request_buffer + bytes_in_buf;
+
+    }
+    if (bytes_read < 0) {
+        perror("handle_client");
+        goto client_error;
+    }
+
+    printf("Client on %s:%d disconnected\n",
+           inet_ntoa(client->addr.sin_addr),
+           ntohs(client->addr.sin_port));
+
+    free(request_buffer);
+    if (request != NULL) {
+        free(request);
+    }
+    return 0;
+client_error:
+    free(request_buffer);
+    if (request != NULL) {
+        free(request);
+    }
+    return -1;
+}
+
+
+static void print_usage(){
+    printf("Usage: as_server [-h] [-e] [-w workers] [-p port] [-l library_directory] [-b files]\n");
+    printf("  -h  Print this message\n");
+    printf("  -e  Serve every client from one process with epoll (default: a process per client)\n");
+    printf("  -w  Serve with epoll from this many worker processes sharing the port (implies -e)\n");
+    printf("  -p  Port to listen on (default: " XSTR(DEFAULT_PORT) ")\n");
     printf("  -l  Directory containing the library (default: ./library/)\n");
+    printf("  -b  Time scanning the library and exit, making one of this many files there first\n");
+    printf("      if there's nothing there\n");
 }
 
 
@@ -696,29 +3296,49 @@ int main(int argc, char * const *argv){
     int opt;
     int port = DEFAULT_PORT;
     const char *library_directory = "library";
+    uint8_t event_driven = 0;
+    int num_workers = 1;
+    int benchmark_files = 0;
 
     // Check out man 3 getopt for how to use this function
     // The short version: it parses command line options
     // Note that optarg is a global variable declared in getopt.h
-    while ((opt = getopt(argc, argv, "hp:l:")) != -1) {
+    while ((opt = getopt(argc, argv, "hew:p:l:b:")) != -1) {
         switch (opt) {
             case 'h':
                 print_usage();
                 return 0;
+            case 'e':
+                event_driven = 1;
+                break;
+            case 'w':
+                event_driven = 1;
+                num_workers = atoi(optarg);
+                break;
             case 'p':
                 port = atoi(optarg);
                 break;
             case 'l':
                 library_directory = optarg;
                 break;
+            case 'b':
+                benchmark_files = atoi(optarg);
+                break;
             default:
                 print_usage();
                 return 1;
         }
     }
 
+    if (benchmark_files > 0) {
+        return benchmark_library_scan(library_directory, benchmark_files) < 0 ? 1 : 0;
+    }
+
     printf("Starting server on port %d, serving library in %s\n",
            port, library_directory);
 
+    if (event_driven) {
+        return run_event_server(port, library_directory, num_workers);
+    }
     return run_server(port, library_directory);
 }
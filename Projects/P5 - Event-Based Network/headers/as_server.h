@@ -4,21 +4,63 @@
 /*                       CSC209-24s A4 Audio Stream                          */
 /*       Copyright 2024 -- Demetres Kostas PhD (aka Darlene Heliokinde)      */
 /*****************************************************************************/
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // splice
+#endif
 #include "libas.h"
 
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#include <time.h>
+
 /*
 ** Constants
 ** ---------
 */
 #define MAX_PENDING 10
-#define STREAM_CHUNK_SIZE 1024
+// Most of a file handed to the kernel to send at once (and what a streaming
+// client gets per turn in event-driven mode, before the others get theirs)
+#define SENDFILE_CHUNK_SIZE (256 * 1024)
 
 #define SELECT_TIMEOUT_SEC 1
 #define SELECT_TIMEOUT_USEC 0
 #define SELECT_TIMEOUT {SELECT_TIMEOUT_SEC, SELECT_TIMEOUT_USEC}
 
 #define LIBRARY_FILENAME_MAX 256
-#define LIBRARY_SCAN_INTERVAL 60
+#define LIBRARY_SCAN_INTERVAL 60    // only without inotify (see LibraryIndex)
+#define LIBRARY_MIN_SLOTS 1024
+#define LIBRARY_SLOT_EMPTY UINT32_MAX
+#define LIBRARY_SLOT_REMOVED (UINT32_MAX - 1)
+#define LIBRARY_WATCH_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+                              IN_CLOSE_WRITE | IN_ONLYDIR)
+#define LIBRARY_EVENT_BUFFER_SIZE (64 * 1024)
+#define LIBRARY_WALK_MAX_THREADS 16
+#define LIBRARY_WALK_BUFFER_SIZE (256 * 1024)   // for getdents64, per thread
+#define LIBRARY_WALK_ARENA_SIZE (1024 * 1024)   // a block of a walk thread's arena
+#define LIBRARY_WALK_MAX_OPEN 64                // directories a walk queues already open
+#define LIBRARY_INDEX_FILE ".as_server_index"   // in the library (see IndexFileHeader)
+#define LIBRARY_INDEX_MAGIC 0x58495341          // "ASIX"
+#define LIBRARY_INDEX_VERSION 3
+#define LIBRARY_INDEX_HOLE UINT64_MAX
+#define LIBRARY_INDEX_WRITE_BUFFER_SIZE (1024 * 1024)
+#define LIBRARY_SAVE_INTERVAL 10    // seconds at least between saves of a changing index
+#define LIBRARY_HOLE_GRACE (60 * 60)  // seconds a removed file's index is kept for it
+
+// Event-driven mode (-e, -w)
+#define EVENT_LISTEN_BACKLOG SOMAXCONN
+#define EVENT_MAX_EVENTS 256
+#define EVENT_MAX_WORKERS 64
 
 
 /*
@@ -30,8 +72,9 @@
 ** to handle this client, and will terminate when the client disconnects.
 **
 ** The server will maintain a library of audio files. The library will be a
-** directory on the server's file system. The server will scan the library
-** directory at regular intervals to keep the library up to date.
+** directory on the server's file system. The server scans the library once (or,
+** if it has run before, starts from the index it saved and checks that in the
+** background), then keeps it up to date as files come and go (see LibraryIndex).
 **
 ** Once a client connects, it can make requests.
 ** The server will respond to the following requests:
@@ -52,6 +95,28 @@
 **
 ** The client-server connection code is nearly identical to T10, so be sure to take a crack
 ** at that lab before starting this assignment.
+**
+** Event-driven mode
+** -----------------
+** With -e, the server instead runs in a single process. Every client socket is
+** non-blocking and registered with epoll, and each connection is a small state
+** machine (see Connection below) that remembers how far it got parsing a request
+** or sending a response. A connection only ever holds a fixed-size request buffer
+** and its place in the file it is streaming, plus a LIST response while sending
+** one, so thousands of concurrent streams cost a few hundred bytes each instead
+** of a process each. Connections streaming the same file share one descriptor for
+** it, each sending from its own offset, so a client costs one descriptor, not two.
+**
+** With -w N, N worker processes are forked once the library has been indexed,
+** each running that same event loop on its own listening socket. The sockets are
+** all bound to the one port with SO_REUSEPORT, so the kernel spreads new
+** connections across the workers and they never contend for an accept queue. The
+** workers start out sharing the parent's library (copy-on-write, and only read)
+** and then watch it for themselves; a client talks to one worker for its
+** whole connection, so the indices it is given and the ones it asks for agree.
+**
+** Either way, file data goes from the page cache to the socket with sendfile(),
+** never passing through the server's memory (see send_file_range).
 */
 
 
@@ -62,6 +127,50 @@ typedef struct client_socket {
 } ClientSocket;
 
 
+// Where send_file_range is up to with one file
+typedef struct file_sender {
+    uint8_t use_splice;   // sendfile() isn't supported for this file; splice through pipe_fds
+    int pipe_fds[2];      // created when first needed, -1 until then
+    size_t in_pipe;       // bytes spliced into the pipe that haven't gone out yet
+} FileSender;
+
+// What a connection in the event-driven server is doing
+typedef enum connection_state {
+    CONN_READ_REQUEST,  // waiting for a request line
+    CONN_READ_INDEX,    // got STREAM, waiting for the 4-byte file index
+    CONN_SEND_LIST,     // writing a LIST response
+    CONN_SEND_FILE      // writing the file size, then the file
+} ConnectionState;
+
+// A library file being streamed, opened once and shared by every connection streaming it
+typedef struct open_file {
+    dev_t dev;            // which file it is, as fstat() says
+    ino_t inode;
+    int fd;
+    int refs;             // connections streaming it
+} OpenFile;
+
+// A client of the event-driven server, and its progress through its current request
+typedef struct connection {
+    ClientSocket client;
+    ConnectionState state;
+    uint32_t events;      // what it is registered with epoll for
+
+    uint8_t request_buffer[REQUEST_BUFFER_SIZE];
+    int bytes_in_buf;
+
+    struct list_response *list; // CONN_SEND_LIST (a reference held while sending it)
+    size_t list_sent;
+
+    OpenFile *file;       // CONN_SEND_FILE
+    off_t file_offset;    // where the next bytes are sent from
+    uint32_t file_left;   // bytes of the file not sent yet
+    uint8_t size_header[sizeof(uint32_t)];
+    int header_sent;
+    FileSender sender;
+} Connection;
+
+
 #define SET_SERVER_FD_SET(fd, conn_soc) do { \
     FD_ZERO(&fd); \
     FD_SET(conn_soc, &fd); \
@@ -103,6 +212,35 @@ ClientSocket accept_connection(int listenfd);
 
 
 // Request response functions
+/*
+** The LIST response for a library (see list_request_response). It is built once
+** each time the library is scanned and never changed afterwards, so every LIST
+** request just sends it; a rescan makes a new one instead of touching this one.
+** Anyone keeping the pointer holds a reference, and the last to release it frees it.
+*/
+typedef struct list_response {
+    char *msg;            // heap-allocated (or in a loaded index or snapshot), null-terminated
+    size_t len;           // bytes sent (not counting the null)
+    int refs;
+    uint8_t in_index;     // msg is the one saved with a loaded index, not to be freed
+    char *snapshot;       // msg is in this library snapshot, unmapped with the last reference
+    size_t snapshot_size; //   (see map_library_snapshot; NULL if it isn't)
+} ListResponse;
+
+/*
+** Build the LIST response for the library, holding one reference to it.
+**
+** Returns the response, or NULL on error.
+*/
+ListResponse *make_list_response(const Library *library);
+
+// Take another reference to list, and return it
+ListResponse *hold_list_response(ListResponse *list);
+
+// Drop a reference to list (which may be NULL), freeing it with the last one
+void release_list_response(ListResponse *list);
+
+
 /*
 ** List the files in the library. The list is returned as a single string
 ** with each file starting with an integer corresponding to it's index in
@@ -117,26 +255,31 @@ ClientSocket accept_connection(int listenfd);
 **
 ** Notes:
 **   -- the null character is not included in the message sent to the client.
+**   -- a file that has been removed leaves its index with no name ("3:\r\n"), so
+**      the other files' indices don't change. Clients written before this must
+**      accept such entries (as_client does), and streaming one fails. The index
+**      names no other file for LIBRARY_HOLE_GRACE seconds (the file gets it back
+**      if it returns); after that a new file can be given it, so a client
+**      shouldn't keep using indices from a LIST that's older than that.
+**   -- list is the response made by make_list_response when the library was
+**      last scanned; it is sent with one write, not rebuilt.
 **
 ** return 0 on success, -1 on error
 */
-int list_request_response(const ClientSocket * client, const Library *library);
+int list_request_response(const ClientSocket * client, const ListResponse *list);
 
 
 /*
-** Stream a file from the library to the client. The file is streamed in chunks
-** of a maximum of STREAM_CHUNK_SIZE bytes. The client will be able to request
-** a specific file by its index in the library.
+** Stream a file from the library to the client. The file is sent straight from
+** the page cache with send_file_range, up to SENDFILE_CHUNK_SIZE bytes at a time.
+** The client will be able to request a specific file by its index in the library.
 **
 ** The 32-bit unsigned network byte-order integer file_index will be read
 ** from the client_socket, but will consider num_pr_bytes (must be <= uint32_t)
 ** from post_req first, then:
 **   The stream will be sent in the following format:
 **     - the first 4 bytes (32-bits) will be the file size in network byte-order
-**     - the rest of the stream will be the file's data written in chunks of
-**       STREAM_CHUNK_SIZE bytes, or less if write returns less than STREAM_CHUNK_SIZE,
-**       the file is less than STREAM_CHUNK_SIZE bytes, or the last remaining chunk is
-**       less than STREAM_CHUNK_SIZE bytes.
+**     - the rest of the stream will be the file's data.
 **
 ** If the file is successfully transported to the client over the client_socket,
 ** return 0. Otherwise, return -1.
@@ -145,17 +288,228 @@ int stream_request_response(const ClientSocket * client, const Library *library,
                             uint8_t *post_req, int num_pr_bytes);
 
 
+/*
+** Send count bytes of the file in_fd, starting at *offset, to the socket out_fd,
+** without copying them through user space: with sendfile(), or where that isn't
+** supported for the file, splice() through a pipe. *offset is advanced past the
+** bytes taken from the file, and sender keeps track of anything left in the pipe,
+** so count is always the number of bytes still to be delivered.
+**
+** On a non-blocking socket this sends what the socket takes, and can be called
+** again to resume where it left off once the socket is writable.
+**
+** Returns the number of bytes sent (0 if the socket is full), -1 on error
+** (including the file ending before count bytes).
+*/
+ssize_t send_file_range(int out_fd, int in_fd, off_t *offset, size_t count,
+                        FileSender *sender);
+
+void init_file_sender(FileSender *sender);
+void close_file_sender(FileSender *sender);
+
+
 // Library functions
 /*
-** Scan the library directory and (re-)populate the library structure. The library
-** structure will be populated with the name of the library, the path to the library,
-** and a list of files in the library.
+** Library index
+** -------------
+** The server's Library, kept up to date in place rather than rebuilt. Files are
+** keyed on their inode, so a file keeps its index for as long as the server runs:
+** through rescans, and through renames and moves within the library (which look
+** like the inode being removed and added again). A removed file leaves a hole, a
+** NULL entry in files, that only its inode fills again, for LIBRARY_HOLE_GRACE
+** seconds. After that the hole goes to the next new file (the oldest hole first),
+** so holes don't pile up as files come and go; new files are appended only when
+** there's no such hole.
+**
+** With inotify every directory of the library is watched, and update_library
+** applies the changes as they are reported. Without it (or when it runs out of
+** watches) scan_library is run every LIBRARY_SCAN_INTERVAL seconds instead.
+**
+** The index is saved in the library, for the next server to start serving from
+** straight away (indices and all) while it checks it against the library.
+*/
+typedef struct file_id {
+    ino_t inode;
+    dev_t dev;
+    off_t size;           // as last seen, to tell a reused inode from the file that had it
+    int64_t mtime_ns;     //   (-1: not known)
+    uint32_t seen;        // the last scan that found it
+    time_t removed_at;    // when it was removed, while it's a hole (0 otherwise)
+    uint32_t prev_hole;   // its neighbours in the queue of holes, while it's a hole
+    uint32_t next_hole;   //   (LIBRARY_SLOT_EMPTY at either end)
+} FileId;
+
+typedef struct library_index {
+    Library library;      // files and num_files include the holes
+    FileId *ids;          // for each entry in files
+    uint32_t files_size;  // entries allocated for files and ids
+
+    uint32_t *by_path;    // open addressing on the name: an index, LIBRARY_SLOT_EMPTY or _REMOVED
+    uint32_t path_slots;
+    uint32_t paths_used;  // slots not empty
+    uint32_t *by_inode;   // open addressing on the inode (which holes keep until reused): an index
+    uint32_t inode_slots; //   or LIBRARY_SLOT_EMPTY
+    uint32_t first_hole;  // the queue of holes, longest removed first (LIBRARY_SLOT_EMPTY
+    uint32_t last_hole;   //   if there are none)
+    uint32_t scan;
+    int scan_threads;     // threads to walk the library with (0: one per CPU)
+
+    int inotify_fd;       // -1 when not watching
+    char **watched;       // each watched directory's path in the library, indexed by wd
+    int watched_size;
+    uint8_t changed;      // files were added or removed; for the caller to clear
+
+    struct library_walk *walk;  // a scan in the background, or NULL
+    int scan_done_fd;     // readable when it's done (-1 when there isn't one)
+
+    char *save_path;      // where the index is saved (NULL: it isn't)
+    time_t saved_at;      // when it was last saved, or tried to be
+    uint8_t unsaved;      // changed since it was saved
+
+    char *saved;          // the index file it was loaded from, mapped privately: names
+    size_t saved_size;    //   and tables point into it until they change (or NULL)
+    const char *saved_list;  // the LIST response saved with it, while nothing has changed
+    size_t saved_list_len;
+    uint8_t unverified;   // loaded, and not yet checked against the library by a walk
+} LibraryIndex;
+
+/*
+** Index file
+** ----------
+** A saved LibraryIndex: this header, then an entry for each of its files (holes
+** too, so that indices survive a restart), then by_path and by_inode as they were
+** (so loading doesn't hash a thing; a change to either hash needs a new version),
+** then the paths, each NUL-terminated, that the entries point into, and last the
+** LIST response for it (and a NUL), for a restarted server to send as it is. It's
+** written in this machine's byte order, and one from anywhere else (or any other
+** version) is ignored.
+**
+** Each entry has the size and modification time its file had, so that the first
+** walk after loading can tell a file from another that was given its inode (the
+** first having been deleted while nothing was watching).
+*/
+typedef struct index_file_header {
+    uint32_t magic;       // LIBRARY_INDEX_MAGIC
+    uint32_t version;     // LIBRARY_INDEX_VERSION
+    uint32_t num_files;
+    uint32_t path_slots;
+    uint32_t inode_slots;
+    uint32_t paths_used;
+    uint64_t paths_size;  // bytes of paths after the tables
+    uint64_t list_size;   // bytes of LIST response after the paths (not counting the NUL)
+} IndexFileHeader;
+
+typedef struct index_file_entry {
+    uint64_t inode;
+    uint64_t dev;
+    int64_t size;
+    int64_t mtime_ns;     // -1 if it wasn't known
+    int64_t removed_at;   // when a hole's file was removed (0 if it isn't a hole)
+    uint64_t path;        // offset of its path in the paths, or LIBRARY_INDEX_HOLE
+} IndexFileEntry;
+
+/*
+** Set up an empty index for the library at path (not copied, so it must outlive
+** the index), to be saved to LIBRARY_INDEX_FILE there. Returns 0 on success, -1
+** on error.
+*/
+int make_library_index(LibraryIndex *index, const char *path);
+void free_library_index(LibraryIndex *index);
+
+/*
+** Walk the library directory and bring the index up to date with it: files that
+** are new are added, files that are gone are removed, and the rest keep their
+** indices. Any directories not watched yet are watched, if the index is watching.
+** The walk is shared among index->scan_threads threads.
 **
 ** Only SUPPORTED_FILE_EXTS files will be added to the library.
 **
-** If the library is successfully populated, return 0. Otherwise, return -1.
+** If the library is successfully scanned, return 0. Otherwise, return -1.
+*/
+int scan_library(LibraryIndex *index);
+
+/*
+** Start watching the library with inotify (a fresh instance, so after a fork each
+** process can watch for itself), then scan it. If inotify isn't available, the
+** index just isn't watched. Returns scan_library's result.
+**
+** If in_background, the scan only starts: the caller carries on with the index as
+** it was, and calls finish_library_scan once index->scan_done_fd is readable (and
+** not update_library or scan_library before then). Returns 0 if it started.
 */
-int scan_library(Library *library);
+int watch_library(LibraryIndex *index, uint8_t in_background);
+
+/*
+** Bring the index up to date with what a scan in the background found, as
+** scan_library would have. Returns 0 on success, -1 on error.
+*/
+int finish_library_scan(LibraryIndex *index);
+
+/*
+** Fill an empty index with the one saved at index->save_path. The file is mapped
+** (privately) and kept: the names and both tables are used where they are, and
+** only copied when they change, so loading takes no longer for a larger library.
+** Nothing on disk is looked at but the file, so the index is only as current as
+** when it was saved: follow with a scan (in the background), which checks each
+** file's inode, size and time against it.
+**
+** Returns 0 if it was loaded, or -1 if there's no saved index or it can't be used
+** (the index is left empty).
+*/
+int load_library_index(LibraryIndex *index);
+
+/*
+** The LIST response for the index: the one saved with it while it's unchanged
+** since it was loaded, otherwise one made by make_list_response.
+**
+** Returns the response (holding one reference), or NULL on error.
+*/
+ListResponse *make_index_list_response(LibraryIndex *index);
+
+/*
+** Save the index to index->save_path (written elsewhere and synced, then renamed
+** into place, so neither a reader nor a crash ever leaves half of one). If the file
+** can't be created, it's not tried again; a failed write (a full disk, say) is.
+**
+** Returns 0 on success, -1 on error.
+*/
+int save_library_index(LibraryIndex *index);
+
+/*
+** Snapshot the index for other processes to serve from: it's written, as an index
+** file would be, to a new memfd (or, while it's as it was loaded, the saved index
+** file is opened instead). Returns the descriptor, or -1 on error.
+*/
+int snapshot_library_index(LibraryIndex *index);
+
+/*
+** Serve library from a snapshot made by snapshot_library_index: its files are
+** pointed into the mapped snapshot (files is replaced; path and name are left
+** alone). The LIST response returned, holding one reference, holds the mapping:
+** it's unmapped with the response's last reference, so library is only valid for
+** as long as the response is held.
+**
+** Returns the response, or NULL on error (library is left as it was).
+*/
+ListResponse *map_library_snapshot(int fd, Library *library);
+
+/*
+** Apply the changes inotify has reported (call it when index->inotify_fd is
+** readable). If so many came at once that some were lost, the library is scanned.
+**
+** Returns 0 on success, -1 on error.
+*/
+int update_library(LibraryIndex *index);
+
+/*
+** Time scans of the library at path, with one thread and with one per CPU, then
+** saving the index and loading it back, and print the results. If there's nothing
+** at path, a library of num_files empty files is made there first (and left for
+** the next run).
+**
+** Returns 0 on success, -1 on error.
+*/
+int benchmark_library_scan(const char *path, int num_files);
 
 
 // Server operation functions
@@ -167,8 +521,10 @@ int scan_library(Library *library);
 **
 ** When the client's socket is closed/receives EOF, this process must exit with a
 ** value of 0. If any errors occur, the process must exit with a non-zero status.
+**
+** list is the library's LIST response, as the server last built it.
 */
-int handle_client(const ClientSocket * client, Library *library);
+int handle_client(const ClientSocket * client, Library *library, const ListResponse *list);
 
 
 /*
@@ -186,4 +542,27 @@ int handle_client(const ClientSocket * client, Library *library);
 */
 int run_server(int port, const char *library_directory);
 
+
+/*
+** Run the server with epoll, serving every client at once from num_workers processes.
+** Requests and responses are the same as run_server's, but no child processes are
+** made: each connection is advanced as far as it can go without blocking whenever
+** its socket is ready, and long streams take turns SENDFILE_CHUNK_SIZE bytes at
+** a time. The open file limit is raised as far as allowed, so the number of
+** clients is bounded by it rather than by the number of processes.
+**
+** With one worker the loop runs in this process. With more (up to
+** EVENT_MAX_WORKERS), each is forked with its own SO_REUSEPORT socket on port,
+** and this process keeps the library index (watching, scanning and saving it),
+** watches for q, and reaps them; a worker that dies is reported, and the rest
+** carry on. The workers don't scan the library: each time the index changes,
+** this process sends every worker a snapshot of it (see snapshot_library_index)
+** over a socket, so they all serve the same files under the same indices.
+**
+** The loop terminates if an error occurs or the user types q + enter in the
+** server's terminal (the workers are then sent SIGTERM, and finish with their
+** clients closed). Returns 0 then, or -1 if the server couldn't be set up.
+*/
+int run_event_server(int port, const char *library_directory, int num_workers);
+
 #endif // AS_SERVER_H_
@@ -55,12 +55,17 @@
 #define SUPPORTED_FILE_EXTS {".wav", ".mp3", ".flac", ".ogg", ".m4a"}
 
 #define REQUEST_BUFFER_SIZE 128
+// The LIST response is one "<index>:<path>\r\n" for each file, highest index first.
+// A file the server has removed leaves its index with an empty path ("3:\r\n") for
+// a while (see list_request_response in as_server.h), after which a new file may
+// take that index: a client should list again rather than keep indices for long.
 #define REQUEST_LIST "LIST"
 #define REQUEST_STREAM "STREAM"
 
 #define RESPONSE_BUFFER_SIZE 4 * MAX_FILE_NAME
 
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
 
 #define END_OF_MESSAGE_TOKEN "\r\n"
 
@@ -0,0 +1,102 @@
+#include "trace_replay.hh"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+void usage( const char* name )
+{
+  cerr << "Usage: " << name << " [options] TRACE.pcap ROUTES\n"
+       << "  Replays a capture into a router loaded with a route dump (see parse_route_dump). The\n"
+       << "  frames arrive on interface 0, which takes the Ethernet address they were sent to;\n"
+       << "  interfaces 1 and up are created for every interface the routes use.\n"
+       << "  -r        at the recorded timing (default: as fast as possible)\n"
+       << "  -x N      at recorded timing, N times faster\n"
+       << "  -b N      frames per batch (default 64)\n";
+}
+
+} // namespace
+
+int main( int argc, char* argv[] )
+{
+  try {
+    ReplayConfig config;
+    int opt = 0;
+    while ( ( opt = getopt( argc, argv, "hrx:b:" ) ) != -1 ) {
+      switch ( opt ) {
+        case 'r':
+          config.pace = ReplayConfig::Pace::RECORDED;
+          break;
+        case 'x':
+          config.pace = ReplayConfig::Pace::RECORDED;
+          config.speedup = stod( optarg );
+          break;
+        case 'b':
+          config.batch = stoul( optarg );
+          break;
+        default:
+          usage( argv[0] );
+          return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+      }
+    }
+    if ( argc - optind != 2 ) {
+      usage( argv[0] );
+      return EXIT_FAILURE;
+    }
+
+    const vector<PcapRecord> trace = PcapReader::read_all( argv[optind] );
+    if ( trace.empty() ) {
+      throw runtime_error( string( argv[optind] ) + " has no frames" );
+    }
+    const RoutesByLength routes = parse_route_dump( [&] {
+      ifstream file { argv[optind + 1] };
+      if ( not file ) {
+        throw runtime_error( string( "couldn't open " ) + argv[optind + 1] );
+      }
+      ostringstream text;
+      text << file.rdbuf();
+      return text.str();
+    }() );
+
+    uint32_t interfaces = 1;
+    for ( const auto& list : routes ) {
+      for ( const auto& route : list ) {
+        interfaces = max( interfaces, route.interface_num + 1 );
+      }
+    }
+
+    Router router;
+    ostringstream discard; //(every interface announces itself on cerr)
+    auto* const old_cerr = cerr.rdbuf( discard.rdbuf() );
+    router.add_interface( AsyncNetworkInterface { trace.front().frame.header.dst, Address { "192.168.0.1" } } );
+    for ( uint32_t i = 1; i < interfaces; i++ ) {
+      router.add_interface( AsyncNetworkInterface { { 0x02, 0, 0, 0, 0, static_cast<uint8_t>( i ) },
+                                                    Address::from_ipv4_numeric( 0x64400001 + ( i << 8 ) ) } );
+    }
+    cerr.rdbuf( old_cerr );
+    router.load_routes( routes );
+
+    const ReplayReport report = replay_trace( router, trace, config );
+    cout << report.frames << " frames (" << report.datagrams << " IPv4) in " << fixed << setprecision( 3 )
+         << report.seconds << " s: " << setprecision( 2 ) << report.pps / 1e6 << " Mpps, " << report.forwarded
+         << " forwarded, " << report.dropped << " dropped\n"
+         << "latency: median " << setprecision( 1 ) << report.latency_p50_ns / 1e3 << " us, p99 "
+         << report.latency_p99_ns / 1e3 << " us, max " << report.latency_max_ns / 1e3 << " us\n";
+  } catch ( const exception& e ) {
+    cerr << "\033[31;1mError: " << e.what() << "\033[m\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
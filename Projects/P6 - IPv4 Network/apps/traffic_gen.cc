@@ -0,0 +1,220 @@
+#include "forwarding_table.hh"
+#include "pcap.hh"
+#include "route_loader.hh"
+#include "traffic_generator.hh"
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <unordered_set>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+void usage( const char* name )
+{
+  cerr << "Usage: " << name << " [options]\n"
+       << "  -d uniform|zipf|locality  how destinations are picked (default uniform)\n"
+       << "  -r FILE                   draw destinations from the prefixes of a route dump\n"
+       << "  -n N                      or from N random Internet-like prefixes (default 10000)\n"
+       << "  -f N                      flows (default 1024)\n"
+       << "  -p N                      packets (default 65536)\n"
+       << "  -s imix|N[,N...]          datagram sizes, equally weighted unless imix (default imix)\n"
+       << "  -z S                      Zipf exponent (default 1.0)\n"
+       << "  -l P                      locality: chance a new flow goes near a recent one (default 0.8)\n"
+       << "  -S SEED                   random seed (default 1)\n"
+       << "  -o FILE                   write each packet as \"src dst proto length\"\n"
+       << "  -R FILE                   write a route dump covering the prefixes, all direct on interface 1\n"
+       << "  -w FILE                   write the frames to a pcap file\n"
+       << "  -t PPS                    packets per second the pcap's timestamps are spaced at (default 1000000)\n"
+       << "  -m MAC                    Ethernet destination of the frames (default 02:00:00:00:00:01)\n";
+}
+
+string dotted( uint32_t address )
+{
+  return to_string( address >> 24 ) + "." + to_string( ( address >> 16 ) & 0xff ) + "."
+         + to_string( ( address >> 8 ) & 0xff ) + "." + to_string( address & 0xff );
+}
+
+vector<pair<uint32_t, uint8_t>> read_prefixes( const string& path )
+{
+  ifstream file { path };
+  if ( not file ) {
+    throw runtime_error( "couldn't open " + path );
+  }
+  const string text { istreambuf_iterator<char> { file }, istreambuf_iterator<char> {} };
+  const RoutesByLength routes = parse_route_dump( text );
+
+  vector<pair<uint32_t, uint8_t>> prefixes;
+  for ( uint8_t length = 0; length <= 32; length++ ) {
+    for ( const auto& route : routes[length] ) {
+      prefixes.emplace_back( get_network( length, route.prefix_mask ), length );
+    }
+  }
+  return prefixes;
+}
+
+vector<TrafficConfig::PacketSize> parse_sizes( const string& arg )
+{
+  if ( arg == "imix" ) {
+    return TrafficConfig::imix();
+  }
+  vector<TrafficConfig::PacketSize> sizes;
+  istringstream list { arg };
+  string size;
+  while ( getline( list, size, ',' ) ) {
+    sizes.push_back( { static_cast<uint16_t>( stoul( size ) ), 1 } );
+  }
+  return sizes;
+}
+
+EthernetAddress parse_mac( const string& arg )
+{
+  EthernetAddress mac {};
+  istringstream octets { arg };
+  string octet;
+  size_t i = 0;
+  while ( getline( octets, octet, ':' ) ) {
+    if ( i == mac.size() ) {
+      throw runtime_error( "\"" + arg + "\" isn't an Ethernet address" );
+    }
+    mac.at( i++ ) = static_cast<uint8_t>( stoul( octet, nullptr, 16 ) );
+  }
+  if ( i != mac.size() ) {
+    throw runtime_error( "\"" + arg + "\" isn't an Ethernet address" );
+  }
+  return mac;
+}
+
+TrafficConfig::Destinations parse_destinations( const string& arg )
+{
+  if ( arg == "uniform" ) {
+    return TrafficConfig::Destinations::UNIFORM;
+  }
+  if ( arg == "zipf" ) {
+    return TrafficConfig::Destinations::ZIPF;
+  }
+  if ( arg == "locality" ) {
+    return TrafficConfig::Destinations::LOCALITY;
+  }
+  throw runtime_error( "unknown destination distribution \"" + arg + "\"" );
+}
+
+} // namespace
+
+int main( int argc, char* argv[] )
+{
+  try {
+    TrafficConfig config;
+    string routes_in;
+    string packets_out;
+    string routes_out;
+    string pcap_out;
+    double rate = 1e6;
+    size_t random_count = 10000;
+    config.ethernet_src = { 0x02, 0, 0, 0, 0, 0x02 };
+    config.ethernet_dst = { 0x02, 0, 0, 0, 0, 0x01 };
+
+    int opt = 0;
+    while ( ( opt = getopt( argc, argv, "hd:r:n:f:p:s:z:l:S:o:R:w:t:m:" ) ) != -1 ) {
+      switch ( opt ) {
+        case 'd':
+          config.destinations = parse_destinations( optarg );
+          break;
+        case 'r':
+          routes_in = optarg;
+          break;
+        case 'n':
+          random_count = stoul( optarg );
+          break;
+        case 'f':
+          config.flows = stoul( optarg );
+          break;
+        case 'p':
+          config.packets = stoul( optarg );
+          break;
+        case 's':
+          config.sizes = parse_sizes( optarg );
+          break;
+        case 'z':
+          config.zipf_exponent = stod( optarg );
+          break;
+        case 'l':
+          config.locality = stod( optarg );
+          break;
+        case 'S':
+          config.seed = stoull( optarg );
+          break;
+        case 'o':
+          packets_out = optarg;
+          break;
+        case 'R':
+          routes_out = optarg;
+          break;
+        case 'w':
+          pcap_out = optarg;
+          break;
+        case 't':
+          rate = stod( optarg );
+          break;
+        case 'm':
+          config.ethernet_dst = parse_mac( optarg );
+          break;
+        default:
+          usage( argv[0] );
+          return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+      }
+    }
+
+    config.prefixes = routes_in.empty() ? random_prefixes( random_count, config.seed ) : read_prefixes( routes_in );
+
+    const auto start = chrono::steady_clock::now();
+    const TrafficTrace trace { config };
+    const double seconds = chrono::duration<double>( chrono::steady_clock::now() - start ).count();
+
+    unordered_set<uint32_t> destinations;
+    for ( const auto& dgram : trace.datagrams() ) {
+      destinations.insert( dgram.header.dst );
+    }
+    cout << trace.size() << " packets (" << trace.bytes() << " bytes) over " << config.prefixes.size()
+         << " prefixes, " << destinations.size() << " distinct destinations, generated in " << fixed
+         << setprecision( 1 ) << seconds * 1000 << " ms (" << setprecision( 2 ) << trace.size() / seconds / 1e6
+         << " M packets/s)\n";
+
+    if ( not packets_out.empty() ) {
+      ofstream out { packets_out };
+      for ( const auto& dgram : trace.datagrams() ) {
+        out << dotted( dgram.header.src ) << ' ' << dotted( dgram.header.dst ) << ' ' << +dgram.header.proto << ' '
+            << dgram.header.len << '\n';
+      }
+    }
+    if ( not routes_out.empty() ) {
+      ofstream out { routes_out };
+      for ( const auto& [prefix, length] : config.prefixes ) {
+        out << dotted( prefix ) << '/' << +length << ",direct,1\n";
+      }
+    }
+    if ( not pcap_out.empty() ) {
+      PcapWriter out { pcap_out };
+      const auto now = chrono::system_clock::now().time_since_epoch();
+      const uint64_t first_ns = chrono::duration_cast<chrono::nanoseconds>( now ).count();
+      for ( size_t i = 0; i < trace.size(); i++ ) {
+        out.write( trace.frames()[i], first_ns + static_cast<uint64_t>( static_cast<double>( i ) * 1e9 / rate ) );
+      }
+    }
+  } catch ( const exception& e ) {
+    cerr << "\033[31;1mError: " << e.what() << "\033[m\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
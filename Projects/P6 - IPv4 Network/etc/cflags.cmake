@@ -3,6 +3,9 @@ set (CMAKE_EXPORT_COMPILE_COMMANDS ON)
 
 set(SANITIZING_FLAGS)
 
+# tests of concurrent code are built with ThreadSanitizer instead
+set(THREAD_SANITIZING_FLAGS -fsanitize=thread)
+
 # ask for more warnings from the compiler
 set (CMAKE_BASE_CXX_FLAGS "${CMAKE_CXX_FLAGS}")
 set (CMAKE_CXX_FLAGS "${CMAKE_CXX_FLAGS} -Wall -Wpedantic -Wextra -Weffc++ -Werror -Wshadow -Wpointer-arith -Wcast-qual -Wformat=2 -Wno-unqualified-std-cast-call")
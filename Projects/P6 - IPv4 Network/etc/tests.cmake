@@ -14,6 +14,20 @@ endmacro (ttest)
 set_property(TEST ${compile_name} PROPERTY TIMEOUT -1)
 set_tests_properties(${compile_name} PROPERTIES FIXTURES_SETUP compile)
 
+set(compile_name_opt "compile with optimization")
+add_test(NAME ${compile_name_opt}
+  COMMAND "${CMAKE_COMMAND}" --build "${CMAKE_BINARY_DIR}" -t speed_testing)
+
+# Benchmarks run one at a time, so they don't time each other
+macro (stest name)
+  add_test(NAME ${name} COMMAND ${name})
+  set_property(TEST ${name} PROPERTY FIXTURES_REQUIRED compile_opt)
+  set_property(TEST ${name} PROPERTY RUN_SERIAL TRUE)
+endmacro (stest)
+
+set_property(TEST ${compile_name_opt} PROPERTY TIMEOUT -1)
+set_tests_properties(${compile_name_opt} PROPERTIES FIXTURES_SETUP compile_opt)
+
 ttest(net_interface_test_typical)
 ttest(net_interface_test_reply)
 ttest(net_interface_test_learn)
@@ -33,6 +47,7 @@ ttest(net_interface_test_hidden_5)
 ttest(net_interface_test_hidden_6)
 ttest(net_interface_test_hidden_7)
 ttest(net_interface_test_hidden_8)
+ttest(net_interface_test_egress)
 
 ttest(router_2hosts_1)
 ttest(router_2hosts_2)
@@ -44,7 +59,37 @@ ttest(router_noroute)
 ttest(router_same_dest)
 ttest(router_test_lpm)
 ttest(router_route_many)
+ttest(router_bloom_lpm)
+ttest(router_fib_compress)
+ttest(router_bulk_load)
+ttest(router_rcu_stress)
+ttest(router_zero_alloc)
+ttest(router_rss)
+ttest(router_ecmp)
+ttest(router_acl)
+ttest(router_napt)
+ttest(router_telemetry)
+ttest(router_warm_restart)
+ttest(router_huge_pages)
+ttest(network_simulator)
+ttest(traffic_generator)
+ttest(pcap_replay)
+ttest(wire_layout)
+ttest(shm_link)
+
+stest(net_interface_egress_speed_test)
+stest(router_ecmp_speed_test)
+stest(router_acl_speed_test)
+stest(napt_speed_test)
+stest(network_simulator_speed_test)
+stest(router_traffic_speed_test)
+stest(pcap_replay_speed_test)
+stest(router_telemetry_speed_test)
+stest(header_codec_speed_test)
+stest(shm_link_speed_test)
 
 add_custom_target (pa1 COMMAND ${CMAKE_CTEST_COMMAND} --output-on-failure --continue-on-failure --timeout 180 -R '^net_interface')
 
-add_custom_target (pa2 COMMAND ${CMAKE_CTEST_COMMAND} --output-on-failure --continue-on-failure --timeout 180 -R '^router')
\ No newline at end of file
+add_custom_target (pa2 COMMAND ${CMAKE_CTEST_COMMAND} --output-on-failure --continue-on-failure --timeout 180 -R '^router')
+
+add_custom_target (speed COMMAND ${CMAKE_CTEST_COMMAND} --output-on-failure --timeout 180 -R '_speed_test')
\ No newline at end of file
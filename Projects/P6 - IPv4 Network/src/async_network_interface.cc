@@ -0,0 +1,68 @@
+#include "router.hh"
+
+using namespace std;
+
+void AsyncNetworkInterface::set_receive_queues( size_t count, size_t capacity )
+{
+  if ( count == 0 || count > INDIRECTION_TABLE_SIZE ) {
+    throw runtime_error( "receive queue count must be between 1 and " + to_string( INDIRECTION_TABLE_SIZE ) );
+  }
+  queues_ = vector<ReceiveQueue>( count, ReceiveQueue { capacity } );
+  for ( size_t i = 0; i < indirection_table_.size(); i++ ) {
+    indirection_table_[i] = i % count;
+  }
+  next_queue_ = 0;
+}
+
+size_t AsyncNetworkInterface::queue_for( const InternetDatagram& dgram ) const
+{
+  if ( queues_.size() == 1 ) {
+    return 0;
+  }
+
+  const auto ports = l4_ports( dgram );
+  const uint32_t hash = ports.has_value()
+                          ? rss_hash_.ipv4( dgram.header.src, dgram.header.dst, ports->first, ports->second )
+                          : rss_hash_.ipv4( dgram.header.src, dgram.header.dst );
+  return indirection_table_[hash % INDIRECTION_TABLE_SIZE];
+}
+
+void AsyncNetworkInterface::recv_frame( const EthernetFrame& frame )
+{
+  if ( not NetworkInterface::recv_frame( frame, incoming_ ) ) {
+    return;
+  }
+
+  // the queue's recycled slot comes back in incoming_, ready for the next frame
+  ReceiveQueue& queue = queues_[queue_for( incoming_ )];
+  if ( not queue.ring.push_swap( incoming_ ) ) {
+    queue.drops.fetch_add( 1, memory_order_relaxed );
+  }
+}
+
+bool AsyncNetworkInterface::maybe_receive( InternetDatagram& datagram )
+{
+  for ( size_t i = 0; i < queues_.size(); i++ ) {
+    const size_t queue = ( next_queue_ + i ) % queues_.size();
+    if ( queues_[queue].ring.pop_swap( datagram ) ) {
+      next_queue_ = ( queue + 1 ) % queues_.size();
+      return true;
+    }
+  }
+  return false;
+}
+
+optional<InternetDatagram> AsyncNetworkInterface::maybe_receive()
+{
+  InternetDatagram datagram;
+  if ( maybe_receive( datagram ) ) {
+    return datagram;
+  }
+  return {};
+}
+
+AsyncNetworkInterface::ReceiveQueueStats AsyncNetworkInterface::receive_queue_stats( size_t queue ) const
+{
+  const ReceiveQueue& q = queues_.at( queue );
+  return { q.ring.size(), q.drops.load( memory_order_relaxed ) };
+}
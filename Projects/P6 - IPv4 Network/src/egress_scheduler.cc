@@ -0,0 +1,181 @@
+#include "egress_scheduler.hh"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+namespace {
+constexpr size_t mtu_frame = 1514;
+
+size_t frame_bytes( const EthernetFrame& frame )
+{
+  size_t bytes = EthernetHeader::LENGTH;
+  for ( const auto& buffer : frame.payload ) {
+    bytes += buffer.size();
+  }
+  return bytes;
+}
+} // namespace
+
+EgressScheduler::Config EgressScheduler::Config::diffserv()
+{
+  Config config;
+  config.classes = {
+    { true, mtu_frame, 256 },          // 0: EF, VOICE-ADMIT, CS6, CS7
+    { false, 4 * mtu_frame, 256 },     // 1: AF4x, CS4, CS5
+    { false, 2 * mtu_frame, 256 },     // 2: AF3x, AF2x, CS2, CS3
+    { false, mtu_frame, 256 },         // 3: best effort (everything else)
+    { false, mtu_frame / 4, 256 },     // 4: CS1, scavenger
+  };
+  config.dscp_class.fill( 3 );
+  for ( const uint8_t dscp : { 46, 44, 48, 56 } ) {
+    config.dscp_class[dscp] = 0;
+  }
+  for ( const uint8_t dscp : { 34, 36, 38, 32, 40 } ) {
+    config.dscp_class[dscp] = 1;
+  }
+  for ( const uint8_t dscp : { 26, 28, 30, 18, 20, 22, 16, 24 } ) {
+    config.dscp_class[dscp] = 2;
+  }
+  config.dscp_class[8] = 4;
+  return config;
+}
+
+EgressScheduler::EgressScheduler() : EgressScheduler( Config {} ) {}
+
+EgressScheduler::EgressScheduler( Config config ) : config_( std::move( config ) )
+{
+  if ( config_.classes.empty() ) {
+    throw runtime_error( "EgressScheduler needs at least one traffic class" );
+  }
+  for ( const uint8_t c : config_.dscp_class ) {
+    if ( c >= config_.classes.size() ) {
+      throw runtime_error( "DSCP mapped to traffic class " + to_string( c ) + ", which doesn't exist" );
+    }
+  }
+  if ( config_.rate_bytes_per_s != 0 && config_.burst_bytes < mtu_frame ) {
+    throw runtime_error( "a shaped interface needs a burst of at least one full-size frame" );
+  }
+
+  for ( size_t i = 0; i < config_.classes.size(); i++ ) {
+    const ClassConfig& c = config_.classes[i];
+    if ( not c.strict && c.quantum == 0 ) {
+      throw runtime_error( "traffic class " + to_string( i ) + " has a quantum of 0" );
+    }
+    classes_.emplace_back().config = c;
+    ( c.strict ? strict_ : drr_ ).push_back( i );
+  }
+
+  tokens_ = static_cast<int64_t>( config_.burst_bytes * 1000 );
+}
+
+EthernetFrame* EgressScheduler::enqueue_slot( size_t traffic_class )
+{
+  TrafficClass& c = classes_.at( traffic_class );
+  if ( c.config.limit != 0 && c.queue.size() >= c.config.limit ) {
+    c.dropped++;
+    return nullptr;
+  }
+  queued_++;
+  return &c.queue.push_slot();
+}
+
+void EgressScheduler::cancel_enqueue( size_t traffic_class )
+{
+  classes_.at( traffic_class ).queue.unpush();
+  queued_--;
+}
+
+void EgressScheduler::enqueue_arp( EthernetFrame&& frame )
+{
+  // ARP is never dropped for being over a class's limit
+  arp_.push( std::move( frame ) );
+  queued_++;
+}
+
+void EgressScheduler::send_from( Ring<EthernetFrame>& queue, EthernetFrame& frame )
+{
+  queue.pop_into( frame );
+  queued_--;
+  if ( config_.rate_bytes_per_s != 0 ) {
+    tokens_ -= static_cast<int64_t>( frame_bytes( frame ) * 1000 );
+  }
+}
+
+bool EgressScheduler::dequeue( EthernetFrame& frame )
+{
+  if ( queued_ == 0 or not shaper_allows() ) {
+    return false;
+  }
+
+  if ( not arp_.empty() ) {
+    send_from( arp_, frame );
+    return true;
+  }
+
+  for ( const size_t i : strict_ ) {
+    TrafficClass& c = classes_[i];
+    if ( not c.queue.empty() ) {
+      send_from( c.queue, frame );
+      c.sent++;
+      return true;
+    }
+  }
+
+  return dequeue_drr( frame );
+}
+
+bool EgressScheduler::dequeue_drr( EthernetFrame& frame )
+{
+  // Something is queued, and it isn't ARP or strict, so some class here has a frame.
+  auto next_turn = [&] {
+    drr_next_ = ( drr_next_ + 1 ) % drr_.size();
+    drr_topped_up_ = false;
+  };
+
+  while ( true ) {
+    TrafficClass& c = classes_[drr_[drr_next_]];
+    if ( c.queue.empty() ) {
+      c.deficit = 0; // an idle class doesn't bank credit
+      next_turn();
+      continue;
+    }
+
+    if ( not drr_topped_up_ ) {
+      c.deficit += c.config.quantum;
+      drr_topped_up_ = true;
+    }
+
+    const size_t bytes = frame_bytes( c.queue.front() );
+    if ( bytes > c.deficit ) {
+      next_turn();
+      continue;
+    }
+
+    c.deficit -= bytes;
+    send_from( c.queue, frame );
+    c.sent++;
+    if ( c.queue.empty() ) {
+      c.deficit = 0;
+      next_turn();
+    }
+    return true;
+  }
+}
+
+void EgressScheduler::tick( size_t ms_since_last_tick )
+{
+  if ( config_.rate_bytes_per_s == 0 ) {
+    return;
+  }
+  const int64_t burst = static_cast<int64_t>( config_.burst_bytes * 1000 );
+  tokens_ = min( burst, tokens_ + static_cast<int64_t>( config_.rate_bytes_per_s * ms_since_last_tick ) );
+}
+
+EgressScheduler::ClassStats EgressScheduler::class_stats( size_t traffic_class ) const
+{
+  const TrafficClass& c = classes_.at( traffic_class );
+  return { c.queue.size(), c.sent, c.dropped };
+}
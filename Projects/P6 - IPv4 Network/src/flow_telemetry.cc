@@ -0,0 +1,260 @@
+#include "flow_telemetry.hh"
+
+#include "packet_classifier.hh"
+
+#include <array>
+#include <chrono>
+#include <stdexcept>
+#include <utility>
+
+using namespace std;
+
+namespace {
+
+constexpr size_t MESSAGE_HEADER = 16;
+constexpr size_t SET_HEADER = 4;
+constexpr uint16_t TEMPLATE_SET_ID = 2;
+
+// The template: (information element, length) for each field of a data record, in order
+constexpr array<pair<uint16_t, uint16_t>, 13> FIELDS = { {
+  { 8, 4 },   // sourceIPv4Address
+  { 12, 4 },  // destinationIPv4Address
+  { 7, 2 },   // sourceTransportPort
+  { 11, 2 },  // destinationTransportPort
+  { 4, 1 },   // protocolIdentifier
+  { 5, 1 },   // ipClassOfService
+  { 10, 4 },  // ingressInterface
+  { 2, 8 },   // packetDeltaCount
+  { 1, 8 },   // octetDeltaCount
+  { 152, 8 }, // flowStartMilliseconds
+  { 153, 8 }, // flowEndMilliseconds
+  { 305, 4 }, // samplingPacketInterval
+  { 136, 1 }, // flowEndReason
+} };
+
+constexpr size_t record_length()
+{
+  size_t total = 0;
+  for ( const auto& field : FIELDS ) {
+    total += field.second;
+  }
+  return total;
+}
+
+constexpr size_t RECORD_LENGTH = record_length();
+
+template<typename T>
+void put( string& out, T value )
+{
+  for ( size_t i = sizeof( T ); i > 0; i-- ) {
+    out.push_back( static_cast<char>( value >> ( ( i - 1 ) * 8 ) ) );
+  }
+}
+
+void patch16( string& out, size_t at, uint16_t value )
+{
+  out[at] = static_cast<char>( value >> 8 );
+  out[at + 1] = static_cast<char>( value & 0xff );
+}
+
+void patch32( string& out, size_t at, uint32_t value )
+{
+  patch16( out, at, static_cast<uint16_t>( value >> 16 ) );
+  patch16( out, at + 2, static_cast<uint16_t>( value & 0xffff ) );
+}
+
+} // namespace
+
+size_t FlowTelemetry::KeyHash::operator()( const Key& key ) const
+{
+  const uint64_t addresses = ( uint64_t { key.src } << 32 ) | key.dst;
+  const uint64_t rest = ( uint64_t { key.src_port } << 24 ) | ( uint64_t { key.dst_port } << 8 ) | key.proto;
+  return ( addresses * 0x9e3779b97f4a7c15 ) ^ ( rest * 0xc2b2ae3d27d4eb4f );
+}
+
+FlowTelemetry::FlowTelemetry( const Config& config ) : config_( config )
+{
+  if ( config_.sampling_interval == 0 || config_.max_flows == 0 || config_.max_flows >= NONE ) {
+    throw runtime_error( "flow telemetry needs a sampling interval and room for at least one flow" );
+  }
+  socket_.set_blocking( false );
+  start_wall_ms_ = chrono::duration_cast<chrono::milliseconds>( chrono::system_clock::now().time_since_epoch() ).count();
+  rng_state_ = 0x853c49e6748fea9b ^ config_.observation_domain;
+  countdown_ = next_gap();
+  index_.reserve( config_.max_flows );
+  entries_.reserve( config_.max_flows );
+  message_.reserve( MAX_MESSAGE );
+}
+
+uint32_t FlowTelemetry::next_gap()
+{
+  //xorshift64, then a gap uniform on 1 .. 2N-1, which averages N.
+  rng_state_ ^= rng_state_ << 13;
+  rng_state_ ^= rng_state_ >> 7;
+  rng_state_ ^= rng_state_ << 17;
+  return 1 + static_cast<uint32_t>( rng_state_ % ( 2 * uint64_t { config_.sampling_interval } - 1 ) );
+}
+
+void FlowTelemetry::unlink( uint32_t entry )
+{
+  Entry& e = entries_[entry];
+  ( e.prev == NONE ? newest_ : entries_[e.prev].next ) = e.next;
+  ( e.next == NONE ? oldest_ : entries_[e.next].prev ) = e.prev;
+  e.prev = e.next = NONE;
+}
+
+void FlowTelemetry::push_newest( uint32_t entry )
+{
+  Entry& e = entries_[entry];
+  e.prev = NONE;
+  e.next = newest_;
+  ( newest_ == NONE ? oldest_ : entries_[newest_].prev ) = entry;
+  newest_ = entry;
+}
+
+void FlowTelemetry::remove( uint32_t entry, EndReason reason )
+{
+  const Record& r = entries_[entry].record;
+  export_record( r, reason );
+  index_.erase( { r.src, r.dst, r.src_port, r.dst_port, r.proto } );
+  unlink( entry );
+  free_.push_back( entry );
+}
+
+void FlowTelemetry::record( const InternetDatagram& dgram, size_t interface )
+{
+  stats_.samples++;
+  const auto ports = l4_ports( dgram );
+  const Key key { dgram.header.src,
+                  dgram.header.dst,
+                  ports.has_value() ? ports->first : uint16_t {},
+                  ports.has_value() ? ports->second : uint16_t {},
+                  dgram.header.proto };
+  const uint64_t now = wall_ms();
+
+  auto [it, created] = index_.try_emplace( key, NONE );
+  if ( created ) {
+    if ( index_.size() > config_.max_flows ) {
+      stats_.evicted++;
+      remove( oldest_, EndReason::LACK_OF_RESOURCES );
+    }
+    if ( free_.empty() ) {
+      free_.push_back( static_cast<uint32_t>( entries_.size() ) );
+      entries_.emplace_back();
+    }
+    it->second = free_.back();
+    free_.pop_back();
+
+    Entry& e = entries_[it->second];
+    e.record = { key.src, key.dst, key.src_port, key.dst_port, key.proto, dgram.header.tos,
+                 static_cast<uint32_t>( interface ), 0, 0, now, now };
+    e.active_since_ms = now_ms_;
+    push_newest( it->second );
+    stats_.flows_created++;
+  } else {
+    unlink( it->second );
+    push_newest( it->second );
+  }
+
+  Entry& e = entries_[it->second];
+  e.record.packets++;
+  e.record.bytes += dgram.header.len;
+  e.record.last_ms = now;
+
+  //a long-lived flow is reported every active timeout, and counted afresh from there.
+  if ( now_ms_ - e.active_since_ms >= config_.active_timeout_ms ) {
+    export_record( e.record, EndReason::ACTIVE_TIMEOUT );
+    e.record.packets = e.record.bytes = 0;
+    e.record.first_ms = now;
+    e.active_since_ms = now_ms_;
+  }
+}
+
+void FlowTelemetry::tick( uint64_t ms_since_last_tick )
+{
+  now_ms_ += ms_since_last_tick;
+  const uint64_t now = wall_ms();
+  while ( oldest_ != NONE && now - entries_[oldest_].record.last_ms >= config_.inactive_timeout_ms ) {
+    remove( oldest_, EndReason::IDLE_TIMEOUT );
+  }
+  send();
+}
+
+void FlowTelemetry::flush()
+{
+  while ( oldest_ != NONE ) {
+    remove( oldest_, EndReason::FORCED_END );
+  }
+  send();
+}
+
+FlowTelemetry::Stats FlowTelemetry::stats() const
+{
+  Stats stats = stats_;
+  stats.flows = index_.size();
+  return stats;
+}
+
+void FlowTelemetry::export_record( const Record& record, EndReason reason )
+{
+  if ( message_.empty() ) {
+    message_.resize( MESSAGE_HEADER ); // filled in when it's sent
+    if ( stats_.messages_sent % TEMPLATE_REFRESH == 0 ) {
+      put( message_, TEMPLATE_SET_ID );
+      put( message_, static_cast<uint16_t>( SET_HEADER + 4 + 4 * FIELDS.size() ) );
+      put( message_, TEMPLATE_ID );
+      put( message_, static_cast<uint16_t>( FIELDS.size() ) );
+      for ( const auto& [element, length] : FIELDS ) {
+        put( message_, element );
+        put( message_, length );
+      }
+    }
+    put( message_, TEMPLATE_ID );
+    put( message_, uint16_t {} ); // data set length, filled in when it's sent
+  }
+
+  put( message_, record.src );
+  put( message_, record.dst );
+  put( message_, record.src_port );
+  put( message_, record.dst_port );
+  put( message_, record.proto );
+  put( message_, record.tos );
+  put( message_, record.interface );
+  put( message_, record.packets );
+  put( message_, record.bytes );
+  put( message_, record.first_ms );
+  put( message_, record.last_ms );
+  put( message_, config_.sampling_interval );
+  put( message_, static_cast<uint8_t>( reason ) );
+  message_records_++;
+  stats_.records_exported++;
+
+  if ( message_.size() + RECORD_LENGTH > MAX_MESSAGE ) {
+    send();
+  }
+}
+
+void FlowTelemetry::send()
+{
+  if ( message_records_ == 0 ) {
+    return;
+  }
+  const size_t data_set = message_.size() - SET_HEADER - message_records_ * RECORD_LENGTH;
+  patch16( message_, data_set + 2, static_cast<uint16_t>( message_.size() - data_set ) );
+
+  patch16( message_, 0, IPFIX_VERSION );
+  patch16( message_, 2, static_cast<uint16_t>( message_.size() ) );
+  patch32( message_, 4, static_cast<uint32_t>( wall_ms() / 1000 ) );
+  patch32( message_, 8, sequence_ );
+  patch32( message_, 12, config_.observation_domain );
+  sequence_ += static_cast<uint32_t>( message_records_ );
+
+  try {
+    socket_.sendto( config_.collector, message_ );
+  } catch ( const exception& ) {
+    stats_.export_errors++; // (telemetry mustn't take the router down with it)
+  }
+  stats_.messages_sent++;
+  message_.clear();
+  message_records_ = 0;
+}
@@ -0,0 +1,218 @@
+#include "forwarding_table.hh"
+
+#include <algorithm>
+#include <bit>
+#include <memory>
+#include <numeric>
+
+using namespace std;
+
+uint32_t get_prefmask(uint8_t prefix_length, const uint32_t route){
+
+  //I assume that there is always a default available if no matches happen.
+  if (prefix_length == 0){ //special case, no matching bits required.
+    return 0;
+  }
+
+  return (route >> (32 - prefix_length));
+}
+
+uint32_t get_network(uint8_t prefix_length, const uint32_t prefix_mask){
+  //the inverse of get_prefmask: put the prefix bits back at the top of the address.
+  if (prefix_length == 0){
+    return 0;
+  }
+
+  return (prefix_mask << (32 - prefix_length));
+}
+
+uint32_t host_bits(uint8_t prefix_length){
+  //shifting a 64 bit value keeps /0 (all 32 bits are host bits) and /32 (none are) well defined.
+  return static_cast<uint32_t>(uint64_t{UINT32_MAX} >> prefix_length);
+}
+
+uint32_t flow_hash(uint32_t src, uint32_t dst, uint8_t proto){
+  //the splitmix64 finalizer: every input bit ends up affecting every output bit, so nearby addresses still spread out.
+  uint64_t z = ((uint64_t{src} << 32) | dst) + proto * 0x9e3779b97f4a7c15ULL;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return static_cast<uint32_t>(z ^ (z >> 31));
+}
+
+void ForwardingTable::install(uint8_t prefix_length, uint32_t prefix_mask, const RouteEntry& entry){
+  routing_table_[prefix_length][prefix_mask] = entry;
+
+  //Keep the filters in step with the table. (a repeated prefix just sets the same bits again)
+  if (bloom_lookup_ && prefix_bloom_.insert(prefix_length, prefix_mask)){
+    rebuild_bloom(); //this length outgrew its filter.
+  }
+}
+
+void ForwardingTable::erase(uint8_t prefix_length, uint32_t prefix_mask){
+  routing_table_[prefix_length].erase(prefix_mask);
+}
+
+void ForwardingTable::set_paths(uint8_t prefix_length, uint32_t prefix_mask, span<const RouteEntry> paths){
+  PathGroup& group = path_groups_[group_key(prefix_length, prefix_mask)];
+  const size_t n = paths.size();
+  constexpr uint8_t unassigned = UINT8_MAX;
+
+  //Where each old path is in the new list (n if it's gone).
+  vector<size_t> moved_to(group.paths.size(), n);
+  for (size_t i = 0; i < group.paths.size(); i++){
+    moved_to[i] = find(paths.begin(), paths.end(), group.paths[i]) - paths.begin();
+  }
+
+  //Buckets keep their path if it's still there.
+  array<uint8_t, PATH_BUCKETS> buckets;
+  vector<size_t> held(n, 0);
+  for (size_t b = 0; b < PATH_BUCKETS; b++){
+    const size_t path = group.paths.empty() ? n : moved_to[group.buckets[b]];
+    buckets[b] = path < n ? path : unassigned;
+    if (path < n){
+      held[path]++;
+    }
+  }
+
+  //Everyone's fair share. The buckets left over go to the paths already holding the most, so they don't have to move.
+  vector<size_t> share(n, PATH_BUCKETS / n);
+  vector<size_t> by_held(n);
+  iota(by_held.begin(), by_held.end(), 0);
+  stable_sort(by_held.begin(), by_held.end(), [&](size_t a, size_t b){ return held[a] > held[b]; });
+  for (size_t i = 0; i < PATH_BUCKETS % n; i++){
+    share[by_held[i]]++;
+  }
+
+  //Paths over their share give up buckets, and paths under it take them.
+  for (size_t b = PATH_BUCKETS; b-- > 0;){
+    if (buckets[b] != unassigned && held[buckets[b]] > share[buckets[b]]){
+      held[buckets[b]]--;
+      buckets[b] = unassigned;
+    }
+  }
+  size_t path = 0;
+  for (auto& bucket : buckets){
+    if (bucket == unassigned){
+      while (held[path] >= share[path]){
+        path++;
+      }
+      bucket = path;
+      held[path]++;
+    }
+  }
+
+  group.paths.assign(paths.begin(), paths.end());
+  group.buckets = buckets;
+}
+
+void ForwardingTable::drop_paths(uint8_t prefix_length, uint32_t prefix_mask){
+  path_groups_.erase(group_key(prefix_length, prefix_mask));
+}
+
+span<const ForwardingTable::RouteEntry> ForwardingTable::paths(uint8_t prefix_length, uint32_t prefix_mask) const{
+  const auto it = path_groups_.find(group_key(prefix_length, prefix_mask));
+  if (it == path_groups_.end()){
+    return {};
+  }
+  return it->second.paths;
+}
+
+void ForwardingTable::use_memory(pmr::memory_resource* memory){
+  //a pmr container keeps the resource it was made with (assigning to it copies the elements, not the resource), so each
+  //one is copied into the new memory, and the copy put in its place.
+  for (auto& table : routing_table_){
+    Table moved {table.begin(), table.end(), table.bucket_count(), memory};
+    destroy_at(&table);
+    construct_at(&table, std::move(moved));
+  }
+  PrefixBloom moved {prefix_bloom_, memory};
+  destroy_at(&prefix_bloom_);
+  construct_at(&prefix_bloom_, std::move(moved));
+}
+
+void ForwardingTable::clear(){
+  for (auto& table : routing_table_){
+    table.clear();
+  }
+  if (bloom_lookup_){
+    rebuild_bloom();
+  }
+}
+
+void ForwardingTable::set_bloom_lookup(bool enabled){
+  bloom_lookup_ = enabled;
+  if (enabled){
+    rebuild_bloom();
+  }
+}
+
+void ForwardingTable::rebuild_bloom(){
+  size_t largest = 0;
+  for (const auto& table : routing_table_){
+    largest = max(largest, table.size());
+  }
+
+  prefix_bloom_.reset(2 * largest); //leave room to grow before the next rebuild.
+  for (size_t prefix_length = 0; prefix_length < 33; prefix_length++){
+    for (const auto& entry : routing_table_[prefix_length]){
+      prefix_bloom_.insert(prefix_length, entry.first);
+    }
+  }
+}
+
+size_t ForwardingTable::size() const{
+  size_t total = 0;
+  for (const auto& table : routing_table_){
+    total += table.size();
+  }
+  return total;
+}
+
+optional<pair<size_t, uint32_t>> ForwardingTable::probe_length(uint8_t prefix_length, uint32_t dst_ip, uint32_t flow) const{
+  //check if there is a match at this prefix length in the table:
+  const uint32_t prefix_mask = get_prefmask(prefix_length, dst_ip);
+  const auto it = routing_table_[prefix_length].find(prefix_mask);
+  if (it == routing_table_[prefix_length].end()){
+    return {};
+  }
+
+  const RouteEntry* entry = &it->second;
+  if (is_multipath(*entry)){
+    //the flow's bucket says which of the equal-cost paths to take.
+    const auto group = path_groups_.find(group_key(prefix_length, prefix_mask));
+    if (group == path_groups_.end()){
+      return {};
+    }
+    entry = &group->second.paths[group->second.buckets[flow % PATH_BUCKETS]];
+  }
+
+  //No next hop was filled in the table, so we know that the next hop is simply the destination IP.
+  return pair<size_t, uint32_t>(entry->first, entry->second.value_or(dst_ip));
+}
+
+optional<pair<size_t, uint32_t>> ForwardingTable::lookup(uint32_t dst_ip, uint32_t flow) const{
+  //In this function, we want to check if there is a corresponding entry here.
+
+  if (bloom_lookup_){
+    //Only probe the lengths the filters say might match, longest first.
+    uint64_t candidates = prefix_bloom_.candidates(dst_ip);
+    while (candidates != 0){
+      const uint8_t prefix_length = 63 - countl_zero(candidates);
+      optional<pair<size_t, uint32_t>> res = probe_length(prefix_length, dst_ip, flow);
+      if (res.has_value()){
+        return res;
+      }
+      candidates &= ~(uint64_t{1} << prefix_length); //false positive, move on to the next candidate.
+    }
+    return {};
+  }
+
+  for (int prefix_length = 32; prefix_length >= 0; prefix_length--){
+    optional<pair<size_t, uint32_t>> res = probe_length(prefix_length, dst_ip, flow);
+    if (res.has_value()){
+      return res; //we've found a match (this is the longest prefix match, as we iterate through prefix lengths backward)
+    }
+  }
+
+  return {}; //we couldn't find any matches, so we return default.
+}
@@ -0,0 +1,130 @@
+#include "frame_link.hh"
+
+#include "exception.hh"
+
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <sys/socket.h>
+
+using namespace std;
+
+size_t FrameLink::pump( AsyncNetworkInterface& interface )
+{
+  size_t moved = 0;
+  while ( interface.maybe_send( pumped_ ) ) {
+    send( pumped_ );
+    moved++;
+  }
+  while ( recv( pumped_ ) ) {
+    interface.recv_frame( pumped_ );
+    moved++;
+  }
+  return moved;
+}
+
+size_t FrameLink::bytes_on_wire( const EthernetFrame& frame )
+{
+  size_t length = EthernetHeader::LENGTH;
+  for ( const auto& b : frame.payload ) {
+    length += b.size();
+  }
+  return length;
+}
+
+void FrameLink::pack( const EthernetFrame& frame, char* out )
+{
+  EthernetHeader::Layout::write( out, frame.header.dst, frame.header.src, frame.header.type );
+  out += EthernetHeader::LENGTH;
+  for ( const auto& b : frame.payload ) {
+    const string_view bytes = b;
+    memcpy( out, bytes.data(), bytes.size() );
+    out += bytes.size();
+  }
+}
+
+bool FrameLink::unpack( const char* bytes, size_t length, EthernetFrame& frame )
+{
+  if ( length < EthernetHeader::LENGTH ) {
+    return false;
+  }
+  EthernetHeader::Layout::read( bytes, frame.header.dst, frame.header.src, frame.header.type );
+
+  Serializer payload { std::move( frame.payload ) };
+  const size_t payload_length = length - EthernetHeader::LENGTH;
+  if ( payload_length > 0 ) {
+    memcpy( payload.append( payload_length ), bytes + EthernetHeader::LENGTH, payload_length );
+  }
+  frame.payload = payload.output();
+  return true;
+}
+
+UdpLink::UdpLink( UDPSocket&& socket ) : socket_( std::move( socket ) )
+{
+  socket_.set_blocking( false );
+}
+
+UdpLink::UdpLink( const Address& local, const Address& peer ) : UdpLink( UDPSocket {} )
+{
+  socket_.bind( local );
+  socket_.connect( peer );
+}
+
+pair<UdpLink, UdpLink> UdpLink::make_pair()
+{
+  UDPSocket a, b;
+  a.bind( Address { "127.0.0.1" } );
+  b.bind( Address { "127.0.0.1" } );
+  a.connect( b.local_address() );
+  b.connect( a.local_address() );
+  return { UdpLink { std::move( a ) }, UdpLink { std::move( b ) } };
+}
+
+bool UdpLink::send( const EthernetFrame& frame )
+{
+  const size_t length = bytes_on_wire( frame );
+  if ( length > datagram_.size() ) {
+    stats_.dropped++;
+    return false;
+  }
+  pack( frame, datagram_.data() );
+
+  //(the socket's send buffer is full, or the peer has gone: the frame is lost, as on a real wire.)
+  if ( ::send( socket_.fd_num(), datagram_.data(), length, MSG_DONTWAIT ) < 0 ) {
+    if ( errno != EAGAIN and errno != ENOBUFS and errno != ECONNREFUSED ) {
+      throw unix_error { "send" };
+    }
+    stats_.dropped++;
+    return false;
+  }
+  stats_.sent++;
+  return true;
+}
+
+bool UdpLink::recv( EthernetFrame& frame )
+{
+  while ( true ) {
+    const ssize_t length
+      = ::recv( socket_.fd_num(), datagram_.data(), datagram_.size(), MSG_DONTWAIT | MSG_TRUNC );
+    if ( length < 0 ) {
+      if ( errno != EAGAIN and errno != ECONNREFUSED ) {
+        throw unix_error { "recv" };
+      }
+      return false;
+    }
+    //skip anything too big or too small to be a frame.
+    if ( static_cast<size_t>( length ) <= datagram_.size() and unpack( datagram_.data(), length, frame ) ) {
+      stats_.received++;
+      return true;
+    }
+  }
+}
+
+bool UdpLink::wait( int timeout_ms )
+{
+  pollfd readable { socket_.fd_num(), POLLIN, 0 };
+  if ( ::poll( &readable, 1, timeout_ms ) < 0 and errno != EINTR ) {
+    throw unix_error { "poll" };
+  }
+  return readable.revents & POLLIN;
+}
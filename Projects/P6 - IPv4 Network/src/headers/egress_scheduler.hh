@@ -0,0 +1,103 @@
+#pragma once
+
+#include "ethernet_frame.hh"
+#include "ring.hh"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+// The send side of a NetworkInterface: frames wait here until maybe_send() takes them.
+//
+// IPv4 frames are sorted into traffic classes by the DSCP field of their TOS byte. Strict
+// classes are always served first (lowest index first); the rest share what's left by
+// deficit round robin, each getting `quantum` bytes per round. ARP has its own queue ahead
+// of everything, so address resolution never waits behind a backlog. A token bucket can cap
+// the interface's rate: while the bucket is empty, nothing is sent until tick() refills it.
+//
+// The default configuration is one unlimited class, i.e. a plain FIFO behind ARP.
+class EgressScheduler
+{
+public:
+  struct ClassConfig
+  {
+    bool strict = false;   // served ahead of every non-strict class
+    size_t quantum = 1514; // bytes per deficit-round-robin round (non-strict classes)
+    size_t limit = 0;      // most frames queued before new ones are dropped (0 = no limit)
+  };
+
+  struct Config
+  {
+    std::vector<ClassConfig> classes { ClassConfig {} };
+    std::array<uint8_t, 64> dscp_class {}; // DSCP -> index into classes
+    uint64_t rate_bytes_per_s = 0;         // token bucket rate (0 = unshaped)
+    uint64_t burst_bytes = 0;              // token bucket depth (at least a frame when shaped)
+
+    // A usual DiffServ setup: EF and network control (CS6, CS7) strict, then AF4x/CS4/CS5 with
+    // weight 4, AF3x/AF2x/CS2/CS3 with weight 2, best effort with weight 1, and CS1 (scavenger)
+    // with a quarter. 256 frames per class.
+    static Config diffserv();
+  };
+
+  struct ClassStats
+  {
+    size_t depth {};     // frames waiting
+    uint64_t sent {};    // frames sent
+    uint64_t dropped {}; // frames dropped because the class was at its limit
+  };
+
+  EgressScheduler(); // a FIFO
+  explicit EgressScheduler( Config config );
+
+  // The traffic class for an IPv4 TOS byte
+  size_t classify( uint8_t tos ) const { return config_.dscp_class[tos >> 2]; }
+
+  // Queue space for a frame in a class, to be filled in by the caller, or nullptr if the class
+  // is full (the frame counts as dropped). The slot holds an old frame, whose memory can be reused.
+  EthernetFrame* enqueue_slot( size_t traffic_class );
+
+  // Give back the slot just returned by enqueue_slot() (e.g. when filling it in failed)
+  void cancel_enqueue( size_t traffic_class );
+
+  // Queue an ARP frame
+  void enqueue_arp( EthernetFrame&& frame );
+
+  // Swap the next frame to send into `frame`. Returns false if nothing is queued or the
+  // shaper is out of tokens.
+  bool dequeue( EthernetFrame& frame );
+
+  // Refill the token bucket
+  void tick( size_t ms_since_last_tick );
+
+  bool empty() const { return queued_ == 0; }
+  ClassStats class_stats( size_t traffic_class ) const;
+  size_t num_classes() const { return classes_.size(); }
+
+private:
+  struct TrafficClass
+  {
+    ClassConfig config {};
+    Ring<EthernetFrame> queue {};
+    size_t deficit {};
+    uint64_t sent {};
+    uint64_t dropped {};
+  };
+
+  Config config_;
+  std::vector<TrafficClass> classes_ {};
+  Ring<EthernetFrame> arp_ {};
+  size_t queued_ {};
+
+  std::vector<size_t> strict_ {}; // strict classes, in priority order
+  std::vector<size_t> drr_ {};    // the rest, in round-robin order
+  size_t drr_next_ {};            // index into drr_ of the class whose turn it is
+  bool drr_topped_up_ {};         // whether that class has had its quantum for this turn
+
+  int64_t tokens_ {}; // in bytes x 1000, so that per-millisecond refills don't round away
+
+  bool shaper_allows() const { return config_.rate_bytes_per_s == 0 or tokens_ > 0; }
+  void send_from( Ring<EthernetFrame>& queue, EthernetFrame& frame );
+  bool dequeue_drr( EthernetFrame& frame );
+};
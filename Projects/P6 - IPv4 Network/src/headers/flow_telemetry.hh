@@ -0,0 +1,164 @@
+#pragma once
+
+#include "ipv4_datagram.hh"
+#include "socket.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Sampled flow telemetry, exported as IPFIX (RFC 7011) over UDP.
+//
+// About 1 in Config::sampling_interval datagrams is sampled. Deciding costs a decrement and
+// a branch: a countdown runs to the next sample, and each sample draws a fresh random gap
+// (averaging the interval) so periodic traffic can't hide between samples.
+//
+// Samples are counted into a cache of flows keyed on the 5-tuple. A flow's record is exported
+// when nothing has been sampled from it for the inactive timeout, and at least once every
+// active timeout while it lasts (its counts then start again from zero). When the cache is
+// full, the least recently sampled flow is exported to make room. Counts are of sampled
+// datagrams only; each record carries the sampling interval, so a collector can scale them.
+//
+// Records go to the collector in IPFIX messages of up to MAX_MESSAGE bytes, with the template
+// describing them sent in the first message and every TEMPLATE_REFRESH messages after. Export
+// never blocks or throws: if the collector can't be reached, the message is counted and lost.
+//
+// Not thread-safe: use from the routing thread.
+class FlowTelemetry
+{
+public:
+  struct Config
+  {
+    Address collector { "127.0.0.1", 4739 };
+    uint32_t observation_domain = 0;
+    uint32_t sampling_interval = 1000; // sample 1 in N datagrams (on average); 1 samples them all
+    uint64_t active_timeout_ms = 60'000;
+    uint64_t inactive_timeout_ms = 15'000;
+    size_t max_flows = 1 << 16;
+  };
+
+  struct Stats
+  {
+    uint64_t samples {};
+    size_t flows {};              // in the cache now
+    uint64_t flows_created {};    // ever
+    uint64_t records_exported {};
+    uint64_t evicted {};          // flows exported early because the cache was full
+    uint64_t messages_sent {};
+    uint64_t export_errors {};    // messages the socket refused
+  };
+
+  // One exported flow (counts since its last export)
+  struct Record
+  {
+    uint32_t src {};
+    uint32_t dst {};
+    uint16_t src_port {}; // 0 if the datagram has no ports (see l4_ports)
+    uint16_t dst_port {};
+    uint8_t proto {};
+    uint8_t tos {};
+    uint32_t interface {}; // the interface it came in on
+    uint64_t packets {};
+    uint64_t bytes {};
+    uint64_t first_ms {}; // wall-clock time of the first and last samples
+    uint64_t last_ms {};
+  };
+
+  // IPFIX flowEndReason values
+  enum class EndReason : uint8_t
+  {
+    IDLE_TIMEOUT = 1,
+    ACTIVE_TIMEOUT = 2,
+    FORCED_END = 4,
+    LACK_OF_RESOURCES = 5,
+  };
+
+  static constexpr uint16_t IPFIX_VERSION = 10;
+  static constexpr uint16_t TEMPLATE_ID = 256;
+  static constexpr size_t MAX_MESSAGE = 1400; // bytes, to stay within one unfragmented datagram
+  static constexpr size_t TEMPLATE_REFRESH = 64;
+
+  explicit FlowTelemetry( const Config& config );
+
+  FlowTelemetry( const FlowTelemetry& other ) = delete;
+  FlowTelemetry& operator=( const FlowTelemetry& other ) = delete;
+
+  // Whether the next datagram should be sampled (call once per datagram)
+  bool sample_due()
+  {
+    if ( --countdown_ != 0 ) {
+      return false;
+    }
+    countdown_ = next_gap();
+    return true;
+  }
+
+  // Count a sampled datagram that came in on `interface`
+  void record( const InternetDatagram& dgram, size_t interface );
+
+  // Advance the clock, export flows that have gone idle, and send whatever records are waiting
+  void tick( uint64_t ms_since_last_tick );
+
+  // Export every flow now, and send
+  void flush();
+
+  Stats stats() const;
+
+private:
+  struct Key
+  {
+    uint32_t src {};
+    uint32_t dst {};
+    uint16_t src_port {};
+    uint16_t dst_port {};
+    uint8_t proto {};
+
+    bool operator==( const Key& other ) const = default;
+  };
+
+  struct KeyHash
+  {
+    size_t operator()( const Key& key ) const;
+  };
+
+  static constexpr uint32_t NONE = UINT32_MAX;
+
+  // A cached flow, on a most-recently-sampled-first list
+  struct Entry
+  {
+    Record record {};
+    uint64_t active_since_ms {}; // when counting (re)started, for the active timeout
+    uint32_t prev = NONE;
+    uint32_t next = NONE;
+  };
+
+  Config config_;
+  UDPSocket socket_ {};
+  uint64_t start_wall_ms_ {}; // wall-clock time when the clock read zero
+  uint64_t now_ms_ {};
+  uint32_t countdown_ {};
+  uint64_t rng_state_ {};
+
+  std::unordered_map<Key, uint32_t, KeyHash> index_ {};
+  std::vector<Entry> entries_ {};
+  std::vector<uint32_t> free_ {};
+  uint32_t newest_ = NONE;
+  uint32_t oldest_ = NONE;
+
+  std::string message_ {};  // the IPFIX message being filled
+  size_t message_records_ {};
+  uint32_t sequence_ {};    // data records exported so far (the IPFIX sequence number)
+  Stats stats_ {};
+
+  uint32_t next_gap();
+  uint64_t wall_ms() const { return start_wall_ms_ + now_ms_; }
+
+  void unlink( uint32_t entry );
+  void push_newest( uint32_t entry );
+  void remove( uint32_t entry, EndReason reason ); // exports and forgets a flow
+
+  void export_record( const Record& record, EndReason reason );
+  void send();
+};
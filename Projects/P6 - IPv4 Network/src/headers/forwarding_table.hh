@@ -0,0 +1,107 @@
+#pragma once
+
+#include "prefix_bloom.hh"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <optional>
+#include <span>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+//Prefix helpers:
+
+uint32_t get_prefmask(uint8_t prefix_length, const uint32_t route); //This makes a mask from a route, consisting of the first prefix_length bits, shifted to the rightmost bits.
+
+uint32_t get_network(uint8_t prefix_length, const uint32_t prefix_mask); //Turns a prefix mask back into the network address it came from (host bits zero).
+
+uint32_t host_bits(uint8_t prefix_length); //All ones in the bits a prefix of this length leaves free.
+
+uint32_t flow_hash(uint32_t src, uint32_t dst, uint8_t proto); //Mixes a datagram's addresses and protocol, so every packet of a flow picks the same equal-cost path.
+
+// The part of the router's routing table that lookups read: the per-length hash tables
+// and the Bloom filters in front of them. The Router keeps two of these, so a lookup
+// always sees a complete table while a route change is being made (see Router::update_fib).
+class ForwardingTable
+{
+public:
+  // A route's action: <interface_num, next_hop_addr>. (no next hop means the destination is directly attached)
+  using RouteEntry = std::pair<size_t, std::optional<uint32_t>>;
+  using Table = std::pmr::unordered_map<uint32_t, RouteEntry>;
+
+  // The interface number of a route with several equal-cost paths; the paths themselves are
+  // kept on the side (see set_paths)
+  static constexpr size_t MULTIPATH = SIZE_MAX;
+  static bool is_multipath( const RouteEntry& entry ) { return entry.first == MULTIPATH; }
+
+  static constexpr size_t MAX_PATHS = 64;
+  static constexpr size_t PATH_BUCKETS = 256;
+
+private:
+  //List of 33 entries of maps from prefix_max -> <interface_num, next_hop_addr> tuples, Indexed by length of prefix match required.
+  Table routing_table_[33];
+
+  //One Bloom filter per prefix length, kept in front of routing_table_ when bloom lookup is enabled.
+  PrefixBloom prefix_bloom_ {};
+  bool bloom_lookup_ = false;
+
+  //A multipath route's paths. A flow hashes to one of the buckets, and each bucket names a path. When the set of paths
+  //changes, only the buckets that have to move do (resilient hashing), so most flows stay on the path they were on.
+  struct PathGroup
+  {
+    std::vector<RouteEntry> paths {};
+    std::array<uint8_t, PATH_BUCKETS> buckets {}; //index into paths.
+  };
+
+  //Keyed by (prefix_length << 32) | prefix_mask.
+  std::unordered_map<uint64_t, PathGroup> path_groups_ {};
+
+  static uint64_t group_key(uint8_t prefix_length, uint32_t prefix_mask){ return (uint64_t{prefix_length} << 32) | prefix_mask; }
+
+  std::optional<std::pair<size_t, uint32_t>> probe_length(uint8_t prefix_length, uint32_t dst_ip, uint32_t flow) const; //Checks the table for a single prefix length.
+
+public:
+  // Add or replace a route, keeping the filters in step
+  void install( uint8_t prefix_length, uint32_t prefix_mask, const RouteEntry& entry );
+
+  // Remove a route (its filter bits stay set until the next rebuild, which only costs a wasted probe)
+  void erase( uint8_t prefix_length, uint32_t prefix_mask );
+
+  // Give a prefix several equal-cost paths (install it with interface MULTIPATH to use them). If the
+  // prefix already had paths, flows on the paths that remain keep them: only the buckets of removed
+  // paths, and the share a new path takes over, are reassigned. Deterministic, so both of the
+  // Router's copies end up the same.
+  void set_paths( uint8_t prefix_length, uint32_t prefix_mask, std::span<const RouteEntry> paths );
+
+  // Forget a prefix's paths, if it had any
+  void drop_paths( uint8_t prefix_length, uint32_t prefix_mask );
+
+  // The paths set for a prefix (empty if none)
+  std::span<const RouteEntry> paths( uint8_t prefix_length, uint32_t prefix_mask ) const;
+
+  // Move the tables and filters into memory from `memory` (which must outlive them); whatever
+  // they allocate from then on comes from there too
+  void use_memory( std::pmr::memory_resource* memory );
+
+  // Clear every route. (paths are kept: they belong to prefixes, not to table entries)
+  void clear();
+
+  void set_bloom_lookup( bool enabled );
+  bool bloom_lookup() const { return bloom_lookup_; }
+
+  // Resize the filters to fit the table and re-insert every prefix
+  void rebuild_bloom();
+
+  // Longest-prefix match: (interface num, next hop IP) for dst_ip, if any route matches. For a
+  // multipath route, `flow` (see flow_hash) picks the path.
+  std::optional<std::pair<size_t, uint32_t>> lookup( uint32_t dst_ip, uint32_t flow = 0 ) const;
+
+  // Direct access to one length's table (for bulk loading; call rebuild_bloom() afterwards)
+  Table& table( uint8_t prefix_length ) { return routing_table_[prefix_length]; }
+  const Table& table( uint8_t prefix_length ) const { return routing_table_[prefix_length]; }
+
+  size_t size() const;
+};
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "ethernet_frame.hh"
+#include "router.hh"
+#include "socket.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+
+// One end of a point-to-point link that carries Ethernet frames between two processes (or
+// threads): what an AsyncNetworkInterface sends goes in at one end and comes out at the other.
+// Sending and receiving never block; wait() does, until something arrives.
+class FrameLink
+{
+public:
+  struct Stats
+  {
+    uint64_t sent {};
+    uint64_t received {};
+    uint64_t dropped {}; // frames send() refused: the link was full, or the frame too big for it
+  };
+
+  FrameLink() = default;
+  virtual ~FrameLink() = default;
+
+  FrameLink( const FrameLink& other ) = delete;
+  FrameLink& operator=( const FrameLink& other ) = delete;
+  FrameLink( FrameLink&& other ) = default;
+  FrameLink& operator=( FrameLink&& other ) = default;
+
+  // Put a frame on the link. Returns false if it was dropped.
+  virtual bool send( const EthernetFrame& frame ) = 0;
+
+  // Take the next frame off the link, reusing the memory of `frame`. Returns false if none is waiting.
+  virtual bool recv( EthernetFrame& frame ) = 0;
+
+  // Block until a frame is waiting, or for at most `timeout_ms` (-1: forever). Returns whether one is.
+  virtual bool wait( int timeout_ms ) = 0;
+
+  // Move frames between the link and an interface: everything the interface has to send goes
+  // out, and everything waiting comes in. Returns the number of frames moved.
+  size_t pump( AsyncNetworkInterface& interface );
+
+  const Stats& stats() const { return stats_; }
+
+  // Largest frame either link carries (a 1500-byte MTU, plus the Ethernet header, with room to spare)
+  static constexpr size_t DEFAULT_FRAME_SIZE = 2048;
+
+protected:
+  Stats stats_ {};
+
+  // A frame's bytes on the wire, written to `out` (which has room for bytes_on_wire())
+  static size_t bytes_on_wire( const EthernetFrame& frame );
+  static void pack( const EthernetFrame& frame, char* out );
+
+  // The frame in `length` bytes, with its payload copied into the recycled memory of frame.payload
+  static bool unpack( const char* bytes, size_t length, EthernetFrame& frame );
+
+private:
+  EthernetFrame pumped_ {};
+};
+
+// A link over a pair of connected UDP sockets, one datagram per frame. Each frame crosses the
+// kernel twice (a send and a receive system call), but the ends can be on different hosts.
+class UdpLink : public FrameLink
+{
+public:
+  // Bound to `local`, sending to (and only accepting from) `peer`
+  UdpLink( const Address& local, const Address& peer );
+
+  // Both ends of a link on the loopback interface
+  static std::pair<UdpLink, UdpLink> make_pair();
+
+  bool send( const EthernetFrame& frame ) override;
+  bool recv( EthernetFrame& frame ) override;
+  bool wait( int timeout_ms ) override;
+
+  Address local_address() const { return socket_.local_address(); }
+
+private:
+  explicit UdpLink( UDPSocket&& socket );
+
+  UDPSocket socket_;
+  std::string datagram_ = std::string( DEFAULT_FRAME_SIZE, '\0' );
+};
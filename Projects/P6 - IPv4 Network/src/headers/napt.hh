@@ -0,0 +1,157 @@
+#pragma once
+
+#include "ipv4_datagram.hh"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Network address and port translation (source NAT) with connection tracking.
+//
+// Each TCP or UDP connection leaving through the NAT gets its own public (address, port),
+// taken from a pool, and datagrams coming back to that public address and port from the
+// same remote end are translated back. Addresses, ports and checksums are rewritten in
+// place, with the checksums patched incrementally rather than recomputed.
+//
+// Everything is allocated up front from Config::max_mappings, so memory stays bounded
+// however many connections come and go. The connection table is two open-addressed hash
+// indexes (by inside 5-tuple and by public 5-tuple) over a slab of mappings:
+//
+// - Lookups are lock-free: they read the indexes under an RcuEpoch guard, and a mapping's
+//   slot isn't reused until every lookup that might still see it has finished.
+// - The slab, the port pool and the idle timers are split between `workers`, so each worker
+//   thread creates and expires its own connections without contending with the others.
+//   A worker must only be used from one thread at a time, and a connection's outbound
+//   datagrams should all go through one worker (which flow-hashed receive queues ensure).
+// - Idle connections expire on a hashed timer wheel per worker. Traffic only stamps a
+//   connection's last-seen time; the wheel re-checks it when the connection's slot comes round.
+// - An expired connection leaves a tombstone in each index, unless the slot after it is empty,
+//   in which case it and any tombstones just before it are cleared. A worker whose expiries
+//   have left many tombstones moves its connections back over them when it next expires.
+class Napt
+{
+public:
+  struct Config
+  {
+    uint32_t public_address {};    // first address of the public pool
+    uint32_t public_addresses = 1; // size of the pool (consecutive addresses)
+    uint16_t first_port = 1024;    // public ports handed out, per address
+    uint16_t last_port = UINT16_MAX;
+    size_t max_mappings = 1 << 16; // connections tracked at once
+    size_t workers = 1;
+
+    uint64_t tcp_timeout_ms = 2 * 60 * 60 * 1000;
+    uint64_t udp_timeout_ms = 5 * 60 * 1000;
+    uint64_t wheel_granularity_ms = 1000; // how precisely idle timeouts are kept
+  };
+
+  struct Stats
+  {
+    size_t active {};      // connections being tracked
+    uint64_t created {};   // connections ever set up
+    uint64_t expired {};   // connections timed out
+    uint64_t exhausted {}; // new connections dropped because no port or table space was left
+  };
+
+  explicit Napt( const Config& config );
+
+  Napt( const Napt& other ) = delete;
+  Napt& operator=( const Napt& other ) = delete;
+  ~Napt();
+
+  // Whether an address belongs to the public pool
+  bool is_public( uint32_t address ) const
+  {
+    return address - config_.public_address < config_.public_addresses;
+  }
+
+  // Rewrite an outgoing datagram's source to its connection's public address and port,
+  // setting up the connection if it's new. Returns false if the datagram should be dropped:
+  // not TCP or UDP (or a non-first fragment), or the pool or table is full.
+  bool translate_outbound( InternetDatagram& dgram, size_t worker = 0 );
+
+  // Rewrite a datagram sent to a public address back to the inside address and port of its
+  // connection. Returns false if there's no such connection (drop it).
+  bool translate_inbound( InternetDatagram& dgram );
+
+  // Advance the clock (from any thread)
+  void tick( uint64_t ms_since_last_tick );
+
+  // Time out a worker's idle connections, freeing their ports. Call from the worker's own
+  // thread, outside any RcuEpoch read section (it waits out lookups that might still be
+  // using the expired connections before reusing them).
+  void expire( size_t worker = 0 );
+
+  Stats stats() const;
+
+  // Bytes allocated for the table, ports and timers
+  size_t memory_bytes() const;
+
+private:
+  static constexpr uint32_t NONE = UINT32_MAX;
+  static constexpr uint32_t EMPTY = 0;        // index slot never used
+  static constexpr uint32_t TOMBSTONE = NONE; // index slot whose mapping expired
+  static constexpr size_t MAX_PROBE = 64;     // an index entry is never further than this from home
+  static constexpr size_t WHEEL_SLOTS = 256;
+
+  // A connection, and the 5-tuple on each side of the NAT
+  struct Mapping
+  {
+    uint8_t proto {};
+    uint32_t inside_address {};
+    uint16_t inside_port {};
+    uint32_t remote_address {};
+    uint16_t remote_port {};
+    uint32_t public_address {};
+    uint16_t public_port {};
+    std::atomic<uint64_t> last_seen { 0 }; // stamped by any worker's lookups
+    uint32_t wheel_next = NONE;            // (only touched by the worker that created it)
+  };
+
+  // A worker's share of the slab and the port pool, and its timers
+  struct Worker
+  {
+    uint32_t first_mapping {}; // the worker's slab indices are [first_mapping, end_mapping)
+    uint32_t end_mapping {};
+    uint32_t next_unused_mapping {};
+    std::vector<uint32_t> free_mappings {};
+
+    uint32_t first_port_id {}; // ports numbered across the pool (address index * ports per address + port
+                               // - first_port), the worker's in [first_port_id, end_port_id)
+    uint32_t end_port_id {};
+    uint32_t next_unused_port_id {};
+    std::vector<uint32_t> free_port_ids {};
+
+    std::vector<uint32_t> wheel {}; // heads of each slot's list
+    uint64_t wheel_tick {};         // the next wheel tick to process
+    std::vector<uint32_t> retired {};
+    size_t tombstones {}; // left in the indexes by this worker's expiries since it last compacted
+
+    std::atomic<uint64_t> created { 0 };
+    std::atomic<uint64_t> expired { 0 };
+    std::atomic<uint64_t> exhausted { 0 };
+  };
+
+  Config config_;
+  size_t index_mask_;
+  std::unique_ptr<Mapping[]> mappings_;
+  std::unique_ptr<std::atomic<uint32_t>[]> by_inside_; // mapping index + 1, EMPTY or TOMBSTONE
+  std::unique_ptr<std::atomic<uint32_t>[]> by_public_;
+  std::vector<Worker> workers_;
+  std::atomic<uint64_t> now_ms_ { 0 };
+
+  static uint64_t key_hash( uint8_t proto, uint32_t addr, uint16_t port, uint32_t remote_addr, uint16_t remote_port );
+  uint64_t timeout( uint8_t proto ) const;
+
+  uint32_t find( const std::atomic<uint32_t>* index, uint64_t hash, bool inside, const Mapping& key ) const;
+  size_t insert( std::atomic<uint32_t>* index, uint64_t hash, uint32_t mapping, size_t limit = MAX_PROBE );
+  void erase( std::atomic<uint32_t>* index, uint64_t hash, uint32_t mapping, Worker& worker );
+  bool clear_tombstones( std::atomic<uint32_t>* index, size_t slot );
+  void relocate( std::atomic<uint32_t>* index, uint64_t hash, uint32_t mapping );
+  void compact( Worker& worker );
+
+  uint32_t create( Worker& worker, const Mapping& key );
+  void schedule( Worker& worker, uint32_t mapping );
+};
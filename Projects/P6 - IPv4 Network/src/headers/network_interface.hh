@@ -4,13 +4,16 @@
 #include "ethernet_frame.hh"
 #include "ipv4_datagram.hh"
 #include "arp_message.hh"
+#include "egress_scheduler.hh"
 
+#include <functional>
 #include <iostream>
 #include <list>
 #include <optional>
 #include <queue>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
 
 // A "network interface" that connects IP (the internet layer, or network layer)
@@ -36,6 +39,22 @@
 // and learns or replies as necessary.
 class NetworkInterface
 {
+public:
+  // Shown every frame the interface receives (sent = false) or sends (sent = true), e.g. to write
+  // them to a PcapWriter
+  using CaptureHook = std::function<void( const EthernetFrame& frame, bool sent )>;
+
+  static constexpr size_t ARP_ENTRY_TTL_MS = 30000;      // how long a learned mapping is kept
+  static constexpr size_t ARP_REQUEST_TIMEOUT_MS = 5000; // how long an ARP request is waited on
+
+  // A learned mapping, as saved across a restart
+  struct Neighbor
+  {
+    uint32_t ip_address {};
+    EthernetAddress ethernet_address {};
+    size_t ttl_ms {}; // left before it expires
+  };
+
 private:
   // Ethernet (known as hardware, network-access, or link-layer) address of the interface
   EthernetAddress ethernet_address_;
@@ -51,9 +70,16 @@ private:
   //This maps ip addresses -> pointer (queue(packets waiting for ARP response with corresponding MAC address), time since ARP request sent)
   std::unordered_map<uint32_t, std::pair<std::queue<InternetDatagram>, size_t>> arp_reqs_;
 
-  //This is a queue of packets that are waiting to be sent. 
-  std::queue<EthernetFrame> rtosend_q_; //TODO: MAY NEED TO CHANGE THIS TO ALLOW MORE DATATYPES. 
+  //This holds the packets that are waiting to be sent, and decides which goes next. (a FIFO unless set_egress_config is called)
+  EgressScheduler egress_;
 
+  //Sees every frame in and out, if set.
+  CaptureHook capture_;
+
+  //Mappings restored from a snapshot that the neighbour hasn't confirmed yet: ip -> ms since we sent it
+  //a unicast ARP request (NOT_PROBED until the entry is first used).
+  std::unordered_map<uint32_t, size_t> stale_;
+  static constexpr size_t NOT_PROBED = SIZE_MAX;
 
   //helpers:
   EthernetFrame construct_frame( const EthernetAddress& src,
@@ -73,7 +99,7 @@ private:
 
   void queue_arp_reply( const Address& target_addr, const EthernetAddress& target_mac_addr );
 
-  std::optional<InternetDatagram> recieve_ipdgram( const EthernetFrame& frame );
+  bool recieve_ipdgram( const EthernetFrame& frame, InternetDatagram& dgram );
 
   void release_reqs_q( uint32_t target_addr_bin, EthernetAddress target_mac_addr );
 
@@ -81,6 +107,8 @@ private:
 
   void reply_arp( const EthernetFrame& frame );
 
+  void probe( uint32_t ip_address, const EthernetAddress& ethernet_address );
+
 public:
 
   // Construct a network interface with given Ethernet (network-access-layer) and IP (internet-layer)
@@ -90,6 +118,11 @@ public:
   // Access queue of Ethernet frames awaiting transmission
   std::optional<EthernetFrame> maybe_send();
 
+  // Same, but swaps the next frame into `frame` (returning false if there isn't one). The frame
+  // passed in is kept for reuse, so a caller that keeps handing back the same EthernetFrame lets
+  // the interface build later frames in its memory instead of allocating.
+  bool maybe_send( EthernetFrame& frame );
+
   // Sends an IPv4 datagram, encapsulated in an Ethernet frame (if it knows the Ethernet destination
   // address). Will need to use [ARP](\ref rfc::rfc826) to look up the Ethernet destination address
   // for the next hop.
@@ -103,7 +136,35 @@ public:
   // If type is ARP reply, learn a mapping from the "sender" fields.
   std::optional<InternetDatagram> recv_frame( const EthernetFrame& frame );
 
+  // Same, but parses an IPv4 datagram into `dgram` (reusing its memory), returning whether there was one.
+  bool recv_frame( const EthernetFrame& frame, InternetDatagram& dgram );
+
   // Called periodically when time elapses
   void tick( size_t ms_since_last_tick );
 
+  // Replace the send queue with one scheduled and shaped as configured (see EgressScheduler).
+  // Frames already waiting are discarded, so do this before sending anything.
+  void set_egress_config( EgressScheduler::Config config ) { egress_ = EgressScheduler { std::move( config ) }; }
+
+  // The send queue, for its per-class counters
+  const EgressScheduler& egress() const { return egress_; }
+
+  // Show every frame received or sent from now on to `hook` (or to nothing, if it's empty)
+  void set_capture( CaptureHook hook ) { capture_ = std::move( hook ); }
+
+  const Address& ip_address() const { return ip_address_; }
+
+  // The ARP table, with each entry's time left
+  std::vector<Neighbor> neighbors() const;
+
+  // Put saved mappings back (skipping any already learned) after a restart, marked stale: they're
+  // used for sending straight away, so nothing waits on ARP, but the first datagram sent to each
+  // stale neighbour also sends it a unicast ARP request. Its reply makes the entry fresh again;
+  // with no reply within ARP_REQUEST_TIMEOUT_MS, the entry is dropped and resolved afresh.
+  // Returns the number restored.
+  size_t restore_neighbors( const std::vector<Neighbor>& neighbors );
+
+  // Restored entries not yet confirmed
+  size_t stale_neighbors() const { return stale_.size(); }
+
 };
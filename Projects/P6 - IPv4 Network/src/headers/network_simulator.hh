@@ -0,0 +1,181 @@
+#pragma once
+
+#include "router.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <queue>
+#include <vector>
+
+// One simulated link, the same in both directions
+struct SimulatedLinkConfig
+{
+  uint64_t latency_ns = 10'000;
+  uint64_t bits_per_s = 10'000'000'000;
+  size_t buffer_bytes = 1'000'000; // backlog a direction can hold before it drops
+};
+
+// A discrete-event simulator for networks of Routers and hosts.
+//
+// Nodes are joined by point-to-point links, each direction with its own latency, bandwidth
+// and buffer. A frame leaving an interface waits for the link to finish sending whatever is
+// ahead of it, takes size / bandwidth to serialize, then arrives one latency later; if the
+// backlog ahead of it is over the buffer, it's dropped. Events (arrivals, hosts' sends, routers
+// getting round to their queues) are kept in a priority queue by time and run in order, ties
+// broken by the order they were scheduled, so a run is deterministic.
+//
+// Addressing is automatic. Router r owns 10.(r / 256).(r % 256).0/24, and its hosts (up to
+// 64) each sit on a /30 from it. Router-to-router links are /30s from 100.64.0.0/10.
+// install_routes() computes shortest paths over the whole topology and bulk-loads every
+// router with a route to every router's host block.
+//
+// Node and interface timers (ARP expiry, NAT idle timeouts) are advanced lazily, whenever
+// a node has something to do, so idle parts of a large topology cost nothing.
+class NetworkSimulator
+{
+public:
+  using Time = uint64_t; // nanoseconds since the start of the simulation
+  using NodeId = uint32_t;
+
+  using LinkConfig = SimulatedLinkConfig;
+
+  struct Stats
+  {
+    uint64_t events {};
+    uint64_t frames_sent {};    // frames put on a link
+    uint64_t frames_dropped {}; // frames that found a link's buffer full
+    uint64_t datagrams_sent {}; // by hosts
+    uint64_t datagrams_delivered {};
+  };
+
+  // Routers and hosts of a generated topology
+  struct Topology
+  {
+    std::vector<NodeId> routers {};
+    std::vector<NodeId> hosts {};
+  };
+
+  // Called for each datagram a host receives
+  using DeliveryHandler = std::function<void( NodeId host, Time at, const InternetDatagram& dgram )>;
+
+  // Receive queues on simulated interfaces are this deep (the default is far more than a
+  // simulation needs, and thousands of interfaces add up)
+  static constexpr size_t RECEIVE_QUEUE_CAPACITY = 64;
+  static constexpr size_t MAX_HOSTS_PER_ROUTER = 64;
+
+  NetworkSimulator() = default;
+  NetworkSimulator( const NetworkSimulator& other ) = delete;
+  NetworkSimulator& operator=( const NetworkSimulator& other ) = delete;
+
+  NodeId add_router();
+
+  // A host on its own link to `router`, with the router as its gateway
+  NodeId add_host( NodeId router, const LinkConfig& link = {} );
+
+  // A link between two routers
+  void connect( NodeId a, NodeId b, const LinkConfig& link = {} );
+
+  // A k-ary fat tree (k even): (k/2)^2 core routers, k pods of k/2 aggregation and k/2 edge
+  // routers, and k/2 hosts on each edge router (k^3 / 4 hosts in all)
+  Topology build_fat_tree( size_t k, const LinkConfig& link = {} );
+
+  // A random connected graph: a random spanning tree, plus random links until the average
+  // degree is `degree`, with `hosts_per_router` hosts on each router
+  Topology build_random( size_t routers, size_t degree, size_t hosts_per_router, uint64_t seed, const LinkConfig& link = {} );
+
+  // Route every router's host block along shortest paths (in hops). Where there are several,
+  // each router picks one per destination by hash, which spreads destinations across them.
+  // Returns the number of routes installed.
+  size_t install_routes();
+
+  // Have a host send a datagram at the given time (no earlier than now())
+  void send( NodeId host, InternetDatagram dgram, Time at );
+
+  void on_delivery( DeliveryHandler handler ) { on_delivery_ = std::move( handler ); }
+
+  // Run events up to and including time `until`. Returns the number run.
+  uint64_t run( Time until = UINT64_MAX );
+
+  Time now() const { return now_; }
+  const Stats& stats() const { return stats_; }
+  size_t num_nodes() const { return nodes_.size(); }
+  bool is_router( NodeId node ) const { return nodes_.at( node ).router != nullptr; }
+  Router& router( NodeId node );
+  uint32_t host_address( NodeId host ) const;
+
+private:
+  // One direction of a link
+  struct Channel
+  {
+    NodeId to {};
+    uint32_t to_port {};
+    LinkConfig config {};
+    Time busy_until {}; // when the frames already handed to the link will have been sent
+  };
+
+  struct Node
+  {
+    std::unique_ptr<Router> router {};              // null for a host
+    std::unique_ptr<AsyncNetworkInterface> host {}; // null for a router
+    uint32_t gateway {};                            // (hosts)
+    uint32_t block {};                              // (routers) the /24 its hosts are numbered from
+    uint32_t hosts {};                              // (routers) hosts attached so far
+    std::vector<uint32_t> out {};                   // channel leaving each interface
+    std::vector<uint32_t> addresses {};             // address of each interface
+    uint64_t ticked_ms {};
+    bool route_pending {};
+  };
+
+  enum class EventKind : uint8_t
+  {
+    ARRIVE, // a frame reaches the end of a channel
+    SEND,   // a host sends a datagram
+    ROUTE,  // a router works through its receive queues
+  };
+
+  struct Event
+  {
+    Time at {};
+    uint64_t seq {};
+    EventKind kind {};
+    uint32_t target {}; // channel (ARRIVE) or node
+    uint32_t slot {};   // frame (ARRIVE) or datagram (SEND)
+  };
+
+  struct Later
+  {
+    bool operator()( const Event& a, const Event& b ) const { return a.at != b.at ? a.at > b.at : a.seq > b.seq; }
+  };
+
+  std::vector<Node> nodes_ {};
+  std::vector<Channel> channels_ {};
+  size_t routers_ {}; // routers so far, which number their host blocks
+  size_t links_ {};   // router-to-router links, which number their subnets
+  uint64_t next_ethernet_ {};
+
+  std::priority_queue<Event, std::vector<Event>, Later> events_ {};
+  uint64_t next_seq_ {};
+  Time now_ {};
+  Stats stats_ {};
+  DeliveryHandler on_delivery_ {};
+
+  // Frames in flight and datagrams waiting to be sent, with free lists so their memory is reused
+  std::vector<EthernetFrame> frames_ {};
+  std::vector<uint32_t> free_frames_ {};
+  std::vector<InternetDatagram> datagrams_ {};
+  std::vector<uint32_t> free_datagrams_ {};
+  InternetDatagram received_ {};
+
+  void schedule( Time at, EventKind kind, uint32_t target, uint32_t slot = 0 );
+  AsyncNetworkInterface make_interface( uint32_t address );
+  void add_channel( NodeId from, NodeId to, uint32_t to_port, const LinkConfig& link );
+  AsyncNetworkInterface& interface( NodeId node, uint32_t port );
+  void tick( Node& node );
+  void transmit( NodeId node ); // puts whatever the node's interfaces have to send on their links
+
+  void arrive( uint32_t channel, uint32_t slot );
+  void host_send( NodeId host, uint32_t slot );
+  void route( NodeId node );
+};
@@ -0,0 +1,102 @@
+#pragma once
+
+#include "ipv4_datagram.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <utility>
+#include <vector>
+
+// The source and destination ports of a TCP or UDP datagram. Only a first fragment carries
+// them, so for later fragments (and other protocols) there are none.
+std::optional<std::pair<uint16_t, uint16_t>> l4_ports( const InternetDatagram& dgram );
+
+// One access-control rule. A datagram matches when every field does.
+struct AclRule
+{
+  enum class Action : uint8_t
+  {
+    PERMIT,
+    DENY
+  };
+
+  uint32_t src_prefix {};
+  uint8_t src_length {}; // 0 matches any source
+  uint32_t dst_prefix {};
+  uint8_t dst_length {};
+  std::optional<uint8_t> proto {}; // any protocol if empty
+
+  // Inclusive port ranges. A datagram without ports (see l4_ports) only matches rules that
+  // leave both ranges at their full extent.
+  std::pair<uint16_t, uint16_t> src_ports { 0, UINT16_MAX };
+  std::pair<uint16_t, uint16_t> dst_ports { 0, UINT16_MAX };
+
+  Action action = Action::DENY;
+};
+
+// An ACL compiled for lookup. The first rule (in list order) that matches decides.
+//
+// Rules are grouped by their pair of prefix lengths (tuple space search): within a tuple, a
+// hash table keyed on the masked addresses leads straight to the few rules that could match,
+// and protocol and ports are checked on just those. Tuples are searched in order of the
+// highest-priority rule they hold, and the search stops as soon as no remaining tuple could
+// beat the match in hand, so a lookup costs a handful of hash probes however many rules there
+// are. Immutable once built: to change the rules, compile a new one and swap it in.
+class PacketClassifier
+{
+public:
+  // Throws std::runtime_error naming the first malformed rule (prefix over 32 bits, or a port
+  // range that ends before it starts)
+  explicit PacketClassifier( const std::vector<AclRule>& rules,
+                             AclRule::Action default_action = AclRule::Action::PERMIT );
+
+  // The index of the first matching rule, if any
+  std::optional<size_t> match( uint32_t src,
+                               uint32_t dst,
+                               uint8_t proto,
+                               std::optional<std::pair<uint16_t, uint16_t>> ports ) const;
+
+  // What to do with a datagram: the first matching rule's action, or the default
+  AclRule::Action decide( const InternetDatagram& dgram ) const;
+
+  size_t num_rules() const { return actions_.size(); }
+  size_t num_tuples() const { return tuples_.size(); }
+
+private:
+  struct Entry
+  {
+    uint32_t priority {}; // index of the rule
+    std::optional<uint8_t> proto {};
+    bool any_ports {};
+    std::pair<uint16_t, uint16_t> src_ports {};
+    std::pair<uint16_t, uint16_t> dst_ports {};
+  };
+
+  // A tuple's hash table: open addressing with linear probing, at most half full, so a probe
+  // is usually one cache line. Each slot points at its rules' run in `entries`.
+  struct Slot
+  {
+    uint64_t key {};    // (src << 32 | dst), masked to the tuple's lengths
+    uint32_t first {};  // index into entries
+    uint32_t count {};  // 0 for an empty slot
+  };
+
+  struct Tuple
+  {
+    uint8_t src_length {};
+    uint8_t dst_length {};
+    uint32_t src_mask {};
+    uint32_t dst_mask {};
+    uint32_t best_priority {}; // of the rules in this tuple
+    uint8_t shift {};          // 64 - log2(slots.size())
+    std::vector<Slot> slots {};
+    std::vector<Entry> entries {}; // grouped by key, by priority within a group
+
+    const Slot* find( uint64_t key ) const;
+  };
+
+  std::vector<Tuple> tuples_ {}; // by best_priority
+  std::vector<AclRule::Action> actions_ {};
+  AclRule::Action default_action_;
+};
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "ethernet_frame.hh"
+#include "file_descriptor.hh"
+#include "mmap_region.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// One captured frame
+struct PcapRecord
+{
+  uint64_t timestamp_ns {};    // since the Unix epoch
+  uint32_t original_length {}; // on the wire (more than the frame holds if the capture cut it short)
+  EthernetFrame frame {};
+};
+
+// Writes Ethernet frames to a file in the libpcap format (as tcpdump -w does), without libpcap:
+// a 24-byte file header, then a 16-byte header and the raw bytes of each frame. Timestamps are
+// in nanoseconds, and everything is in host byte order, which readers detect from the magic
+// number. Frames are collected in memory and written in large chunks, so capturing costs
+// about a copy of each frame; the file is complete once flush() or the destructor has run.
+class PcapWriter
+{
+public:
+  static constexpr uint32_t MAGIC_MICROSECONDS = 0xa1b2c3d4;
+  static constexpr uint32_t MAGIC_NANOSECONDS = 0xa1b23c4d;
+  static constexpr uint32_t LINKTYPE_ETHERNET = 1;
+  static constexpr uint32_t SNAP_LENGTH = 65535; // longer frames are cut short
+
+  // Create (or truncate) the file and write its header
+  explicit PcapWriter( const std::string& path );
+  ~PcapWriter();
+
+  PcapWriter( const PcapWriter& other ) = delete;
+  PcapWriter& operator=( const PcapWriter& other ) = delete;
+
+  void write( const EthernetFrame& frame, uint64_t timestamp_ns );
+
+  // Timestamped with the current (wall-clock) time
+  void write( const EthernetFrame& frame );
+
+  void flush();
+
+  uint64_t frames() const { return frames_; }
+
+private:
+  static constexpr size_t FLUSH_BYTES = 1 << 20;
+
+  FileDescriptor fd_;
+  std::string pending_ {};
+  uint64_t frames_ {};
+};
+
+// Reads a libpcap file of Ethernet frames, in either byte order and with microsecond or
+// nanosecond timestamps. The file is mapped, and each frame is copied out as it's read.
+class PcapReader
+{
+public:
+  // Throws std::runtime_error if the file isn't a pcap file of Ethernet frames
+  explicit PcapReader( const std::string& path );
+
+  // The next frame. Returns false at the end of the file; throws std::runtime_error if the
+  // file ends partway through a frame.
+  bool read( PcapRecord& record );
+
+  // Every frame in a file
+  static std::vector<PcapRecord> read_all( const std::string& path );
+
+private:
+  std::string path_;
+  MMapRegion region_ {};
+  size_t offset_ {};
+  bool swapped_ {};     // written in the other byte order
+  bool nanoseconds_ {}; // timestamps' fractional part is in ns (otherwise us)
+
+  uint32_t read32( size_t at ) const;
+};
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <vector>
+
+// One small Bloom filter per prefix length (0..32), sitting in front of the
+// router's per-length hash tables. A lookup probes all 33 filters at once and
+// returns a bitmask of the lengths that *might* hold a matching prefix, so the
+// router only has to do a hash-table probe for those lengths.
+//
+// Each filter is "blocked": a key hashes to a single 64-bit word and sets
+// HASHES_PER_KEY bits inside it, so a probe is one load and one compare.
+// All 33 filters have the same (power of two) number of words and live in one
+// flat array, which keeps the probe loop a fixed-trip-count loop over plain
+// arrays that the compiler can unroll and vectorize.
+class PrefixBloom
+{
+public:
+  static constexpr size_t NUM_LENGTHS = 33;
+  static constexpr size_t HASHES_PER_KEY = 3;
+  static constexpr size_t KEYS_PER_WORD = 6; // load factor before the filters ask to be grown
+
+  // words_per_filter is rounded up to a power of two. The filters' memory comes from `memory`.
+  explicit PrefixBloom( size_t words_per_filter = 16,
+                        std::pmr::memory_resource* memory = std::pmr::get_default_resource() );
+
+  PrefixBloom( const PrefixBloom& other ) = default;
+  PrefixBloom& operator=( const PrefixBloom& other ) = default;
+
+  // The same filters, in memory from `memory`
+  PrefixBloom( const PrefixBloom& other, std::pmr::memory_resource* memory );
+
+  // Record that a prefix (already shifted down to its low prefix_length bits) is in the table.
+  // Returns true if the filter for this length is now over its load factor, and the owner
+  // should call reset() with a larger size and re-insert everything.
+  bool insert( uint8_t prefix_length, uint32_t prefix_key );
+
+  // Bit L of the result is set if a prefix of length L covering dst_ip may be in the table.
+  // There are no false negatives; false positives just cost one extra hash-table probe.
+  uint64_t candidates( uint32_t dst_ip ) const;
+
+  // Drop every key and resize each filter to hold at least expected_keys keys.
+  void reset( size_t expected_keys );
+
+  size_t words_per_filter() const { return word_mask_ + 1; }
+  size_t keys( uint8_t prefix_length ) const { return keys_.at( prefix_length ); }
+  size_t max_keys() const;
+
+private:
+  size_t word_mask_ {};
+  unsigned index_shift_ {};
+  std::pmr::vector<uint64_t> words_ {};     // NUM_LENGTHS filters, back to back
+  std::array<size_t, NUM_LENGTHS> keys_ {}; // keys inserted per length
+  uint64_t nonempty_ {};                    // bit L set once length L holds a key
+
+  static uint64_t hash( uint8_t prefix_length, uint32_t prefix_key );
+  static uint64_t bits_of( uint64_t h );
+};
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "mmap_region.hh"
+
+#include <array>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// A route in the form the routing table stores it: the prefix already shifted down to its
+// low prefix_length bits (see Router::get_prefmask). The prefix length itself is implied by
+// which list the route sits in. Plain old data, so a FIB image can be read straight off disk.
+struct PackedRoute
+{
+  uint32_t prefix_mask {};
+  uint32_t next_hop {};
+  uint32_t interface_num {};
+  uint32_t has_next_hop {};
+};
+
+// Routes grouped by prefix length (index 0..32)
+using RoutesByLength = std::array<std::vector<PackedRoute>, 33>;
+using RouteSpans = std::array<std::span<const PackedRoute>, 33>;
+
+// Parse a text route dump, one route per line:
+//
+//   <prefix>/<length>,<next hop address | direct>,<interface num>
+//
+// e.g. "10.0.0.0/8,direct,1" or "0.0.0.0/0,171.67.76.1,0". Blank lines and lines starting
+// with '#' are skipped. Large dumps are cut at line boundaries and parsed on several threads;
+// within each length, routes keep their order in the file (so a repeated prefix's last line
+// wins, as with add_route). Throws std::runtime_error naming the first malformed line.
+RoutesByLength parse_route_dump( std::string_view text );
+
+// Replace the file at `path` with `contents` so that, even across a crash, it holds either the
+// old contents or all of the new: they're written to a temporary file alongside and synced, then
+// renamed into place, and the directory is synced so the rename itself lasts. Throws on error.
+void replace_file( const std::string& path, std::string_view contents );
+
+// A compact binary snapshot of a routing table: a fixed header, then the PackedRoutes for
+// length 0, then length 1, ... up to 32. Written in host byte order, as it is meant for
+// restarting a router on the same machine, and mapped back read-only so loading it needs no
+// parsing: the routes are bulk-inserted straight from the page cache. The lookup tables are
+// still built from them, though, so loading an image takes time in proportion to its routes
+// (it is a fast source to rebuild from, not a table lookups can use as it is).
+class FibImage
+{
+public:
+  struct Header
+  {
+    std::array<char, 8> magic;
+    uint32_t version;
+    uint32_t route_size;
+    std::array<uint64_t, 33> routes_per_length;
+  };
+
+  static constexpr std::array<char, 8> MAGIC = { 'C', 'S', 'C', 'F', 'I', 'B', '\0', '\0' };
+  static constexpr uint32_t VERSION = 1;
+
+  // Write an image (with replace_file, so readers never see half of one, even after a crash)
+  static void write( const std::string& path, const RouteSpans& routes );
+
+  // Map an image, checking that its header and size are consistent
+  explicit FibImage( const std::string& path );
+
+  const RouteSpans& routes() const { return routes_; }
+
+private:
+  MMapRegion region_ {};
+  RouteSpans routes_ {};
+};
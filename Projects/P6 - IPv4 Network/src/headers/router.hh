@@ -1,18 +1,71 @@
 #pragma once
 
 #include "network_interface.hh"
+#include "epoch.hh"
+#include "flow_telemetry.hh"
+#include "forwarding_table.hh"
+#include "huge_pages.hh"
+#include "napt.hh"
+#include "packet_classifier.hh"
+#include "route_loader.hh"
+#include "spsc_ring.hh"
+#include "toeplitz.hh"
 
+#include <array>
+#include <atomic>
+#include <map>
+#include <memory_resource>
+#include <memory>
+#include <mutex>
 #include <optional>
-#include <queue>
 
 // A wrapper for NetworkInterface that makes the host-side
 // interface asynchronous: instead of returning received datagrams
 // immediately (from the `recv_frame` method), it stores them for
 // later retrieval. Otherwise, behaves identically to the underlying
 // implementation of NetworkInterface.
+//
+// Received datagrams can be spread over several receive queues, the way a multi-queue NIC does
+// receive-side scaling: a Toeplitz hash of each datagram's addresses (and TCP/UDP ports) picks
+// its queue, so a flow always lands in the same queue and stays in order. Each queue is a
+// lock-free single-producer/single-consumer ring, so while one thread calls recv_frame, every
+// queue can be drained by its own worker thread.
 class AsyncNetworkInterface : public NetworkInterface
 {
-  std::queue<InternetDatagram> datagrams_in_ {};
+public:
+  static constexpr size_t DEFAULT_QUEUE_CAPACITY = 1024;
+  static constexpr size_t INDIRECTION_TABLE_SIZE = 128;
+
+  // Gauges for one receive queue
+  struct ReceiveQueueStats
+  {
+    size_t depth {};   // datagrams waiting to be received
+    uint64_t drops {}; // datagrams dropped because the queue was full
+  };
+
+private:
+  struct ReceiveQueue
+  {
+    SpscRing<InternetDatagram> ring;
+    std::atomic<uint64_t> drops { 0 };
+
+    explicit ReceiveQueue( size_t capacity ) : ring( capacity ) {}
+
+    // (copied along with the interface, which is only safe while nothing is using it)
+    ReceiveQueue( const ReceiveQueue& other ) : ring( other.ring ), drops( other.drops.load() ) {}
+    ReceiveQueue& operator=( const ReceiveQueue& other )
+    {
+      ring = other.ring;
+      drops = other.drops.load();
+      return *this;
+    }
+  };
+
+  std::vector<ReceiveQueue> queues_ = std::vector<ReceiveQueue>( 1, ReceiveQueue { DEFAULT_QUEUE_CAPACITY } );
+  std::array<uint32_t, INDIRECTION_TABLE_SIZE> indirection_table_ {}; // low bits of the hash -> queue
+  ToeplitzHash rss_hash_ {};
+  InternetDatagram incoming_ {}; // frames are parsed into this, then swapped into their queue
+  size_t next_queue_ {};         // where the any-queue maybe_receive() looks first
 
 public:
   using NetworkInterface::NetworkInterface;
@@ -20,6 +73,14 @@ public:
   // Construct from a NetworkInterface
   explicit AsyncNetworkInterface( NetworkInterface&& interface ) : NetworkInterface( interface ) {}
 
+  // Use `count` receive queues of `capacity` datagrams each, with the hash's buckets dealt out
+  // round-robin. Anything still queued is discarded, so set this up before traffic arrives.
+  void set_receive_queues( size_t count, size_t capacity = DEFAULT_QUEUE_CAPACITY );
+  size_t receive_queues() const { return queues_.size(); }
+
+  // The queue a datagram is steered to
+  size_t queue_for( const InternetDatagram& dgram ) const;
+
   // \brief Receives and Ethernet frame and responds appropriately.
 
   // - If type is IPv4, pushes to the `datagrams_out` queue for later retrieval by the owner.
@@ -27,46 +88,104 @@ public:
   // - If type is ARP reply, learn a mapping from the "target" fields.
   //
   // \param[in] frame the incoming Ethernet frame
-  void recv_frame( const EthernetFrame& frame )
-  {
-    auto optional_dgram = NetworkInterface::recv_frame( frame );
-    if ( optional_dgram.has_value() ) {
-      datagrams_in_.push( std::move( optional_dgram.value() ) );
-    }
-  };
+  void recv_frame( const EthernetFrame& frame );
 
-  // Access queue of Internet datagrams that have been received
-  std::optional<InternetDatagram> maybe_receive()
-  {
-    if ( datagrams_in_.empty() ) {
-      return {};
-    }
+  // Access queue of Internet datagrams that have been received (taking from each receive queue in turn)
+  std::optional<InternetDatagram> maybe_receive();
 
-    InternetDatagram datagram = std::move( datagrams_in_.front() );
-    datagrams_in_.pop();
-    return datagram;
+  // Same, but swaps the next datagram into `datagram` (and the old contents of `datagram` into the
+  // queue, for reuse). Returns false if there wasn't one.
+  bool maybe_receive( InternetDatagram& datagram );
+
+  // Same, from one receive queue only. Each queue can have its own consumer thread.
+  bool maybe_receive( size_t queue, InternetDatagram& datagram )
+  {
+    return queues_.at( queue ).ring.pop_swap( datagram );
   }
+
+  ReceiveQueueStats receive_queue_stats( size_t queue ) const;
 };
 
 // A router that has multiple network interfaces and
 // performs longest-prefix-match routing between them.
 class Router
 {
+public:
+  // A route's action: <interface_num, next_hop_addr>. (no next hop means the destination is directly attached)
+  using RouteEntry = ForwardingTable::RouteEntry;
+
+private:
   // The router's collection of network interfaces
   std::vector<AsyncNetworkInterface> interfaces_ {};
-  //List of 33 entries of maps from prefix_max -> <interface_num, next_hop_addr> tuples, Indexed by length of prefix match required. 
-  std::unordered_map<uint32_t, std::pair<size_t, std::optional<uint32_t>>> routing_table_[33];
+
+  //Memory for the forwarding tables, once they're on huge pages: a pool of freed blocks in front of the 2 MiB pages.
+  //(declared before the tables, so it outlives them)
+  std::unique_ptr<HugePageResource> huge_pages_ {};
+  std::unique_ptr<std::pmr::synchronized_pool_resource> fib_memory_ {};
+
+  //Two copies of the forwarding table. Lookups read whichever copy fib_ points at, without locking;
+  //route changes are made to the other copy, which is then published, and once no lookup can still
+  //be reading the old copy, the same change is replayed onto it. (see update_fib)
+  ForwardingTable fib_copies_[2] {};
+  std::atomic<const ForwardingTable*> fib_ {&fib_copies_[0]};
+  size_t standby_ = 1; //index of the copy lookups aren't using.
+
+  //Only route changes take this (to keep writers from interleaving), lookups never do.
+  mutable std::mutex update_mutex_ {};
+
+  //Every route that was added, keyed by (network address, prefix length) so a prefix's more-specifics are one contiguous range.
+  //Only kept while FIB compression is on; the forwarding table then holds just the routes their covering route doesn't already imply.
+  std::map<std::pair<uint32_t, uint8_t>, RouteEntry> rib_ {};
+  bool fib_compression_ = false;
 
   //Helpers:
 
-  uint32_t get_prefmask(uint8_t prefix_length, const uint32_t route); //This makes a mask from a route, consisting of the first prefix_length bits, shifted to the rightmost bits.
+  //Applies a change to the standby copy, publishes it, waits out the readers of the old copy, then applies the change to that too.
+  //The change has to be deterministic, so both copies end up the same. Call with update_mutex_ held.
+  template<typename Change>
+  void update_fib(const Change& change){
+    ForwardingTable& next = fib_copies_[standby_];
+    ForwardingTable& old = fib_copies_[1 - standby_];
+
+    change(next);
+    fib_.store(&next, std::memory_order_seq_cst); //publish.
+    RcuEpoch::synchronize(); //no lookup can be in the old copy after this.
+    change(old);
+    standby_ = 1 - standby_;
+  }
+
+  void reaggregate(ForwardingTable& fib, uint32_t network, uint8_t prefix_length) const; //Re-decides which routes belong in the table after the rib_ route at this prefix changed.
+
+  void refresh_route(ForwardingTable& fib, uint32_t network, uint8_t prefix_length, const RouteEntry& entry) const; //Installs or removes a single rib_ route, depending on whether its covering route makes it redundant.
+
+  void recompress(ForwardingTable& fib) const; //Rebuilds the table from scratch out of rib_.
+
+  size_t bulk_install(const RouteSpans& routes); //Adds many routes at once, filling the per-length tables in parallel.
+
+  //The ingress ACL, if one is set. Published like the forwarding table: lookups read acl_ under an RcuEpoch guard,
+  //and a replaced classifier is only freed once no lookup can still be using it.
+  std::unique_ptr<const PacketClassifier> acl_owner_ {};
+  std::atomic<const PacketClassifier*> acl_ {nullptr};
+  std::atomic<uint64_t> acl_denied_ {0};
+
+  void swap_acl(std::unique_ptr<const PacketClassifier> next); //Publishes a new ACL (or none), then frees the old one.
+
+  bool admit(const InternetDatagram& dgram); //Runs the datagram past the ACL, counting it if it's denied.
+
+  //Source NAT, if enabled: connections routed out of napt_interface_ get a public address and port.
+  std::unique_ptr<Napt> napt_ {};
+  size_t napt_interface_ = 0;
+
+  //Sampled flow export, if enabled.
+  std::unique_ptr<FlowTelemetry> telemetry_ {};
+
+  //The datagram being forwarded. Kept between calls, so each datagram taken off an interface's queue reuses the memory of the last.
+  InternetDatagram dgram_ {};
 
   void process_interface(size_t interface_num); //Handles all packages waiting at an interface.
 
   void process_dgram(InternetDatagram& dgram); //This processes the dgram, matching it to an interface to send to, and sending it, or dropping it if required. handling next hop data, etc. 
 
-  std::optional<std::pair<size_t, uint32_t>> find_match(uint32_t dst_ip); //Uses longest prefix matching to find next hop IP and interface num to route packet, if a match is found in the table.
-
 public:
   // Add an interface to the router
   // interface: an already-constructed network interface
@@ -79,6 +198,7 @@ public:
 
   // Access an interface by index
   AsyncNetworkInterface& interface( size_t N ) { return interfaces_.at( N ); }
+  size_t num_interfaces() const { return interfaces_.size(); }
 
   // Add a route (a forwarding rule)
   void add_route( uint32_t route_prefix,
@@ -86,6 +206,116 @@ public:
                   std::optional<Address> next_hop,
                   size_t interface_num );
 
+  // One of several equal-cost ways to reach a prefix
+  struct Path
+  {
+    std::optional<Address> next_hop {};
+    size_t interface_num {};
+  };
+
+  // Add a route with up to ForwardingTable::MAX_PATHS equal-cost paths (ECMP). Each datagram's
+  // source, destination and protocol are hashed to pick a path, so a flow sticks to one path
+  // while flows as a whole are spread evenly. Calling this again for the same prefix with paths
+  // added or removed only moves the flows that have to move (resilient hashing).
+  void add_route( uint32_t route_prefix, uint8_t prefix_length, const std::vector<Path>& paths );
+
+  Router() = default;
+  Router( const Router& other ) = delete;
+  Router& operator=( const Router& other ) = delete;
+
+  // Use longest prefix matching to find the (interface num, next hop IP) to route a packet to dst_ip,
+  // if a match is found in the table. Safe to call from any number of threads while routes are
+  // being changed: it never blocks, and sees the table either before or after each change.
+  // If the route has several paths, `flow` (see flow_hash) picks one.
+  std::optional<std::pair<size_t, uint32_t>> find_match( uint32_t dst_ip, uint32_t flow = 0 ) const;
+
+  // Put a Bloom filter per prefix length in front of the routing table, so that a lookup only
+  // probes the hash tables for lengths that might match (usually just one), instead of every
+  // length from 32 down to the first hit.
+  void set_bloom_lookup( bool enabled );
+
+  // Size of the forwarding table, before and after compression. Memory is approximate, and counts
+  // both copies of the lookup table (see fib_copies_).
+  struct FibStats
+  {
+    size_t routes_added {};     // distinct routes given to add_route
+    size_t routes_installed {}; // routes actually in the lookup table
+    size_t fib_bytes {};        // lookup-table memory
+    size_t rib_bytes {};        // memory of the full route set compression keeps on the side
+    int64_t bytes_saved {};     // net of both, against the uncompressed table (negative: costs more)
+  };
+
+  // Drop routes that are more-specifics of a covering route with the same interface and next hop.
+  // Lookups give exactly the same answers with fewer table entries. While this is on, the full set
+  // of routes is kept on the side, and every add_route only re-aggregates the routes under the
+  // changed prefix. That side copy can cost more memory than the smaller table saves (fib_stats
+  // reports both): what compression buys is fewer entries to probe and keep in cache.
+  void set_fib_compression( bool enabled );
+
+  FibStats fib_stats() const;
+
+  // Load a text route dump (one "prefix/length,next hop or direct,interface" per line, see
+  // parse_route_dump) in one pass: the file is parsed on several threads, bucketed by prefix
+  // length, and each length's table is sized once and filled in parallel. Unlike add_route,
+  // nothing is logged per route. Returns the number of routes loaded.
+  size_t load_routes( const std::string& path );
+
+  // The same, for routes already in table form (e.g. computed by a simulator or a controller)
+  size_t load_routes( const RoutesByLength& routes );
+
+  // Write the routes to a compact binary FIB image, and load one back (mapped read-only and
+  // bulk-inserted, with no parsing). This spares a restart the parsing of a route dump, but not
+  // building the tables: both copies are filled from the image, so a restart still takes time in
+  // proportion to the number of routes (see FibImage). Multipath routes can't be written to an
+  // image (saving throws std::runtime_error).
+  void save_fib_image( const std::string& path ) const;
+  size_t load_fib_image( const std::string& path );
+
+  // Save every interface's ARP table, with the time each entry has left, and load it back into a
+  // restarted router, so it can forward at once instead of re-resolving every neighbour in a burst
+  // of broadcasts. Entries that would have expired while the router was down are skipped, as are
+  // entries for interfaces that no longer exist or have changed address; the rest are restored
+  // stale, and checked lazily (see NetworkInterface::restore_neighbors). Loading throws if the
+  // file can't be read, and std::runtime_error if it's malformed. Returns the number restored.
+  void save_neighbors( const std::string& path ) const;
+  size_t load_neighbors( const std::string& path );
+
+  // Move the forwarding tables (and their Bloom filters) into memory backed by 2 MiB pages (see
+  // HugePageResource), so random lookups into a large FIB miss the TLB far less often. Every route
+  // added afterwards goes there too, so this is best done before loading routes. Returns the
+  // backing obtained: hugetlbfs pages if the kernel has some reserved, otherwise transparent huge
+  // pages if they're enabled, otherwise small pages.
+  PageBacking enable_huge_pages();
+
+  // The backing of the forwarding tables' memory (SMALL, unless enable_huge_pages() got better)
+  PageBacking fib_page_backing() const;
+
+  // Filter datagrams as they come in, before they're routed: the first rule that matches a
+  // datagram's addresses, protocol and ports decides whether it's forwarded or dropped (see
+  // PacketClassifier). The rules are compiled here, on the calling thread, then swapped in
+  // atomically, so routing never sees a half-updated rule set and never waits for one.
+  // Throws std::runtime_error for a malformed rule, leaving the current ACL in place.
+  void set_acl( const std::vector<AclRule>& rules, AclRule::Action default_action = AclRule::Action::PERMIT );
+  void clear_acl();
+
+  // Datagrams the ACL has dropped
+  uint64_t acl_denied() const { return acl_denied_.load( std::memory_order_relaxed ); }
+
+  // Source-NAT the TCP and UDP connections routed out of `outside_interface` (see Napt), and
+  // translate what comes back to the public addresses. Other traffic to or from the inside
+  // through that interface is dropped. Set this up before routing starts.
+  void enable_napt( size_t outside_interface, const Napt::Config& config );
+  const Napt* napt() const { return napt_.get(); }
+
+  // Sample about 1 in config.sampling_interval datagrams as they come in (after the ACL), and
+  // export flow records for them to a collector over UDP (see FlowTelemetry). Set this up
+  // before routing starts.
+  void enable_telemetry( const FlowTelemetry::Config& config );
+  FlowTelemetry* telemetry() { return telemetry_.get(); }
+
+  // Advance the router's clock, timing out idle NAT connections and exporting idle flows. (not from inside route())
+  void tick( size_t ms_since_last_tick );
+
   // Route packets between the interfaces. For each interface, use the
   // maybe_receive() method to consume every incoming datagram and
   // send it on one of interfaces to the correct next hop. The router
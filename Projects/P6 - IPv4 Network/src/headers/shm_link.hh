@@ -0,0 +1,75 @@
+#pragma once
+
+#include "frame_link.hh"
+#include "mmap_region.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+// Shape of a shared-memory link, the same in both directions
+struct ShmLinkConfig
+{
+  size_t ring_slots = 1024;                         // frames a direction can hold (a power of two)
+  size_t frame_size = FrameLink::DEFAULT_FRAME_SIZE; // largest frame it carries
+};
+
+// A link through shared memory, in the style of memif: frames between processes on one host
+// never cross the kernel.
+//
+// Both ends map one memfd region holding, for each direction, a ring of descriptors (offset
+// and length of a frame) and a packet buffer per ring slot. The sender writes the frame into
+// the next free slot's buffer and publishes it by advancing the ring's tail; the receiver reads
+// it out and advances the head. Each ring has exactly one writer of each index, so no locks
+// are needed.
+//
+// A receiver with nothing to do can sleep in wait() (or poll wakeup_fd() from its event loop):
+// it flags itself as waiting, and the next sender to publish a frame kicks its eventfd. A busy
+// receiver never sets the flag, so a busy link makes no system calls at all.
+//
+// The region and eventfds can be handed to another process by fork() or over a Unix socket,
+// and the other end rebuilt there from them.
+class ShmLink : public FrameLink
+{
+public:
+  static constexpr uint32_t MAGIC = 0x6d656d31; // "mem1"
+
+  // Both ends of a new link
+  static std::pair<ShmLink, ShmLink> make_pair( const ShmLinkConfig& config = {} );
+
+  // One end of an existing link, from its memfd, the eventfd that wakes this end and the one that
+  // wakes the peer. `side` is 0 or 1 (the peer's is the other). Throws if the region isn't a link.
+  ShmLink( FileDescriptor&& memory, FileDescriptor&& wake_me, FileDescriptor&& wake_peer, unsigned side );
+
+  bool send( const EthernetFrame& frame ) override;
+  bool recv( EthernetFrame& frame ) override;
+  bool wait( int timeout_ms ) override;
+
+  // Readable when this end has been woken (a caller polling it must still call wait() or recv()
+  // to rearm, as a frame may already be waiting)
+  const FileDescriptor& wakeup_fd() const { return wake_me_; }
+
+  // What's needed to rebuild this end in another process
+  const FileDescriptor& memory_fd() const { return memory_; }
+  const FileDescriptor& peer_wakeup_fd() const { return wake_peer_; }
+  unsigned side() const { return side_; }
+
+  // Times this end kicked its peer's eventfd
+  uint64_t wakeups_sent() const { return wakeups_sent_; }
+
+private:
+  struct Ring; // (laid out in shm_link.cc)
+
+  FileDescriptor memory_;
+  FileDescriptor wake_me_;
+  FileDescriptor wake_peer_;
+  MMapRegion region_ {};
+  unsigned side_;
+  uint32_t slots_ {};
+  uint32_t frame_size_ {};
+  uint64_t wakeups_sent_ {};
+
+  Ring& ring( unsigned direction ) const; // the ring that side `direction` sends on
+  char* buffer( unsigned direction, uint32_t slot ) const;
+  bool frame_waiting() const;
+};
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "pcap.hh"
+#include "router.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// How to play a trace into a router
+struct ReplayConfig
+{
+  enum class Pace : uint8_t
+  {
+    FAST,     // back to back, in batches, as fast as the router takes them
+    RECORDED, // each frame at its recorded time (relative to the first), scaled by speedup
+  };
+
+  Pace pace = Pace::FAST;
+  double speedup = 1.0; // RECORDED: play the trace this many times faster than it was captured
+  size_t ingress = 0;   // the router interface frames arrive on
+  size_t batch = 64;    // most frames handed to the router between calls to route()
+
+  // Reply to the router's ARP requests as if every next hop were there (with a made-up
+  // Ethernet address), so a router only needs its interfaces and routes set up
+  bool answer_arp = true;
+};
+
+struct ReplayReport
+{
+  uint64_t frames {};    // frames offered
+  uint64_t datagrams {}; // of those, IPv4
+  uint64_t forwarded {}; // IPv4 frames the router sent
+  uint64_t dropped {};   // IPv4 frames offered that never came out (no route, TTL, full queues, ACL...)
+  double seconds {};
+  double pps {}; // frames offered per second
+
+  // From handing a frame to the ingress interface to taking it off an egress one
+  uint64_t latency_p50_ns {};
+  uint64_t latency_p99_ns {};
+  uint64_t latency_max_ns {};
+};
+
+// Play a recorded trace (see PcapReader) into a router's ingress interface, routing and taking
+// everything off every interface after each batch, and report how it went. Forwarded frames
+// are matched to the frames that went in by IPv4 source, destination, protocol and id (the
+// earliest first, if several in flight share those). In RECORDED pace, the router and its
+// interfaces are ticked as the replay's clock advances.
+ReplayReport replay_trace( Router& router, const std::vector<PcapRecord>& trace, const ReplayConfig& config = {} );
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "ethernet_frame.hh"
+#include "ipv4_datagram.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// What synthetic traffic should look like
+struct TrafficConfig
+{
+  enum class Destinations : uint8_t
+  {
+    UNIFORM,  // any prefix equally likely
+    ZIPF,     // the i-th prefix (in list order) weighted 1 / (i + 1)^zipf_exponent
+    LOCALITY, // most new flows go near where a recent flow went
+  };
+
+  struct PacketSize
+  {
+    uint16_t bytes {}; // IPv4 total length
+    double weight {};
+  };
+
+  // The simple IMIX: 7 : 4 : 1 of 40, 576 and 1500-byte datagrams
+  static std::vector<PacketSize> imix() { return { { 40, 7 }, { 576, 4 }, { 1500, 1 } }; }
+
+  // (prefix, length) pairs destinations are drawn from; all of IPv4 if empty
+  std::vector<std::pair<uint32_t, uint8_t>> prefixes {};
+  Destinations destinations = Destinations::UNIFORM;
+  double zipf_exponent = 1.0;
+  double locality = 0.8; // LOCALITY: chance a new flow stays in the /24 (or prefix) of one of the last few
+
+  size_t flows = 1024;   // distinct 5-tuples; each packet belongs to one picked at random
+  size_t packets = 65536;
+  std::vector<PacketSize> sizes = imix();
+  double tcp_fraction = 0.8; // of flows (the rest are UDP)
+
+  uint32_t source_prefix = 0x0a000000; // sources are random addresses in 10.0.0.0/8
+  uint8_t source_length = 8;
+
+  EthernetAddress ethernet_src {}; // the frames' addresses
+  EthernetAddress ethernet_dst {};
+
+  uint64_t seed = 1;
+};
+
+// `count` random prefixes with lengths in roughly the mix of a full Internet routing table
+// (mostly /24s, then /22-/23s, a few /16s and shorter)
+std::vector<std::pair<uint32_t, uint8_t>> random_prefixes( size_t count, uint64_t seed );
+
+// A precomputed stream of traffic, as datagrams and as the Ethernet frames that carry them.
+//
+// Everything is generated up front, so replaying it costs nothing but the replay. Each flow's
+// TCP/UDP header and payload of each size is one Buffer, shared by all of that flow's
+// datagrams of that size, so a trace of millions of packets is mostly just their IPv4
+// headers. (Buffers are copy-on-write, so whoever rewrites a datagram gets their own copy.)
+// TCP/UDP checksums are left zero; nothing on the forwarding path checks them.
+class TrafficTrace
+{
+public:
+  // Throws std::runtime_error for an unusable config (no flows, no sizes, a size too small
+  // for the IPv4 and TCP headers or with a negative weight, a prefix over 32 bits)
+  explicit TrafficTrace( const TrafficConfig& config );
+
+  const std::vector<InternetDatagram>& datagrams() const { return datagrams_; }
+  const std::vector<EthernetFrame>& frames() const { return frames_; }
+  size_t size() const { return datagrams_.size(); }
+
+  // Total IPv4 bytes
+  uint64_t bytes() const { return bytes_; }
+
+private:
+  std::vector<InternetDatagram> datagrams_ {};
+  std::vector<EthernetFrame> frames_ {};
+  uint64_t bytes_ {};
+};
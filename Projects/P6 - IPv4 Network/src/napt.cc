@@ -0,0 +1,488 @@
+#include "napt.hh"
+
+#include "checksum.hh"
+#include "epoch.hh"
+#include "packet_classifier.hh"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+namespace {
+
+// Where the TCP or UDP checksum sits in the segment
+size_t checksum_offset( uint8_t proto )
+{
+  return proto == IPv4Header::PROTO_TCP ? 16 : 6;
+}
+
+size_t payload_size( const InternetDatagram& dgram )
+{
+  size_t size = 0;
+  for ( const auto& b : dgram.payload ) {
+    size += b.size();
+  }
+  return size;
+}
+
+uint16_t read16( const string& bytes, size_t offset )
+{
+  return ( static_cast<uint8_t>( bytes[offset] ) << 8 ) | static_cast<uint8_t>( bytes[offset + 1] );
+}
+
+void write16( string& bytes, size_t offset, uint16_t value )
+{
+  bytes[offset] = static_cast<char>( value >> 8 );
+  bytes[offset + 1] = static_cast<char>( value & 0xff );
+}
+
+// Replace the source (or destination) address and port of a TCP or UDP datagram, patching the
+// IPv4 and TCP/UDP checksums for the change. The caller has checked the segment is long enough.
+void rewrite_endpoint( InternetDatagram& dgram, bool source, uint32_t address, uint16_t port )
+{
+  const size_t cksum_at = checksum_offset( dgram.header.proto );
+  if ( dgram.payload.front().size() < cksum_at + 2 ) {
+    // the segment's header is split across buffers: gather it into one (rare)
+    string joined;
+    for ( const auto& b : dgram.payload ) {
+      joined.append( b );
+    }
+    dgram.payload.assign( 1, Buffer { std::move( joined ) } );
+  }
+  string& segment = dgram.payload.front(); // (a private copy, if the memory was shared)
+
+  uint32_t& header_address = source ? dgram.header.src : dgram.header.dst;
+  const uint32_t old_address = header_address;
+  const size_t port_at = source ? 0 : 2;
+  const uint16_t old_port = read16( segment, port_at );
+
+  dgram.header.cksum = InternetChecksum::adjust32( dgram.header.cksum, old_address, address );
+  header_address = address;
+
+  // the TCP/UDP checksum covers the addresses (in the pseudo-header) and the ports.
+  // A zero UDP checksum means there isn't one, and stays that way.
+  uint16_t cksum = read16( segment, cksum_at );
+  if ( dgram.header.proto == IPv4Header::PROTO_TCP || cksum != 0 ) {
+    cksum = InternetChecksum::adjust32( cksum, old_address, address );
+    cksum = InternetChecksum::adjust( cksum, old_port, port );
+    if ( dgram.header.proto == IPv4Header::PROTO_UDP && cksum == 0 ) {
+      cksum = 0xffff;
+    }
+    write16( segment, cksum_at, cksum );
+  }
+  write16( segment, port_at, port );
+}
+
+} // namespace
+
+Napt::Napt( const Config& config )
+  : config_( config ), index_mask_(), mappings_(), by_inside_(), by_public_(), workers_()
+{
+  if ( config.public_addresses == 0 || config.public_addresses > UINT16_MAX ) {
+    throw runtime_error( "NAPT needs between 1 and 65535 public addresses" );
+  }
+  if ( config.first_port > config.last_port ) {
+    throw runtime_error( "NAPT port range ends before it starts" );
+  }
+  if ( config.max_mappings == 0 || config.max_mappings >= ( size_t { 1 } << 31 ) ) {
+    throw runtime_error( "NAPT table size must be between 1 and 2^31 - 1 connections" );
+  }
+  if ( config.workers == 0 || config.workers > config.max_mappings ) {
+    throw runtime_error( "NAPT needs between 1 and max_mappings workers" );
+  }
+  if ( config.wheel_granularity_ms == 0 ) {
+    throw runtime_error( "NAPT timer wheel granularity must be at least 1 ms" );
+  }
+
+  size_t index_size = 2;
+  while ( index_size < 2 * config.max_mappings ) {
+    index_size *= 2;
+  }
+  index_mask_ = index_size - 1;
+  mappings_ = make_unique<Mapping[]>( config.max_mappings );
+  by_inside_ = make_unique<atomic<uint32_t>[]>( index_size );
+  by_public_ = make_unique<atomic<uint32_t>[]>( index_size );
+
+  // deal the slab and the port pool out to the workers in contiguous shares
+  const uint64_t ports = uint64_t { config.public_addresses } * ( config.last_port - config.first_port + 1U );
+  workers_ = vector<Worker>( config.workers );
+  for ( size_t i = 0; i < config.workers; i++ ) {
+    Worker& w = workers_[i];
+    w.first_mapping = w.next_unused_mapping = i * config.max_mappings / config.workers;
+    w.end_mapping = ( i + 1 ) * config.max_mappings / config.workers;
+    w.first_port_id = w.next_unused_port_id = i * ports / config.workers;
+    w.end_port_id = ( i + 1 ) * ports / config.workers;
+
+    // a worker never has more of either free than it has had in use at once, so this is all the
+    // memory the free lists will ever need
+    const size_t share = w.end_mapping - w.first_mapping;
+    w.free_mappings.reserve( share );
+    w.free_port_ids.reserve( share );
+    w.retired.reserve( share );
+    w.wheel.assign( WHEEL_SLOTS, NONE );
+  }
+}
+
+Napt::~Napt() = default;
+
+uint64_t Napt::key_hash( uint8_t proto, uint32_t addr, uint16_t port, uint32_t remote_addr, uint16_t remote_port )
+{
+  // two rounds of the splitmix64 finalizer over the 5-tuple
+  uint64_t z = ( ( uint64_t { addr } << 32 ) | remote_addr ) + 0x9e3779b97f4a7c15ULL;
+  z = ( z ^ ( z >> 30 ) ) * 0xbf58476d1ce4e5b9ULL;
+  z ^= ( uint64_t { proto } << 32 ) | ( uint64_t { port } << 16 ) | remote_port;
+  z = ( z ^ ( z >> 27 ) ) * 0x94d049bb133111ebULL;
+  return z ^ ( z >> 31 );
+}
+
+uint64_t Napt::timeout( uint8_t proto ) const
+{
+  return proto == IPv4Header::PROTO_TCP ? config_.tcp_timeout_ms : config_.udp_timeout_ms;
+}
+
+uint32_t Napt::find( const atomic<uint32_t>* index, uint64_t hash, bool inside, const Mapping& key ) const
+{
+  for ( size_t probe = 0, i = hash & index_mask_; probe < MAX_PROBE; probe++, i = ( i + 1 ) & index_mask_ ) {
+    const uint32_t entry = index[i].load( memory_order_seq_cst ); // (pairs with the RcuEpoch slot store)
+    if ( entry == EMPTY ) {
+      return NONE;
+    }
+    if ( entry == TOMBSTONE ) {
+      continue;
+    }
+
+    const Mapping& m = mappings_[entry - 1];
+    if ( m.proto == key.proto && m.remote_address == key.remote_address && m.remote_port == key.remote_port
+         && ( inside ? m.inside_address == key.inside_address && m.inside_port == key.inside_port
+                     : m.public_address == key.public_address && m.public_port == key.public_port ) ) {
+      return entry - 1;
+    }
+  }
+  return NONE;
+}
+
+size_t Napt::insert( atomic<uint32_t>* index, uint64_t hash, uint32_t mapping, size_t limit )
+{
+  const size_t home = hash & index_mask_;
+  size_t probe = 0;
+  while ( probe < limit ) {
+    const size_t i = ( home + probe ) & index_mask_;
+    uint32_t entry = index[i].load( memory_order_relaxed );
+    if ( ( entry != EMPTY && entry != TOMBSTONE )
+         || not index[i].compare_exchange_strong( entry, mapping + 1, memory_order_seq_cst, memory_order_relaxed ) ) {
+      probe++;
+      continue;
+    }
+
+    //another worker may have cleared a slot we passed, thinking nothing lay beyond it. it looks at
+    //our slot after clearing, and we look at its slot after filling ours (all sequentially
+    //consistent), so at least one of us notices: if it's us, start again from home.
+    bool reachable = true;
+    for ( size_t before = 0; before < probe && reachable; before++ ) {
+      reachable = index[( home + before ) & index_mask_].load( memory_order_seq_cst ) != EMPTY;
+    }
+    if ( reachable ) {
+      return probe;
+    }
+    index[i].store( TOMBSTONE, memory_order_seq_cst );
+    clear_tombstones( index, i );
+    probe = 0;
+  }
+  return MAX_PROBE; // too crowded around here: treat the table as full
+}
+
+void Napt::erase( atomic<uint32_t>* index, uint64_t hash, uint32_t mapping, Worker& worker )
+{
+  for ( size_t probe = 0, i = hash & index_mask_; probe < MAX_PROBE; probe++, i = ( i + 1 ) & index_mask_ ) {
+    if ( index[i].load( memory_order_relaxed ) == mapping + 1 ) {
+      index[i].store( TOMBSTONE, memory_order_seq_cst );
+      if ( not clear_tombstones( index, i ) ) {
+        worker.tombstones++;
+      }
+      return;
+    }
+  }
+}
+
+// Empty a tombstone whose next slot is empty (no probe needs to pass it), then the ones before
+// it in turn. Returns whether `slot` was emptied.
+bool Napt::clear_tombstones( atomic<uint32_t>* index, size_t slot )
+{
+  bool cleared = false;
+  for ( size_t i = slot;; i = ( i - 1 ) & index_mask_ ) {
+    const size_t next = ( i + 1 ) & index_mask_;
+    uint32_t entry = TOMBSTONE;
+    if ( index[next].load( memory_order_seq_cst ) != EMPTY
+         || not index[i].compare_exchange_strong( entry, EMPTY, memory_order_seq_cst ) ) {
+      return cleared; // (or an insert took the tombstone)
+    }
+    if ( index[next].load( memory_order_seq_cst ) != EMPTY ) {
+      // an insert filled the next slot meanwhile, probing through this one: put it back
+      entry = EMPTY;
+      index[i].compare_exchange_strong( entry, TOMBSTONE, memory_order_seq_cst );
+      return cleared;
+    }
+    cleared = true;
+  }
+}
+
+// Move a mapping's index entry to the first tombstone before it, if there is one
+void Napt::relocate( atomic<uint32_t>* index, uint64_t hash, uint32_t mapping )
+{
+  for ( size_t probe = 0; probe < MAX_PROBE; probe++ ) {
+    const size_t i = ( hash + probe ) & index_mask_;
+    if ( index[i].load( memory_order_relaxed ) == mapping + 1 ) {
+      // (a lookup meanwhile finds the entry in either place)
+      if ( probe > 0 && insert( index, hash, mapping, probe ) < probe ) {
+        index[i].store( TOMBSTONE, memory_order_seq_cst );
+        clear_tombstones( index, i );
+      }
+      return;
+    }
+  }
+}
+
+// Move the worker's connections back over tombstones, so probes (especially for connections
+// that don't exist) stop wading through them
+void Napt::compact( Worker& worker )
+{
+  for ( const uint32_t head : worker.wheel ) {
+    for ( uint32_t mapping = head; mapping != NONE; mapping = mappings_[mapping].wheel_next ) {
+      const Mapping& m = mappings_[mapping];
+      relocate( by_inside_.get(),
+                key_hash( m.proto, m.inside_address, m.inside_port, m.remote_address, m.remote_port ),
+                mapping );
+      relocate( by_public_.get(),
+                key_hash( m.proto, m.public_address, m.public_port, m.remote_address, m.remote_port ),
+                mapping );
+    }
+  }
+  worker.tombstones = 0;
+}
+
+void Napt::schedule( Worker& worker, uint32_t mapping )
+{
+  Mapping& m = mappings_[mapping];
+  const uint64_t deadline = m.last_seen.load( memory_order_relaxed ) + timeout( m.proto );
+  const uint64_t tick = max( deadline / config_.wheel_granularity_ms, worker.wheel_tick );
+  uint32_t& head = worker.wheel[tick % WHEEL_SLOTS];
+  m.wheel_next = head;
+  head = mapping;
+}
+
+uint32_t Napt::create( Worker& worker, const Mapping& key )
+{
+  uint32_t mapping = NONE;
+  if ( not worker.free_mappings.empty() ) {
+    mapping = worker.free_mappings.back();
+    worker.free_mappings.pop_back();
+  } else if ( worker.next_unused_mapping < worker.end_mapping ) {
+    mapping = worker.next_unused_mapping++;
+  }
+
+  uint32_t port_id = NONE;
+  if ( not worker.free_port_ids.empty() ) {
+    port_id = worker.free_port_ids.back();
+    worker.free_port_ids.pop_back();
+  } else if ( worker.next_unused_port_id < worker.end_port_id ) {
+    port_id = worker.next_unused_port_id++;
+  }
+
+  if ( mapping == NONE || port_id == NONE ) {
+    if ( mapping != NONE ) {
+      worker.free_mappings.push_back( mapping );
+    }
+    if ( port_id != NONE ) {
+      worker.free_port_ids.push_back( port_id );
+    }
+    worker.exhausted.fetch_add( 1, memory_order_relaxed );
+    return NONE;
+  }
+
+  // nothing can be reading this slot: it's either fresh or was retired past a grace period
+  const uint32_t ports_per_address = config_.last_port - config_.first_port + 1U;
+  Mapping& m = mappings_[mapping];
+  m.proto = key.proto;
+  m.inside_address = key.inside_address;
+  m.inside_port = key.inside_port;
+  m.remote_address = key.remote_address;
+  m.remote_port = key.remote_port;
+  m.public_address = config_.public_address + port_id / ports_per_address;
+  m.public_port = config_.first_port + port_id % ports_per_address;
+  m.last_seen.store( now_ms_.load( memory_order_relaxed ), memory_order_relaxed );
+
+  const uint64_t inside_hash
+    = key_hash( m.proto, m.inside_address, m.inside_port, m.remote_address, m.remote_port );
+  const uint64_t public_hash
+    = key_hash( m.proto, m.public_address, m.public_port, m.remote_address, m.remote_port );
+  if ( insert( by_public_.get(), public_hash, mapping ) == MAX_PROBE ) {
+    worker.free_mappings.push_back( mapping );
+    worker.free_port_ids.push_back( port_id );
+    worker.exhausted.fetch_add( 1, memory_order_relaxed );
+    return NONE;
+  }
+  if ( insert( by_inside_.get(), inside_hash, mapping ) == MAX_PROBE ) {
+    // a lookup may have seen the public entry already, so the slot waits out a grace period
+    erase( by_public_.get(), public_hash, mapping, worker );
+    worker.retired.push_back( mapping );
+    worker.exhausted.fetch_add( 1, memory_order_relaxed );
+    return NONE;
+  }
+
+  schedule( worker, mapping );
+  worker.created.fetch_add( 1, memory_order_relaxed );
+  return mapping;
+}
+
+bool Napt::translate_outbound( InternetDatagram& dgram, size_t worker )
+{
+  const auto ports = l4_ports( dgram );
+  if ( not ports.has_value() || payload_size( dgram ) < checksum_offset( dgram.header.proto ) + 2 ) {
+    return false;
+  }
+
+  Mapping key;
+  key.proto = dgram.header.proto;
+  key.inside_address = dgram.header.src;
+  key.inside_port = ports->first;
+  key.remote_address = dgram.header.dst;
+  key.remote_port = ports->second;
+
+  const RcuEpoch::ReadGuard guard;
+  uint32_t mapping = find( by_inside_.get(),
+                           key_hash( key.proto, key.inside_address, key.inside_port, key.remote_address, key.remote_port ),
+                           true,
+                           key );
+  if ( mapping == NONE ) {
+    mapping = create( workers_.at( worker ), key );
+    if ( mapping == NONE ) {
+      return false;
+    }
+  }
+
+  Mapping& m = mappings_[mapping];
+  const uint64_t now = now_ms_.load( memory_order_relaxed );
+  if ( m.last_seen.load( memory_order_relaxed ) != now ) {
+    m.last_seen.store( now, memory_order_relaxed );
+  }
+  rewrite_endpoint( dgram, true, m.public_address, m.public_port );
+  return true;
+}
+
+bool Napt::translate_inbound( InternetDatagram& dgram )
+{
+  const auto ports = l4_ports( dgram );
+  if ( not ports.has_value() || payload_size( dgram ) < checksum_offset( dgram.header.proto ) + 2 ) {
+    return false;
+  }
+
+  Mapping key;
+  key.proto = dgram.header.proto;
+  key.public_address = dgram.header.dst;
+  key.public_port = ports->second;
+  key.remote_address = dgram.header.src;
+  key.remote_port = ports->first;
+
+  const RcuEpoch::ReadGuard guard;
+  const uint32_t mapping = find( by_public_.get(),
+                                 key_hash( key.proto, key.public_address, key.public_port, key.remote_address, key.remote_port ),
+                                 false,
+                                 key );
+  if ( mapping == NONE ) {
+    return false;
+  }
+
+  Mapping& m = mappings_[mapping];
+  const uint64_t now = now_ms_.load( memory_order_relaxed );
+  if ( m.last_seen.load( memory_order_relaxed ) != now ) {
+    m.last_seen.store( now, memory_order_relaxed );
+  }
+  rewrite_endpoint( dgram, false, m.inside_address, m.inside_port );
+  return true;
+}
+
+void Napt::tick( uint64_t ms_since_last_tick )
+{
+  now_ms_.fetch_add( ms_since_last_tick, memory_order_relaxed );
+}
+
+void Napt::expire( size_t worker )
+{
+  Worker& w = workers_.at( worker );
+  const uint64_t now = now_ms_.load( memory_order_relaxed );
+  const uint64_t target = now / config_.wheel_granularity_ms;
+
+  // after a long gap, one pass over every slot catches everything
+  if ( target >= w.wheel_tick + WHEEL_SLOTS ) {
+    w.wheel_tick = target - WHEEL_SLOTS + 1;
+  }
+
+  const uint32_t ports_per_address = config_.last_port - config_.first_port + 1U;
+  while ( w.wheel_tick <= target ) {
+    uint32_t mapping = exchange( w.wheel[w.wheel_tick % WHEEL_SLOTS], NONE );
+    w.wheel_tick++;
+
+    while ( mapping != NONE ) {
+      Mapping& m = mappings_[mapping];
+      const uint32_t next = m.wheel_next;
+      if ( m.last_seen.load( memory_order_relaxed ) + timeout( m.proto ) > now ) {
+        schedule( w, mapping ); // seen since it was scheduled: check again later
+      } else {
+        erase( by_inside_.get(),
+               key_hash( m.proto, m.inside_address, m.inside_port, m.remote_address, m.remote_port ),
+               mapping,
+               w );
+        erase( by_public_.get(),
+               key_hash( m.proto, m.public_address, m.public_port, m.remote_address, m.remote_port ),
+               mapping,
+               w );
+        w.retired.push_back( mapping );
+        w.expired.fetch_add( 1, memory_order_relaxed );
+      }
+      mapping = next;
+    }
+  }
+
+  // once the worker has left tombstones for half its share of the slab, probes start to drag
+  if ( w.tombstones > ( w.end_mapping - w.first_mapping ) / 2 ) {
+    compact( w );
+  }
+
+  if ( w.retired.empty() ) {
+    return;
+  }
+
+  // once no lookup can still be looking at them, the mappings and their ports are free
+  RcuEpoch::synchronize();
+  for ( const uint32_t mapping : w.retired ) {
+    const Mapping& m = mappings_[mapping];
+    w.free_port_ids.push_back( ( m.public_address - config_.public_address ) * ports_per_address + m.public_port
+                               - config_.first_port );
+    w.free_mappings.push_back( mapping );
+  }
+  w.retired.clear();
+}
+
+Napt::Stats Napt::stats() const
+{
+  Stats stats;
+  for ( const Worker& w : workers_ ) {
+    stats.created += w.created.load( memory_order_relaxed );
+    stats.expired += w.expired.load( memory_order_relaxed );
+    stats.exhausted += w.exhausted.load( memory_order_relaxed );
+  }
+  stats.active = stats.created - stats.expired;
+  return stats;
+}
+
+size_t Napt::memory_bytes() const
+{
+  size_t bytes = config_.max_mappings * sizeof( Mapping ) + 2 * ( index_mask_ + 1 ) * sizeof( atomic<uint32_t> );
+  for ( const Worker& w : workers_ ) {
+    bytes += sizeof( Worker ) + w.wheel.capacity() * sizeof( uint32_t )
+             + ( w.free_mappings.capacity() + w.free_port_ids.capacity() + w.retired.capacity() ) * sizeof( uint32_t );
+  }
+  return bytes;
+}
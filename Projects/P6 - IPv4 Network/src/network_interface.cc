@@ -2,6 +2,8 @@
 #include "arp_message.hh"
 #include "ethernet_frame.hh"
 
+#include <algorithm>
+
 using namespace std;
 
 //TODO: DO WE NEED TO PUT THE INTERFACES OWN IP -> MAC ADDRESS MAPPING IN THE ARP TABLE?
@@ -15,7 +17,9 @@ NetworkInterface::NetworkInterface(const EthernetAddress& ethernet_address,
     ip_address_(ip_address),
     arp_table_({}),
     arp_reqs_({}),
-    rtosend_q_() {
+    egress_(),
+    capture_(),
+    stale_() {
 
     cerr << "DEBUG: Network interface has Ethernet address ";
     cerr << to_string(ethernet_address_);
@@ -53,8 +57,25 @@ ARPMessage NetworkInterface::construct_arp( const uint16_t opcode,
 }
 
 void NetworkInterface::queue_ip_packet(const InternetDatagram& dgram, const EthernetAddress& target_mac_addr){
-    EthernetFrame new_frame = construct_frame(ethernet_address_, target_mac_addr, EthernetHeader::TYPE_IPv4, serialize(dgram)); //create the eth frame.
-    rtosend_q_.push(new_frame);
+    //fill in a slot in the send queue (for the datagram's traffic class) directly. The slot still holds an old frame, so serializing
+    //over its payload reuses that memory (see Serializer), and the datagram's payload buffers are shared, not copied.
+    const size_t traffic_class = egress_.classify(dgram.header.tos);
+    EthernetFrame* new_frame = egress_.enqueue_slot(traffic_class);
+    if (new_frame == nullptr){
+        return; //that class's queue is full, so the packet is dropped.
+    }
+    new_frame->header.src = ethernet_address_;
+    new_frame->header.dst = target_mac_addr;
+    new_frame->header.type = EthernetHeader::TYPE_IPv4;
+
+    try {
+        Serializer serializer {std::move(new_frame->payload)};
+        dgram.serialize(serializer);
+        new_frame->payload = serializer.output();
+    } catch (...) {
+        egress_.cancel_enqueue(traffic_class); //don't leave a half-built frame on the queue.
+        throw;
+    }
 }
 
 void NetworkInterface::queue_arp_req(const Address& target_addr) {
@@ -68,7 +89,7 @@ void NetworkInterface::queue_arp_req(const Address& target_addr) {
     ARPMessage arp_req = construct_arp(ARPMessage::OPCODE_REQUEST, ethernet_address_, ip_address_, {}, target_addr); //create the request.
     EthernetFrame new_frame = construct_frame(ethernet_address_, ETHERNET_BROADCAST, EthernetHeader::TYPE_ARP, serialize(arp_req)); //create the eth frame.
     //this eth frame will be broadcasted.
-    rtosend_q_.push(new_frame); //push it onto the send queue. 
+    egress_.enqueue_arp(std::move(new_frame)); //push it onto the send queue. 
 }
 
 void NetworkInterface::queue_arp_reply(const Address& target_addr, const EthernetAddress& target_mac_addr) {
@@ -76,7 +97,15 @@ void NetworkInterface::queue_arp_reply(const Address& target_addr, const Etherne
     ARPMessage arp_reply = construct_arp(ARPMessage::OPCODE_REPLY, ethernet_address_, ip_address_, target_mac_addr, target_addr); //create the reply.
     EthernetFrame new_frame = construct_frame(ethernet_address_, target_mac_addr, EthernetHeader::TYPE_ARP, serialize(arp_reply)); //create the eth frame.
 
-    rtosend_q_.push(new_frame); //push it onto the send queue. 
+    egress_.enqueue_arp(std::move(new_frame)); //push it onto the send queue. 
+}
+
+void NetworkInterface::probe(uint32_t target_addr_bin, const EthernetAddress& target_mac_addr) {
+    //Ask the neighbour we think has this IP directly (unicast), rather than the whole link.
+    ARPMessage arp_req = construct_arp(ARPMessage::OPCODE_REQUEST, ethernet_address_, ip_address_, {}, Address::from_ipv4_numeric(target_addr_bin));
+    EthernetFrame new_frame = construct_frame(ethernet_address_, target_mac_addr, EthernetHeader::TYPE_ARP, serialize(arp_req));
+
+    egress_.enqueue_arp(std::move(new_frame));
 }
 
 
@@ -88,12 +117,19 @@ void NetworkInterface::queue_arp_reply(const Address& target_addr, const Etherne
 // Address::ipv4_numeric() method.
 void NetworkInterface::send_datagram(const InternetDatagram& dgram, 
                                      const Address& next_hop){
-    EthernetAddress mac_addr;
-
     //First we check if we know the MAC address of the next hop:
-    if (arp_table_.find(next_hop.ipv4_numeric()) != arp_table_.end()){
-        mac_addr = arp_table_[next_hop.ipv4_numeric()].first; //we have the MAC_addr.
-        queue_ip_packet(dgram, mac_addr); //create the ethernet frame for the packet, and queue it to be sent.
+    const auto arp_entry = arp_table_.find(next_hop.ipv4_numeric());
+    if (arp_entry != arp_table_.end()){
+        queue_ip_packet(dgram, arp_entry->second.first); //we have the MAC_addr, so create the ethernet frame for the packet, and queue it to be sent.
+
+        //If the entry came from a snapshot and hasn't been checked yet, check it now (the datagram goes anyway).
+        if (!stale_.empty()){
+            const auto stale_entry = stale_.find(arp_entry->first);
+            if (stale_entry != stale_.end() && stale_entry->second == NOT_PROBED){
+                probe(arp_entry->first, arp_entry->second.first);
+                stale_entry->second = 0;
+            }
+        }
 
     } else {
         queue_arp_req(next_hop); //sends a request for the destination mac_address. (or not if we already requested it recently)
@@ -101,14 +137,9 @@ void NetworkInterface::send_datagram(const InternetDatagram& dgram,
     }
 }
 
-optional<InternetDatagram> NetworkInterface::recieve_ipdgram(const EthernetFrame& frame){
-    //attempt to parse, returning null on error. 
-    InternetDatagram incoming_dgram = {};
-    if (parse(incoming_dgram, (&frame)->payload)){
-        return incoming_dgram;
-    }
-
-    return {};
+bool NetworkInterface::recieve_ipdgram(const EthernetFrame& frame, InternetDatagram& dgram){
+    //attempt to parse, returning false on error. (the datagram's payload refers to the frame's buffers, nothing is copied)
+    return parse(dgram, frame.payload);
 }
 
 void NetworkInterface::release_reqs_q(uint32_t target_addr_bin, EthernetAddress target_mac_addr){
@@ -132,6 +163,7 @@ void NetworkInterface::recieve_arp(const EthernetFrame& frame){
     if (parse(arp_reply, frame.payload)){ //The payload is an ARP Reply
         arp_table_[arp_reply.sender_ip_address].first = arp_reply.sender_ethernet_address; //add or replace an entry in the table. 
         arp_table_[arp_reply.sender_ip_address].second = 0;
+        stale_.erase(arp_reply.sender_ip_address); //confirmed, if it was restored.
 
         release_reqs_q(arp_reply.sender_ip_address, arp_reply.sender_ethernet_address); //Queue all packets that were waiting for this MAC address to be sent.
     }
@@ -145,6 +177,7 @@ void NetworkInterface::reply_arp(const EthernetFrame& frame){
     if (parse(arp_req, frame.payload)){ //The payload is an ARP Req
         arp_table_[arp_req.sender_ip_address].first = arp_req.sender_ethernet_address; //add or replace an entry in the table. 
         arp_table_[arp_req.sender_ip_address].second = 0;
+        stale_.erase(arp_req.sender_ip_address);
 
         release_reqs_q(arp_req.sender_ip_address, arp_req.sender_ethernet_address); //Queue all packets that were waiting for this MAC address to be sent.
         
@@ -158,13 +191,25 @@ void NetworkInterface::reply_arp(const EthernetFrame& frame){
 
 // frame: the incoming Ethernet frame
 optional<InternetDatagram> NetworkInterface::recv_frame(const EthernetFrame& frame) {
+    InternetDatagram dgram;
+    if (recv_frame(frame, dgram)){
+        return dgram;
+    }
+    return {};
+}
+
+bool NetworkInterface::recv_frame(const EthernetFrame& frame, InternetDatagram& dgram) {
+
+    if (capture_){
+        capture_(frame, false);
+    }
 
     //First we check if the frame was destined for this interface specifically.
     if (frame.header.dst == ethernet_address_){
 
         if (frame.header.type == EthernetHeader::TYPE_IPv4){ //This is an ipv4 datagram destined for the interface
 
-            return recieve_ipdgram(frame);
+            return recieve_ipdgram(frame, dgram);
 
         } else { //handle the frame if it is an ARP reply.
             recieve_arp(frame);
@@ -178,7 +223,7 @@ optional<InternetDatagram> NetworkInterface::recv_frame(const EthernetFrame& fra
     }
 
 
-    return {}; 
+    return false; 
 }
 
 // ms_since_last_tick: the number of milliseconds since the last call to this method
@@ -189,7 +234,8 @@ void NetworkInterface::tick(const size_t ms_since_last_tick){
         auto& key_val = it->second;
         key_val.second += ms_since_last_tick; // Add time since last tick
     
-        if (key_val.second >= 30000) { // check for 30-second limit
+        if (key_val.second >= ARP_ENTRY_TTL_MS) { // check for 30-second limit
+            stale_.erase(it->first);
             it = arp_table_.erase(it);  
         } else {
             ++it; 
@@ -201,7 +247,7 @@ void NetworkInterface::tick(const size_t ms_since_last_tick){
         auto& key_val = it->second;
         key_val.second += ms_since_last_tick; // Add time since last tick
     
-        if (key_val.second >= 5000) { // check for 5-second limit
+        if (key_val.second >= ARP_REQUEST_TIMEOUT_MS) { // check for 5-second limit
             it = arp_reqs_.erase(it);  
         } else {
             ++it; 
@@ -209,16 +255,64 @@ void NetworkInterface::tick(const size_t ms_since_last_tick){
     }
 
     //Can't combine these without using templates, as the maps are of different types. 
+
+    //Restored entries whose probe went unanswered are dropped, so the next packet resolves them afresh.
+    for (auto it = stale_.begin(); it != stale_.end(); ) {
+        if (it->second != NOT_PROBED){
+            it->second += ms_since_last_tick;
+            if (it->second >= ARP_REQUEST_TIMEOUT_MS){
+                arp_table_.erase(it->first);
+                it = stale_.erase(it);
+                continue;
+            }
+        }
+        ++it;
+    }
+
+    egress_.tick(ms_since_last_tick); //refill the shaper's token bucket.
+}
+
+vector<NetworkInterface::Neighbor> NetworkInterface::neighbors() const {
+    vector<Neighbor> neighbors;
+    neighbors.reserve(arp_table_.size());
+    for (const auto& [ip, entry] : arp_table_){
+        neighbors.push_back({ip, entry.first, ARP_ENTRY_TTL_MS - entry.second});
+    }
+    return neighbors;
+}
+
+size_t NetworkInterface::restore_neighbors(const vector<Neighbor>& neighbors){
+    size_t restored = 0;
+    for (const auto& neighbor : neighbors){
+        if (neighbor.ttl_ms == 0 || arp_table_.find(neighbor.ip_address) != arp_table_.end()){
+            continue; //expired, or we've already learned something newer.
+        }
+        //age the entry so it expires when it would have done.
+        arp_table_[neighbor.ip_address] = {neighbor.ethernet_address, ARP_ENTRY_TTL_MS - min(neighbor.ttl_ms, ARP_ENTRY_TTL_MS)};
+        stale_[neighbor.ip_address] = NOT_PROBED;
+        restored++;
+    }
+    return restored;
 }
 
 optional<EthernetFrame> NetworkInterface::maybe_send()
 {   
     //Check for a frame on the queue. If there is one, pop it off, and send it. 
-    if (!rtosend_q_.empty()){
-        EthernetFrame nextframe = rtosend_q_.front();
-        rtosend_q_.pop();
+    EthernetFrame nextframe;
+    if (maybe_send(nextframe)){
         return nextframe;
     }
 
     return {}; 
 }
+
+bool NetworkInterface::maybe_send(EthernetFrame& frame)
+{
+    if (not egress_.dequeue(frame)){ //the caller's old frame goes back in the queue, to be reused.
+        return false;
+    }
+    if (capture_){
+        capture_(frame, true);
+    }
+    return true;
+}
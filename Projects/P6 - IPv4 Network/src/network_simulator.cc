@@ -0,0 +1,428 @@
+#include "network_simulator.hh"
+
+#include <algorithm>
+#include <random>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+using namespace std;
+
+namespace {
+
+constexpr uint32_t HOST_BLOCKS = 0x0a000000; // 10.0.0.0/8, a /24 per router
+constexpr uint32_t LINK_SUBNETS = 0x64400000; // 100.64.0.0/10, a /30 per router-to-router link
+constexpr size_t MAX_LINKS = size_t { 1 } << 20;
+constexpr size_t MAX_ROUTERS = size_t { 1 } << 16;
+
+uint64_t mix( uint64_t x )
+{
+  x = ( x ^ ( x >> 30 ) ) * 0xbf58476d1ce4e5b9ULL;
+  x = ( x ^ ( x >> 27 ) ) * 0x94d049bb133111ebULL;
+  return x ^ ( x >> 31 );
+}
+
+} // namespace
+
+void NetworkSimulator::schedule( Time at, EventKind kind, uint32_t target, uint32_t slot )
+{
+  events_.push( { at, next_seq_++, kind, target, slot } );
+}
+
+AsyncNetworkInterface NetworkSimulator::make_interface( uint32_t address )
+{
+  const uint64_t n = next_ethernet_++;
+  const EthernetAddress ethernet = { 0x02,
+                                     0,
+                                     static_cast<uint8_t>( n >> 24 ),
+                                     static_cast<uint8_t>( n >> 16 ),
+                                     static_cast<uint8_t>( n >> 8 ),
+                                     static_cast<uint8_t>( n ) };
+  AsyncNetworkInterface interface { ethernet, Address::from_ipv4_numeric( address ) };
+  interface.set_receive_queues( 1, RECEIVE_QUEUE_CAPACITY );
+  return interface;
+}
+
+void NetworkSimulator::add_channel( NodeId from, NodeId to, uint32_t to_port, const LinkConfig& link )
+{
+  if ( link.bits_per_s == 0 ) {
+    throw runtime_error( "a simulated link needs a nonzero bandwidth" );
+  }
+  nodes_[from].out.push_back( static_cast<uint32_t>( channels_.size() ) );
+  channels_.push_back( { to, to_port, link, 0 } );
+}
+
+NetworkSimulator::NodeId NetworkSimulator::add_router()
+{
+  if ( routers_ == MAX_ROUTERS ) {
+    throw runtime_error( "the simulator's addressing only has room for " + to_string( MAX_ROUTERS ) + " routers" );
+  }
+
+  Node& node = nodes_.emplace_back();
+  node.router = make_unique<Router>();
+  node.block = HOST_BLOCKS | static_cast<uint32_t>( routers_++ << 8 );
+  return nodes_.size() - 1;
+}
+
+NetworkSimulator::NodeId NetworkSimulator::add_host( NodeId router, const LinkConfig& link )
+{
+  Node& r = nodes_.at( router );
+  if ( r.router == nullptr ) {
+    throw runtime_error( "hosts can only be attached to routers" );
+  }
+  if ( r.hosts == MAX_HOSTS_PER_ROUTER ) {
+    throw runtime_error( "a simulated router takes at most " + to_string( MAX_HOSTS_PER_ROUTER ) + " hosts" );
+  }
+
+  const uint32_t subnet = r.block | ( r.hosts++ << 2 );
+  const NodeId host = nodes_.size();
+  const uint32_t router_port = r.router->add_interface( make_interface( subnet | 1 ) );
+  r.addresses.push_back( subnet | 1 );
+
+  Node& h = nodes_.emplace_back();
+  h.host = make_unique<AsyncNetworkInterface>( make_interface( subnet | 2 ) );
+  h.gateway = subnet | 1;
+  h.addresses.push_back( subnet | 2 );
+
+  add_channel( router, host, 0, link );
+  add_channel( host, router, router_port, link );
+
+  // the router reaches the host directly on its own /30
+  RoutesByLength routes;
+  routes[30].push_back( { subnet >> 2, 0, router_port, 0 } );
+  nodes_[router].router->load_routes( routes );
+  return host;
+}
+
+void NetworkSimulator::connect( NodeId a, NodeId b, const LinkConfig& link )
+{
+  if ( a == b || nodes_.at( a ).router == nullptr || nodes_.at( b ).router == nullptr ) {
+    throw runtime_error( "links join two different routers" );
+  }
+  if ( links_ == MAX_LINKS ) {
+    throw runtime_error( "the simulator's addressing only has room for " + to_string( MAX_LINKS ) + " links" );
+  }
+
+  const uint32_t subnet = LINK_SUBNETS | static_cast<uint32_t>( links_++ << 2 );
+  const uint32_t a_port = nodes_[a].router->add_interface( make_interface( subnet | 1 ) );
+  nodes_[a].addresses.push_back( subnet | 1 );
+  const uint32_t b_port = nodes_[b].router->add_interface( make_interface( subnet | 2 ) );
+  nodes_[b].addresses.push_back( subnet | 2 );
+  add_channel( a, b, b_port, link );
+  add_channel( b, a, a_port, link );
+}
+
+NetworkSimulator::Topology NetworkSimulator::build_fat_tree( size_t k, const LinkConfig& link )
+{
+  if ( k < 2 || k % 2 != 0 ) {
+    throw runtime_error( "a fat tree needs an even k of at least 2" );
+  }
+  const size_t half = k / 2;
+
+  Topology topology;
+  vector<NodeId> core;
+  for ( size_t i = 0; i < half * half; i++ ) {
+    core.push_back( add_router() );
+  }
+  topology.routers = core;
+
+  for ( size_t pod = 0; pod < k; pod++ ) {
+    vector<NodeId> aggregation;
+    for ( size_t i = 0; i < half; i++ ) {
+      aggregation.push_back( add_router() );
+      // aggregation router i of every pod links to core routers [i * k/2, (i + 1) * k/2)
+      for ( size_t j = 0; j < half; j++ ) {
+        connect( aggregation.back(), core[i * half + j], link );
+      }
+    }
+    for ( size_t i = 0; i < half; i++ ) {
+      const NodeId edge = add_router();
+      for ( const NodeId agg : aggregation ) {
+        connect( edge, agg, link );
+      }
+      for ( size_t j = 0; j < half; j++ ) {
+        topology.hosts.push_back( add_host( edge, link ) );
+      }
+      topology.routers.push_back( edge );
+    }
+    topology.routers.insert( topology.routers.end(), aggregation.begin(), aggregation.end() );
+  }
+  return topology;
+}
+
+NetworkSimulator::Topology NetworkSimulator::build_random( size_t routers,
+                                                           size_t degree,
+                                                           size_t hosts_per_router,
+                                                           uint64_t seed,
+                                                           const LinkConfig& link )
+{
+  if ( routers < 2 || degree < 2 || degree >= routers ) {
+    throw runtime_error( "a random topology needs at least 2 routers and a degree between 2 and routers - 1" );
+  }
+
+  mt19937_64 rd { seed };
+  Topology topology;
+  for ( size_t i = 0; i < routers; i++ ) {
+    topology.routers.push_back( add_router() );
+  }
+
+  set<pair<size_t, size_t>> linked;
+  auto link_pair = [&]( size_t a, size_t b ) {
+    if ( a == b || not linked.insert( minmax( a, b ) ).second ) {
+      return false;
+    }
+    connect( topology.routers[a], topology.routers[b], link );
+    return true;
+  };
+
+  // a random tree keeps the graph connected, then random extra links make up the degree
+  for ( size_t i = 1; i < routers; i++ ) {
+    link_pair( i, rd() % i );
+  }
+  const size_t target = routers * degree / 2;
+  while ( linked.size() < target ) {
+    link_pair( rd() % routers, rd() % routers );
+  }
+
+  for ( const NodeId router : topology.routers ) {
+    for ( size_t j = 0; j < hosts_per_router; j++ ) {
+      topology.hosts.push_back( add_host( router, link ) );
+    }
+  }
+  return topology;
+}
+
+size_t NetworkSimulator::install_routes()
+{
+  // BFS out from each router with hosts, over router-to-router channels only. Every router one
+  // hop closer to the destination is a shortest-path next hop.
+  vector<RoutesByLength> routes( nodes_.size() );
+  vector<uint32_t> distance( nodes_.size() );
+  vector<NodeId> frontier;
+  size_t installed = 0;
+
+  for ( NodeId destination = 0; destination < nodes_.size(); destination++ ) {
+    const Node& dst = nodes_[destination];
+    if ( dst.router == nullptr || dst.hosts == 0 ) {
+      continue;
+    }
+
+    ranges::fill( distance, UINT32_MAX );
+    distance[destination] = 0;
+    frontier.assign( 1, destination );
+    for ( size_t i = 0; i < frontier.size(); i++ ) {
+      for ( const uint32_t channel : nodes_[frontier[i]].out ) {
+        const NodeId next = channels_[channel].to;
+        if ( nodes_[next].router != nullptr && distance[next] == UINT32_MAX ) {
+          distance[next] = distance[frontier[i]] + 1;
+          frontier.push_back( next );
+        }
+      }
+    }
+
+    const uint32_t block = dst.block;
+    for ( const NodeId node : frontier ) {
+      if ( node == destination ) {
+        continue;
+      }
+      const Node& from = nodes_[node];
+      // the ports leading one hop closer, then one of them by hash of (router, destination)
+      uint32_t candidates = 0;
+      uint32_t chosen = 0;
+      const uint64_t pick = mix( ( uint64_t { node } << 32 ) | destination );
+      for ( uint32_t port = 0; port < from.out.size(); port++ ) {
+        const Channel& channel = channels_[from.out[port]];
+        if ( nodes_[channel.to].router != nullptr && distance[channel.to] + 1 == distance[node] ) {
+          // reservoir sampling with a fixed "random" sequence: one pass, uniform choice
+          candidates++;
+          if ( mix( pick + candidates ) % candidates == 0 ) {
+            chosen = port;
+          }
+        }
+      }
+      const Channel& channel = channels_[from.out[chosen]];
+      routes[node][24].push_back( { block >> 8, nodes_[channel.to].addresses[channel.to_port], chosen, 1 } );
+    }
+  }
+
+  for ( NodeId node = 0; node < nodes_.size(); node++ ) {
+    if ( nodes_[node].router != nullptr ) {
+      installed += nodes_[node].router->load_routes( routes[node] );
+    }
+  }
+  return installed;
+}
+
+void NetworkSimulator::send( NodeId host, InternetDatagram dgram, Time at )
+{
+  if ( nodes_.at( host ).host == nullptr ) {
+    throw runtime_error( "only hosts send datagrams" );
+  }
+
+  uint32_t slot = 0;
+  if ( free_datagrams_.empty() ) {
+    slot = datagrams_.size();
+    datagrams_.push_back( std::move( dgram ) );
+  } else {
+    slot = free_datagrams_.back();
+    free_datagrams_.pop_back();
+    datagrams_[slot] = std::move( dgram );
+  }
+  schedule( max( at, now_ ), EventKind::SEND, host, slot );
+}
+
+Router& NetworkSimulator::router( NodeId node )
+{
+  if ( nodes_.at( node ).router == nullptr ) {
+    throw runtime_error( "node " + to_string( node ) + " isn't a router" );
+  }
+  return *nodes_[node].router;
+}
+
+uint32_t NetworkSimulator::host_address( NodeId host ) const
+{
+  if ( nodes_.at( host ).host == nullptr ) {
+    throw runtime_error( "node " + to_string( host ) + " isn't a host" );
+  }
+  return nodes_[host].addresses.front();
+}
+
+AsyncNetworkInterface& NetworkSimulator::interface( NodeId node, uint32_t port )
+{
+  Node& n = nodes_[node];
+  return n.router ? n.router->interface( port ) : *n.host;
+}
+
+void NetworkSimulator::tick( Node& node )
+{
+  const uint64_t now_ms = now_ / 1'000'000;
+  if ( now_ms == node.ticked_ms ) {
+    return;
+  }
+  const size_t elapsed = now_ms - node.ticked_ms;
+  node.ticked_ms = now_ms;
+  if ( node.router ) {
+    for ( size_t port = 0; port < node.out.size(); port++ ) {
+      node.router->interface( port ).tick( elapsed );
+    }
+    node.router->tick( elapsed );
+  } else {
+    node.host->tick( elapsed );
+  }
+}
+
+void NetworkSimulator::transmit( NodeId node )
+{
+  for ( uint32_t port = 0; port < nodes_[node].out.size(); port++ ) {
+    AsyncNetworkInterface& source = interface( node, port );
+    Channel& channel = channels_[nodes_[node].out[port]];
+
+    while ( true ) {
+      uint32_t slot = 0;
+      if ( free_frames_.empty() ) {
+        slot = frames_.size();
+        frames_.emplace_back();
+      } else {
+        slot = free_frames_.back();
+        free_frames_.pop_back();
+      }
+      if ( not source.maybe_send( frames_[slot] ) ) {
+        free_frames_.push_back( slot );
+        break;
+      }
+
+      size_t bytes = EthernetHeader::LENGTH;
+      for ( const auto& buffer : frames_[slot].payload ) {
+        bytes += buffer.size();
+      }
+
+      // drop-tail: the backlog still to go out ahead of this frame, in bytes
+      const Time backlog_ns = channel.busy_until > now_ ? channel.busy_until - now_ : 0;
+      if ( static_cast<double>( backlog_ns ) * channel.config.bits_per_s / 8e9 > channel.config.buffer_bytes ) {
+        stats_.frames_dropped++;
+        free_frames_.push_back( slot );
+        continue;
+      }
+
+      const Time serialization_ns = ( bytes * 8 * 1'000'000'000 + channel.config.bits_per_s - 1 ) / channel.config.bits_per_s;
+      channel.busy_until = max( channel.busy_until, now_ ) + serialization_ns;
+      schedule( channel.busy_until + channel.config.latency_ns, EventKind::ARRIVE, nodes_[node].out[port], slot );
+      stats_.frames_sent++;
+    }
+  }
+}
+
+void NetworkSimulator::arrive( uint32_t channel, uint32_t slot )
+{
+  const Channel& c = channels_[channel];
+  Node& node = nodes_[c.to];
+  tick( node );
+  interface( c.to, c.to_port ).recv_frame( frames_[slot] );
+  frames_[slot] = {};
+  free_frames_.push_back( slot );
+
+  if ( node.router ) {
+    // everything arriving at this moment gets routed in one go
+    if ( not node.route_pending ) {
+      node.route_pending = true;
+      schedule( now_, EventKind::ROUTE, c.to );
+    }
+    return;
+  }
+
+  while ( node.host->maybe_receive( received_ ) ) {
+    stats_.datagrams_delivered++;
+    if ( on_delivery_ ) {
+      on_delivery_( c.to, now_, received_ );
+    }
+  }
+  transmit( c.to ); // (ARP replies)
+}
+
+void NetworkSimulator::host_send( NodeId host, uint32_t slot )
+{
+  Node& node = nodes_[host];
+  tick( node );
+  node.host->send_datagram( datagrams_[slot], Address::from_ipv4_numeric( node.gateway ) );
+  datagrams_[slot] = {};
+  free_datagrams_.push_back( slot );
+  stats_.datagrams_sent++;
+  transmit( host );
+}
+
+void NetworkSimulator::route( NodeId node )
+{
+  Node& n = nodes_[node];
+  n.route_pending = false;
+  tick( n );
+  n.router->route();
+  transmit( node );
+}
+
+uint64_t NetworkSimulator::run( Time until )
+{
+  uint64_t ran = 0;
+  while ( not events_.empty() && events_.top().at <= until ) {
+    const Event event = events_.top();
+    events_.pop();
+    now_ = event.at;
+    switch ( event.kind ) {
+      case EventKind::ARRIVE:
+        arrive( event.target, event.slot );
+        break;
+      case EventKind::SEND:
+        host_send( event.target, event.slot );
+        break;
+      case EventKind::ROUTE:
+        route( event.target );
+        break;
+    }
+    ran++;
+  }
+  stats_.events += ran;
+  if ( until != UINT64_MAX ) {
+    now_ = max( now_, until );
+  }
+  return ran;
+}
@@ -0,0 +1,175 @@
+#include "packet_classifier.hh"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <map>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+using namespace std;
+
+namespace {
+
+uint32_t network_mask( uint8_t length )
+{
+  return length == 0 ? 0 : UINT32_MAX << ( 32 - length );
+}
+
+uint64_t tuple_key( uint32_t src, uint32_t dst )
+{
+  return ( static_cast<uint64_t>( src ) << 32 ) | dst;
+}
+
+// Fibonacci hashing: the top bits of the product pick the slot
+uint64_t slot_hash( uint64_t key )
+{
+  return key * 0x9e3779b97f4a7c15ULL;
+}
+
+bool in_range( uint16_t port, const pair<uint16_t, uint16_t>& range )
+{
+  return port >= range.first && port <= range.second;
+}
+
+} // namespace
+
+optional<pair<uint16_t, uint16_t>> l4_ports( const InternetDatagram& dgram )
+{
+  if ( ( dgram.header.proto != IPv4Header::PROTO_TCP && dgram.header.proto != IPv4Header::PROTO_UDP )
+       || dgram.header.mf || dgram.header.offset != 0 ) {
+    return {};
+  }
+
+  array<uint8_t, 4> ports {};
+  size_t have = 0;
+  for ( const auto& buffer : dgram.payload ) {
+    for ( const char c : string_view { buffer } ) {
+      if ( have == ports.size() ) {
+        break;
+      }
+      ports[have++] = static_cast<uint8_t>( c );
+    }
+  }
+  if ( have < ports.size() ) {
+    return {};
+  }
+  return pair<uint16_t, uint16_t> { ( ports[0] << 8 ) | ports[1], ( ports[2] << 8 ) | ports[3] };
+}
+
+PacketClassifier::PacketClassifier( const vector<AclRule>& rules, AclRule::Action default_action )
+  : default_action_( default_action )
+{
+  constexpr pair<uint16_t, uint16_t> all_ports { 0, UINT16_MAX };
+
+  // (src length, dst length) -> masked key -> the rules with that key, in order
+  map<pair<uint8_t, uint8_t>, map<uint64_t, vector<Entry>>> by_lengths;
+  for ( size_t i = 0; i < rules.size(); i++ ) {
+    const AclRule& rule = rules[i];
+    if ( rule.src_length > 32 || rule.dst_length > 32 ) {
+      throw runtime_error( "ACL rule " + to_string( i ) + ": prefix length over 32" );
+    }
+    if ( rule.src_ports.first > rule.src_ports.second || rule.dst_ports.first > rule.dst_ports.second ) {
+      throw runtime_error( "ACL rule " + to_string( i ) + ": port range ends before it starts" );
+    }
+
+    const uint64_t key = tuple_key( rule.src_prefix & network_mask( rule.src_length ),
+                                    rule.dst_prefix & network_mask( rule.dst_length ) );
+    by_lengths[{ rule.src_length, rule.dst_length }][key].push_back(
+      { static_cast<uint32_t>( i ),
+        rule.proto,
+        rule.src_ports == all_ports && rule.dst_ports == all_ports,
+        rule.src_ports,
+        rule.dst_ports } );
+    actions_.push_back( rule.action );
+  }
+
+  for ( const auto& [lengths, groups] : by_lengths ) {
+    Tuple& tuple = tuples_.emplace_back();
+    tuple.src_length = lengths.first;
+    tuple.dst_length = lengths.second;
+    tuple.src_mask = network_mask( lengths.first );
+    tuple.dst_mask = network_mask( lengths.second );
+    tuple.best_priority = UINT32_MAX;
+
+    size_t slots = 2;
+    while ( slots < 2 * groups.size() ) {
+      slots *= 2;
+    }
+    tuple.shift = 64 - countr_zero( slots );
+    tuple.slots.resize( slots );
+
+    for ( const auto& [key, entries] : groups ) {
+      size_t i = slot_hash( key ) >> tuple.shift;
+      while ( tuple.slots[i].count != 0 ) {
+        i = ( i + 1 ) & ( slots - 1 );
+      }
+      tuple.slots[i] = { key, static_cast<uint32_t>( tuple.entries.size() ), static_cast<uint32_t>( entries.size() ) };
+      tuple.entries.insert( tuple.entries.end(), entries.begin(), entries.end() );
+      tuple.best_priority = min( tuple.best_priority, entries.front().priority );
+    }
+  }
+  sort( tuples_.begin(), tuples_.end(), []( const Tuple& a, const Tuple& b ) {
+    return a.best_priority < b.best_priority;
+  } );
+}
+
+const PacketClassifier::Slot* PacketClassifier::Tuple::find( uint64_t key ) const
+{
+  for ( size_t i = slot_hash( key ) >> shift;; i = ( i + 1 ) & ( slots.size() - 1 ) ) {
+    const Slot& slot = slots[i];
+    if ( slot.count == 0 ) {
+      return nullptr;
+    }
+    if ( slot.key == key ) {
+      return &slot;
+    }
+  }
+}
+
+optional<size_t> PacketClassifier::match( uint32_t src,
+                                          uint32_t dst,
+                                          uint8_t proto,
+                                          optional<pair<uint16_t, uint16_t>> ports ) const
+{
+  uint32_t best = UINT32_MAX;
+  for ( const Tuple& tuple : tuples_ ) {
+    if ( tuple.best_priority >= best ) {
+      break; // nothing further on can come before the match we have
+    }
+
+    const Slot* slot = tuple.find( tuple_key( src & tuple.src_mask, dst & tuple.dst_mask ) );
+    if ( slot == nullptr ) {
+      continue;
+    }
+
+    for ( const Entry& entry : span { tuple.entries }.subspan( slot->first, slot->count ) ) {
+      if ( entry.priority >= best ) {
+        break;
+      }
+      if ( entry.proto.has_value() && *entry.proto != proto ) {
+        continue;
+      }
+      if ( not entry.any_ports
+           && ( not ports.has_value() || not in_range( ports->first, entry.src_ports )
+                || not in_range( ports->second, entry.dst_ports ) ) ) {
+        continue;
+      }
+      best = entry.priority;
+      break;
+    }
+  }
+
+  if ( best == UINT32_MAX ) {
+    return {};
+  }
+  return best;
+}
+
+AclRule::Action PacketClassifier::decide( const InternetDatagram& dgram ) const
+{
+  const auto rule = match( dgram.header.src, dgram.header.dst, dgram.header.proto, l4_ports( dgram ) );
+  return rule.has_value() ? actions_[*rule] : default_action_;
+}
@@ -0,0 +1,164 @@
+#include "pcap.hh"
+
+#include "exception.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <stdexcept>
+
+using namespace std;
+
+namespace {
+
+constexpr size_t FILE_HEADER_LENGTH = 24;
+constexpr size_t RECORD_HEADER_LENGTH = 16;
+constexpr uint16_t VERSION_MAJOR = 2;
+constexpr uint16_t VERSION_MINOR = 4;
+
+template<typename T>
+void append( string& out, T value )
+{
+  out.append( reinterpret_cast<const char*>( &value ), sizeof( value ) ); // NOLINT(*-reinterpret-cast)
+}
+
+} // namespace
+
+PcapWriter::PcapWriter( const string& path )
+  : fd_( CheckSystemCall( "open", open( path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644 ) ) )
+{
+  pending_.reserve( FLUSH_BYTES + SNAP_LENGTH + RECORD_HEADER_LENGTH );
+  append( pending_, MAGIC_NANOSECONDS );
+  append( pending_, VERSION_MAJOR );
+  append( pending_, VERSION_MINOR );
+  append( pending_, int32_t { 0 } );  // time zone (always UTC)
+  append( pending_, uint32_t { 0 } ); // timestamp accuracy (unused)
+  append( pending_, SNAP_LENGTH );
+  append( pending_, LINKTYPE_ETHERNET );
+  flush();
+}
+
+PcapWriter::~PcapWriter()
+{
+  try {
+    flush();
+  } catch ( const exception& e ) {
+    // don't throw an exception from the destructor
+    cerr << "Exception destructing PcapWriter: " << e.what() << endl;
+  }
+}
+
+void PcapWriter::write( const EthernetFrame& frame, uint64_t timestamp_ns )
+{
+  uint32_t length = EthernetHeader::LENGTH;
+  for ( const auto& buffer : frame.payload ) {
+    length += buffer.size();
+  }
+  const uint32_t captured = min( length, SNAP_LENGTH );
+
+  append( pending_, static_cast<uint32_t>( timestamp_ns / 1'000'000'000 ) );
+  append( pending_, static_cast<uint32_t>( timestamp_ns % 1'000'000'000 ) );
+  append( pending_, captured );
+  append( pending_, length );
+
+  //the frame itself, cut off at the snap length.
+  const size_t end = pending_.size() + captured;
+  pending_.append( frame.header.dst.begin(), frame.header.dst.end() );
+  pending_.append( frame.header.src.begin(), frame.header.src.end() );
+  pending_.push_back( static_cast<char>( frame.header.type >> 8 ) );
+  pending_.push_back( static_cast<char>( frame.header.type & 0xff ) );
+  for ( const auto& buffer : frame.payload ) {
+    const string_view bytes = buffer;
+    pending_.append( bytes.substr( 0, end - min( end, pending_.size() ) ) );
+  }
+
+  frames_++;
+  if ( pending_.size() >= FLUSH_BYTES ) {
+    flush();
+  }
+}
+
+void PcapWriter::write( const EthernetFrame& frame )
+{
+  const auto now = chrono::system_clock::now().time_since_epoch();
+  write( frame, chrono::duration_cast<chrono::nanoseconds>( now ).count() );
+}
+
+void PcapWriter::flush()
+{
+  string_view remaining = pending_;
+  while ( not remaining.empty() ) {
+    remaining.remove_prefix( fd_.write( remaining ) );
+  }
+  pending_.clear();
+}
+
+PcapReader::PcapReader( const string& path ) : path_( path )
+{
+  const FileDescriptor fd { CheckSystemCall( "open", open( path.c_str(), O_RDONLY ) ) };
+  region_ = MMapRegion::map_readonly( fd );
+  if ( region_.size() < FILE_HEADER_LENGTH ) {
+    throw runtime_error( path + ": too short to be a pcap file" );
+  }
+
+  const uint32_t magic = read32( 0 );
+  swapped_ = magic == __builtin_bswap32( PcapWriter::MAGIC_MICROSECONDS )
+             || magic == __builtin_bswap32( PcapWriter::MAGIC_NANOSECONDS );
+  const uint32_t native = swapped_ ? __builtin_bswap32( magic ) : magic;
+  if ( native != PcapWriter::MAGIC_MICROSECONDS && native != PcapWriter::MAGIC_NANOSECONDS ) {
+    throw runtime_error( path + ": not a pcap file" );
+  }
+  nanoseconds_ = native == PcapWriter::MAGIC_NANOSECONDS;
+  if ( read32( 20 ) != PcapWriter::LINKTYPE_ETHERNET ) {
+    throw runtime_error( path + ": not a capture of Ethernet frames (link type " + to_string( read32( 20 ) ) + ")" );
+  }
+  offset_ = FILE_HEADER_LENGTH;
+}
+
+uint32_t PcapReader::read32( size_t at ) const
+{
+  uint32_t value = 0;
+  memcpy( &value, static_cast<const char*>( region_.data() ) + at, sizeof( value ) );
+  return swapped_ ? __builtin_bswap32( value ) : value;
+}
+
+bool PcapReader::read( PcapRecord& record )
+{
+  if ( offset_ == region_.size() ) {
+    return false;
+  }
+  if ( region_.size() - offset_ < RECORD_HEADER_LENGTH ) {
+    throw runtime_error( path_ + ": truncated in a frame header" );
+  }
+  const uint64_t seconds = read32( offset_ );
+  const uint64_t fraction = read32( offset_ + 4 );
+  const uint32_t captured = read32( offset_ + 8 );
+  record.original_length = read32( offset_ + 12 );
+  record.timestamp_ns = seconds * 1'000'000'000 + ( nanoseconds_ ? fraction : fraction * 1000 );
+  offset_ += RECORD_HEADER_LENGTH;
+
+  if ( region_.size() - offset_ < captured ) {
+    throw runtime_error( path_ + ": truncated in a frame" );
+  }
+  const char* bytes = static_cast<const char*>( region_.data() ) + offset_;
+  offset_ += captured;
+
+  if ( not parse( record.frame, { Buffer { string { bytes, captured } } } ) ) {
+    throw runtime_error( path_ + ": a frame is too short to be Ethernet" );
+  }
+  return true;
+}
+
+vector<PcapRecord> PcapReader::read_all( const string& path )
+{
+  PcapReader reader { path };
+  vector<PcapRecord> records;
+  PcapRecord record;
+  while ( reader.read( record ) ) {
+    records.push_back( std::move( record ) );
+    record = {};
+  }
+  return records;
+}
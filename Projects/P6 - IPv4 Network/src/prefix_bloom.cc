@@ -0,0 +1,92 @@
+#include "prefix_bloom.hh"
+
+#include <algorithm>
+#include <bit>
+
+using namespace std;
+
+namespace {
+//Upper bound on the size of one filter (2^18 words = 2 MiB), keeps the word index in the top bits of the hash
+//from ever overlapping the bits used to pick the bit positions inside a word.
+constexpr size_t MAX_WORDS_PER_FILTER = size_t { 1 } << 18;
+constexpr size_t MIN_WORDS_PER_FILTER = 16;
+}
+
+PrefixBloom::PrefixBloom( size_t words_per_filter, pmr::memory_resource* memory ) : words_( memory )
+{
+  reset( words_per_filter * KEYS_PER_WORD );
+}
+
+PrefixBloom::PrefixBloom( const PrefixBloom& other, pmr::memory_resource* memory )
+  : word_mask_( other.word_mask_ )
+  , index_shift_( other.index_shift_ )
+  , words_( other.words_, memory )
+  , keys_( other.keys_ )
+  , nonempty_( other.nonempty_ )
+{}
+
+uint64_t PrefixBloom::hash( uint8_t prefix_length, uint32_t prefix_key )
+{
+  //multiply-xorshift-multiply; the length is folded in so the same key at two lengths lands in different places.
+  uint64_t x = ( ( static_cast<uint64_t>( prefix_key ) << 6 ) | prefix_length ) * 0x9E3779B97F4A7C15ULL;
+  x ^= x >> 32;
+  return x * 0xD6E8FEB86659FD93ULL;
+}
+
+uint64_t PrefixBloom::bits_of( uint64_t h )
+{
+  //three bit positions out of the middle of the hash (the word index comes from the top bits).
+  return ( uint64_t { 1 } << ( ( h >> 20 ) & 63 ) ) | ( uint64_t { 1 } << ( ( h >> 26 ) & 63 ) )
+         | ( uint64_t { 1 } << ( ( h >> 32 ) & 63 ) );
+}
+
+void PrefixBloom::reset( size_t expected_keys )
+{
+  size_t words = bit_ceil( max( MIN_WORDS_PER_FILTER, ( expected_keys + KEYS_PER_WORD - 1 ) / KEYS_PER_WORD ) );
+  words = min( words, MAX_WORDS_PER_FILTER );
+
+  word_mask_ = words - 1;
+  index_shift_ = 64 - countr_zero( words );
+  words_.assign( words * NUM_LENGTHS, 0 );
+  keys_.fill( 0 );
+  nonempty_ = 0;
+}
+
+bool PrefixBloom::insert( uint8_t prefix_length, uint32_t prefix_key )
+{
+  const uint64_t h = hash( prefix_length, prefix_key );
+  words_[prefix_length * words_per_filter() + ( h >> index_shift_ )] |= bits_of( h );
+
+  keys_[prefix_length]++;
+  nonempty_ |= uint64_t { 1 } << prefix_length;
+
+  return keys_[prefix_length] > words_per_filter() * KEYS_PER_WORD && words_per_filter() < MAX_WORDS_PER_FILTER;
+}
+
+uint64_t PrefixBloom::candidates( uint32_t dst_ip ) const
+{
+  //First pass: hash the dst_ip prefix for every length. No branches and a fixed trip count, so this vectorizes.
+  array<uint64_t, NUM_LENGTHS> h;
+  for ( size_t len = 0; len < NUM_LENGTHS; len++ ) {
+    //shifting a 64 bit value lets length 0 (shift by 32) fall out as key 0 without a special case.
+    const uint32_t key = static_cast<uint32_t>( static_cast<uint64_t>( dst_ip ) >> ( 32 - len ) );
+    h[len] = hash( static_cast<uint8_t>( len ), key );
+  }
+
+  //Second pass: one word load per filter, folded into a bitmask of lengths that might match.
+  const uint64_t* filter = words_.data();
+  const size_t stride = words_per_filter();
+  uint64_t result = 0;
+  for ( size_t len = 0; len < NUM_LENGTHS; len++ ) {
+    const uint64_t bits = bits_of( h[len] );
+    const uint64_t word = filter[len * stride + ( h[len] >> index_shift_ )];
+    result |= static_cast<uint64_t>( ( word & bits ) == bits ) << len;
+  }
+
+  return result & nonempty_;
+}
+
+size_t PrefixBloom::max_keys() const
+{
+  return *max_element( keys_.begin(), keys_.end() );
+}
@@ -0,0 +1,233 @@
+#include "route_loader.hh"
+
+#include "exception.hh"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <future>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+//Don't bother splitting dumps smaller than this across threads.
+constexpr size_t MIN_CHUNK_BYTES = 1 << 16;
+
+string_view trim( string_view s )
+{
+  while ( not s.empty() && ( s.front() == ' ' || s.front() == '\t' || s.front() == '\r' ) ) {
+    s.remove_prefix( 1 );
+  }
+  while ( not s.empty() && ( s.back() == ' ' || s.back() == '\t' || s.back() == '\r' ) ) {
+    s.remove_suffix( 1 );
+  }
+  return s;
+}
+
+template<typename T>
+optional<T> parse_number( string_view s )
+{
+  T value {};
+  const auto [end, err] = from_chars( s.data(), s.data() + s.size(), value );
+  if ( err != errc {} || end != s.data() + s.size() || s.empty() ) {
+    return {};
+  }
+  return value;
+}
+
+//Dotted quad to a host-order address, without going through getaddrinfo for every route.
+optional<uint32_t> parse_ipv4( string_view s )
+{
+  uint32_t addr = 0;
+  for ( int octet = 0; octet < 4; octet++ ) {
+    const size_t dot = octet < 3 ? s.find( '.' ) : s.size();
+    if ( dot == string_view::npos ) {
+      return {};
+    }
+    const auto value = parse_number<uint32_t>( s.substr( 0, dot ) );
+    if ( not value.has_value() || *value > 255 ) {
+      return {};
+    }
+    addr = ( addr << 8 ) | *value;
+    s.remove_prefix( min( s.size(), dot + 1 ) );
+  }
+  return addr;
+}
+
+//Parses one line into its length's list. Returns false if the line is malformed.
+bool parse_line( string_view line, RoutesByLength& out )
+{
+  line = trim( line );
+  if ( line.empty() || line.front() == '#' ) {
+    return true;
+  }
+
+  const size_t slash = line.find( '/' );
+  const size_t comma1 = line.find( ',' );
+  const size_t comma2 = comma1 == string_view::npos ? string_view::npos : line.find( ',', comma1 + 1 );
+  if ( slash == string_view::npos || comma2 == string_view::npos || slash > comma1 ) {
+    return false;
+  }
+
+  const auto prefix = parse_ipv4( trim( line.substr( 0, slash ) ) );
+  const auto length = parse_number<uint32_t>( trim( line.substr( slash + 1, comma1 - slash - 1 ) ) );
+  const string_view hop = trim( line.substr( comma1 + 1, comma2 - comma1 - 1 ) );
+  const auto interface_num = parse_number<uint32_t>( trim( line.substr( comma2 + 1 ) ) );
+  if ( not prefix.has_value() || not length.has_value() || *length > 32 || not interface_num.has_value() ) {
+    return false;
+  }
+
+  PackedRoute route;
+  route.prefix_mask = *length == 0 ? 0 : ( *prefix >> ( 32 - *length ) );
+  route.interface_num = *interface_num;
+  if ( hop != "direct" ) {
+    const auto next_hop = parse_ipv4( hop );
+    if ( not next_hop.has_value() ) {
+      return false;
+    }
+    route.next_hop = *next_hop;
+    route.has_next_hop = 1;
+  }
+
+  out[*length].push_back( route );
+  return true;
+}
+
+//Parses a run of whole lines. On a bad line, returns the offset of that line within `chunk`.
+optional<size_t> parse_chunk( string_view chunk, RoutesByLength& out )
+{
+  size_t pos = 0;
+  while ( pos < chunk.size() ) {
+    const size_t end = min( chunk.find( '\n', pos ), chunk.size() );
+    if ( not parse_line( chunk.substr( pos, end - pos ), out ) ) {
+      return pos;
+    }
+    pos = end + 1;
+  }
+  return {};
+}
+
+} // namespace
+
+RoutesByLength parse_route_dump( string_view text )
+{
+  //Cut the dump into roughly equal chunks, each ending on a line boundary.
+  const size_t threads
+    = clamp<size_t>( text.size() / MIN_CHUNK_BYTES, 1, max<size_t>( 1, thread::hardware_concurrency() ) );
+  vector<string_view> chunks;
+  size_t start = 0;
+  for ( size_t i = 1; i <= threads && start < text.size(); i++ ) {
+    size_t end = i == threads ? text.size() : text.find( '\n', max( start, text.size() * i / threads ) );
+    end = end == string_view::npos ? text.size() : end + 1;
+    chunks.push_back( text.substr( start, end - start ) );
+    start = end;
+  }
+
+  vector<RoutesByLength> parsed( chunks.size() );
+  vector<future<optional<size_t>>> results;
+  for ( size_t i = 0; i < chunks.size(); i++ ) {
+    results.push_back( async( launch::async, parse_chunk, chunks[i], ref( parsed[i] ) ) );
+  }
+
+  for ( size_t i = 0; i < chunks.size(); i++ ) {
+    const optional<size_t> bad = results[i].get();
+    if ( bad.has_value() ) {
+      const size_t offset = static_cast<size_t>( chunks[i].data() - text.data() ) + *bad;
+      const size_t line_number = count( text.begin(), text.begin() + static_cast<ptrdiff_t>( offset ), '\n' ) + 1;
+      const string_view line = text.substr( offset, text.find( '\n', offset ) - offset );
+      throw runtime_error( "route dump line " + to_string( line_number ) + ": can't parse \"" + string( line ) + "\"" );
+    }
+  }
+
+  //Stitch the chunks back together in file order, length by length.
+  RoutesByLength routes;
+  for ( size_t length = 0; length < routes.size(); length++ ) {
+    size_t total = 0;
+    for ( const auto& p : parsed ) {
+      total += p[length].size();
+    }
+    routes[length].reserve( total );
+    for ( const auto& p : parsed ) {
+      routes[length].insert( routes[length].end(), p[length].begin(), p[length].end() );
+    }
+  }
+  return routes;
+}
+
+void replace_file( const string& path, string_view contents )
+{
+  const string temp_path = path + ".tmp";
+  {
+    FileDescriptor fd { CheckSystemCall( "open", open( temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644 ) ) };
+    while ( not contents.empty() ) {
+      contents.remove_prefix( fd.write( contents ) );
+    }
+    //on disk before it takes the old file's place, or a crash could leave it empty under the final name.
+    CheckSystemCall( "fsync", fsync( fd.fd_num() ) );
+  }
+  CheckSystemCall( "rename", rename( temp_path.c_str(), path.c_str() ) );
+
+  const filesystem::path directory = filesystem::path( path ).parent_path();
+  const FileDescriptor dir {
+    CheckSystemCall( "open", open( directory.empty() ? "." : directory.c_str(), O_RDONLY | O_DIRECTORY ) ) };
+  CheckSystemCall( "fsync", fsync( dir.fd_num() ) );
+}
+
+void FibImage::write( const string& path, const RouteSpans& routes )
+{
+  Header header {};
+  header.magic = MAGIC;
+  header.version = VERSION;
+  header.route_size = sizeof( PackedRoute );
+
+  string image;
+  size_t total = 0;
+  for ( size_t length = 0; length < routes.size(); length++ ) {
+    header.routes_per_length.at( length ) = routes.at( length ).size();
+    total += routes.at( length ).size();
+  }
+  image.reserve( sizeof( Header ) + total * sizeof( PackedRoute ) );
+  image.append( reinterpret_cast<const char*>( &header ), sizeof( Header ) ); // NOLINT(*-reinterpret-cast)
+  for ( const auto& list : routes ) {
+    image.append( reinterpret_cast<const char*>( list.data() ), list.size_bytes() ); // NOLINT(*-reinterpret-cast)
+  }
+
+  replace_file( path, image );
+}
+
+FibImage::FibImage( const string& path )
+{
+  const FileDescriptor fd { CheckSystemCall( "open", open( path.c_str(), O_RDONLY ) ) };
+  region_ = MMapRegion::map_readonly( fd );
+
+  const auto bytes = region_.bytes();
+  Header header {};
+  if ( bytes.size() < sizeof( Header ) ) {
+    throw runtime_error( path + ": too short to be a FIB image" );
+  }
+  memcpy( &header, bytes.data(), sizeof( Header ) );
+  if ( header.magic != MAGIC || header.version != VERSION || header.route_size != sizeof( PackedRoute ) ) {
+    throw runtime_error( path + ": not a FIB image from this version of the router" );
+  }
+
+  //The mapping is page aligned and the header is a multiple of 4 bytes, so the routes can be used in place.
+  const auto* next = reinterpret_cast<const PackedRoute*>( bytes.data() + sizeof( Header ) ); // NOLINT(*-reinterpret-cast)
+  size_t remaining = ( bytes.size() - sizeof( Header ) ) / sizeof( PackedRoute );
+  for ( size_t length = 0; length < routes_.size(); length++ ) {
+    const uint64_t count = header.routes_per_length.at( length );
+    if ( count > remaining ) {
+      throw runtime_error( path + ": FIB image is truncated" );
+    }
+    routes_.at( length ) = { next, count };
+    next += count;
+    remaining -= count;
+  }
+}
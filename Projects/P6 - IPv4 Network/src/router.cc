@@ -1,10 +1,46 @@
 #include "router.hh"
 
+#include "checksum.hh"
+#include "exception.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fcntl.h>
 #include <iostream>
 #include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
 
 using namespace std;
 
+namespace {
+Router::RouteEntry unpack(const PackedRoute& route){
+  if (route.has_next_hop){
+    return {route.interface_num, route.next_hop};
+  }
+  return {route.interface_num, nullopt};
+}
+
+PackedRoute pack(uint32_t prefix_mask, const Router::RouteEntry& entry){
+  return {prefix_mask, entry.second.value_or(0), static_cast<uint32_t>(entry.first), entry.second.has_value()};
+}
+
+uint64_t wall_ms(){
+  return chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count();
+}
+
+optional<EthernetAddress> parse_ethernet(const string& text){
+  EthernetAddress address {};
+  char end = 0;
+  if (text.size() != 17 || sscanf(text.c_str(), "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx%c", &address[0], &address[1], &address[2], &address[3], &address[4], &address[5], &end) != 6){
+    return {};
+  }
+  return address;
+}
+}
+
 // route_prefix: The "up-to-32-bit" IPv4 address prefix to match the datagram's destination address against
 // prefix_length: For this route to be applicable, how many high-order (most-significant) bits of
 //    the route_prefix will need to match the corresponding bits of the datagram's destination address?
@@ -23,51 +59,385 @@ void Router::add_route( const uint32_t route_prefix,
   //prefix mask will only have nonzero values in first prefix_length bits.
   uint32_t prefix_mask = get_prefmask(prefix_length, route_prefix); //This is the mask for the prefix. If the prefix has bits 1001...., and prefix length is 4, the mask would be 0000...1001
 
-  //Add all this data to the given table, at the given prefix.
-  routing_table_[prefix_length][prefix_mask].first = interface_num;
-
+  RouteEntry entry {interface_num, {}};
   if (next_hop != nullopt){
-    routing_table_[prefix_length][prefix_mask].second = (next_hop.value()).ipv4_numeric(); 
+    entry.second = (next_hop.value()).ipv4_numeric(); 
+  }
+
+  const lock_guard<mutex> lock(update_mutex_);
+
+  if (fib_compression_){
+    //record the route, then fix up whichever routes in the table it affects.
+    const uint32_t network = get_network(prefix_length, prefix_mask);
+    rib_[{network, prefix_length}] = entry;
+    update_fib([&](ForwardingTable& fib){
+      fib.drop_paths(prefix_length, prefix_mask);
+      reaggregate(fib, network, prefix_length);
+    });
+    return;
+  }
+
+  //Add all this data to the given table, at the given prefix. (if the prefix had several paths, it's down to one now)
+  update_fib([&](ForwardingTable& fib){
+    fib.drop_paths(prefix_length, prefix_mask);
+    fib.install(prefix_length, prefix_mask, entry);
+  });
+}
+
+void Router::add_route( const uint32_t route_prefix, const uint8_t prefix_length, const vector<Path>& paths )
+{
+  if (paths.empty() || paths.size() > ForwardingTable::MAX_PATHS){
+    throw runtime_error("a route needs between 1 and " + to_string(ForwardingTable::MAX_PATHS) + " paths, not " + to_string(paths.size()));
+  }
+  if (paths.size() == 1){
+    add_route(route_prefix, prefix_length, paths.front().next_hop, paths.front().interface_num);
+    return;
+  }
+
+  cerr << "DEBUG: adding route " << Address::from_ipv4_numeric( route_prefix ).ip() << "/"
+       << static_cast<int>( prefix_length ) << " =>";
+  for (const Path& path : paths){
+    cerr << " " << ( path.next_hop.has_value() ? path.next_hop->ip() : "(direct)" ) << " on interface " << path.interface_num << ( &path == &paths.back() ? "\n" : "," );
+  }
+
+  const uint32_t prefix_mask = get_prefmask(prefix_length, route_prefix);
+  vector<RouteEntry> entries;
+  for (const Path& path : paths){
+    entries.emplace_back(path.interface_num, path.next_hop.has_value() ? optional<uint32_t>(path.next_hop->ipv4_numeric()) : nullopt);
+  }
+  const RouteEntry entry {ForwardingTable::MULTIPATH, {}}; //the table entry just says to look at the paths.
+
+  const lock_guard<mutex> lock(update_mutex_);
+
+  if (fib_compression_){
+    const uint32_t network = get_network(prefix_length, prefix_mask);
+    rib_[{network, prefix_length}] = entry;
+    update_fib([&](ForwardingTable& fib){
+      fib.set_paths(prefix_length, prefix_mask, entries);
+      reaggregate(fib, network, prefix_length);
+    });
+    return;
+  }
+
+  update_fib([&](ForwardingTable& fib){
+    fib.set_paths(prefix_length, prefix_mask, entries);
+    fib.install(prefix_length, prefix_mask, entry);
+  });
+}
+
+void Router::set_bloom_lookup(bool enabled){
+  const lock_guard<mutex> lock(update_mutex_);
+  update_fib([&](ForwardingTable& fib){ fib.set_bloom_lookup(enabled); });
+}
+
+PageBacking Router::enable_huge_pages(){
+  const lock_guard<mutex> lock(update_mutex_);
+  if (!huge_pages_){
+    huge_pages_ = make_unique<HugePageResource>();
+    fib_memory_ = make_unique<pmr::synchronized_pool_resource>(huge_pages_.get());
+    update_fib([&](ForwardingTable& fib){ fib.use_memory(fib_memory_.get()); });
+  }
+  return huge_pages_->backing();
+}
+
+PageBacking Router::fib_page_backing() const{
+  const lock_guard<mutex> lock(update_mutex_);
+  return huge_pages_ ? huge_pages_->backing() : PageBacking::SMALL;
+}
+
+void Router::refresh_route(ForwardingTable& fib, uint32_t network, uint8_t prefix_length, const RouteEntry& entry) const{
+  //find the covering route: the longest shorter prefix in the rib that contains this one.
+  const RouteEntry* cover = nullptr;
+  for (int cover_length = prefix_length - 1; cover_length >= 0 && cover == nullptr; cover_length--){
+    const auto it = rib_.find({get_network(cover_length, get_prefmask(cover_length, network)), static_cast<uint8_t>(cover_length)});
+    if (it != rib_.end()){
+      cover = &it->second;
+    }
+  }
+
+  const uint32_t prefix_mask = get_prefmask(prefix_length, network);
+  if (cover != nullptr && *cover == entry && !ForwardingTable::is_multipath(entry)){ //(two multipath routes can have different paths)
+    //Redundant: anything this route would match falls through to a route that sends it the same way.
+    fib.erase(prefix_length, prefix_mask);
   } else {
-    routing_table_[prefix_length][prefix_mask].second = {};
+    fib.install(prefix_length, prefix_mask, entry);
   }
+}
+
+void Router::reaggregate(ForwardingTable& fib, uint32_t network, uint8_t prefix_length) const{
+  //The changed route itself:
+  auto it = rib_.find({network, prefix_length});
+  refresh_route(fib, network, prefix_length, it->second);
+
+  //Its immediate more-specifics now have it as their covering route. Anything further down still has
+  //the same covering route as before, so we skip over each child's own subtree.
+  const uint32_t last = network | host_bits(prefix_length);
+  ++it;
+  while (it != rib_.end() && it->first.first <= last){
+    const auto [child_network, child_length] = it->first;
+    refresh_route(fib, child_network, child_length, it->second);
 
+    const uint32_t child_last = child_network | host_bits(child_length);
+    if (child_last == UINT32_MAX){
+      break; //the child's subtree runs to the end of the address space.
+    }
+    it = rib_.lower_bound({child_last + 1, 0});
+  }
 }
 
-uint32_t Router::get_prefmask(uint8_t prefix_length, const uint32_t route){
+void Router::recompress(ForwardingTable& fib) const{
+  fib.clear();
+  for (const auto& [key, entry] : rib_){
+    refresh_route(fib, key.first, key.second, entry);
+  }
+  if (fib.bloom_lookup()){
+    fib.rebuild_bloom(); //drop the bits left behind by routes that turned out redundant.
+  }
+}
+
+void Router::set_fib_compression(bool enabled){
+  const lock_guard<mutex> lock(update_mutex_);
+  if (enabled == fib_compression_){
+    return;
+  }
+  fib_compression_ = enabled;
+
+  if (enabled){
+    //Copy every route into the rib, then rebuild the table from it.
+    const ForwardingTable& current = fib_copies_[1 - standby_];
+    for (size_t prefix_length = 0; prefix_length < 33; prefix_length++){
+      for (const auto& [prefix_mask, entry] : current.table(prefix_length)){
+        rib_[{get_network(prefix_length, prefix_mask), prefix_length}] = entry;
+      }
+    }
+    update_fib([&](ForwardingTable& fib){ recompress(fib); });
+  } else {
+    //Put back everything compression left out.
+    update_fib([&](ForwardingTable& fib){
+      for (const auto& [key, entry] : rib_){
+        fib.install(key.second, get_prefmask(key.second, key.first), entry);
+      }
+    });
+    rib_.clear();
+  }
+}
+
+size_t Router::bulk_install(const RouteSpans& routes){
+  size_t total = 0;
+  for (const auto& list : routes){
+    total += list.size();
+  }
 
-  //I assume that there is always a default available if no matches happen.
-  if (prefix_length == 0){ //special case, no matching bits required.
-    return 0;
+  const lock_guard<mutex> lock(update_mutex_);
+
+  if (fib_compression_){
+    //the rib is one ordered map, so this part stays on one thread.
+    for (size_t prefix_length = 0; prefix_length < 33; prefix_length++){
+      for (const PackedRoute& route : routes[prefix_length]){
+        rib_[{get_network(prefix_length, route.prefix_mask), prefix_length}] = unpack(route);
+      }
+    }
+    update_fib([&](ForwardingTable& fib){ recompress(fib); });
+    return total;
   }
-  
-  return (route >> (32 - prefix_length));
+
+  update_fib([&](ForwardingTable& fib){
+    //Each length has its own table, so the lengths can be filled on different threads.
+    //Within a length the routes go in order, so a repeated prefix ends up with its last entry.
+    auto fill = [&](size_t first, size_t step){
+      for (size_t prefix_length = first; prefix_length < 33; prefix_length += step){
+        auto& table = fib.table(prefix_length);
+        table.reserve(table.size() + routes[prefix_length].size());
+        for (const PackedRoute& route : routes[prefix_length]){
+          table.insert_or_assign(route.prefix_mask, unpack(route));
+        }
+      }
+    };
+
+    const size_t threads = min<size_t>(max(1u, thread::hardware_concurrency()), total / 4096 + 1);
+    vector<thread> workers;
+    for (size_t i = 1; i < threads; i++){
+      workers.emplace_back(fill, i, threads);
+    }
+    fill(0, threads);
+    for (auto& worker : workers){
+      worker.join();
+    }
+
+    if (fib.bloom_lookup()){
+      fib.rebuild_bloom();
+    }
+  });
+  return total;
 }
 
-optional<pair<size_t, uint32_t>> Router::find_match(uint32_t dst_ip){
-  //In this function, we want to check if there is a corresponding entry here.
-  
-  uint32_t ip_mask;
-  pair<size_t, uint32_t> res;
-  for (int prefix_length = 32; prefix_length >= 0; prefix_length--){
+size_t Router::load_routes(const string& path){
+  const FileDescriptor fd {CheckSystemCall("open", open(path.c_str(), O_RDONLY))};
+  const MMapRegion text = MMapRegion::map_readonly(fd);
 
-    ip_mask = get_prefmask(prefix_length, dst_ip);
+  return load_routes(parse_route_dump({static_cast<const char*>(text.data()), text.size()}));
+}
 
-    //check if there is a match at this prefix length in the table:
-    if (routing_table_[prefix_length].find(ip_mask) != routing_table_[prefix_length].end()){
-      res.first = routing_table_[prefix_length][ip_mask].first; //we've found a match (this is the longest prefix match, as we iterate through prefix lengths backward)
+size_t Router::load_routes(const RoutesByLength& routes){
+  RouteSpans spans;
+  for (size_t prefix_length = 0; prefix_length < 33; prefix_length++){
+    spans[prefix_length] = routes[prefix_length];
+  }
+  return bulk_install(spans);
+}
 
-      if (routing_table_[prefix_length][ip_mask].second == nullopt){ //No next hop was filled in the table, so we know that the next hop is simply the destination IP.
-        res.second = dst_ip;
-      } else {
-        res.second = routing_table_[prefix_length][ip_mask].second.value();
+void Router::save_fib_image(const string& path) const{
+  const lock_guard<mutex> lock(update_mutex_);
+
+  auto check_packable = [](const RouteEntry& entry){
+    if (ForwardingTable::is_multipath(entry)){
+      throw runtime_error("FIB images can't hold multipath routes");
+    }
+  };
+
+  //save the routes as they were added, so compression (if any) is redone on load.
+  RoutesByLength routes;
+  if (fib_compression_){
+    for (const auto& [key, entry] : rib_){
+      check_packable(entry);
+      routes[key.second].push_back(pack(get_prefmask(key.second, key.first), entry));
+    }
+  } else {
+    const ForwardingTable& current = fib_copies_[1 - standby_];
+    for (size_t prefix_length = 0; prefix_length < 33; prefix_length++){
+      routes[prefix_length].reserve(current.table(prefix_length).size());
+      for (const auto& [prefix_mask, entry] : current.table(prefix_length)){
+        check_packable(entry);
+        routes[prefix_length].push_back(pack(prefix_mask, entry));
       }
+    }
+  }
+
+  RouteSpans spans;
+  for (size_t prefix_length = 0; prefix_length < 33; prefix_length++){
+    spans[prefix_length] = routes[prefix_length];
+  }
+  FibImage::write(path, spans);
+}
 
-      return res; //we return our result.
+size_t Router::load_fib_image(const string& path){
+  const FibImage image {path};
+  return bulk_install(image.routes());
+}
+
+//The snapshot is text, one neighbour per line after the time it was taken:
+//  saved <ms since the epoch>
+//  <interface> <interface IP> <neighbour IP> <neighbour Ethernet address> <ms left>
+void Router::save_neighbors(const string& path) const{
+  string snapshot = "saved " + to_string(wall_ms()) + "\n";
+  for (size_t i = 0; i < interfaces_.size(); i++){
+    const string interface_ip = interfaces_[i].ip_address().ip();
+    for (const auto& neighbor : interfaces_[i].neighbors()){
+      snapshot += to_string(i) + " " + interface_ip + " " + Address::from_ipv4_numeric(neighbor.ip_address).ip() + " "
+                  + to_string(neighbor.ethernet_address) + " " + to_string(neighbor.ttl_ms) + "\n";
     }
-  } 
-  
-  return {}; //we couldn't find any matches, so we return default. 
+  }
+
+  //synced alongside, then renamed over the old one, so a crash mid-save can't leave half a snapshot.
+  replace_file(path, snapshot);
+}
+
+size_t Router::load_neighbors(const string& path){
+  FileDescriptor fd {CheckSystemCall("open", open(path.c_str(), O_RDONLY))};
+  string text, chunk;
+  while (not fd.eof()){
+    fd.read(chunk);
+    text += chunk;
+  }
+
+  istringstream lines {text};
+  string line, word;
+  uint64_t saved_ms = 0;
+  if (not getline(lines, line) || not (istringstream {line} >> word >> saved_ms) || word != "saved"){
+    throw runtime_error(path + ": not a neighbour snapshot");
+  }
+  const uint64_t now = wall_ms();
+  const uint64_t downtime = now > saved_ms ? now - saved_ms : 0;
+
+  vector<vector<NetworkInterface::Neighbor>> restored(interfaces_.size());
+  for (size_t line_num = 2; getline(lines, line); line_num++){
+    if (line.empty()){
+      continue;
+    }
+    istringstream fields {line};
+    size_t interface_num = 0;
+    uint64_t ttl_ms = 0;
+    string interface_ip, neighbor_ip, ethernet;
+    if (not (fields >> interface_num >> interface_ip >> neighbor_ip >> ethernet >> ttl_ms) || not (fields >> word).fail()){
+      throw runtime_error(path + ":" + to_string(line_num) + ": malformed neighbour entry");
+    }
+    const optional<EthernetAddress> ethernet_address = parse_ethernet(ethernet);
+    if (not ethernet_address.has_value()){
+      throw runtime_error(path + ":" + to_string(line_num) + ": bad Ethernet address " + ethernet);
+    }
+    const uint32_t neighbor = Address {neighbor_ip}.ipv4_numeric();
+
+    //skip neighbours of interfaces that are gone or renumbered, and entries that ran out while we were down.
+    if (interface_num >= interfaces_.size() || interfaces_[interface_num].ip_address().ip() != interface_ip || ttl_ms <= downtime){
+      continue;
+    }
+    restored[interface_num].push_back({neighbor, *ethernet_address, ttl_ms - downtime});
+  }
+
+  size_t total = 0;
+  for (size_t i = 0; i < interfaces_.size(); i++){
+    total += interfaces_[i].restore_neighbors(restored[i]);
+  }
+  return total;
+}
+
+Router::FibStats Router::fib_stats() const{
+  const lock_guard<mutex> lock(update_mutex_);
+
+  FibStats stats;
+  stats.routes_installed = fib_copies_[1 - standby_].size();
+  stats.routes_added = fib_compression_ ? rib_.size() : stats.routes_installed;
+
+  //an unordered_map entry is a heap node (next pointer + key/value) plus about one bucket pointer,
+  //in each of the two copies; a map entry is a tree node (colour + three pointers) + key/value.
+  constexpr size_t bytes_per_route = 2 * (sizeof(pair<const uint32_t, RouteEntry>) + 2 * sizeof(void*));
+  constexpr size_t bytes_per_rib_route = sizeof(decltype(rib_)::value_type) + 4 * sizeof(void*);
+  stats.fib_bytes = stats.routes_installed * bytes_per_route;
+  stats.rib_bytes = fib_compression_ ? rib_.size() * bytes_per_rib_route : 0;
+  stats.bytes_saved = static_cast<int64_t>(stats.routes_added * bytes_per_route)
+                      - static_cast<int64_t>(stats.fib_bytes + stats.rib_bytes);
+  return stats;
+}
+
+optional<pair<size_t, uint32_t>> Router::find_match(uint32_t dst_ip, uint32_t flow) const{
+  //Pin the current epoch, so the copy we're reading can't be reused under us. (seq_cst, to pair with the
+  //guard's slot store: either the writer sees our slot or we see its new copy.)
+  const RcuEpoch::ReadGuard guard;
+  return fib_.load(memory_order_seq_cst)->lookup(dst_ip, flow);
+}
+
+void Router::swap_acl(unique_ptr<const PacketClassifier> next){
+  const lock_guard<mutex> lock(update_mutex_);
+  acl_.store(next.get(), memory_order_seq_cst); //publish.
+  RcuEpoch::synchronize(); //no datagram is being checked against the old one after this.
+  acl_owner_ = std::move(next);
+}
+
+void Router::set_acl(const vector<AclRule>& rules, AclRule::Action default_action){
+  swap_acl(make_unique<const PacketClassifier>(rules, default_action)); //compiled before anything is swapped.
+}
+
+void Router::clear_acl(){
+  swap_acl(nullptr);
+}
+
+bool Router::admit(const InternetDatagram& dgram){
+  const PacketClassifier* acl = acl_.load(memory_order_seq_cst); //(as fib_ in find_match)
+  if (acl == nullptr || acl->decide(dgram) == AclRule::Action::PERMIT){
+    return true;
+  }
+  acl_denied_.fetch_add(1, memory_order_relaxed);
+  return false;
 }
 
 void Router::process_dgram(InternetDatagram& dgram){
@@ -76,12 +446,25 @@ void Router::process_dgram(InternetDatagram& dgram){
   if (dgram.header.ttl <= 1){
     return; //drop packet. 
   } else {
+    //the checksum was verified on the way in, so it only needs patching for the one word that changed.
+    const uint16_t old_word = (static_cast<uint16_t>(dgram.header.ttl) << 8) | dgram.header.proto;
     dgram.header.ttl--;
-    dgram.header.compute_checksum();
+    dgram.header.cksum = InternetChecksum::adjust(dgram.header.cksum, old_word, old_word - 0x100);
+  }
+
+  //Replies to NATed connections go back to the inside address before they're routed.
+  if (napt_ && napt_->is_public(dgram.header.dst) && !napt_->translate_inbound(dgram)){
+    return; //not a connection we know of.
   }
 
   optional<pair<size_t, uint32_t>> routing_info; 
-  routing_info = find_match(dgram.header.dst);
+  routing_info = find_match(dgram.header.dst, flow_hash(dgram.header.src, dgram.header.dst, dgram.header.proto)); //the hash only matters if the route has several paths.
+
+  //Connections leaving by the outside interface get a public source.
+  if (routing_info != nullopt && napt_ && routing_info->first == napt_interface_
+      && !napt_->is_public(dgram.header.src) && !napt_->translate_outbound(dgram)){
+    return; //not something we can translate, or out of ports.
+  }
 
   if (routing_info != nullopt){ //We found a location, so we send the packet now.
     AsyncNetworkInterface& outgoing_intf = interface(routing_info.value().first); //Get the outgoing interface we need to send the datagram on.
@@ -91,22 +474,49 @@ void Router::process_dgram(InternetDatagram& dgram){
   return; //if we don't find a location, we simply return without doing anything (packet dropped)
 }
 
+void Router::enable_napt(size_t outside_interface, const Napt::Config& config){
+  if (outside_interface >= interfaces_.size()){
+    throw runtime_error("NAPT outside interface " + to_string(outside_interface) + " doesn't exist");
+  }
+  napt_ = make_unique<Napt>(config);
+  napt_interface_ = outside_interface;
+}
+
+void Router::enable_telemetry(const FlowTelemetry::Config& config){
+  telemetry_ = make_unique<FlowTelemetry>(config);
+}
+
+void Router::tick(size_t ms_since_last_tick){
+  if (napt_){
+    napt_->tick(ms_since_last_tick);
+    napt_->expire();
+  }
+  if (telemetry_){
+    telemetry_->tick(ms_since_last_tick);
+  }
+}
+
 void Router::process_interface(size_t interface_num){
   //We assume the interface_num is valid and in bounds here. 
 
     //Get the interface that we want to process. 
   AsyncNetworkInterface& targ_intf = interface(interface_num);
-  optional<InternetDatagram> dgram = targ_intf.maybe_receive(); //get a packet from the queue. 
 
-  while (dgram.has_value()){//Keep iterating through queue until it is empty. 
-    process_dgram(dgram.value());
-    dgram = targ_intf.maybe_receive();
+  while (targ_intf.maybe_receive(dgram_)){//Keep taking packets off the queue until it is empty. 
+    if (admit(dgram_)){ //the ACL gets first say.
+      if (telemetry_ && telemetry_->sample_due()){ //a decrement, unless this one is sampled.
+        telemetry_->record(dgram_, interface_num);
+      }
+      process_dgram(dgram_);
+    }
   }
 
   return;
 }
 
 void Router::route() {
+  //Stay pinned for the whole pass, so the lookups inside only need to nest.
+  const RcuEpoch::ReadGuard guard;
 
   //Check through all interfaces for packets that need processing:
   for (size_t i = 0; i < (interfaces_).size(); i++) {
@@ -0,0 +1,279 @@
+#include "shm_link.hh"
+
+#include "exception.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cerrno>
+#include <new>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+constexpr uint32_t VERSION = 1;
+constexpr size_t CACHE_LINE = 64;
+constexpr size_t PAGE = 4096;
+constexpr uint32_t MAX_SLOTS = 1 << 20;
+constexpr uint32_t MAX_FRAME_SIZE = 1 << 16;
+constexpr size_t RING_SIZE = 3 * CACHE_LINE; // sizeof( ShmLink::Ring )
+
+static_assert( atomic<uint32_t>::is_always_lock_free, "the rings need atomics that work across processes" );
+
+// At the start of the region
+struct alignas( CACHE_LINE ) RegionHeader
+{
+  uint32_t magic {};
+  uint32_t version {};
+  uint32_t ring_slots {};
+  uint32_t frame_size {};
+};
+
+// Where a frame is, as an offset from the start of the region
+struct Descriptor
+{
+  uint32_t offset {};
+  uint32_t length {};
+};
+
+size_t round_up( size_t n, size_t multiple )
+{
+  return ( n + multiple - 1 ) / multiple * multiple;
+}
+
+} // namespace
+
+// One direction's indices, each on its own cache line so the two ends don't share one they write.
+// Its descriptors and buffers follow the rings.
+struct ShmLink::Ring
+{
+  alignas( CACHE_LINE ) atomic<uint32_t> tail { 0 };             // next slot to fill (written by the sender)
+  alignas( CACHE_LINE ) atomic<uint32_t> head { 0 };             // next slot to drain (written by the receiver)
+  alignas( CACHE_LINE ) atomic<uint32_t> receiver_waiting { 0 }; // the receiver is asleep in wait()
+};
+
+namespace {
+
+// The region: the header, both rings, both directions' descriptors, then (page-aligned) both
+// directions' buffers
+struct RegionLayout
+{
+  size_t rings {};
+  size_t descriptors {};
+  size_t buffers {};
+  size_t length {};
+
+  RegionLayout( uint32_t slots, uint32_t frame_size )
+  {
+    rings = sizeof( RegionHeader );
+    descriptors = rings + 2 * RING_SIZE;
+    buffers = round_up( descriptors + 2 * size_t { slots } * sizeof( Descriptor ), PAGE );
+    length = round_up( buffers + 2 * size_t { slots } * frame_size, PAGE );
+  }
+};
+
+FileDescriptor make_eventfd()
+{
+  return FileDescriptor { CheckSystemCall( "eventfd", eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC ) ) };
+}
+
+} // namespace
+
+pair<ShmLink, ShmLink> ShmLink::make_pair( const ShmLinkConfig& config )
+{
+  if ( config.ring_slots == 0 or config.ring_slots > MAX_SLOTS or not has_single_bit( config.ring_slots ) ) {
+    throw runtime_error( "ShmLink: ring_slots must be a power of two, up to " + to_string( MAX_SLOTS ) );
+  }
+  if ( config.frame_size < EthernetHeader::LENGTH or config.frame_size > MAX_FRAME_SIZE ) {
+    throw runtime_error( "ShmLink: frame_size must be between " + to_string( EthernetHeader::LENGTH ) + " and "
+                         + to_string( MAX_FRAME_SIZE ) );
+  }
+  const auto slots = static_cast<uint32_t>( config.ring_slots );
+  const auto frame_size = static_cast<uint32_t>( round_up( config.frame_size, CACHE_LINE ) );
+  const RegionLayout layout { slots, frame_size };
+  if ( layout.length > UINT32_MAX ) {
+    throw runtime_error( "ShmLink: ring_slots * frame_size is too big (descriptors hold 32-bit offsets)" );
+  }
+
+  FileDescriptor memory { CheckSystemCall( "memfd_create", memfd_create( "shm_link", MFD_CLOEXEC ) ) };
+  CheckSystemCall( "ftruncate", ftruncate( memory.fd_num(), static_cast<off_t>( layout.length ) ) );
+  {
+    //(a fresh memfd is zeroed, so only the header and rings need writing.)
+    const MMapRegion region = MMapRegion::map_shared( memory, layout.length );
+    char* const base = static_cast<char*>( region.data() );
+    new ( base + layout.rings ) Ring {};
+    new ( base + layout.rings + RING_SIZE ) Ring {};
+    new ( base ) RegionHeader { MAGIC, VERSION, slots, frame_size };
+  }
+
+  FileDescriptor wake_0 = make_eventfd();
+  FileDescriptor wake_1 = make_eventfd();
+  ShmLink end_0 { memory.duplicate(), wake_0.duplicate(), wake_1.duplicate(), 0 };
+  ShmLink end_1 { std::move( memory ), std::move( wake_1 ), std::move( wake_0 ), 1 };
+  return { std::move( end_0 ), std::move( end_1 ) };
+}
+
+ShmLink::ShmLink( FileDescriptor&& memory, FileDescriptor&& wake_me, FileDescriptor&& wake_peer, unsigned side )
+  : memory_( std::move( memory ) ), wake_me_( std::move( wake_me ) ), wake_peer_( std::move( wake_peer ) ), side_( side )
+{
+  if ( side_ > 1 ) {
+    throw runtime_error( "ShmLink: side must be 0 or 1" );
+  }
+
+  struct stat info {};
+  CheckSystemCall( "fstat", fstat( memory_.fd_num(), &info ) );
+  const auto length = static_cast<size_t>( info.st_size );
+  if ( length < sizeof( RegionHeader ) ) {
+    throw runtime_error( "ShmLink: the region is too small to be a link" );
+  }
+  region_ = MMapRegion::map_shared( memory_, length );
+
+  const auto* const header = static_cast<const RegionHeader*>( region_.data() );
+  if ( header->magic != MAGIC or header->version != VERSION ) {
+    throw runtime_error( "ShmLink: the region isn't a link (or is another version's)" );
+  }
+  slots_ = header->ring_slots;
+  frame_size_ = header->frame_size;
+  if ( slots_ == 0 or slots_ > MAX_SLOTS or not has_single_bit( slots_ ) or frame_size_ < EthernetHeader::LENGTH
+       or frame_size_ > MAX_FRAME_SIZE or RegionLayout { slots_, frame_size_ }.length != length
+       or length > UINT32_MAX ) {
+    throw runtime_error( "ShmLink: the region's header doesn't match its size" );
+  }
+}
+
+ShmLink::Ring& ShmLink::ring( unsigned direction ) const
+{
+  static_assert( sizeof( Ring ) == RING_SIZE );
+  char* const base = static_cast<char*>( region_.data() ) + RegionLayout { slots_, frame_size_ }.rings;
+  return *launder( reinterpret_cast<Ring*>( base + direction * RING_SIZE ) ); // NOLINT(*-reinterpret-cast)
+}
+
+char* ShmLink::buffer( unsigned direction, uint32_t slot ) const
+{
+  const size_t index = size_t { direction } * slots_ + slot;
+  return static_cast<char*>( region_.data() ) + RegionLayout { slots_, frame_size_ }.buffers + index * frame_size_;
+}
+
+namespace {
+
+Descriptor* descriptors( void* region, uint32_t slots, uint32_t frame_size, unsigned direction )
+{
+  char* const base = static_cast<char*>( region ) + RegionLayout { slots, frame_size }.descriptors;
+  return reinterpret_cast<Descriptor*>( base ) + size_t { direction } * slots; // NOLINT(*-reinterpret-cast)
+}
+
+} // namespace
+
+bool ShmLink::send( const EthernetFrame& frame )
+{
+  Ring& out = ring( side_ );
+  const uint32_t tail = out.tail.load( memory_order_relaxed );
+  const size_t length = bytes_on_wire( frame );
+  if ( tail - out.head.load( memory_order_acquire ) == slots_ or length > frame_size_ ) {
+    stats_.dropped++;
+    return false;
+  }
+
+  const uint32_t slot = tail & ( slots_ - 1 );
+  char* const bytes = buffer( side_, slot );
+  pack( frame, bytes );
+  descriptors( region_.data(), slots_, frame_size_, side_ )[slot]
+    = { static_cast<uint32_t>( bytes - static_cast<char*>( region_.data() ) ), static_cast<uint32_t>( length ) };
+  stats_.sent++;
+
+  //the receiver sets its flag then checks the ring; we publish then check the flag. all four are
+  //sequentially consistent, so at least one of us sees the other, and a frame never sits unnoticed.
+  out.tail.store( tail + 1, memory_order_seq_cst );
+  if ( out.receiver_waiting.load( memory_order_seq_cst ) ) {
+    const uint64_t one = 1;
+    if ( ::write( wake_peer_.fd_num(), &one, sizeof( one ) ) < 0 and errno != EAGAIN ) {
+      throw unix_error { "write (eventfd)" };
+    }
+    wakeups_sent_++;
+  }
+  return true;
+}
+
+bool ShmLink::frame_waiting() const
+{
+  const Ring& in = ring( 1 - side_ );
+  return in.head.load( memory_order_relaxed ) != in.tail.load( memory_order_seq_cst );
+}
+
+bool ShmLink::recv( EthernetFrame& frame )
+{
+  const unsigned peer = 1 - side_;
+  Ring& in = ring( peer );
+  const size_t first = static_cast<size_t>( buffer( peer, 0 ) - static_cast<char*>( region_.data() ) );
+  const size_t end = first + size_t { slots_ } * frame_size_;
+
+  //frames too short to be frames are skipped, so keep going until one unpacks or the ring is empty.
+  while ( true ) {
+    const uint32_t head = in.head.load( memory_order_relaxed );
+    const uint32_t tail = in.tail.load( memory_order_acquire );
+    if ( head == tail ) {
+      return false;
+    }
+    if ( tail - head > slots_ ) {
+      throw runtime_error( "ShmLink: the peer's ring indices are corrupt" );
+    }
+
+    //the descriptor is in memory the peer can write, so check it points into the peer's buffers.
+    const Descriptor descriptor = descriptors( region_.data(), slots_, frame_size_, peer )[head & ( slots_ - 1 )];
+    if ( descriptor.offset < first or descriptor.length > frame_size_
+         or size_t { descriptor.offset } + descriptor.length > end ) {
+      throw runtime_error( "ShmLink: the peer published a frame outside its buffers" );
+    }
+
+    const bool ok = unpack( static_cast<const char*>( region_.data() ) + descriptor.offset, descriptor.length, frame );
+    in.head.store( head + 1, memory_order_release );
+    if ( ok ) {
+      stats_.received++;
+      return true;
+    }
+  }
+}
+
+bool ShmLink::wait( int timeout_ms )
+{
+  if ( frame_waiting() ) {
+    return true;
+  }
+
+  //a kick can be left over from a frame we found without sleeping, so waking doesn't always
+  //mean a frame is there: keep sleeping until one is, or the time is up.
+  const auto deadline = chrono::steady_clock::now() + chrono::milliseconds( max( timeout_ms, 0 ) );
+  Ring& in = ring( 1 - side_ );
+  in.receiver_waiting.store( 1, memory_order_seq_cst );
+  while ( not frame_waiting() ) {
+    const int remaining
+      = timeout_ms < 0 ? -1
+                       : static_cast<int>( chrono::ceil<chrono::milliseconds>(
+                                             max( deadline - chrono::steady_clock::now(), chrono::nanoseconds { 0 } ) )
+                                             .count() );
+    pollfd woken { wake_me_.fd_num(), POLLIN, 0 };
+    const int ready = ::poll( &woken, 1, remaining );
+    if ( ready < 0 and errno != EINTR ) {
+      throw unix_error { "poll" };
+    }
+    if ( ready == 0 ) {
+      break; // (timed out)
+    }
+    if ( woken.revents & POLLIN ) {
+      uint64_t kicks = 0;
+      if ( ::read( wake_me_.fd_num(), &kicks, sizeof( kicks ) ) < 0 and errno != EAGAIN ) {
+        throw unix_error { "read (eventfd)" };
+      }
+    }
+  }
+  in.receiver_waiting.store( 0, memory_order_relaxed );
+  return frame_waiting();
+}
@@ -0,0 +1,199 @@
+#include "trace_replay.hh"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+
+using namespace std;
+
+namespace {
+
+constexpr uint64_t SPIN_NS = 200'000; // wait this close to a frame's time by spinning, not sleeping
+
+uint64_t now_ns()
+{
+  return chrono::duration_cast<chrono::nanoseconds>( chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+// Identifies the datagram a frame carries by the fields routing leaves alone: source,
+// destination, protocol and id. Returns false if it isn't IPv4.
+bool datagram_key( const EthernetFrame& frame, uint64_t& key )
+{
+  if ( frame.header.type != EthernetHeader::TYPE_IPv4 ) {
+    return false;
+  }
+  array<uint8_t, IPv4Header::LENGTH> bytes {};
+  size_t have = 0;
+  for ( const auto& buffer : frame.payload ) {
+    const string_view view = buffer;
+    const size_t n = min( view.size(), bytes.size() - have );
+    copy_n( view.begin(), n, bytes.begin() + have );
+    have += n;
+    if ( have == bytes.size() ) {
+      break;
+    }
+  }
+  if ( have < bytes.size() ) {
+    return false;
+  }
+
+  auto load = [&]( size_t at, size_t n ) {
+    uint64_t value = 0;
+    for ( size_t i = 0; i < n; i++ ) {
+      value = ( value << 8 ) | bytes[at + i];
+    }
+    return value;
+  };
+  const uint64_t addresses = ( load( 12, 4 ) << 32 ) | load( 16, 4 );
+  key = addresses * 0x9e3779b97f4a7c15 ^ ( load( 4, 2 ) << 8 | load( 9, 1 ) );
+  return true;
+}
+
+// Answers an ARP request the router sent, as the host it asked about. Returns whether it was one.
+bool answer_arp( AsyncNetworkInterface& interface, const EthernetFrame& frame )
+{
+  ARPMessage request;
+  if ( frame.header.type != EthernetHeader::TYPE_ARP || not parse( request, frame.payload )
+       || request.opcode != ARPMessage::OPCODE_REQUEST ) {
+    return false;
+  }
+  const uint32_t ip = request.target_ip_address;
+
+  ARPMessage reply;
+  reply.opcode = ARPMessage::OPCODE_REPLY;
+  reply.sender_ethernet_address
+    = { 0x02, 0x00, static_cast<uint8_t>( ip >> 24 ), static_cast<uint8_t>( ip >> 16 ),
+        static_cast<uint8_t>( ip >> 8 ), static_cast<uint8_t>( ip ) };
+  reply.sender_ip_address = ip;
+  reply.target_ethernet_address = request.sender_ethernet_address;
+  reply.target_ip_address = request.sender_ip_address;
+
+  EthernetFrame answer;
+  answer.header = { request.sender_ethernet_address, reply.sender_ethernet_address, EthernetHeader::TYPE_ARP };
+  answer.payload = serialize( reply );
+  interface.recv_frame( answer );
+  return true;
+}
+
+} // namespace
+
+ReplayReport replay_trace( Router& router, const vector<PcapRecord>& trace, const ReplayConfig& config )
+{
+  if ( config.batch == 0 || config.speedup <= 0 ) {
+    throw runtime_error( "replay needs a batch of at least one frame and a positive speedup" );
+  }
+  AsyncNetworkInterface& ingress = router.interface( config.ingress );
+
+  ReplayReport report;
+  report.frames = trace.size();
+  // Datagrams that went in and haven't come out, by trace position. A key can be shared (the
+  // 16-bit id wraps), so each key holds a chain of positions, matched oldest first.
+  struct Chain
+  {
+    size_t oldest, newest;
+  };
+  unordered_map<uint64_t, Chain> in_flight; // datagram key -> positions in the trace
+  vector<size_t> next_in_chain( trace.size() );
+  vector<uint64_t> sent_at( trace.size() );
+  vector<uint64_t> latencies;
+  latencies.reserve( trace.size() );
+  EthernetFrame out;
+
+  //takes everything off every interface, answering ARP until nothing more comes out.
+  auto drain = [&] {
+    bool answered = true;
+    while ( answered ) {
+      answered = false;
+      for ( size_t i = 0; i < router.num_interfaces(); i++ ) {
+        AsyncNetworkInterface& interface = router.interface( i );
+        while ( interface.maybe_send( out ) ) {
+          uint64_t key = 0;
+          if ( datagram_key( out, key ) ) {
+            report.forwarded++;
+            const auto it = in_flight.find( key );
+            if ( it != in_flight.end() ) {
+              Chain& chain = it->second;
+              latencies.push_back( now_ns() - sent_at[chain.oldest] );
+              if ( chain.oldest == chain.newest ) {
+                in_flight.erase( it );
+              } else {
+                chain.oldest = next_in_chain[chain.oldest];
+              }
+            }
+          } else if ( config.answer_arp ) {
+            answered = answer_arp( interface, out ) || answered;
+          }
+        }
+      }
+    }
+  };
+
+  const uint64_t start = now_ns();
+  const uint64_t first = trace.empty() ? 0 : trace.front().timestamp_ns;
+  auto due = [&]( size_t i ) {
+    const uint64_t offset = trace[i].timestamp_ns > first ? trace[i].timestamp_ns - first : 0;
+    return start + static_cast<uint64_t>( static_cast<double>( offset ) / config.speedup );
+  };
+  const bool recorded = config.pace == ReplayConfig::Pace::RECORDED;
+  uint64_t ticked_ms = 0;
+
+  size_t next = 0;
+  while ( next < trace.size() ) {
+    if ( recorded ) {
+      const uint64_t at = due( next );
+      uint64_t now = now_ns();
+      if ( at > now + SPIN_NS ) {
+        this_thread::sleep_for( chrono::nanoseconds( at - now - SPIN_NS ) );
+      }
+      while ( ( now = now_ns() ) < at ) {}
+
+      const uint64_t elapsed_ms = ( now - start ) / 1'000'000;
+      if ( elapsed_ms > ticked_ms ) {
+        router.tick( elapsed_ms - ticked_ms );
+        for ( size_t i = 0; i < router.num_interfaces(); i++ ) {
+          router.interface( i ).tick( elapsed_ms - ticked_ms );
+        }
+        ticked_ms = elapsed_ms;
+      }
+    }
+
+    //hand over a batch: up to config.batch frames, and (at recorded pace) only those whose time has come.
+    const size_t batch_start = next;
+    do {
+      const EthernetFrame& frame = trace[next].frame;
+      uint64_t key = 0;
+      if ( datagram_key( frame, key ) ) {
+        report.datagrams++;
+        sent_at[next] = now_ns();
+        const auto [it, fresh] = in_flight.try_emplace( key, Chain { next, next } );
+        if ( not fresh ) {
+          next_in_chain[it->second.newest] = next;
+          it->second.newest = next;
+        }
+      }
+      ingress.recv_frame( frame );
+      next++;
+    } while ( next < trace.size() && next - batch_start < config.batch && ( not recorded || due( next ) <= now_ns() ) );
+
+    router.route();
+    drain();
+  }
+
+  report.seconds = static_cast<double>( now_ns() - start ) / 1e9;
+  report.pps = report.seconds > 0 ? static_cast<double>( report.frames ) / report.seconds : 0;
+  report.dropped = report.datagrams > report.forwarded ? report.datagrams - report.forwarded : 0;
+  if ( not latencies.empty() ) {
+    auto percentile = [&]( size_t p ) {
+      const auto nth = latencies.begin() + static_cast<ptrdiff_t>( ( latencies.size() - 1 ) * p / 100 );
+      nth_element( latencies.begin(), nth, latencies.end() );
+      return *nth;
+    };
+    report.latency_p50_ns = percentile( 50 );
+    report.latency_p99_ns = percentile( 99 );
+    report.latency_max_ns = ranges::max( latencies );
+  }
+  return report;
+}
@@ -0,0 +1,188 @@
+#include "traffic_generator.hh"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <random>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+namespace {
+
+constexpr size_t TCP_HEADER = 20;
+constexpr size_t RECENT = 16; // LOCALITY: how many recent destinations new flows cluster around
+
+const array<uint16_t, 8> SERVICES = { 80, 443, 443, 443, 53, 22, 8080, 123 };
+
+struct Flow
+{
+  uint8_t proto {};
+  uint32_t src {};
+  uint32_t dst {};
+  uint16_t src_port {};
+  uint16_t dst_port {};
+  vector<Buffer> segments {}; // TCP/UDP header and payload, one per packet size, made when first needed
+  uint16_t next_id {};        // IPv4 id of the flow's next datagram
+};
+
+uint32_t host_mask( uint8_t length )
+{
+  return length == 0 ? UINT32_MAX : ( length == 32 ? 0 : UINT32_MAX >> length );
+}
+
+// A segment: the flow's TCP or UDP header, then filler to make up the size
+Buffer make_segment( const Flow& flow, size_t segment_size )
+{
+  string segment( segment_size, 'x' );
+  auto put16 = [&]( size_t at, uint16_t value ) {
+    segment[at] = static_cast<char>( value >> 8 );
+    segment[at + 1] = static_cast<char>( value & 0xff );
+  };
+
+  put16( 0, flow.src_port );
+  put16( 2, flow.dst_port );
+  if ( flow.proto == IPv4Header::PROTO_TCP ) {
+    fill_n( segment.begin() + 4, TCP_HEADER - 4, 0 );
+    segment[12] = 0x50; // data offset: 5 words
+    segment[13] = 0x10; // ACK
+    put16( 14, 0xffff ); // window
+  } else {
+    put16( 4, static_cast<uint16_t>( segment_size ) );
+    put16( 6, 0 ); // no checksum
+  }
+  return Buffer { std::move( segment ) };
+}
+
+} // namespace
+
+vector<pair<uint32_t, uint8_t>> random_prefixes( size_t count, uint64_t seed )
+{
+  // prefix length -> share of the table
+  const vector<pair<uint8_t, double>> lengths
+    = { { 8, 0.2 }, { 12, 0.3 }, { 14, 0.5 }, { 16, 4 },  { 17, 1 },  { 18, 2 },
+        { 19, 4 },  { 20, 5 },   { 21, 5 },   { 22, 10 }, { 23, 10 }, { 24, 58 } };
+  vector<double> weights;
+  for ( const auto& length : lengths ) {
+    weights.push_back( length.second );
+  }
+
+  mt19937_64 rd { seed };
+  discrete_distribution<size_t> pick { weights.begin(), weights.end() };
+  vector<pair<uint32_t, uint8_t>> prefixes;
+  prefixes.reserve( count );
+  for ( size_t i = 0; i < count; i++ ) {
+    const uint8_t length = lengths[pick( rd )].first;
+    prefixes.emplace_back( static_cast<uint32_t>( rd() ) & ~host_mask( length ), length );
+  }
+  return prefixes;
+}
+
+TrafficTrace::TrafficTrace( const TrafficConfig& config )
+{
+  if ( config.flows == 0 ) {
+    throw runtime_error( "traffic needs at least one flow" );
+  }
+  if ( config.sizes.empty() ) {
+    throw runtime_error( "traffic needs at least one packet size" );
+  }
+  for ( const auto& size : config.sizes ) {
+    if ( size.bytes < IPv4Header::LENGTH + TCP_HEADER ) {
+      throw runtime_error( "packet size " + to_string( size.bytes ) + " is too small for IPv4 and TCP headers" );
+    }
+    if ( size.weight < 0 ) {
+      throw runtime_error( "packet size " + to_string( size.bytes ) + " has a negative weight" );
+    }
+  }
+  for ( const auto& [prefix, length] : config.prefixes ) {
+    if ( length > 32 ) {
+      throw runtime_error( "destination prefix length over 32" );
+    }
+  }
+  if ( config.source_length > 32 ) {
+    throw runtime_error( "source prefix length over 32" );
+  }
+
+  mt19937_64 rd { config.seed };
+  uniform_real_distribution<double> chance;
+  auto random32 = [&] { return static_cast<uint32_t>( rd() ); };
+
+  // where destinations come from: a prefix picked by the chosen distribution, then a random host in it
+  vector<pair<uint32_t, uint8_t>> prefixes = config.prefixes;
+  if ( prefixes.empty() ) {
+    prefixes.emplace_back( 0, 0 );
+  }
+  vector<double> prefix_weights( prefixes.size(), 1.0 );
+  if ( config.destinations == TrafficConfig::Destinations::ZIPF ) {
+    for ( size_t i = 0; i < prefixes.size(); i++ ) {
+      prefix_weights[i] = 1.0 / pow( static_cast<double>( i + 1 ), config.zipf_exponent );
+    }
+  }
+  discrete_distribution<size_t> pick_prefix { prefix_weights.begin(), prefix_weights.end() };
+  auto in_prefix = [&]( pair<uint32_t, uint8_t> p ) {
+    const uint32_t mask = host_mask( p.second );
+    return ( p.first & ~mask ) | ( random32() & mask );
+  };
+
+  // the flows
+  vector<Flow> flows( config.flows );
+  vector<pair<uint32_t, uint8_t>> recent; // LOCALITY: the last few destinations, and their prefix lengths
+  for ( Flow& flow : flows ) {
+    flow.proto = chance( rd ) < config.tcp_fraction ? IPv4Header::PROTO_TCP : IPv4Header::PROTO_UDP;
+    flow.src = ( config.source_prefix & ~host_mask( config.source_length ) )
+               | ( random32() & host_mask( config.source_length ) );
+    flow.src_port = static_cast<uint16_t>( 1024 + rd() % ( 65536 - 1024 ) );
+    flow.dst_port = SERVICES[rd() % SERVICES.size()];
+    flow.segments.resize( config.sizes.size() );
+
+    if ( config.destinations == TrafficConfig::Destinations::LOCALITY && not recent.empty()
+         && chance( rd ) < config.locality ) {
+      // a neighbour of a recent destination: same /24, or same prefix if that's longer
+      const auto [near, length] = recent[rd() % recent.size()];
+      flow.dst = in_prefix( { near, max<uint8_t>( length, 24 ) } );
+    } else {
+      const auto& prefix = prefixes[pick_prefix( rd )];
+      flow.dst = in_prefix( prefix );
+      if ( recent.size() == RECENT ) {
+        recent.erase( recent.begin() );
+      }
+      recent.emplace_back( flow.dst, prefix.second );
+    }
+  }
+
+  // the packets
+  vector<double> size_weights;
+  for ( const auto& size : config.sizes ) {
+    size_weights.push_back( size.weight );
+  }
+  discrete_distribution<size_t> pick_size { size_weights.begin(), size_weights.end() };
+
+  datagrams_.reserve( config.packets );
+  frames_.reserve( config.packets );
+  for ( size_t i = 0; i < config.packets; i++ ) {
+    Flow& flow = flows[rd() % flows.size()];
+    const size_t size_index = pick_size( rd );
+    const uint16_t total = config.sizes[size_index].bytes;
+    Buffer& segment = flow.segments[size_index];
+    if ( segment.empty() ) {
+      segment = make_segment( flow, total - IPv4Header::LENGTH );
+    }
+
+    InternetDatagram& dgram = datagrams_.emplace_back();
+    dgram.header.len = total;
+    dgram.header.id = flow.next_id++;
+    dgram.header.proto = flow.proto;
+    dgram.header.src = flow.src;
+    dgram.header.dst = flow.dst;
+    dgram.header.compute_checksum();
+    dgram.payload.push_back( segment );
+    bytes_ += total;
+
+    EthernetFrame& frame = frames_.emplace_back();
+    frame.header.dst = config.ethernet_dst;
+    frame.header.src = config.ethernet_src;
+    frame.header.type = EthernetHeader::TYPE_IPv4;
+    frame.payload = serialize( dgram );
+  }
+}
@@ -0,0 +1,125 @@
+#include "arp_message.hh"
+#include "ethernet_frame.hh"
+#include "ipv4_datagram.hh"
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+constexpr size_t ROUNDS = 5'000'000;
+
+double seconds_since( chrono::steady_clock::time_point start )
+{
+  return chrono::duration<double>( chrono::steady_clock::now() - start ).count();
+}
+
+// What Serializer::integer used to do: one push_back per byte
+template<typename T>
+void put_bytewise( string& out, T value )
+{
+  for ( size_t i = sizeof( T ); i > 0; i-- ) {
+    out.push_back( static_cast<char>( value >> ( ( i - 1 ) * 8 ) ) );
+  }
+}
+
+void serialize_bytewise( const IPv4Header& h, string& out )
+{
+  put_bytewise( out, static_cast<uint8_t>( ( h.ver << 4 ) | ( h.hlen & 0xf ) ) );
+  put_bytewise( out, h.tos );
+  put_bytewise( out, h.len );
+  put_bytewise( out, h.id );
+  put_bytewise( out, static_cast<uint16_t>( ( h.df ? 0x4000 : 0 ) | ( h.mf ? 0x2000 : 0 ) | ( h.offset & 0x1fff ) ) );
+  put_bytewise( out, h.ttl );
+  put_bytewise( out, h.proto );
+  put_bytewise( out, h.cksum );
+  put_bytewise( out, h.src );
+  put_bytewise( out, h.dst );
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    IPv4Header header;
+    header.len = 1500;
+    header.src = 0x0a000001;
+    header.compute_checksum();
+
+    //the old encoding, into a reused string.
+    string bytes;
+    bytes.reserve( 64 );
+    uint64_t check = 0;
+    auto start = chrono::steady_clock::now();
+    for ( size_t i = 0; i < ROUNDS; i++ ) {
+      header.dst = static_cast<uint32_t>( i );
+      bytes.clear();
+      serialize_bytewise( header, bytes );
+      check += static_cast<uint8_t>( bytes[19] );
+    }
+    const double bytewise_ns = seconds_since( start ) * 1e9 / ROUNDS;
+
+    //the layout, the way NetworkInterface serializes: into the recycled memory of the last frame.
+    vector<Buffer> recycled;
+    start = chrono::steady_clock::now();
+    for ( size_t i = 0; i < ROUNDS; i++ ) {
+      header.dst = static_cast<uint32_t>( i );
+      Serializer serializer { std::move( recycled ) };
+      header.serialize( serializer );
+      recycled = serializer.output();
+      check -= static_cast<uint8_t>( string_view { recycled.front() }[19] );
+    }
+    const double layout_ns = seconds_since( start ) * 1e9 / ROUNDS;
+
+    //parsing, straight from one Buffer.
+    header.compute_checksum();
+    const vector<Buffer> wire = serialize( header );
+    IPv4Header parsed;
+    size_t parsed_ok = 0;
+    start = chrono::steady_clock::now();
+    for ( size_t i = 0; i < ROUNDS; i++ ) {
+      parsed_ok += parse( parsed, wire );
+    }
+    const double parse_ns = seconds_since( start ) * 1e9 / ROUNDS;
+
+    //a whole ARP frame (Ethernet header, then ARP message), as ARP requests are built.
+    ARPMessage arp;
+    arp.opcode = ARPMessage::OPCODE_REQUEST;
+    EthernetFrame frame;
+    frame.header = { ETHERNET_BROADCAST, { 2, 0, 0, 0, 0, 1 }, EthernetHeader::TYPE_ARP };
+    size_t frame_bytes = 0;
+    start = chrono::steady_clock::now();
+    for ( size_t i = 0; i < ROUNDS; i++ ) {
+      arp.target_ip_address = static_cast<uint32_t>( i );
+      frame.payload = serialize( arp );
+      frame_bytes += frame.payload.front().size();
+    }
+    const double arp_ns = seconds_since( start ) * 1e9 / ROUNDS;
+
+    cout << "IPv4 header (20 bytes):\n"
+         << fixed << setprecision( 1 ) << "  serialize, a byte at a time: " << setw( 6 ) << bytewise_ns << " ns\n"
+         << "  serialize, from the layout:  " << setw( 6 ) << layout_ns << " ns\n"
+         << "  parse, from the layout:      " << setw( 6 ) << parse_ns << " ns\n"
+         << "ARP message (28 bytes), into a fresh Buffer: " << arp_ns << " ns\n";
+
+    if ( check != 0 || parsed_ok != ROUNDS || parsed.dst != header.dst || frame_bytes != ROUNDS * ARPMessage::LENGTH ) {
+      throw runtime_error( "the layout didn't produce the same bytes, or couldn't read them back" );
+    }
+    if ( layout_ns > 100 || parse_ns > 100 ) {
+      throw runtime_error( "an IPv4 header took over 100 ns to serialize or parse" );
+    }
+  } catch ( const exception& e ) {
+    cerr << "\n\n\n";
+    cerr << "\033[31;1mError: " << e.what() << "\033[m\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,146 @@
+#include "napt.hh"
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+constexpr size_t CONNECTIONS = 1'000'000;
+constexpr size_t LOOKUPS = 2'000'000;
+constexpr uint32_t PUBLIC_ADDRESSES = 32;
+
+struct Flow
+{
+  uint32_t inside_address;
+  uint16_t inside_port;
+  uint32_t remote_address;
+  uint16_t remote_port;
+  uint32_t public_address {};
+  uint16_t public_port {};
+};
+
+void write16( string& bytes, size_t offset, uint16_t value )
+{
+  bytes[offset] = static_cast<char>( value >> 8 );
+  bytes[offset + 1] = static_cast<char>( value & 0xff );
+}
+
+uint16_t read16( string_view bytes, size_t offset )
+{
+  return ( static_cast<uint8_t>( bytes[offset] ) << 8 ) | static_cast<uint8_t>( bytes[offset + 1] );
+}
+
+// Points the (reused) datagram at a flow's endpoints, as though it had just been received
+void address( InternetDatagram& dgram, uint32_t src, uint16_t src_port, uint32_t dst, uint16_t dst_port )
+{
+  dgram.header.src = src;
+  dgram.header.dst = dst;
+  string& segment = dgram.payload.front();
+  write16( segment, 0, src_port );
+  write16( segment, 2, dst_port );
+}
+
+double seconds_since( chrono::steady_clock::time_point start )
+{
+  return chrono::duration<double>( chrono::steady_clock::now() - start ).count();
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    default_random_engine rd { random_device()() };
+
+    Napt::Config config;
+    config.public_address = 0xc6336400; // 198.51.100.0/27
+    config.public_addresses = PUBLIC_ADDRESSES;
+    config.max_mappings = CONNECTIONS;
+    Napt napt { config };
+
+    //a million distinct connections from a /16 of hosts to a few thousand servers.
+    vector<Flow> flows;
+    flows.reserve( CONNECTIONS );
+    for ( size_t i = 0; i < CONNECTIONS; i++ ) {
+      flows.push_back( { 0xc0a80000 | static_cast<uint32_t>( i & 0xffff ),
+                         static_cast<uint16_t>( 10000 + ( i >> 16 ) ),
+                         0x5db80000 | static_cast<uint32_t>( rd() % 4096 ),
+                         static_cast<uint16_t>( rd() % 2 ? 443 : 80 ) } );
+    }
+
+    InternetDatagram dgram;
+    dgram.header.proto = IPv4Header::PROTO_TCP;
+    dgram.payload.emplace_back( string( 20, 0 ) );
+    dgram.header.len = static_cast<uint64_t>( dgram.header.hlen ) * 4 + 20;
+    dgram.header.compute_checksum();
+
+    auto start = chrono::steady_clock::now();
+    for ( auto& flow : flows ) {
+      address( dgram, flow.inside_address, flow.inside_port, flow.remote_address, flow.remote_port );
+      if ( not napt.translate_outbound( dgram ) ) {
+        throw runtime_error( "connection " + to_string( &flow - flows.data() ) + " wasn't set up" );
+      }
+      flow.public_address = dgram.header.src;
+      flow.public_port = read16( dgram.payload.front(), 0 );
+    }
+    const double setup_s = seconds_since( start );
+
+    //established traffic, picking connections at random so lookups miss the cache like real ones.
+    vector<uint32_t> order( LOOKUPS );
+    for ( auto& i : order ) {
+      i = static_cast<uint32_t>( rd() % CONNECTIONS );
+    }
+
+    size_t translated = 0;
+    start = chrono::steady_clock::now();
+    for ( const uint32_t i : order ) {
+      const Flow& flow = flows[i];
+      address( dgram, flow.inside_address, flow.inside_port, flow.remote_address, flow.remote_port );
+      translated += napt.translate_outbound( dgram );
+    }
+    const double outbound_s = seconds_since( start );
+
+    start = chrono::steady_clock::now();
+    for ( const uint32_t i : order ) {
+      const Flow& flow = flows[i];
+      address( dgram, flow.remote_address, flow.remote_port, flow.public_address, flow.public_port );
+      translated += napt.translate_inbound( dgram );
+    }
+    const double inbound_s = seconds_since( start );
+
+    const Napt::Stats stats = napt.stats();
+    cout << "NAPT, " << stats.active << " connections over " << PUBLIC_ADDRESSES << " public addresses:\n"
+         << fixed << setprecision( 2 ) << "  new connections: " << setw( 6 ) << CONNECTIONS / setup_s / 1e6
+         << " M/s\n"
+         << "  established:     " << setw( 6 ) << LOOKUPS / outbound_s / 1e6 << " Mpps outbound, "
+         << LOOKUPS / inbound_s / 1e6 << " Mpps inbound (" << translated << " translated)\n"
+         << setprecision( 1 ) << "  memory:          " << setw( 6 ) << napt.memory_bytes() / 1048576.0 << " MiB ("
+         << static_cast<double>( napt.memory_bytes() ) / CONNECTIONS << " bytes per connection)\n";
+
+    if ( stats.active != CONNECTIONS || translated != 2 * LOOKUPS ) {
+      throw runtime_error( "established connections weren't all found" );
+    }
+    //each lookup is a few dependent cache misses into a table far bigger than the cache, so this
+    //is bounded by memory latency; the floor only catches something going badly wrong.
+    if ( LOOKUPS / outbound_s < 250'000 || LOOKUPS / inbound_s < 250'000 ) {
+      throw runtime_error( "established traffic was translated at under 250k packets/s" );
+    }
+    if ( napt.memory_bytes() > 128 * CONNECTIONS ) {
+      throw runtime_error( "the connection table took over 128 bytes per connection" );
+    }
+  } catch ( const exception& e ) {
+    cerr << "\n\n\n";
+    cerr << "\033[31;1mError: " << e.what() << "\033[m\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,185 @@
+#include "network_interface.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+constexpr uint8_t TOS_EF = 46 << 2;
+constexpr uint64_t LINK_BYTES_PER_S = 12'500'000; // 100 Mbit/s
+constexpr size_t SIMULATED_MS = 2000;
+constexpr size_t BULK_FRAMES_PER_MS = 16; // ~24 kB/ms offered against a 12.5 kB/ms link
+constexpr size_t BULK_PAYLOAD = 1480;
+constexpr size_t EF_PAYLOAD = 160;
+
+const EthernetAddress LOCAL_ETH = { 0x02, 0, 0, 0, 0, 0x01 };
+const EthernetAddress NEXT_HOP_ETH = { 0x02, 0, 0, 0, 0, 0x02 };
+const Address LOCAL_IP { "10.0.0.1" };
+const Address NEXT_HOP { "10.0.0.2" };
+
+InternetDatagram make_datagram( uint8_t tos, size_t payload_bytes )
+{
+  InternetDatagram dgram;
+  dgram.header.src = LOCAL_IP.ipv4_numeric();
+  dgram.header.dst = Address { "1.2.3.4" }.ipv4_numeric();
+  dgram.header.tos = tos;
+  dgram.payload.emplace_back( string( payload_bytes, 'x' ) );
+  dgram.header.len = static_cast<uint64_t>( dgram.header.hlen ) * 4 + payload_bytes;
+  dgram.header.compute_checksum();
+  return dgram;
+}
+
+NetworkInterface make_interface( EgressScheduler::Config config )
+{
+  ostringstream discard;
+  auto* const old_cerr = cerr.rdbuf( discard.rdbuf() );
+  NetworkInterface interface { LOCAL_ETH, LOCAL_IP };
+  cerr.rdbuf( old_cerr );
+  interface.set_egress_config( std::move( config ) );
+
+  ARPMessage arp;
+  arp.opcode = ARPMessage::OPCODE_REQUEST;
+  arp.sender_ethernet_address = NEXT_HOP_ETH;
+  arp.sender_ip_address = NEXT_HOP.ipv4_numeric();
+  arp.target_ip_address = LOCAL_IP.ipv4_numeric();
+  EthernetFrame frame;
+  frame.header = { ETHERNET_BROADCAST, NEXT_HOP_ETH, EthernetHeader::TYPE_ARP };
+  frame.payload = serialize( arp );
+  interface.recv_frame( frame );
+  while ( interface.maybe_send() ) {}
+  return interface;
+}
+
+struct Result
+{
+  vector<double> ef_latency_us {};
+  uint64_t bulk_bytes_sent {};
+};
+
+// A saturating bulk flow plus one small EF packet per ms, through a 100 Mbit/s shaper.
+Result simulate( EgressScheduler::Config config )
+{
+  config.rate_bytes_per_s = LINK_BYTES_PER_S;
+  config.burst_bytes = LINK_BYTES_PER_S / 1000 + 1514; // a tick's worth of tokens, plus a frame
+  NetworkInterface interface = make_interface( std::move( config ) );
+
+  InternetDatagram bulk = make_datagram( 0, BULK_PAYLOAD );
+  InternetDatagram ef = make_datagram( TOS_EF, EF_PAYLOAD );
+  vector<double> ef_sent_at;
+  Result result;
+  EthernetFrame frame;
+  InternetDatagram dgram;
+
+  for ( size_t ms = 0; ms < SIMULATED_MS; ms++ ) {
+    for ( size_t i = 0; i < BULK_FRAMES_PER_MS; i++ ) {
+      if ( i == BULK_FRAMES_PER_MS / 2 ) {
+        ef.header.id = ef_sent_at.size();
+        ef.header.compute_checksum();
+        ef_sent_at.push_back( ms * 1000.0 );
+        interface.send_datagram( ef, NEXT_HOP );
+      }
+      interface.send_datagram( bulk, NEXT_HOP );
+    }
+
+    //Over this millisecond, the link takes frames as fast as the shaper lets it.
+    interface.tick( 1 );
+    uint64_t bytes_this_ms = 0;
+    while ( interface.maybe_send( frame ) ) {
+      uint64_t bytes = EthernetHeader::LENGTH;
+      for ( const auto& b : frame.payload ) {
+        bytes += b.size();
+      }
+      bytes_this_ms += bytes;
+      const double departure_us = ms * 1000.0 + bytes_this_ms * 1e6 / LINK_BYTES_PER_S;
+
+      if ( not parse( dgram, frame.payload ) ) {
+        throw runtime_error( "the interface sent a malformed datagram" );
+      }
+      if ( dgram.header.tos == TOS_EF ) {
+        result.ef_latency_us.push_back( departure_us - ef_sent_at.at( dgram.header.id ) );
+      } else {
+        result.bulk_bytes_sent += bytes;
+      }
+    }
+  }
+
+  sort( result.ef_latency_us.begin(), result.ef_latency_us.end() );
+  return result;
+}
+
+double percentile( const vector<double>& sorted, double p )
+{
+  if ( sorted.empty() ) {
+    return 0;
+  }
+  return sorted[min( sorted.size() - 1, static_cast<size_t>( p * sorted.size() ) )];
+}
+
+void report( const string& name, const Result& r )
+{
+  cout << setw( 28 ) << left << name << right << fixed << setprecision( 1 ) << " EF delivered " << setw( 5 )
+       << r.ef_latency_us.size() << "   p50 " << setw( 8 ) << percentile( r.ef_latency_us, 0.5 ) << " us   p99 "
+       << setw( 8 ) << percentile( r.ef_latency_us, 0.99 ) << " us   max " << setw( 8 )
+       << percentile( r.ef_latency_us, 1.0 ) << " us   bulk " << setprecision( 2 )
+       << r.bulk_bytes_sent * 8 / ( SIMULATED_MS / 1000.0 ) / 1e6 << " Mbit/s\n";
+}
+
+// How fast the scheduler itself goes: enqueue and dequeue with no shaping
+void scheduler_throughput()
+{
+  NetworkInterface interface = make_interface( EgressScheduler::Config::diffserv() );
+  vector<InternetDatagram> mix;
+  for ( const uint8_t dscp : { 0, 0, 0, 34, 26, 46, 8 } ) {
+    mix.push_back( make_datagram( dscp << 2, 64 ) );
+  }
+
+  constexpr size_t rounds = 200000;
+  EthernetFrame frame;
+  const auto start = chrono::steady_clock::now();
+  for ( size_t i = 0; i < rounds; i++ ) {
+    for ( const auto& d : mix ) {
+      interface.send_datagram( d, NEXT_HOP );
+    }
+    while ( interface.maybe_send( frame ) ) {}
+  }
+  const double seconds = chrono::duration<double>( chrono::steady_clock::now() - start ).count();
+  cout << "scheduler: " << fixed << setprecision( 2 ) << rounds * mix.size() / seconds / 1e6
+       << " M frames/s through send_datagram + maybe_send (diffserv classes, unshaped)\n";
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    cout << "EF latency with a saturating bulk flow on a 100 Mbit/s shaped link:\n";
+
+    EgressScheduler::Config fifo;
+    fifo.classes[0].limit = 256;
+    const Result fifo_result = simulate( fifo );
+    report( "FIFO (256 frames)", fifo_result );
+
+    const Result diffserv_result = simulate( EgressScheduler::Config::diffserv() );
+    report( "strict EF + DRR (diffserv)", diffserv_result );
+
+    scheduler_throughput();
+
+    if ( percentile( diffserv_result.ef_latency_us, 0.99 ) >= percentile( fifo_result.ef_latency_us, 0.99 ) ) {
+      throw runtime_error( "prioritizing EF didn't cut its tail latency" );
+    }
+  } catch ( const exception& e ) {
+    cerr << "\n\n\n";
+    cerr << "\033[31;1mError: " << e.what() << "\033[m\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,173 @@
+#include "network_interface.hh"
+
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+namespace {
+
+constexpr uint8_t TOS_EF = 46 << 2;
+constexpr uint8_t TOS_AF41 = 34 << 2;
+constexpr uint8_t TOS_BEST_EFFORT = 0;
+
+const EthernetAddress LOCAL_ETH = { 0x02, 0, 0, 0, 0, 0x01 };
+const EthernetAddress NEXT_HOP_ETH = { 0x02, 0, 0, 0, 0, 0x02 };
+const Address LOCAL_IP { "10.0.0.1" };
+const Address NEXT_HOP { "10.0.0.2" };
+
+InternetDatagram make_datagram( uint8_t tos, uint16_t id, size_t payload_bytes )
+{
+  InternetDatagram dgram;
+  dgram.header.src = LOCAL_IP.ipv4_numeric();
+  dgram.header.dst = Address { "1.2.3.4" }.ipv4_numeric();
+  dgram.header.tos = tos;
+  dgram.header.id = id;
+  dgram.payload.emplace_back( string( payload_bytes, 'x' ) );
+  dgram.header.len = static_cast<uint64_t>( dgram.header.hlen ) * 4 + payload_bytes;
+  dgram.header.compute_checksum();
+  return dgram;
+}
+
+// An interface that already knows the next hop's Ethernet address
+NetworkInterface make_interface( const EgressScheduler::Config& config )
+{
+  ostringstream discard;
+  auto* const old_cerr = cerr.rdbuf( discard.rdbuf() );
+  NetworkInterface interface { LOCAL_ETH, LOCAL_IP };
+  cerr.rdbuf( old_cerr );
+  interface.set_egress_config( config );
+
+  ARPMessage arp;
+  arp.opcode = ARPMessage::OPCODE_REQUEST;
+  arp.sender_ethernet_address = NEXT_HOP_ETH;
+  arp.sender_ip_address = NEXT_HOP.ipv4_numeric();
+  arp.target_ip_address = LOCAL_IP.ipv4_numeric();
+  EthernetFrame frame;
+  frame.header = { ETHERNET_BROADCAST, NEXT_HOP_ETH, EthernetHeader::TYPE_ARP };
+  frame.payload = serialize( arp );
+  interface.recv_frame( frame );
+  while ( interface.maybe_send() ) {} // the ARP reply
+  return interface;
+}
+
+// The (tos, id) of the next frame sent, or nothing for ARP or no frame
+optional<pair<uint8_t, uint16_t>> next_sent( NetworkInterface& interface, bool& got_frame )
+{
+  const auto frame = interface.maybe_send();
+  got_frame = frame.has_value();
+  InternetDatagram dgram;
+  if ( not frame.has_value() || frame->header.type != EthernetHeader::TYPE_IPv4
+       || not parse( dgram, frame->payload ) ) {
+    return {};
+  }
+  return pair<uint8_t, uint16_t> { dgram.header.tos, dgram.header.id };
+}
+
+void test_strict_priority_and_arp_first()
+{
+  NetworkInterface interface = make_interface( EgressScheduler::Config::diffserv() );
+
+  for ( uint16_t i = 0; i < 10; i++ ) {
+    interface.send_datagram( make_datagram( TOS_BEST_EFFORT, i, 1000 ), NEXT_HOP );
+  }
+  interface.send_datagram( make_datagram( TOS_EF, 100, 100 ), NEXT_HOP );
+  interface.send_datagram( make_datagram( TOS_BEST_EFFORT, 11, 1000 ), Address { "10.0.0.3" } ); // needs ARP
+
+  bool got_frame = false;
+  auto sent = next_sent( interface, got_frame );
+  if ( not got_frame || sent.has_value() ) {
+    throw runtime_error( "the ARP request didn't go out ahead of the queued datagrams" );
+  }
+  sent = next_sent( interface, got_frame );
+  if ( not sent.has_value() || sent->second != 100 ) {
+    throw runtime_error( "the EF datagram didn't go out ahead of the best-effort backlog" );
+  }
+  for ( uint16_t i = 0; i < 10; i++ ) {
+    sent = next_sent( interface, got_frame );
+    if ( not sent.has_value() || sent->second != i ) {
+      throw runtime_error( "best-effort datagrams came out of order" );
+    }
+  }
+}
+
+void test_drr_weights()
+{
+  //AF41 gets 4 quanta per round and best effort 1, so with both backlogged they share 4:1.
+  NetworkInterface interface = make_interface( EgressScheduler::Config::diffserv() );
+  for ( uint16_t i = 0; i < 200; i++ ) {
+    interface.send_datagram( make_datagram( TOS_AF41, i, 1000 ), NEXT_HOP );
+    interface.send_datagram( make_datagram( TOS_BEST_EFFORT, i, 1000 ), NEXT_HOP );
+  }
+
+  size_t af41 = 0;
+  size_t best_effort = 0;
+  bool got_frame = false;
+  for ( size_t i = 0; i < 200; i++ ) {
+    const auto sent = next_sent( interface, got_frame );
+    ( sent.has_value() && sent->first == TOS_AF41 ? af41 : best_effort )++;
+  }
+  if ( af41 < 150 || af41 > 170 ) {
+    throw runtime_error( "AF41 got " + to_string( af41 ) + " of 200 frames against best effort, expected about 160" );
+  }
+
+  const size_t limit = EgressScheduler::Config::diffserv().classes[3].limit;
+  for ( uint16_t i = 0; i < 2 * limit; i++ ) {
+    interface.send_datagram( make_datagram( TOS_BEST_EFFORT, i, 100 ), NEXT_HOP );
+  }
+  const auto stats = interface.egress().class_stats( 3 );
+  if ( stats.depth != limit || stats.dropped == 0 ) {
+    throw runtime_error( "a full class wasn't held to its limit" );
+  }
+}
+
+void test_shaper()
+{
+  //100 kB/s with a 3 kB bucket: three ~1 kB frames, then one more per 10 ms.
+  EgressScheduler::Config config;
+  config.rate_bytes_per_s = 100000;
+  config.burst_bytes = 3000;
+  NetworkInterface interface = make_interface( config );
+  interface.tick( 1000 ); // (the ARP reply spent some tokens)
+
+  for ( uint16_t i = 0; i < 10; i++ ) {
+    interface.send_datagram( make_datagram( TOS_BEST_EFFORT, i, 966 ), NEXT_HOP ); // 1000-byte frames
+  }
+
+  size_t sent = 0;
+  while ( interface.maybe_send() ) {
+    sent++;
+  }
+  if ( sent != 3 ) {
+    throw runtime_error( "a full bucket let " + to_string( sent ) + " frames through, expected 3" );
+  }
+
+  interface.tick( 10 );
+  sent = 0;
+  while ( interface.maybe_send() ) {
+    sent++;
+  }
+  if ( sent != 1 ) {
+    throw runtime_error( "10 ms of tokens let " + to_string( sent ) + " frames through, expected 1" );
+  }
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    test_strict_priority_and_arp_first();
+    test_drr_weights();
+    test_shaper();
+  } catch ( const exception& e ) {
+    cerr << "\n\n\n";
+    cerr << "\033[31;1mError: " << e.what() << "\033[m\n";
+    return EXIT_FAILURE;
+  }
+
+  cout << "\033[32;1mEgress scheduling and shaping behaved as configured.\033[m\n";
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,176 @@
+#include "network_simulator.hh"
+
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+using Time = NetworkSimulator::Time;
+using NodeId = NetworkSimulator::NodeId;
+
+InternetDatagram make_dgram( uint32_t src, uint32_t dst, size_t payload_size )
+{
+  InternetDatagram dgram;
+  dgram.header.src = src;
+  dgram.header.dst = dst;
+  dgram.payload.emplace_back( string( payload_size, 'x' ) );
+  dgram.header.len = static_cast<uint64_t>( dgram.header.hlen ) * 4 + payload_size;
+  dgram.header.compute_checksum();
+  return dgram;
+}
+
+struct Delivery
+{
+  NodeId host;
+  Time at;
+  uint32_t src;
+  uint8_t ttl;
+};
+
+// Collects what every host receives
+void record( NetworkSimulator& sim, vector<Delivery>& deliveries )
+{
+  sim.on_delivery( [&deliveries]( NodeId host, Time at, const InternetDatagram& dgram ) {
+    deliveries.push_back( { host, at, dgram.header.src, dgram.header.ttl } );
+  } );
+}
+
+// host a - router - router - host b, with 1 ms links at 100 Mbit/s
+void test_timing()
+{
+  NetworkSimulator sim;
+  NetworkSimulator::LinkConfig link;
+  link.latency_ns = 1'000'000;
+  link.bits_per_s = 100'000'000;
+  link.buffer_bytes = 10'000;
+
+  const NodeId r1 = sim.add_router();
+  const NodeId r2 = sim.add_router();
+  sim.connect( r1, r2, link );
+  const NodeId a = sim.add_host( r1, link );
+  const NodeId b = sim.add_host( r2, link );
+  if ( sim.install_routes() != 2 ) {
+    throw runtime_error( "expected one route on each router" );
+  }
+  vector<Delivery> deliveries;
+  record( sim, deliveries );
+
+  //the first datagram waits on ARP at every hop.
+  sim.send( a, make_dgram( sim.host_address( a ), sim.host_address( b ), 1000 ), 0 );
+  sim.run();
+  if ( deliveries.size() != 1 || deliveries[0].host != b || deliveries[0].ttl != IPv4Header::DEFAULT_TTL - 2 ) {
+    throw runtime_error( "the datagram didn't cross both routers to host b" );
+  }
+
+  //once ARP is resolved, a datagram takes exactly 3 x (serialization + latency).
+  const Time start = sim.now() + 1'000'000;
+  sim.send( a, make_dgram( sim.host_address( a ), sim.host_address( b ), 1000 ), start );
+  sim.run();
+  const Time serialization = ( EthernetHeader::LENGTH + 20 + 1000 ) * 8 * 10; // ns at 100 Mbit/s
+  if ( deliveries.size() != 2 || deliveries[1].at - start != 3 * ( serialization + link.latency_ns ) ) {
+    throw runtime_error( "a datagram took " + to_string( deliveries.back().at - start ) + " ns, expected "
+                         + to_string( 3 * ( serialization + link.latency_ns ) ) );
+  }
+
+  //a burst queues behind itself, and the link's buffer overflows: 10 of these fill its 10 kB.
+  const Time burst = sim.now() + 1'000'000;
+  for ( size_t i = 0; i < 30; i++ ) {
+    sim.send( a, make_dgram( sim.host_address( a ), sim.host_address( b ), 1000 ), burst );
+  }
+  sim.run();
+  const auto& stats = sim.stats();
+  if ( stats.datagrams_sent != 32 || stats.datagrams_delivered + stats.frames_dropped != 32
+       || stats.frames_dropped != 20 ) {
+    throw runtime_error( "expected 20 of a 30-datagram burst to be dropped, " + to_string( stats.frames_dropped )
+                         + " were" );
+  }
+  //the last one out was 10th in line on the first link, then had the next links to itself.
+  if ( deliveries.back().at - burst != 10 * serialization + 2 * serialization + 3 * link.latency_ns ) {
+    throw runtime_error( "the burst's last datagram arrived at the wrong time" );
+  }
+}
+
+// Every host sends to every other host; returns the deliveries in order
+vector<Delivery> all_pairs( NetworkSimulator& sim, const NetworkSimulator::Topology& topology )
+{
+  vector<Delivery> deliveries;
+  record( sim, deliveries );
+  for ( const NodeId src : topology.hosts ) {
+    for ( const NodeId dst : topology.hosts ) {
+      if ( src != dst ) {
+        sim.send( src, make_dgram( sim.host_address( src ), sim.host_address( dst ), 100 ), 0 );
+      }
+    }
+  }
+  sim.run();
+
+  const size_t expected = topology.hosts.size() * ( topology.hosts.size() - 1 );
+  if ( deliveries.size() != expected || sim.stats().frames_dropped != 0 ) {
+    throw runtime_error( to_string( deliveries.size() ) + " of " + to_string( expected ) + " datagrams arrived" );
+  }
+  return deliveries;
+}
+
+void test_fat_tree()
+{
+  NetworkSimulator sim;
+  const auto topology = sim.build_fat_tree( 4 );
+  if ( topology.routers.size() != 20 || topology.hosts.size() != 16 ) {
+    throw runtime_error( "a k=4 fat tree has 20 routers and 16 hosts" );
+  }
+  sim.install_routes();
+  const vector<Delivery> deliveries = all_pairs( sim, topology );
+
+  //hosts on the same edge router are 1 router apart, in the same pod 3, otherwise 5.
+  for ( const auto& d : deliveries ) {
+    const uint8_t hops = IPv4Header::DEFAULT_TTL - d.ttl;
+    if ( hops != 1 && hops != 3 && hops != 5 ) {
+      throw runtime_error( "a datagram crossed " + to_string( hops ) + " routers, which isn't a shortest path" );
+    }
+  }
+}
+
+void test_random_graph()
+{
+  auto run_once = [] {
+    NetworkSimulator sim;
+    const auto topology = sim.build_random( 40, 3, 1, 12345 );
+    sim.install_routes();
+    return all_pairs( sim, topology );
+  };
+  const vector<Delivery> first = run_once();
+  const vector<Delivery> second = run_once();
+  for ( size_t i = 0; i < first.size(); i++ ) {
+    if ( first[i].host != second[i].host || first[i].at != second[i].at || first[i].src != second[i].src ) {
+      throw runtime_error( "two runs of the same simulation differed" );
+    }
+  }
+}
+
+} // namespace
+
+int main()
+{
+  //(every simulated interface announces itself on cerr)
+  ostringstream discard;
+  auto* const old_cerr = cerr.rdbuf( discard.rdbuf() );
+  try {
+    test_timing();
+    test_fat_tree();
+    test_random_graph();
+    cerr.rdbuf( old_cerr );
+  } catch ( const exception& e ) {
+    cerr.rdbuf( old_cerr );
+    cerr << "\n\n\n";
+    cerr << "\033[31;1mError: " << e.what() << "\033[m\n";
+    return EXIT_FAILURE;
+  }
+
+  cout << "\033[32;1mThe simulator timed, queued and routed frames across generated topologies.\033[m\n";
+  return EXIT_SUCCESS;
+}
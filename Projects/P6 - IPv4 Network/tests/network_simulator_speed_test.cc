@@ -0,0 +1,120 @@
+#include "network_simulator.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+using Time = NetworkSimulator::Time;
+
+constexpr size_t DATAGRAMS_PER_HOST = 20;
+constexpr Time SEND_WINDOW_NS = 10'000'000; // datagrams are sent at random over the first 10 ms
+constexpr size_t PAYLOAD = 500;
+
+double seconds_since( chrono::steady_clock::time_point start )
+{
+  return chrono::duration<double>( chrono::steady_clock::now() - start ).count();
+}
+
+// Builds the topology, installs routes, then has every host send to random others, timing each part
+void measure( const string& name, const function<NetworkSimulator::Topology( NetworkSimulator& )>& build )
+{
+  NetworkSimulator sim;
+
+  auto start = chrono::steady_clock::now();
+  const NetworkSimulator::Topology topology = build( sim );
+  const double build_s = seconds_since( start );
+
+  start = chrono::steady_clock::now();
+  const size_t routes = sim.install_routes();
+  const double routes_s = seconds_since( start );
+
+  //each datagram carries its send time, so delivery can work out its latency.
+  vector<Time> latencies;
+  sim.on_delivery( [&]( NetworkSimulator::NodeId, Time at, const InternetDatagram& dgram ) {
+    Time sent = 0;
+    memcpy( &sent, string_view { dgram.payload.front() }.data(), sizeof( sent ) );
+    latencies.push_back( at - sent );
+  } );
+
+  default_random_engine rd { 458 };
+  const size_t hosts = topology.hosts.size();
+  for ( size_t s = 0; s < hosts; s++ ) {
+    const auto src = topology.hosts[s];
+    for ( size_t i = 0; i < DATAGRAMS_PER_HOST; i++ ) {
+      auto dst = topology.hosts[rd() % hosts];
+      if ( dst == src ) {
+        dst = topology.hosts[( s + 1 ) % hosts];
+      }
+      const Time at = rd() % SEND_WINDOW_NS;
+      string payload( PAYLOAD, 0 );
+      memcpy( payload.data(), &at, sizeof( at ) );
+
+      InternetDatagram dgram;
+      dgram.header.src = sim.host_address( src );
+      dgram.header.dst = sim.host_address( dst );
+      dgram.payload.emplace_back( std::move( payload ) );
+      dgram.header.len = static_cast<uint64_t>( dgram.header.hlen ) * 4 + PAYLOAD;
+      dgram.header.compute_checksum();
+      sim.send( src, std::move( dgram ), at );
+    }
+  }
+
+  start = chrono::steady_clock::now();
+  const uint64_t events = sim.run();
+  const double run_s = seconds_since( start );
+
+  const size_t sent = hosts * DATAGRAMS_PER_HOST;
+  ranges::sort( latencies );
+  cout << "  " << name << ": " << topology.routers.size() << " routers, " << hosts << " hosts, built in " << fixed
+       << setprecision( 2 ) << build_s << " s, " << routes << " routes computed and installed in " << routes_s
+       << " s\n"
+       << "    " << sent << " datagrams: " << events << " events in " << run_s << " s ("
+       << setprecision( 0 ) << events / run_s << " events/s, " << sim.stats().frames_sent / run_s
+       << " frame hops/s), " << latencies.size() << " delivered, " << sim.stats().frames_dropped << " dropped\n"
+       << setprecision( 1 ) << "    latency (simulated): median " << latencies[latencies.size() / 2] / 1e3
+       << " us, p99 " << latencies[latencies.size() * 99 / 100] / 1e3 << " us (includes ARP warm-up)\n";
+
+  if ( latencies.size() != sent ) {
+    throw runtime_error( name + ": only " + to_string( latencies.size() ) + " of " + to_string( sent )
+                         + " datagrams were delivered" );
+  }
+  if ( events / run_s < 20'000 ) {
+    throw runtime_error( name + ": the simulator ran under 20k events/s" );
+  }
+}
+
+} // namespace
+
+int main()
+{
+  //(every simulated interface announces itself on cerr)
+  ostringstream discard;
+  auto* const old_cerr = cerr.rdbuf( discard.rdbuf() );
+  try {
+    cout << "Discrete-event simulation:\n";
+    measure( "fat tree (k=16)", []( NetworkSimulator& sim ) { return sim.build_fat_tree( 16 ); } );
+    measure( "random graph (degree 4)",
+             []( NetworkSimulator& sim ) { return sim.build_random( 1000, 4, 1, 458 ); } );
+    cerr.rdbuf( old_cerr );
+  } catch ( const exception& e ) {
+    cerr.rdbuf( old_cerr );
+    cerr << "\n\n\n";
+    cerr << "\033[31;1mError: " << e.what() << "\033[m\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,275 @@
+#include "pcap.hh"
+#include "trace_replay.hh"
+#include "traffic_generator.hh"
+
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+const EthernetAddress ROUTER_ETH = { 0x02, 0, 0, 0, 0, 0x10 };
+const EthernetAddress SENDER_ETH = { 0x02, 0, 0, 0, 0, 0x20 };
+
+string temp_path( const string& name )
+{
+  return filesystem::temp_directory_path() / ( "pcap_replay_" + name + "_" + to_string( getpid() ) + ".pcap" );
+}
+
+string flatten( const vector<Buffer>& buffers )
+{
+  string out;
+  for ( const auto& b : buffers ) {
+    out += string_view { b };
+  }
+  return out;
+}
+
+EthernetFrame make_frame( uint16_t type, vector<Buffer> payload )
+{
+  EthernetFrame frame;
+  frame.header = { ROUTER_ETH, SENDER_ETH, type };
+  frame.payload = std::move( payload );
+  return frame;
+}
+
+void test_round_trip()
+{
+  const string path = temp_path( "round_trip" );
+  vector<EthernetFrame> frames;
+  frames.push_back( make_frame( EthernetHeader::TYPE_IPv4, { Buffer { string( 46, 'a' ) } } ) );
+  frames.push_back( make_frame( EthernetHeader::TYPE_ARP, { Buffer { "split" }, Buffer { " across buffers" } } ) );
+  frames.push_back( make_frame( 0x86dd, { Buffer { string( 1500, 'z' ) } } ) );
+  {
+    PcapWriter writer { path };
+    for ( size_t i = 0; i < frames.size(); i++ ) {
+      writer.write( frames[i], 1'700'000'000'123'456'789 + i * 1000 );
+    }
+    if ( writer.frames() != frames.size() ) {
+      throw runtime_error( "the writer miscounted its frames" );
+    }
+  }
+
+  const vector<PcapRecord> records = PcapReader::read_all( path );
+  filesystem::remove( path );
+  if ( records.size() != frames.size() ) {
+    throw runtime_error( "wrote 3 frames, read back " + to_string( records.size() ) );
+  }
+  for ( size_t i = 0; i < frames.size(); i++ ) {
+    const PcapRecord& r = records[i];
+    if ( r.timestamp_ns != 1'700'000'000'123'456'789 + i * 1000 ) {
+      throw runtime_error( "a timestamp didn't survive to the nanosecond" );
+    }
+    if ( r.frame.header.dst != ROUTER_ETH || r.frame.header.src != SENDER_ETH
+         || r.frame.header.type != frames[i].header.type
+         || flatten( r.frame.payload ) != flatten( frames[i].payload ) ) {
+      throw runtime_error( "frame " + to_string( i ) + " didn't read back as written" );
+    }
+    if ( r.original_length != EthernetHeader::LENGTH + flatten( frames[i].payload ).size() ) {
+      throw runtime_error( "a frame's original length was wrong" );
+    }
+  }
+}
+
+// A file as a big-endian machine would write it, with microsecond timestamps
+void test_foreign_file()
+{
+  string file;
+  auto be32 = [&]( uint32_t v ) {
+    for ( int shift = 24; shift >= 0; shift -= 8 ) {
+      file.push_back( static_cast<char>( v >> shift ) );
+    }
+  };
+  be32( 0xa1b2c3d4 );
+  be32( 0x00020004 ); // version 2.4
+  be32( 0 );
+  be32( 0 );
+  be32( 65535 );
+  be32( 1 ); // Ethernet
+  be32( 1000 );
+  be32( 500'000 ); // 1000.5 s
+  be32( 18 );      // 14-byte header and 4 bytes of payload captured...
+  be32( 100 );     // ...of 100 on the wire
+  file += string( "\x02\x00\x00\x00\x00\x10\x02\x00\x00\x00\x00\x20\x08\x00", 14 );
+  file += "abcd";
+
+  const string path = temp_path( "foreign" );
+  {
+    ofstream out { path, ios::binary };
+    out << file;
+  }
+  const vector<PcapRecord> records = PcapReader::read_all( path );
+  if ( records.size() != 1 || records[0].timestamp_ns != 1'000'500'000'000 || records[0].original_length != 100
+       || records[0].frame.header.type != EthernetHeader::TYPE_IPv4
+       || flatten( records[0].frame.payload ) != "abcd" ) {
+    throw runtime_error( "a big-endian microsecond pcap file wasn't read correctly" );
+  }
+
+  auto rejects = [&]( const string& contents ) {
+    {
+      ofstream out { path, ios::binary };
+      out << contents;
+    }
+    try {
+      PcapReader::read_all( path );
+    } catch ( const runtime_error& ) {
+      return true;
+    }
+    return false;
+  };
+  const bool truncated = rejects( file.substr( 0, file.size() - 1 ) );
+  const bool not_pcap = rejects( string( 64, 'x' ) );
+  string raw_ip = file;
+  raw_ip[23] = 101; // LINKTYPE_RAW
+  const bool not_ethernet = rejects( raw_ip );
+  filesystem::remove( path );
+  if ( not truncated || not not_pcap || not not_ethernet ) {
+    throw runtime_error( "a truncated, non-pcap or non-Ethernet file was accepted" );
+  }
+}
+
+void test_capture()
+{
+  const string path = temp_path( "capture" );
+  {
+    PcapWriter writer { path };
+    NetworkInterface interface { ROUTER_ETH, Address { "10.0.0.1" } };
+    vector<bool> directions;
+    interface.set_capture( [&]( const EthernetFrame& frame, bool sent ) {
+      writer.write( frame );
+      directions.push_back( sent );
+    } );
+
+    //sending to an unknown next hop: an ARP request goes out, the reply comes in, then the datagram goes.
+    InternetDatagram dgram;
+    dgram.header.dst = Address { "10.0.0.2" }.ipv4_numeric();
+    dgram.payload.emplace_back( string( 10, 'x' ) );
+    dgram.header.len = IPv4Header::LENGTH + 10;
+    dgram.header.compute_checksum();
+    interface.send_datagram( dgram, Address { "10.0.0.2" } );
+    while ( interface.maybe_send() ) {}
+
+    ARPMessage reply;
+    reply.opcode = ARPMessage::OPCODE_REPLY;
+    reply.sender_ethernet_address = SENDER_ETH;
+    reply.sender_ip_address = Address { "10.0.0.2" }.ipv4_numeric();
+    reply.target_ethernet_address = ROUTER_ETH;
+    reply.target_ip_address = Address { "10.0.0.1" }.ipv4_numeric();
+    interface.recv_frame( make_frame( EthernetHeader::TYPE_ARP, serialize( reply ) ) );
+    EthernetFrame out;
+    while ( interface.maybe_send( out ) ) {}
+
+    interface.set_capture( {} );
+    interface.recv_frame( make_frame( EthernetHeader::TYPE_ARP, serialize( reply ) ) );
+
+    if ( directions != vector<bool> { true, false, true } ) {
+      throw runtime_error( "the capture hook didn't see the frames out, in and out" );
+    }
+  }
+
+  const vector<PcapRecord> records = PcapReader::read_all( path );
+  filesystem::remove( path );
+  if ( records.size() != 3 || records[0].frame.header.type != EthernetHeader::TYPE_ARP
+       || records[1].frame.header.type != EthernetHeader::TYPE_ARP
+       || records[2].frame.header.type != EthernetHeader::TYPE_IPv4 || records[0].timestamp_ns == 0
+       || records[2].timestamp_ns < records[0].timestamp_ns ) {
+    throw runtime_error( "the capture file didn't hold the ARP exchange and the datagram" );
+  }
+}
+
+// A router with interface 0 facing the trace, and 10.0.0.0/9 and 10.128.0.0/9 out of interfaces 1 and 2
+void setup( Router& router )
+{
+  router.add_interface( AsyncNetworkInterface { ROUTER_ETH, Address { "192.168.0.1" } } );
+  router.add_interface( AsyncNetworkInterface { ROUTER_ETH, Address { "100.64.0.1" } } );
+  router.add_interface( AsyncNetworkInterface { ROUTER_ETH, Address { "100.64.1.1" } } );
+  router.add_route( Address { "10.0.0.0" }.ipv4_numeric(), 9, Address { "100.64.0.2" }, 1 );
+  router.add_route( Address { "10.128.0.0" }.ipv4_numeric(), 9, Address { "100.64.1.2" }, 2 );
+}
+
+vector<PcapRecord> make_trace( size_t packets, uint64_t spacing_ns )
+{
+  TrafficConfig config;
+  config.prefixes = { { 0x0a000000, 8 }, { 0xc0000200, 24 } }; // 10/8 is routed, 192.0.2.0/24 isn't
+  config.destinations = TrafficConfig::Destinations::ZIPF;
+  config.packets = packets;
+  config.ethernet_src = SENDER_ETH;
+  config.ethernet_dst = ROUTER_ETH;
+  const TrafficTrace traffic { config };
+
+  vector<PcapRecord> trace;
+  for ( size_t i = 0; i < traffic.size(); i++ ) {
+    trace.push_back( { 1'000'000'000 + i * spacing_ns, 0, traffic.frames()[i] } );
+  }
+  return trace;
+}
+
+void test_replay()
+{
+  const vector<PcapRecord> trace = make_trace( 3000, 1000 );
+  size_t routable = 0;
+  for ( const auto& record : trace ) {
+    InternetDatagram dgram;
+    parse( dgram, record.frame.payload );
+    routable += ( dgram.header.dst >> 24 ) == 10;
+  }
+
+  Router router;
+  setup( router );
+  const ReplayReport fast = replay_trace( router, trace );
+  if ( fast.frames != 3000 || fast.datagrams != 3000 || fast.forwarded != routable
+       || fast.dropped != 3000 - routable ) {
+    throw runtime_error( "replay forwarded " + to_string( fast.forwarded ) + " and dropped "
+                         + to_string( fast.dropped ) + ", expected " + to_string( routable ) + " and "
+                         + to_string( 3000 - routable ) );
+  }
+  if ( fast.pps <= 0 || fast.latency_p50_ns == 0 || fast.latency_p50_ns > fast.latency_p99_ns
+       || fast.latency_p99_ns > fast.latency_max_ns ) {
+    throw runtime_error( "replay's rate and latency weren't reported" );
+  }
+
+  //at recorded timing: 200 frames 1 ms apart take 0.2 s, or 0.1 s at double speed.
+  Router paced_router;
+  setup( paced_router );
+  ReplayConfig config;
+  config.pace = ReplayConfig::Pace::RECORDED;
+  config.speedup = 2;
+  const ReplayReport paced = replay_trace( paced_router, make_trace( 200, 1'000'000 ), config );
+  if ( paced.seconds < 0.099 || paced.seconds > 1 ) {
+    throw runtime_error( "a 0.2 s trace at double speed took " + to_string( paced.seconds ) + " s" );
+  }
+  if ( paced.forwarded + paced.dropped != 200 ) {
+    throw runtime_error( "a paced replay lost track of frames" );
+  }
+}
+
+} // namespace
+
+int main()
+{
+  //(interfaces and routes announce themselves on cerr)
+  ostringstream discard;
+  auto* const old_cerr = cerr.rdbuf( discard.rdbuf() );
+  try {
+    test_round_trip();
+    test_foreign_file();
+    test_capture();
+    test_replay();
+    cerr.rdbuf( old_cerr );
+  } catch ( const exception& e ) {
+    cerr.rdbuf( old_cerr );
+    cerr << "\n\n\n";
+    cerr << "\033[31;1mError: " << e.what() << "\033[m\n";
+    return EXIT_FAILURE;
+  }
+
+  cout << "\033[32;1mFrames were captured to pcap, read back, and replayed through a router.\033[m\n";
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,105 @@
+#include "pcap.hh"
+#include "trace_replay.hh"
+#include "traffic_generator.hh"
+
+#include <chrono>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+constexpr size_t PREFIXES = 100'000;
+constexpr size_t PACKETS = 200'000;
+constexpr size_t UPLINKS = 4;
+const EthernetAddress ROUTER_ETH = { 0x02, 0, 0, 0, 0, 0x10 };
+
+double seconds_since( chrono::steady_clock::time_point start )
+{
+  return chrono::duration<double>( chrono::steady_clock::now() - start ).count();
+}
+
+// A router with the prefixes spread over UPLINKS uplinks (whose next hops the replay resolves)
+void setup( Router& router, const vector<pair<uint32_t, uint8_t>>& prefixes )
+{
+  ostringstream discard;
+  auto* const old_cerr = cerr.rdbuf( discard.rdbuf() );
+  router.add_interface( AsyncNetworkInterface { ROUTER_ETH, Address { "192.168.0.1" } } );
+  for ( size_t i = 0; i < UPLINKS; i++ ) {
+    router.add_interface(
+      AsyncNetworkInterface { ROUTER_ETH, Address::from_ipv4_numeric( 0x64400001 + static_cast<uint32_t>( i << 8 ) ) } );
+  }
+  cerr.rdbuf( old_cerr );
+
+  RoutesByLength routes;
+  for ( size_t i = 0; i < prefixes.size(); i++ ) {
+    const auto [prefix, length] = prefixes[i];
+    const auto uplink = static_cast<uint32_t>( i % UPLINKS );
+    routes[length].push_back( { get_prefmask( length, prefix ), 0x64400002 + ( uplink << 8 ), uplink + 1, 1 } );
+  }
+  router.load_routes( routes );
+}
+
+} // namespace
+
+int main()
+{
+  const string path
+    = filesystem::temp_directory_path() / ( "pcap_replay_speed_test_" + to_string( getpid() ) + ".pcap" );
+  try {
+    TrafficConfig config;
+    config.prefixes = random_prefixes( PREFIXES, 458 );
+    config.destinations = TrafficConfig::Destinations::ZIPF;
+    config.packets = PACKETS;
+    config.ethernet_dst = ROUTER_ETH;
+    const TrafficTrace traffic { config };
+    const double megabytes = static_cast<double>( traffic.bytes() + PACKETS * EthernetHeader::LENGTH ) / 1e6;
+
+    auto start = chrono::steady_clock::now();
+    {
+      PcapWriter writer { path };
+      for ( size_t i = 0; i < traffic.size(); i++ ) {
+        writer.write( traffic.frames()[i], i * 1000 );
+      }
+    }
+    const double write_s = seconds_since( start );
+
+    start = chrono::steady_clock::now();
+    const vector<PcapRecord> trace = PcapReader::read_all( path );
+    const double read_s = seconds_since( start );
+    filesystem::remove( path );
+
+    Router router;
+    setup( router, config.prefixes );
+    const ReplayReport report = replay_trace( router, trace );
+
+    cout << "pcap, " << PACKETS << " IMIX frames (" << fixed << setprecision( 0 ) << megabytes << " MB):\n"
+         << "  write:  " << setw( 6 ) << megabytes / write_s << " MB/s\n"
+         << "  read:   " << setw( 6 ) << megabytes / read_s << " MB/s\n"
+         << "Replayed through a " << PREFIXES << "-prefix router as fast as it would take them:\n"
+         << "  " << setprecision( 2 ) << report.pps / 1e6 << " Mpps, " << report.forwarded << " forwarded, "
+         << report.dropped << " dropped, latency median " << setprecision( 1 ) << report.latency_p50_ns / 1e3
+         << " us, p99 " << report.latency_p99_ns / 1e3 << " us\n";
+
+    if ( trace.size() != PACKETS || report.forwarded != PACKETS ) {
+      throw runtime_error( "frames were lost between the file and the router" );
+    }
+    if ( report.pps < 100'000 ) {
+      throw runtime_error( "the replay ran at under 100k packets/s" );
+    }
+  } catch ( const exception& e ) {
+    filesystem::remove( path );
+    cerr << "\n\n\n";
+    cerr << "\033[31;1mError: " << e.what() << "\033[m\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,270 @@
+#include "router.hh"
+
+#include <atomic>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+const EthernetAddress ROUTER_ETH0 = { 0x02, 0, 0, 0, 0, 0x10 };
+const EthernetAddress ROUTER_ETH1 = { 0x02, 0, 0, 0, 0, 0x11 };
+const EthernetAddress SENDER_ETH = { 0x02, 0, 0, 0, 0, 0x20 };
+const EthernetAddress NEXT_HOP_ETH = { 0x02, 0, 0, 0, 0, 0x22 };
+const Address NEXT_HOP { "10.1.0.2" };
+
+uint32_t ip( const string& str )
+{
+  return Address { str }.ipv4_numeric();
+}
+
+struct Packet
+{
+  uint32_t src, dst;
+  uint8_t proto;
+  optional<pair<uint16_t, uint16_t>> ports;
+};
+
+bool matches( const AclRule& rule, const Packet& p )
+{
+  auto prefix_matches = []( uint32_t addr, uint32_t prefix, uint8_t length ) {
+    return length == 0 || ( ( addr ^ prefix ) >> ( 32 - length ) ) == 0;
+  };
+  auto in_range = []( uint16_t port, pair<uint16_t, uint16_t> range ) {
+    return port >= range.first && port <= range.second;
+  };
+
+  if ( not prefix_matches( p.src, rule.src_prefix, rule.src_length )
+       || not prefix_matches( p.dst, rule.dst_prefix, rule.dst_length )
+       || ( rule.proto.has_value() && *rule.proto != p.proto ) ) {
+    return false;
+  }
+  const pair<uint16_t, uint16_t> all { 0, UINT16_MAX };
+  if ( rule.src_ports == all && rule.dst_ports == all ) {
+    return true;
+  }
+  return p.ports.has_value() && in_range( p.ports->first, rule.src_ports )
+         && in_range( p.ports->second, rule.dst_ports );
+}
+
+// What the classifier should find: the first rule that matches, checked one by one
+optional<size_t> linear_match( const vector<AclRule>& rules, const Packet& p )
+{
+  for ( size_t i = 0; i < rules.size(); i++ ) {
+    if ( matches( rules[i], p ) ) {
+      return i;
+    }
+  }
+  return {};
+}
+
+void test_against_linear_scan()
+{
+  default_random_engine rd { random_device()() };
+  uniform_int_distribution<uint32_t> addr_dist;
+  const vector<uint8_t> lengths = { 0, 8, 16, 24, 30, 32 };
+  const vector<optional<uint8_t>> protos = { {}, IPv4Header::PROTO_TCP, IPv4Header::PROTO_UDP, 1 };
+
+  //Addresses from a small pool, so rules overlap and packets actually hit them.
+  vector<uint32_t> pool;
+  for ( size_t i = 0; i < 16; i++ ) {
+    pool.push_back( addr_dist( rd ) );
+  }
+  auto pick_addr = [&] { return pool[rd() % pool.size()] ^ ( rd() % 4 == 0 ? addr_dist( rd ) >> 20 : 0 ); };
+
+  vector<AclRule> rules;
+  for ( size_t i = 0; i < 2000; i++ ) {
+    AclRule rule;
+    rule.src_prefix = pick_addr();
+    rule.src_length = lengths[rd() % lengths.size()];
+    rule.dst_prefix = pick_addr();
+    rule.dst_length = lengths[rd() % lengths.size()];
+    rule.proto = protos[rd() % protos.size()];
+    if ( rd() % 2 ) {
+      const auto low = static_cast<uint16_t>( rd() % 2000 );
+      rule.dst_ports = { low, static_cast<uint16_t>( low + rd() % 100 ) };
+    }
+    if ( rd() % 5 == 0 ) {
+      rule.src_ports = { 1024, UINT16_MAX };
+    }
+    rule.action = rd() % 2 ? AclRule::Action::PERMIT : AclRule::Action::DENY;
+    rules.push_back( rule );
+  }
+
+  const PacketClassifier classifier { rules };
+  for ( size_t i = 0; i < 50000; i++ ) {
+    Packet p { pick_addr(), pick_addr(), protos[rd() % protos.size()].value_or( 47 ), {} };
+    if ( p.proto == IPv4Header::PROTO_TCP || p.proto == IPv4Header::PROTO_UDP ) {
+      p.ports = pair<uint16_t, uint16_t> { static_cast<uint16_t>( rd() % 3000 ), static_cast<uint16_t>( rd() % 2100 ) };
+    }
+    if ( classifier.match( p.src, p.dst, p.proto, p.ports ) != linear_match( rules, p ) ) {
+      throw runtime_error( "the classifier picked a different rule than a linear scan of the ACL" );
+    }
+  }
+
+  //malformed rules are refused.
+  for ( const auto& bad : { AclRule { 0, 33, 0, 0, {}, { 0, UINT16_MAX }, { 0, UINT16_MAX }, AclRule::Action::DENY },
+                            AclRule { 0, 0, 0, 0, {}, { 0, UINT16_MAX }, { 80, 79 }, AclRule::Action::DENY } } ) {
+    bool threw = false;
+    try {
+      const PacketClassifier c { { bad } };
+    } catch ( const runtime_error& ) {
+      threw = true;
+    }
+    if ( not threw ) {
+      throw runtime_error( "a malformed ACL rule was accepted" );
+    }
+  }
+}
+
+EthernetFrame make_frame( const EthernetAddress& dst, const EthernetAddress& src, uint16_t type, vector<Buffer> payload )
+{
+  EthernetFrame frame;
+  frame.header.dst = dst;
+  frame.header.src = src;
+  frame.header.type = type;
+  frame.payload = std::move( payload );
+  return frame;
+}
+
+EthernetFrame make_segment( uint8_t proto, uint16_t dst_port )
+{
+  InternetDatagram dgram;
+  dgram.header.src = ip( "192.168.0.5" );
+  dgram.header.dst = ip( "10.2.3.4" );
+  dgram.header.proto = proto;
+  string payload = { 0x30, 0x39, static_cast<char>( dst_port >> 8 ), static_cast<char>( dst_port & 0xff ) };
+  payload.append( 16, 'x' );
+  dgram.payload.emplace_back( std::move( payload ) );
+  dgram.header.len = static_cast<uint64_t>( dgram.header.hlen ) * 4 + dgram.payload.back().size();
+  dgram.header.compute_checksum();
+  return make_frame( ROUTER_ETH0, SENDER_ETH, EthernetHeader::TYPE_IPv4, serialize( dgram ) );
+}
+
+void setup( Router& router )
+{
+  ostringstream discard;
+  auto* const old_cerr = cerr.rdbuf( discard.rdbuf() );
+  router.add_interface( AsyncNetworkInterface { ROUTER_ETH0, Address { "192.168.0.1" } } );
+  router.add_interface( AsyncNetworkInterface { ROUTER_ETH1, Address { "10.1.0.1" } } );
+  router.add_route( ip( "10.0.0.0" ), 8, NEXT_HOP, 1 );
+  cerr.rdbuf( old_cerr );
+
+  ARPMessage arp;
+  arp.opcode = ARPMessage::OPCODE_REQUEST;
+  arp.sender_ethernet_address = NEXT_HOP_ETH;
+  arp.sender_ip_address = NEXT_HOP.ipv4_numeric();
+  arp.target_ip_address = ip( "10.1.0.1" );
+  router.interface( 1 ).recv_frame(
+    make_frame( ROUTER_ETH1, NEXT_HOP_ETH, EthernetHeader::TYPE_ARP, serialize( arp ) ) );
+  while ( router.interface( 1 ).maybe_send() ) {} // the ARP reply
+}
+
+// Whether the router forwards the frame
+bool forwarded( Router& router, const EthernetFrame& frame )
+{
+  router.interface( 0 ).recv_frame( frame );
+  router.route();
+  bool sent = false;
+  while ( router.interface( 1 ).maybe_send() ) {
+    sent = true;
+  }
+  return sent;
+}
+
+void test_router_ingress()
+{
+  Router router;
+  setup( router );
+  const EthernetFrame ssh = make_segment( IPv4Header::PROTO_TCP, 22 );
+  const EthernetFrame web = make_segment( IPv4Header::PROTO_TCP, 443 );
+  const EthernetFrame dns = make_segment( IPv4Header::PROTO_UDP, 53 );
+
+  if ( not forwarded( router, ssh ) || not forwarded( router, dns ) ) {
+    throw runtime_error( "the router dropped traffic with no ACL set" );
+  }
+
+  //No SSH into 10/8, everything else allowed.
+  AclRule no_ssh;
+  no_ssh.dst_prefix = ip( "10.0.0.0" );
+  no_ssh.dst_length = 8;
+  no_ssh.proto = IPv4Header::PROTO_TCP;
+  no_ssh.dst_ports = { 22, 22 };
+  router.set_acl( { no_ssh } );
+  if ( forwarded( router, ssh ) || not forwarded( router, web ) || not forwarded( router, dns ) ) {
+    throw runtime_error( "the ACL didn't drop exactly the SSH traffic" );
+  }
+
+  //Swapped for an allow-list: only web traffic, everything else dropped.
+  AclRule web_only;
+  web_only.proto = IPv4Header::PROTO_TCP;
+  web_only.dst_ports = { 443, 443 };
+  web_only.action = AclRule::Action::PERMIT;
+  router.set_acl( { web_only }, AclRule::Action::DENY );
+  if ( forwarded( router, ssh ) || not forwarded( router, web ) || forwarded( router, dns ) ) {
+    throw runtime_error( "the swapped-in ACL didn't take effect" );
+  }
+  if ( router.acl_denied() != 3 ) {
+    throw runtime_error( "the ACL counted " + to_string( router.acl_denied() ) + " drops, expected 3" );
+  }
+
+  router.clear_acl();
+  if ( not forwarded( router, ssh ) ) {
+    throw runtime_error( "clearing the ACL didn't let traffic through again" );
+  }
+}
+
+// Rule sets are swapped while another thread routes: every datagram is judged by one rule set
+// or the other, never lost or double-counted.
+void test_concurrent_swaps()
+{
+  Router router;
+  setup( router );
+  const EthernetFrame ssh = make_segment( IPv4Header::PROTO_TCP, 22 );
+
+  AclRule deny_all;
+  atomic<bool> done { false };
+  thread swapper( [&] {
+    while ( not done.load() ) {
+      router.set_acl( { deny_all } );
+      router.clear_acl();
+    }
+  } );
+
+  constexpr size_t packets = 5000;
+  size_t sent = 0;
+  for ( size_t i = 0; i < packets; i++ ) {
+    sent += forwarded( router, ssh );
+  }
+  done = true;
+  swapper.join();
+
+  if ( sent + router.acl_denied() != packets ) {
+    throw runtime_error( to_string( sent ) + " forwarded and " + to_string( router.acl_denied() )
+                         + " denied doesn't add up to " + to_string( packets ) );
+  }
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    test_against_linear_scan();
+    test_router_ingress();
+    test_concurrent_swaps();
+  } catch ( const exception& e ) {
+    cerr << "\n\n\n";
+    cerr << "\033[31;1mError: " << e.what() << "\033[m\n";
+    return EXIT_FAILURE;
+  }
+
+  cout << "\033[32;1mThe ACL classified like a linear scan and filtered router ingress.\033[m\n";
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,160 @@
+#include "packet_classifier.hh"
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+constexpr size_t PACKETS = 200000;
+
+struct Packet
+{
+  uint32_t src, dst;
+  uint8_t proto;
+  optional<pair<uint16_t, uint16_t>> ports;
+};
+
+// A firewall-like rule set: mostly host and subnet rules on a few well-known ports, some
+// broader ones, and a little protocol-only and any-any at the end.
+vector<AclRule> make_rules( default_random_engine& rd, size_t count, const vector<uint32_t>& sites )
+{
+  const vector<uint8_t> src_lengths = { 0, 0, 8, 16, 16, 24, 24, 24, 32, 32 };
+  const vector<uint8_t> dst_lengths = { 16, 24, 24, 28, 32, 32, 32, 32 };
+  const vector<uint16_t> services = { 22, 25, 53, 80, 123, 443, 993, 3306, 5432, 8080 };
+
+  vector<AclRule> rules;
+  for ( size_t i = 0; i < count; i++ ) {
+    AclRule rule;
+    rule.src_prefix = sites[rd() % sites.size()] ^ ( rd() & 0xffff );
+    rule.src_length = src_lengths[rd() % src_lengths.size()];
+    rule.dst_prefix = sites[rd() % sites.size()] ^ ( rd() & 0xffff );
+    rule.dst_length = dst_lengths[rd() % dst_lengths.size()];
+    switch ( rd() % 10 ) {
+      case 0:
+        break; // any protocol
+      case 1:
+        rule.proto = IPv4Header::PROTO_UDP;
+        rule.dst_ports = { 1024, UINT16_MAX };
+        break;
+      default: {
+        rule.proto = rd() % 3 ? IPv4Header::PROTO_TCP : IPv4Header::PROTO_UDP;
+        const uint16_t port = services[rd() % services.size()];
+        rule.dst_ports = { port, port };
+      }
+    }
+    rule.action = rd() % 4 ? AclRule::Action::PERMIT : AclRule::Action::DENY;
+    rules.push_back( rule );
+  }
+  return rules;
+}
+
+vector<Packet> make_packets( default_random_engine& rd, const vector<uint32_t>& sites )
+{
+  vector<Packet> packets;
+  for ( size_t i = 0; i < PACKETS; i++ ) {
+    const uint8_t proto = rd() % 3 ? IPv4Header::PROTO_TCP : IPv4Header::PROTO_UDP;
+    const uint16_t dst_port = rd() % 2 ? static_cast<uint16_t>( rd() % 1024 ) : static_cast<uint16_t>( rd() );
+    packets.push_back( { sites[rd() % sites.size()] ^ static_cast<uint32_t>( rd() & 0xffff ),
+                         sites[rd() % sites.size()] ^ static_cast<uint32_t>( rd() & 0xffff ),
+                         proto,
+                         pair<uint16_t, uint16_t> { static_cast<uint16_t>( rd() ), dst_port } } );
+  }
+  return packets;
+}
+
+bool matches( const AclRule& rule, const Packet& p )
+{
+  auto prefix_matches = []( uint32_t addr, uint32_t prefix, uint8_t length ) {
+    return length == 0 || ( ( addr ^ prefix ) >> ( 32 - length ) ) == 0;
+  };
+  return prefix_matches( p.src, rule.src_prefix, rule.src_length )
+         && prefix_matches( p.dst, rule.dst_prefix, rule.dst_length )
+         && ( not rule.proto.has_value() || *rule.proto == p.proto ) && p.ports->first >= rule.src_ports.first
+         && p.ports->first <= rule.src_ports.second && p.ports->second >= rule.dst_ports.first
+         && p.ports->second <= rule.dst_ports.second;
+}
+
+template<typename Classify>
+double ns_per_packet( const vector<Packet>& packets, size_t count, Classify&& classify, size_t& matched )
+{
+  matched = 0;
+  const auto start = chrono::steady_clock::now();
+  for ( size_t i = 0; i < count; i++ ) {
+    matched += classify( packets[i] ).has_value();
+  }
+  return chrono::duration<double, nano>( chrono::steady_clock::now() - start ).count() / count;
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    default_random_engine rd { random_device()() };
+    vector<uint32_t> sites;
+    for ( size_t i = 0; i < 64; i++ ) {
+      sites.push_back( static_cast<uint32_t>( rd() ) & 0xffff0000 );
+    }
+    const vector<Packet> packets = make_packets( rd, sites );
+
+    cout << "ACL classification, " << PACKETS << " packets:\n";
+    double compiled_10k = 0;
+    double linear_10k = 0;
+    for ( const size_t count : { 1000, 10000 } ) {
+      const vector<AclRule> rules = make_rules( rd, count, sites );
+
+      const auto start = chrono::steady_clock::now();
+      const PacketClassifier classifier { rules };
+      const double compile_ms = chrono::duration<double, milli>( chrono::steady_clock::now() - start ).count();
+
+      size_t compiled_matched = 0;
+      const double compiled = ns_per_packet(
+        packets,
+        packets.size(),
+        [&]( const Packet& p ) { return classifier.match( p.src, p.dst, p.proto, p.ports ); },
+        compiled_matched );
+
+      //the linear scan is slow enough that a slice of the packets will do.
+      size_t linear_matched = 0;
+      const size_t linear_packets = packets.size() / 20;
+      const double linear = ns_per_packet(
+        packets,
+        linear_packets,
+        [&]( const Packet& p ) -> optional<size_t> {
+          for ( size_t i = 0; i < rules.size(); i++ ) {
+            if ( matches( rules[i], p ) ) {
+              return i;
+            }
+          }
+          return {};
+        },
+        linear_matched );
+
+      cout << "  " << setw( 5 ) << count << " rules: " << setw( 3 ) << classifier.num_tuples() << " tuples, compiled in "
+           << fixed << setprecision( 1 ) << setw( 6 ) << compile_ms << " ms, " << setw( 7 ) << compiled
+           << " ns/packet (" << 100.0 * compiled_matched / packets.size() << "% matched), linear scan " << setw( 8 )
+           << linear << " ns/packet (" << 100.0 * linear_matched / linear_packets << "% matched)\n";
+
+      if ( count == 10000 ) {
+        compiled_10k = compiled;
+        linear_10k = linear;
+      }
+    }
+
+    if ( compiled_10k * 10 > linear_10k ) {
+      throw runtime_error( "the compiled classifier wasn't at least 10x faster than a linear scan of 10k rules" );
+    }
+  } catch ( const exception& e ) {
+    cerr << "\n\n\n";
+    cerr << "\033[31;1mError: " << e.what() << "\033[m\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
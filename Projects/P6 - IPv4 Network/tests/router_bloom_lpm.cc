@@ -0,0 +1,163 @@
+#include "router.hh"
+#include "prefix_bloom.hh"
+
+#include <array>
+#include <bit>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <unordered_set>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+struct Route
+{
+  uint32_t prefix;
+  uint8_t length;
+  optional<Address> next_hop;
+  size_t interface_num;
+};
+
+vector<Route> random_routes( default_random_engine& rd, size_t count )
+{
+  //Lengths weighted the way real tables are: mostly /16../24, a few short and host routes.
+  discrete_distribution<int> length_dist { { 1, 0, 0, 0, 0, 0, 0, 0, 2,  1,  1,  1,  2,  3,  4,  4, 10,
+                                             6, 8, 8, 9, 9, 9, 9, 40, 2, 2, 2, 2, 2, 2, 2, 3 } };
+  uniform_int_distribution<uint32_t> addr_dist;
+  uniform_int_distribution<size_t> intf_dist { 0, 7 };
+
+  vector<Route> routes;
+  routes.push_back( { 0, 0, Address { "10.0.0.1" }, 0 } ); //always have a default route
+  while ( routes.size() < count ) {
+    const auto length = static_cast<uint8_t>( length_dist( rd ) );
+    optional<Address> next_hop;
+    if ( rd() % 2 ) {
+      next_hop = Address::from_ipv4_numeric( addr_dist( rd ) );
+    }
+    routes.push_back( { addr_dist( rd ), length, next_hop, intf_dist( rd ) } );
+  }
+  return routes;
+}
+
+void check_same( const Router& expected, const Router& actual, uint32_t dst )
+{
+  if ( expected.find_match( dst ) != actual.find_match( dst ) ) {
+    throw runtime_error( "bloom lookup disagrees with linear lookup for " + Address::from_ipv4_numeric( dst ).ip() );
+  }
+}
+
+void test_filters_have_no_false_negatives( default_random_engine& rd )
+{
+  PrefixBloom bloom;
+  bloom.reset( 4096 );
+  uniform_int_distribution<uint32_t> addr_dist;
+
+  vector<uint32_t> inserted;
+  for ( size_t i = 0; i < 4096; i++ ) {
+    inserted.push_back( addr_dist( rd ) );
+    bloom.insert( 24, inserted.back() >> 8 );
+  }
+
+  for ( const uint32_t addr : inserted ) {
+    if ( not( bloom.candidates( addr ) & ( uint64_t { 1 } << 24 ) ) ) {
+      throw runtime_error( "false negative for " + Address::from_ipv4_numeric( addr ).ip() );
+    }
+  }
+}
+
+void test_matches_linear_lookup( default_random_engine& rd )
+{
+  Router linear;
+  Router bloom;
+  bloom.set_bloom_lookup( true );
+
+  const vector<Route> routes = random_routes( rd, 3000 );
+  for ( size_t i = 0; i < routes.size(); i++ ) {
+    const auto& r = routes[i];
+    linear.add_route( r.prefix, r.length, r.next_hop, r.interface_num );
+    bloom.add_route( r.prefix, r.length, r.next_hop, r.interface_num );
+
+    //overwrite an earlier route every so often, as add_route allows.
+    if ( i % 97 == 0 ) {
+      const auto& old = routes[i / 2];
+      linear.add_route( old.prefix, old.length, {}, 3 );
+      bloom.add_route( old.prefix, old.length, {}, 3 );
+    }
+  }
+
+  uniform_int_distribution<uint32_t> addr_dist;
+  for ( size_t i = 0; i < 200000; i++ ) {
+    check_same( linear, bloom, addr_dist( rd ) );
+  }
+
+  //addresses inside the installed prefixes, where the longer lengths actually get hit.
+  for ( const auto& r : routes ) {
+    const uint32_t host_bits = r.length == 32 ? 0 : ( addr_dist( rd ) >> r.length );
+    check_same( linear, bloom, r.prefix | host_bits );
+    check_same( linear, bloom, r.prefix );
+  }
+
+  //turning the filters off again must fall back to the plain lookup.
+  bloom.set_bloom_lookup( false );
+  for ( size_t i = 0; i < 10000; i++ ) {
+    check_same( linear, bloom, addr_dist( rd ) );
+  }
+}
+
+void test_probe_count( default_random_engine& rd )
+{
+  PrefixBloom bloom;
+  array<unordered_set<uint32_t>, PrefixBloom::NUM_LENGTHS> table;
+  const vector<Route> routes = random_routes( rd, 20000 );
+  bloom.reset( 20000 );
+  for ( const auto& r : routes ) {
+    const uint32_t key = r.length == 0 ? 0 : r.prefix >> ( 32 - r.length );
+    bloom.insert( r.length, key );
+    table.at( r.length ).insert( key );
+  }
+
+  //count the hash-table probes the router would make: candidates, longest first, up to the first real hit.
+  uniform_int_distribution<uint32_t> addr_dist;
+  size_t probes = 0;
+  constexpr size_t lookups = 100000;
+  for ( size_t i = 0; i < lookups; i++ ) {
+    const uint32_t dst = addr_dist( rd );
+    uint64_t candidates = bloom.candidates( dst );
+    while ( candidates ) {
+      const int len = 63 - countl_zero( candidates );
+      probes++;
+      if ( table.at( len ).contains( len == 0 ? 0 : dst >> ( 32 - len ) ) ) {
+        break;
+      }
+      candidates &= ~( uint64_t { 1 } << len );
+    }
+  }
+
+  const double average = static_cast<double>( probes ) / lookups;
+  cout << "Average hash-table probes per lookup: " << average << " (linear search probes up to 33)\n";
+  if ( average > 1.5 ) {
+    throw runtime_error( "Bloom filters let through too many candidate lengths: " + to_string( average ) );
+  }
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    default_random_engine rd { random_device()() };
+    test_filters_have_no_false_negatives( rd );
+    test_matches_linear_lookup( rd );
+    test_probe_count( rd );
+  } catch ( const exception& e ) {
+    cerr << "\n\n\n";
+    cerr << "\033[31;1mError: " << e.what() << "\033[m\n";
+    return EXIT_FAILURE;
+  }
+
+  cout << "\033[32;1mBloom filter lookups match the linear lookup.\033[m\n";
+  return EXIT_SUCCESS;
+}
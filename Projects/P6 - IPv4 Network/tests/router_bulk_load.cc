@@ -0,0 +1,171 @@
+#include "router.hh"
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+struct Route
+{
+  uint32_t prefix;
+  uint8_t length;
+  optional<Address> next_hop;
+  size_t interface_num;
+};
+
+double ms_since( chrono::steady_clock::time_point start )
+{
+  return chrono::duration<double, milli>( chrono::steady_clock::now() - start ).count();
+}
+
+void check_same( const Router& expected, const Router& actual, const vector<Route>& routes, const string& what )
+{
+  default_random_engine rd { random_device()() };
+  uniform_int_distribution<uint32_t> addr_dist;
+  auto check = [&]( uint32_t dst ) {
+    if ( expected.find_match( dst ) != actual.find_match( dst ) ) {
+      throw runtime_error( what + " forwards " + Address::from_ipv4_numeric( dst ).ip()
+                           + " differently from add_route" );
+    }
+  };
+
+  for ( size_t i = 0; i < 100000; i++ ) {
+    check( addr_dist( rd ) );
+  }
+  for ( const auto& r : routes ) {
+    check( r.prefix | ( r.length == 32 ? 0 : ( addr_dist( rd ) >> r.length ) ) );
+  }
+}
+
+void test_bulk_load()
+{
+  default_random_engine rd { random_device()() };
+  uniform_int_distribution<uint32_t> addr_dist;
+  uniform_int_distribution<int> length_dist { 8, 32 };
+
+  vector<Route> routes;
+  routes.push_back( { 0, 0, Address { "171.67.76.1" }, 0 } );
+  for ( size_t i = 0; i < 50000; i++ ) {
+    optional<Address> next_hop;
+    if ( i % 3 ) {
+      next_hop = Address::from_ipv4_numeric( addr_dist( rd ) );
+    }
+    routes.push_back( { addr_dist( rd ), static_cast<uint8_t>( length_dist( rd ) ), next_hop, i % 8 } );
+  }
+  //a repeated prefix: the later line has to win, as it would with add_route.
+  routes.push_back( { routes[10].prefix, routes[10].length, {}, 7 } );
+
+  const auto dir = filesystem::temp_directory_path();
+  const string dump_path = dir / ( "router_bulk_load_" + to_string( getpid() ) + ".csv" );
+  const string image_path = dir / ( "router_bulk_load_" + to_string( getpid() ) + ".fib" );
+  {
+    ofstream dump { dump_path };
+    dump << "# prefix/length,next hop,interface\n\n";
+    for ( const auto& r : routes ) {
+      dump << Address::from_ipv4_numeric( r.prefix ).ip() << "/" << static_cast<int>( r.length ) << ","
+           << ( r.next_hop.has_value() ? r.next_hop->ip() : "direct" ) << "," << r.interface_num << "\n";
+    }
+  }
+
+  //The reference router, built one add_route at a time (with its logging thrown away).
+  Router one_by_one;
+  ostringstream discard;
+  auto* const old_cerr = cerr.rdbuf( discard.rdbuf() );
+  auto start = chrono::steady_clock::now();
+  for ( const auto& r : routes ) {
+    one_by_one.add_route( r.prefix, r.length, r.next_hop, r.interface_num );
+  }
+  cerr.rdbuf( old_cerr );
+  cout << "add_route x " << routes.size() << ": " << ms_since( start ) << " ms\n";
+
+  Router bulk;
+  start = chrono::steady_clock::now();
+  const size_t loaded = bulk.load_routes( dump_path );
+  cout << "load_routes: " << ms_since( start ) << " ms\n";
+  if ( loaded != routes.size() ) {
+    throw runtime_error( "load_routes loaded " + to_string( loaded ) + " routes, expected "
+                         + to_string( routes.size() ) );
+  }
+  check_same( one_by_one, bulk, routes, "bulk-loaded router" );
+
+  bulk.save_fib_image( image_path );
+  Router restarted;
+  start = chrono::steady_clock::now();
+  restarted.load_fib_image( image_path );
+  cout << "load_fib_image: " << ms_since( start ) << " ms\n";
+  check_same( one_by_one, restarted, routes, "router restored from a FIB image" );
+
+  //An image saved from a compressed table restores the full route set.
+  Router compressed;
+  compressed.set_fib_compression( true );
+  compressed.load_routes( dump_path );
+  check_same( one_by_one, compressed, routes, "compressed bulk-loaded router" );
+  compressed.save_fib_image( image_path );
+  Router from_compressed;
+  from_compressed.set_bloom_lookup( true );
+  from_compressed.load_fib_image( image_path );
+  check_same( one_by_one, from_compressed, routes, "router restored from a compressed router's image" );
+
+  filesystem::remove( dump_path );
+  filesystem::remove( image_path );
+}
+
+void test_bad_input()
+{
+  const auto dir = filesystem::temp_directory_path();
+  const string path = dir / ( "router_bulk_load_bad_" + to_string( getpid() ) + ".csv" );
+  {
+    ofstream dump { path };
+    dump << "10.0.0.0/8,direct,1\n10.1.0.0/33,direct,1\n";
+  }
+
+  bool threw = false;
+  try {
+    Router router;
+    router.load_routes( path );
+  } catch ( const runtime_error& e ) {
+    threw = string( e.what() ).find( "line 2" ) != string::npos;
+  }
+  filesystem::remove( path );
+  if ( not threw ) {
+    throw runtime_error( "a malformed route dump was not reported with its line number" );
+  }
+
+  ofstream { path } << "not a FIB image";
+  threw = false;
+  try {
+    Router router;
+    router.load_fib_image( path );
+  } catch ( const runtime_error& e ) {
+    threw = true;
+  }
+  filesystem::remove( path );
+  if ( not threw ) {
+    throw runtime_error( "a corrupt FIB image was accepted" );
+  }
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    test_bulk_load();
+    test_bad_input();
+  } catch ( const exception& e ) {
+    cerr << "\n\n\n";
+    cerr << "\033[31;1mError: " << e.what() << "\033[m\n";
+    return EXIT_FAILURE;
+  }
+
+  cout << "\033[32;1mBulk-loaded and restored routers match add_route.\033[m\n";
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,256 @@
+#include "router.hh"
+
+#include <iostream>
+#include <map>
+#include <random>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+constexpr uint8_t PROTO_UDP = 17;
+constexpr size_t UPLINKS = 4;
+const EthernetAddress ROUTER_ETH = { 0x02, 0, 0, 0, 0, 0x10 };
+const EthernetAddress SENDER_ETH = { 0x02, 0, 0, 0, 0, 0x20 };
+
+uint32_t ip( const string& str )
+{
+  return Address { str }.ipv4_numeric();
+}
+
+// The next hop at the far end of uplink i (interface i + 1)
+Address uplink_next_hop( size_t i )
+{
+  return Address { "10." + to_string( i + 1 ) + ".0.2" };
+}
+
+EthernetAddress uplink_next_hop_eth( size_t i )
+{
+  return { 0x02, 0, 0, 0, 1, static_cast<uint8_t>( i ) };
+}
+
+vector<Router::Path> uplinks( const vector<size_t>& which )
+{
+  vector<Router::Path> paths;
+  for ( const size_t i : which ) {
+    paths.push_back( { uplink_next_hop( i ), i + 1 } );
+  }
+  return paths;
+}
+
+struct Flow
+{
+  uint32_t src, dst;
+  uint8_t proto;
+};
+
+vector<Flow> make_flows( size_t count )
+{
+  default_random_engine rd { random_device()() };
+  uniform_int_distribution<uint32_t> host_dist { 0, 0xffff };
+  vector<Flow> flows;
+  for ( size_t i = 0; i < count; i++ ) {
+    flows.push_back( { ip( "192.168.0.0" ) | host_dist( rd ),
+                       ip( "172.16.0.0" ) | host_dist( rd ),
+                       static_cast<uint8_t>( i % 3 == 0 ? 6 : PROTO_UDP ) } );
+  }
+  return flows;
+}
+
+// The interface each flow is sent out of
+vector<size_t> paths_taken( const Router& router, const vector<Flow>& flows )
+{
+  vector<size_t> taken;
+  for ( const auto& f : flows ) {
+    const auto match = router.find_match( f.dst, flow_hash( f.src, f.dst, f.proto ) );
+    if ( not match.has_value() ) {
+      throw runtime_error( "no route for a flow" );
+    }
+    if ( match->second != uplink_next_hop( match->first - 1 ).ipv4_numeric() ) {
+      throw runtime_error( "a path's interface and next hop got mixed up" );
+    }
+    taken.push_back( match->first );
+  }
+  return taken;
+}
+
+void check_spread( const vector<size_t>& taken, const set<size_t>& interfaces )
+{
+  map<size_t, size_t> counts;
+  for ( const size_t i : taken ) {
+    counts[i]++;
+  }
+  const double expected = static_cast<double>( taken.size() ) / interfaces.size();
+  for ( const size_t i : interfaces ) {
+    if ( counts[i] < 0.8 * expected || counts[i] > 1.2 * expected ) {
+      throw runtime_error( "interface " + to_string( i ) + " got " + to_string( counts[i] ) + " flows, expected about "
+                           + to_string( static_cast<size_t>( expected ) ) );
+    }
+  }
+  if ( counts.size() != interfaces.size() ) {
+    throw runtime_error( "flows went out of an interface that isn't one of the route's paths" );
+  }
+}
+
+void test_flow_hashing( bool compressed )
+{
+  ostringstream discard;
+  auto* const old_cerr = cerr.rdbuf( discard.rdbuf() );
+  Router router;
+  router.set_fib_compression( compressed );
+  router.add_route( ip( "0.0.0.0" ), 0, Address { "10.9.9.9" }, 0 );
+  router.add_route( ip( "172.16.0.0" ), 12, uplinks( { 0, 1, 2, 3 } ) );
+  cerr.rdbuf( old_cerr );
+
+  const vector<Flow> flows = make_flows( 8000 );
+  const vector<size_t> before = paths_taken( router, flows );
+  check_spread( before, { 1, 2, 3, 4 } );
+  if ( paths_taken( router, flows ) != before ) {
+    throw runtime_error( "a flow changed paths between lookups" );
+  }
+
+  //A fifth path: it should take about a fifth of the flows, and take them only from the others.
+  cerr.rdbuf( discard.rdbuf() );
+  router.add_route( ip( "172.16.0.0" ), 12, uplinks( { 0, 1, 2, 3, 4 } ) );
+  cerr.rdbuf( old_cerr );
+  const vector<size_t> added = paths_taken( router, flows );
+  check_spread( added, { 1, 2, 3, 4, 5 } );
+  for ( size_t i = 0; i < flows.size(); i++ ) {
+    if ( added[i] != before[i] && added[i] != 5 ) {
+      throw runtime_error( "adding a path moved a flow between two of the old paths" );
+    }
+  }
+
+  //Taking a path away only moves the flows that were on it.
+  cerr.rdbuf( discard.rdbuf() );
+  router.add_route( ip( "172.16.0.0" ), 12, uplinks( { 0, 2, 3, 4 } ) );
+  cerr.rdbuf( old_cerr );
+  const vector<size_t> removed = paths_taken( router, flows );
+  check_spread( removed, { 1, 3, 4, 5 } );
+  for ( size_t i = 0; i < flows.size(); i++ ) {
+    if ( added[i] != 2 && removed[i] != added[i] ) {
+      throw runtime_error( "removing a path moved a flow that wasn't on it" );
+    }
+  }
+
+  //Still a more-specific under compression, and still not something an image can hold.
+  if ( router.find_match( ip( "8.8.8.8" ) ) != pair<size_t, uint32_t> { 0, ip( "10.9.9.9" ) } ) {
+    throw runtime_error( "the default route stopped working" );
+  }
+  bool threw = false;
+  try {
+    router.save_fib_image( "/dev/null" );
+  } catch ( const runtime_error& ) {
+    threw = true;
+  }
+  if ( not threw ) {
+    throw runtime_error( "saving a multipath route to a FIB image didn't fail" );
+  }
+
+  //Going back to one path takes every flow there.
+  cerr.rdbuf( discard.rdbuf() );
+  router.add_route( ip( "172.16.0.0" ), 12, uplink_next_hop( 2 ), 3 );
+  cerr.rdbuf( old_cerr );
+  for ( const size_t i : paths_taken( router, flows ) ) {
+    if ( i != 3 ) {
+      throw runtime_error( "a single-path route still spread flows out" );
+    }
+  }
+}
+
+EthernetFrame make_frame( const EthernetAddress& src, uint16_t type, vector<Buffer> payload )
+{
+  EthernetFrame frame;
+  frame.header.dst = ROUTER_ETH;
+  frame.header.src = src;
+  frame.header.type = type;
+  frame.payload = std::move( payload );
+  return frame;
+}
+
+// Datagrams forwarded through the router keep to one uplink per flow
+void test_forwarding()
+{
+  ostringstream discard;
+  auto* const old_cerr = cerr.rdbuf( discard.rdbuf() );
+  Router router;
+  router.add_interface( AsyncNetworkInterface { ROUTER_ETH, Address { "192.168.0.1" } } );
+  for ( size_t i = 0; i < UPLINKS; i++ ) {
+    router.add_interface( AsyncNetworkInterface { ROUTER_ETH, Address { "10." + to_string( i + 1 ) + ".0.1" } } );
+  }
+  router.add_route( ip( "172.16.0.0" ), 12, uplinks( { 0, 1, 2, 3 } ) );
+  cerr.rdbuf( old_cerr );
+
+  for ( size_t i = 0; i < UPLINKS; i++ ) {
+    ARPMessage arp;
+    arp.opcode = ARPMessage::OPCODE_REQUEST;
+    arp.sender_ethernet_address = uplink_next_hop_eth( i );
+    arp.sender_ip_address = uplink_next_hop( i ).ipv4_numeric();
+    arp.target_ip_address = ip( "10." + to_string( i + 1 ) + ".0.1" );
+    router.interface( i + 1 ).recv_frame(
+      make_frame( uplink_next_hop_eth( i ), EthernetHeader::TYPE_ARP, serialize( arp ) ) );
+    while ( router.interface( i + 1 ).maybe_send() ) {} // the ARP reply
+  }
+
+  const vector<Flow> flows = make_flows( 64 );
+  map<pair<uint32_t, uint32_t>, size_t> flow_uplink;
+  set<size_t> used;
+  for ( size_t round = 0; round < 5; round++ ) {
+    for ( const auto& f : flows ) {
+      InternetDatagram dgram;
+      dgram.header.src = f.src;
+      dgram.header.dst = f.dst;
+      dgram.header.proto = f.proto;
+      dgram.payload.emplace_back( string( 20, 'x' ) );
+      dgram.header.len = static_cast<uint64_t>( dgram.header.hlen ) * 4 + dgram.payload.back().size();
+      dgram.header.compute_checksum();
+      router.interface( 0 ).recv_frame( make_frame( SENDER_ETH, EthernetHeader::TYPE_IPv4, serialize( dgram ) ) );
+    }
+    router.route();
+
+    size_t forwarded = 0;
+    for ( size_t i = 0; i < UPLINKS; i++ ) {
+      while ( const auto frame = router.interface( i + 1 ).maybe_send() ) {
+        InternetDatagram dgram;
+        if ( frame->header.dst != uplink_next_hop_eth( i ) || not parse( dgram, frame->payload ) ) {
+          throw runtime_error( "uplink " + to_string( i ) + " sent something other than a forwarded datagram" );
+        }
+        if ( flow_uplink.try_emplace( { dgram.header.src, dgram.header.dst }, i ).first->second != i ) {
+          throw runtime_error( "a flow's datagrams were forwarded over more than one uplink" );
+        }
+        used.insert( i );
+        forwarded++;
+      }
+    }
+    if ( forwarded != flows.size() ) {
+      throw runtime_error( "forwarded " + to_string( forwarded ) + " of " + to_string( flows.size() )
+                           + " datagrams" );
+    }
+  }
+  if ( used.size() != UPLINKS ) {
+    throw runtime_error( "only " + to_string( used.size() ) + " of the uplinks carried traffic" );
+  }
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    test_flow_hashing( false );
+    test_flow_hashing( true );
+    test_forwarding();
+  } catch ( const exception& e ) {
+    cerr << "\n\n\n";
+    cerr << "\033[31;1mError: " << e.what() << "\033[m\n";
+    return EXIT_FAILURE;
+  }
+
+  cout << "\033[32;1mFlows were spread over equal-cost paths, and stayed put as paths came and went.\033[m\n";
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,172 @@
+#include "router.hh"
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+constexpr uint8_t PROTO_UDP = 17;
+constexpr uint64_t LINK_BYTES_PER_S = 12'500'000; // 100 Mbit/s per uplink
+constexpr size_t OFFERED_FRAMES_PER_MS = 100;     // ~1.2 Gbit/s of 1500-byte datagrams
+constexpr size_t SIMULATED_MS = 300;
+constexpr size_t FLOWS = 4096;
+constexpr size_t PAYLOAD = 1472;
+const EthernetAddress ROUTER_ETH = { 0x02, 0, 0, 0, 0, 0x10 };
+const EthernetAddress SENDER_ETH = { 0x02, 0, 0, 0, 0, 0x20 };
+
+Address uplink_address( size_t i )
+{
+  return Address { "10." + to_string( i + 1 ) + ".0.1" };
+}
+
+Address uplink_next_hop( size_t i )
+{
+  return Address { "10." + to_string( i + 1 ) + ".0.2" };
+}
+
+EthernetAddress uplink_next_hop_eth( size_t i )
+{
+  return { 0x02, 0, 0, 0, 1, static_cast<uint8_t>( i ) };
+}
+
+EthernetFrame make_frame( const EthernetAddress& src, uint16_t type, vector<Buffer> payload )
+{
+  EthernetFrame frame;
+  frame.header.dst = ROUTER_ETH;
+  frame.header.src = src;
+  frame.header.type = type;
+  frame.payload = std::move( payload );
+  return frame;
+}
+
+// One frame per flow, all headed for the multipath prefix
+vector<EthernetFrame> make_traffic()
+{
+  default_random_engine rd { random_device()() };
+  uniform_int_distribution<uint32_t> host_dist { 0, 0xffff };
+  vector<EthernetFrame> frames;
+  for ( size_t i = 0; i < FLOWS; i++ ) {
+    InternetDatagram dgram;
+    dgram.header.src = Address { "192.168.0.0" }.ipv4_numeric() | host_dist( rd );
+    dgram.header.dst = Address { "172.16.0.0" }.ipv4_numeric() | host_dist( rd );
+    dgram.header.proto = PROTO_UDP;
+    dgram.payload.emplace_back( string( PAYLOAD, 'x' ) );
+    dgram.header.len = static_cast<uint64_t>( dgram.header.hlen ) * 4 + PAYLOAD;
+    dgram.header.compute_checksum();
+    frames.push_back( make_frame( SENDER_ETH, EthernetHeader::TYPE_IPv4, serialize( dgram ) ) );
+  }
+  return frames;
+}
+
+// A router with `links` shaped 100 Mbit/s uplinks, all equal-cost paths to 172.16.0.0/12
+void setup( Router& router, size_t links )
+{
+  EgressScheduler::Config link;
+  link.classes[0].limit = 256; // the link's buffer
+  link.rate_bytes_per_s = LINK_BYTES_PER_S;
+  link.burst_bytes = LINK_BYTES_PER_S / 1000 + 1514;
+
+  ostringstream discard;
+  auto* const old_cerr = cerr.rdbuf( discard.rdbuf() );
+  router.add_interface( AsyncNetworkInterface { ROUTER_ETH, Address { "192.168.0.1" } } );
+  vector<Router::Path> paths;
+  for ( size_t i = 0; i < links; i++ ) {
+    router.add_interface( AsyncNetworkInterface { ROUTER_ETH, uplink_address( i ) } );
+    paths.push_back( { uplink_next_hop( i ), i + 1 } );
+  }
+  router.add_route( Address { "172.16.0.0" }.ipv4_numeric(), 12, paths );
+  cerr.rdbuf( old_cerr );
+
+  for ( size_t i = 0; i < links; i++ ) {
+    AsyncNetworkInterface& uplink = router.interface( i + 1 );
+    uplink.set_egress_config( link );
+
+    ARPMessage arp;
+    arp.opcode = ARPMessage::OPCODE_REQUEST;
+    arp.sender_ethernet_address = uplink_next_hop_eth( i );
+    arp.sender_ip_address = uplink_next_hop( i ).ipv4_numeric();
+    arp.target_ip_address = uplink_address( i ).ipv4_numeric();
+    uplink.recv_frame( make_frame( uplink_next_hop_eth( i ), EthernetHeader::TYPE_ARP, serialize( arp ) ) );
+    while ( uplink.maybe_send() ) {} // the ARP reply
+  }
+}
+
+struct Result
+{
+  double delivered_mbit_s {};
+  double forwarded_mpps {}; // wall-clock rate of the router's own work
+};
+
+// Offer more than every link can carry, and measure what gets through
+Result simulate( size_t links, const vector<EthernetFrame>& traffic )
+{
+  Router router;
+  setup( router, links );
+
+  uint64_t delivered_bytes = 0;
+  uint64_t routed = 0;
+  size_t next_flow = 0;
+  EthernetFrame frame;
+  chrono::duration<double> routing_time {};
+
+  for ( size_t ms = 0; ms < SIMULATED_MS; ms++ ) {
+    const auto start = chrono::steady_clock::now();
+    for ( size_t i = 0; i < OFFERED_FRAMES_PER_MS; i++ ) {
+      router.interface( 0 ).recv_frame( traffic[next_flow] );
+      next_flow = ( next_flow + 1 ) % traffic.size();
+    }
+    router.route();
+    routing_time += chrono::steady_clock::now() - start;
+    routed += OFFERED_FRAMES_PER_MS;
+
+    for ( size_t i = 0; i < links; i++ ) {
+      AsyncNetworkInterface& uplink = router.interface( i + 1 );
+      uplink.tick( 1 );
+      while ( uplink.maybe_send( frame ) ) {
+        delivered_bytes += EthernetHeader::LENGTH;
+        for ( const auto& b : frame.payload ) {
+          delivered_bytes += b.size();
+        }
+      }
+    }
+  }
+
+  return { delivered_bytes * 8 / ( SIMULATED_MS / 1000.0 ) / 1e6, routed / routing_time.count() / 1e6 };
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    const vector<EthernetFrame> traffic = make_traffic();
+    cout << FLOWS << " flows offering ~" << OFFERED_FRAMES_PER_MS * ( PAYLOAD + 20 + EthernetHeader::LENGTH ) * 8 / 1000
+         << " Mbit/s to a prefix reached over N equal-cost 100 Mbit/s uplinks:\n";
+
+    vector<Result> results;
+    for ( const size_t links : { 1, 2, 4, 8 } ) {
+      results.push_back( simulate( links, traffic ) );
+      cout << "  N = " << links << "   delivered " << fixed << setprecision( 1 ) << setw( 6 )
+           << results.back().delivered_mbit_s << " Mbit/s   router forwarding at " << setprecision( 2 )
+           << results.back().forwarded_mpps << " Mpps\n";
+    }
+
+    if ( results.back().delivered_mbit_s < 6 * results.front().delivered_mbit_s ) {
+      throw runtime_error( "8 equal-cost links didn't carry at least 6x what one link does" );
+    }
+  } catch ( const exception& e ) {
+    cerr << "\n\n\n";
+    cerr << "\033[31;1mError: " << e.what() << "\033[m\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,160 @@
+#include "router.hh"
+
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+struct Route
+{
+  uint32_t prefix;
+  uint8_t length;
+  optional<Address> next_hop;
+  size_t interface_num;
+};
+
+//A few upstreams, each announcing aggregates plus lots of more-specifics, most of which go the same way
+//as the aggregate that covers them (the redundant children compression should drop).
+vector<Route> hierarchical_routes( default_random_engine& rd, size_t count )
+{
+  const vector<optional<Address>> next_hops
+    = { Address { "10.0.0.1" }, Address { "10.0.1.1" }, Address { "10.0.2.1" }, {} };
+  uniform_int_distribution<uint32_t> addr_dist;
+  uniform_int_distribution<size_t> hop_dist { 0, next_hops.size() - 1 };
+  uniform_int_distribution<int> extra_bits { 1, 8 };
+
+  vector<Route> routes;
+  routes.push_back( { 0, 0, next_hops[0], 0 } );
+  while ( routes.size() < count ) {
+    //pick an existing route as the parent and carve a more-specific out of it.
+    const Route parent = routes[rd() % routes.size()];
+    const auto length = static_cast<uint8_t>( min( 32, parent.length + extra_bits( rd ) ) );
+    const uint32_t parent_mask = parent.length == 0 ? 0 : UINT32_MAX << ( 32 - parent.length );
+    const uint32_t prefix = ( parent.prefix & parent_mask ) | ( addr_dist( rd ) & ~parent_mask );
+
+    if ( rd() % 10 < 7 ) {
+      routes.push_back( { prefix, length, parent.next_hop, parent.interface_num } );
+    } else {
+      const size_t hop = hop_dist( rd );
+      routes.push_back( { prefix, length, next_hops[hop], hop } );
+    }
+  }
+  return routes;
+}
+
+void add( Router& router, const Route& r )
+{
+  router.add_route( r.prefix, r.length, r.next_hop, r.interface_num );
+}
+
+void check_equivalent( const Router& plain,
+                       const Router& compressed,
+                       const vector<Route>& routes,
+                       default_random_engine& rd )
+{
+  uniform_int_distribution<uint32_t> addr_dist;
+  auto check = [&]( uint32_t dst ) {
+    if ( plain.find_match( dst ) != compressed.find_match( dst ) ) {
+      throw runtime_error( "compressed table forwards " + Address::from_ipv4_numeric( dst ).ip()
+                           + " differently from the uncompressed table" );
+    }
+  };
+
+  for ( size_t i = 0; i < 100000; i++ ) {
+    check( addr_dist( rd ) );
+  }
+  for ( const auto& r : routes ) {
+    const uint32_t host_bits = r.length == 32 ? 0 : ( addr_dist( rd ) >> r.length );
+    check( r.prefix | host_bits );
+  }
+}
+
+void print_stats( const string& when, const Router::FibStats& stats )
+{
+  cout << when << ": " << stats.routes_added << " routes added, " << stats.routes_installed << " installed, ~"
+       << stats.fib_bytes << " table + " << stats.rib_bytes << " side bytes, ~" << stats.bytes_saved
+       << " bytes saved net\n";
+}
+
+void test_compression()
+{
+  default_random_engine rd { random_device()() };
+  vector<Route> routes = hierarchical_routes( rd, 4000 );
+
+  Router plain;
+  Router compressed;
+  compressed.set_fib_compression( true );
+  for ( const auto& r : routes ) {
+    add( plain, r );
+    add( compressed, r );
+  }
+
+  const auto stats = compressed.fib_stats();
+  print_stats( "After loading", stats );
+  if ( stats.routes_added != plain.fib_stats().routes_installed ) {
+    throw runtime_error( "compressed router lost track of some routes" );
+  }
+  if ( stats.routes_installed * 10 > stats.routes_added * 8 ) {
+    throw runtime_error( "compression removed fewer than 20% of the routes" );
+  }
+  //The routes kept on the side count against what the smaller table saves.
+  const auto plain_stats = plain.fib_stats();
+  if ( plain_stats.rib_bytes != 0 || stats.rib_bytes == 0
+       || stats.bytes_saved
+            != static_cast<int64_t>( plain_stats.fib_bytes ) - static_cast<int64_t>( stats.fib_bytes + stats.rib_bytes ) ) {
+    throw runtime_error( "compression's memory saving doesn't count the routes it keeps aside" );
+  }
+  check_equivalent( plain, compressed, routes, rd );
+
+  //Incremental updates: repoint some aggregates (which un-hides or hides their children), add new
+  //more-specifics and re-add old routes, checking after each batch.
+  for ( int batch = 0; batch < 5; batch++ ) {
+    vector<Route> changes = hierarchical_routes( rd, 200 );
+    for ( size_t i = 0; i < 100; i++ ) {
+      Route r = routes[rd() % routes.size()];
+      r.interface_num = ( r.interface_num + 1 ) % 4;
+      changes.push_back( r );
+    }
+    for ( const auto& r : changes ) {
+      add( plain, r );
+      add( compressed, r );
+      routes.push_back( r );
+    }
+    check_equivalent( plain, compressed, routes, rd );
+  }
+  print_stats( "After updates", compressed.fib_stats() );
+
+  //Turning compression on for an already-loaded table, together with the bloom filters.
+  Router late;
+  late.set_bloom_lookup( true );
+  for ( const auto& r : routes ) {
+    add( late, r );
+  }
+  late.set_fib_compression( true );
+  check_equivalent( plain, late, routes, rd );
+  late.set_fib_compression( false );
+  if ( late.fib_stats().routes_installed != plain.fib_stats().routes_installed ) {
+    throw runtime_error( "turning compression off did not restore every route" );
+  }
+  check_equivalent( plain, late, routes, rd );
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    test_compression();
+  } catch ( const exception& e ) {
+    cerr << "\n\n\n";
+    cerr << "\033[31;1mError: " << e.what() << "\033[m\n";
+    return EXIT_FAILURE;
+  }
+
+  cout << "\033[32;1mCompressed table forwards the same as the uncompressed table.\033[m\n";
+  return EXIT_SUCCESS;
+}
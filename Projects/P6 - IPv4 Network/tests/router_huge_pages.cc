@@ -0,0 +1,126 @@
+#include "router.hh"
+#include "traffic_generator.hh"
+
+#include <iostream>
+#include <memory_resource>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+void test_resource()
+{
+  HugePageResource memory;
+
+  //small blocks share a 2 MiB chunk, and come back aligned.
+  vector<void*> blocks;
+  for ( const size_t alignment : { 1, 8, 64, 4096 } ) {
+    void* const p = memory.allocate( 24, alignment );
+    if ( reinterpret_cast<uintptr_t>( p ) % alignment != 0 ) { // NOLINT(*-reinterpret-cast)
+      throw runtime_error( "a block came back misaligned" );
+    }
+    static_cast<char*>( p )[23] = 1;
+    blocks.push_back( p );
+  }
+  HugePageResource::Stats stats = memory.stats();
+  if ( stats.hugetlb_bytes + stats.transparent_bytes + stats.small_bytes != HugePageResource::CHUNK_SIZE ) {
+    throw runtime_error( "small blocks weren't carved from one chunk" );
+  }
+
+  //big ones get mappings of their own, given back when they're freed.
+  const size_t big = 3 * HugePageResource::HUGE_PAGE_SIZE + 1;
+  char* const p = static_cast<char*>( memory.allocate( big ) );
+  if ( reinterpret_cast<uintptr_t>( p ) % HugePageResource::HUGE_PAGE_SIZE != 0 ) { // NOLINT(*-reinterpret-cast)
+    throw runtime_error( "a big block wasn't on a huge page boundary" );
+  }
+  p[0] = p[big - 1] = 1;
+  stats = memory.stats();
+  if ( stats.hugetlb_bytes + stats.transparent_bytes + stats.small_bytes != 5 * HugePageResource::HUGE_PAGE_SIZE ) {
+    throw runtime_error( "a big block wasn't rounded up to whole huge pages" );
+  }
+  memory.deallocate( p, big );
+  stats = memory.stats();
+  if ( stats.hugetlb_bytes + stats.transparent_bytes + stats.small_bytes != HugePageResource::CHUNK_SIZE ) {
+    throw runtime_error( "a freed big block wasn't unmapped" );
+  }
+  for ( void* const block : blocks ) {
+    memory.deallocate( block, 24 );
+  }
+
+  //whatever the backing, it's reported consistently.
+  const PageBacking backing = memory.backing();
+  const size_t bytes_of_backing = backing == PageBacking::HUGETLB       ? stats.hugetlb_bytes
+                                  : backing == PageBacking::TRANSPARENT ? stats.transparent_bytes
+                                                                        : stats.small_bytes;
+  if ( bytes_of_backing == 0 || to_string( backing ).empty() ) {
+    throw runtime_error( "the reported backing didn't match the memory mapped" );
+  }
+}
+
+void test_router()
+{
+  const auto prefixes = random_prefixes( 20'000, 458 );
+  RoutesByLength routes;
+  for ( size_t i = 0; i < prefixes.size(); i++ ) {
+    const auto [prefix, length] = prefixes[i];
+    routes[length].push_back(
+      { get_prefmask( length, prefix ), static_cast<uint32_t>( i ), static_cast<uint32_t>( i % 4 ), 1 } );
+  }
+
+  //one router on huge pages from the start, one moved over after loading, one left alone.
+  Router before, after, plain;
+  if ( plain.fib_page_backing() != PageBacking::SMALL ) {
+    throw runtime_error( "a router claimed huge pages it wasn't given" );
+  }
+  const PageBacking backing = before.enable_huge_pages();
+  before.set_bloom_lookup( true );
+  before.load_routes( routes );
+  after.set_bloom_lookup( true );
+  after.load_routes( routes );
+  after.enable_huge_pages();
+  plain.load_routes( routes );
+  if ( before.fib_page_backing() != backing || after.enable_huge_pages() != after.fib_page_backing() ) {
+    throw runtime_error( "the routers reported their backing inconsistently" );
+  }
+
+  //and more routes after the move.
+  for ( Router* router : { &before, &after, &plain } ) {
+    ostringstream discard;
+    auto* const old_cerr = cerr.rdbuf( discard.rdbuf() );
+    for ( uint32_t i = 0; i < 1000; i++ ) {
+      router->add_route( 0xc6120000 + ( i << 8 ), 24, Address::from_ipv4_numeric( i ), 1 );
+    }
+    cerr.rdbuf( old_cerr );
+  }
+
+  mt19937 rng { 458 };
+  for ( size_t i = 0; i < 200'000; i++ ) {
+    const uint32_t dst = i % 2 ? rng() : 0xc6120000 + static_cast<uint32_t>( rng() % ( 1 << 20 ) );
+    const auto expected = plain.find_match( dst );
+    if ( before.find_match( dst ) != expected || after.find_match( dst ) != expected ) {
+      throw runtime_error( "a FIB on huge pages gave a different answer" );
+    }
+  }
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    test_resource();
+    test_router();
+  } catch ( const exception& e ) {
+    cerr << "\n\n\n";
+    cerr << "\033[31;1mError: " << e.what() << "\033[m\n";
+    return EXIT_FAILURE;
+  }
+
+  cout << "\033[32;1mThe FIB moved onto huge pages and answered the same.\033[m\n";
+  return EXIT_SUCCESS;
+}
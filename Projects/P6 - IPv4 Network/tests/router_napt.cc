@@ -0,0 +1,436 @@
+#include "checksum.hh"
+#include "router.hh"
+
+#include <atomic>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+const EthernetAddress ROUTER_ETH0 = { 0x02, 0, 0, 0, 0, 0x10 };
+const EthernetAddress ROUTER_ETH1 = { 0x02, 0, 0, 0, 0, 0x11 };
+const EthernetAddress INSIDE_ETH = { 0x02, 0, 0, 0, 0, 0x20 };
+const EthernetAddress UPSTREAM_ETH = { 0x02, 0, 0, 0, 0, 0x22 };
+const Address UPSTREAM { "203.0.113.1" };
+
+uint32_t ip( const string& str )
+{
+  return Address { str }.ipv4_numeric();
+}
+
+uint16_t read16( string_view bytes, size_t offset )
+{
+  return ( static_cast<uint8_t>( bytes[offset] ) << 8 ) | static_cast<uint8_t>( bytes[offset + 1] );
+}
+
+// A TCP or UDP datagram with correct checksums (or, for UDP, none at all if asked)
+InternetDatagram make_dgram( uint8_t proto,
+                             uint32_t src,
+                             uint16_t src_port,
+                             uint32_t dst,
+                             uint16_t dst_port,
+                             bool udp_checksum = true )
+{
+  InternetDatagram dgram;
+  dgram.header.src = src;
+  dgram.header.dst = dst;
+  dgram.header.proto = proto;
+
+  string segment( proto == IPv4Header::PROTO_TCP ? 20 : 8, 0 );
+  segment[0] = static_cast<char>( src_port >> 8 );
+  segment[1] = static_cast<char>( src_port & 0xff );
+  segment[2] = static_cast<char>( dst_port >> 8 );
+  segment[3] = static_cast<char>( dst_port & 0xff );
+  if ( proto == IPv4Header::PROTO_TCP ) {
+    segment[12] = 0x50; // data offset: 5 words
+  }
+  segment.append( "some payload that is 31 bytes." );
+  if ( proto == IPv4Header::PROTO_UDP ) {
+    segment[4] = static_cast<char>( segment.size() >> 8 );
+    segment[5] = static_cast<char>( segment.size() & 0xff );
+  }
+  dgram.header.len = static_cast<uint64_t>( dgram.header.hlen ) * 4 + segment.size();
+  dgram.header.compute_checksum();
+
+  if ( proto == IPv4Header::PROTO_TCP || udp_checksum ) {
+    InternetChecksum check { dgram.header.pseudo_checksum() };
+    check.add( segment );
+    const uint16_t cksum = check.value();
+    const size_t at = proto == IPv4Header::PROTO_TCP ? 16 : 6;
+    segment[at] = static_cast<char>( cksum >> 8 );
+    segment[at + 1] = static_cast<char>( cksum & 0xff );
+  }
+  dgram.payload.emplace_back( std::move( segment ) );
+  return dgram;
+}
+
+// Checks a datagram's IPv4 and TCP/UDP checksums from scratch
+void check_checksums( const InternetDatagram& dgram, const string& what )
+{
+  InternetDatagram reparsed;
+  if ( not parse( reparsed, serialize( dgram ) ) ) {
+    throw runtime_error( what + ": bad IPv4 header checksum" );
+  }
+
+  string segment;
+  for ( const auto& b : dgram.payload ) {
+    segment.append( b );
+  }
+  if ( dgram.header.proto == IPv4Header::PROTO_UDP && read16( segment, 6 ) == 0 ) {
+    return; // no checksum
+  }
+  InternetChecksum check { dgram.header.pseudo_checksum() };
+  check.add( segment );
+  if ( check.value() != 0 ) {
+    throw runtime_error( what + ": bad " + ( dgram.header.proto == IPv4Header::PROTO_TCP ? "TCP" : "UDP" )
+                         + " checksum" );
+  }
+}
+
+pair<uint16_t, uint16_t> ports( const InternetDatagram& dgram )
+{
+  return { read16( dgram.payload.front(), 0 ), read16( dgram.payload.front(), 2 ) };
+}
+
+Napt::Config small_config()
+{
+  Napt::Config config;
+  config.public_address = ip( "198.51.100.10" );
+  config.public_addresses = 2;
+  config.first_port = 2000;
+  config.last_port = 2003; // 8 public endpoints in all
+  config.max_mappings = 64;
+  config.tcp_timeout_ms = 10000;
+  config.udp_timeout_ms = 3000;
+  config.wheel_granularity_ms = 100;
+  return config;
+}
+
+void test_translation()
+{
+  Napt napt { small_config() };
+  const uint32_t host = ip( "192.168.0.5" );
+  const uint32_t server = ip( "93.184.216.34" );
+
+  for ( const uint8_t proto : { IPv4Header::PROTO_TCP, IPv4Header::PROTO_UDP } ) {
+    InternetDatagram out = make_dgram( proto, host, 40000, server, 443 );
+    if ( not napt.translate_outbound( out ) ) {
+      throw runtime_error( "a new connection wasn't translated" );
+    }
+    if ( not napt.is_public( out.header.src ) || ports( out ).first < 2000 || ports( out ).first > 2003
+         || out.header.dst != server || ports( out ).second != 443 ) {
+      throw runtime_error( "the outbound datagram's source wasn't rewritten to a public endpoint" );
+    }
+    check_checksums( out, "outbound" );
+
+    //the next datagram of the connection gets the same public endpoint.
+    InternetDatagram again = make_dgram( proto, host, 40000, server, 443 );
+    napt.translate_outbound( again );
+    if ( again.header.src != out.header.src || ports( again ).first != ports( out ).first ) {
+      throw runtime_error( "one connection was given two public endpoints" );
+    }
+
+    //the reply comes back to the inside host.
+    InternetDatagram reply = make_dgram( proto, server, 443, out.header.src, ports( out ).first );
+    if ( not napt.translate_inbound( reply ) ) {
+      throw runtime_error( "a reply to a tracked connection was dropped" );
+    }
+    if ( reply.header.dst != host || ports( reply ).second != 40000 || reply.header.src != server ) {
+      throw runtime_error( "the reply wasn't rewritten back to the inside host" );
+    }
+    check_checksums( reply, "inbound" );
+
+    //but not from anyone else, or to another port.
+    InternetDatagram stranger = make_dgram( proto, ip( "1.2.3.4" ), 443, out.header.src, ports( out ).first );
+    InternetDatagram other_port = make_dgram( proto, server, 443, out.header.src, ports( out ).first ^ 1 );
+    if ( napt.translate_inbound( stranger ) || napt.translate_inbound( other_port ) ) {
+      throw runtime_error( "a datagram that's not part of a tracked connection was let in" );
+    }
+  }
+
+  //a UDP datagram without a checksum still hasn't got one after translation.
+  InternetDatagram bare = make_dgram( IPv4Header::PROTO_UDP, host, 5353, server, 53, false );
+  napt.translate_outbound( bare );
+  if ( read16( bare.payload.front(), 6 ) != 0 ) {
+    throw runtime_error( "translation made up a UDP checksum" );
+  }
+  check_checksums( bare, "checksum-less UDP" );
+
+  //a segment whose header is split across buffers is translated too.
+  InternetDatagram split = make_dgram( IPv4Header::PROTO_TCP, host, 40001, server, 443 );
+  const string whole = split.payload.front();
+  split.payload = { Buffer { whole.substr( 0, 10 ) }, Buffer { whole.substr( 10 ) } };
+  if ( not napt.translate_outbound( split ) ) {
+    throw runtime_error( "a split TCP header wasn't translated" );
+  }
+  check_checksums( split, "split TCP header" );
+
+  //other protocols, and later fragments, aren't translatable.
+  InternetDatagram icmp = make_dgram( IPv4Header::PROTO_TCP, host, 40002, server, 443 );
+  icmp.header.proto = 1;
+  InternetDatagram fragment = make_dgram( IPv4Header::PROTO_UDP, host, 40003, server, 443 );
+  fragment.header.offset = 100;
+  if ( napt.translate_outbound( icmp ) || napt.translate_outbound( fragment ) ) {
+    throw runtime_error( "an untranslatable datagram was let out" );
+  }
+
+  //the original frame's memory is left alone when the datagram shares it.
+  InternetDatagram shared = make_dgram( IPv4Header::PROTO_UDP, host, 40004, server, 443 );
+  const vector<Buffer> original = shared.payload;
+  const string before { string_view { original.front() } };
+  napt.translate_outbound( shared );
+  if ( string_view { original.front() } != before ) {
+    throw runtime_error( "translating a datagram rewrote a buffer it shared with someone else" );
+  }
+}
+
+void test_expiry_and_exhaustion()
+{
+  Napt napt { small_config() };
+  const uint32_t server = ip( "93.184.216.34" );
+  auto open = [&]( uint8_t proto, uint16_t port ) {
+    InternetDatagram dgram = make_dgram( proto, ip( "192.168.0.7" ), port, server, 80 );
+    return napt.translate_outbound( dgram ) ? optional { dgram } : nullopt;
+  };
+
+  //8 public endpoints: the 9th connection finds none left.
+  vector<InternetDatagram> udp;
+  for ( uint16_t port = 1000; port < 1006; port++ ) {
+    udp.push_back( open( IPv4Header::PROTO_UDP, port ).value() );
+  }
+  const InternetDatagram tcp1 = open( IPv4Header::PROTO_TCP, 1006 ).value();
+  const InternetDatagram tcp2 = open( IPv4Header::PROTO_TCP, 1007 ).value();
+  if ( open( IPv4Header::PROTO_UDP, 1008 ).has_value() ) {
+    throw runtime_error( "a connection was given a public endpoint already in use" );
+  }
+  if ( napt.stats().active != 8 || napt.stats().exhausted != 1 ) {
+    throw runtime_error( "the stats don't show a full pool" );
+  }
+
+  //one UDP connection stays busy, the others go idle past the UDP timeout.
+  for ( size_t ms = 0; ms < 4000; ms += 500 ) {
+    napt.tick( 500 );
+    open( IPv4Header::PROTO_UDP, 1000 );
+    napt.expire();
+  }
+  const Napt::Stats stats = napt.stats();
+  if ( stats.expired != 5 || stats.active != 3 ) {
+    throw runtime_error( "expected 5 idle UDP connections to expire, " + to_string( stats.expired ) + " did" );
+  }
+  InternetDatagram late_reply = make_dgram( IPv4Header::PROTO_UDP, server, 80, udp[1].header.src, ports( udp[1] ).first );
+  if ( napt.translate_inbound( late_reply ) ) {
+    throw runtime_error( "a reply to an expired connection was let in" );
+  }
+  InternetDatagram busy_reply = make_dgram( IPv4Header::PROTO_UDP, server, 80, udp[0].header.src, ports( udp[0] ).first );
+  if ( not napt.translate_inbound( busy_reply ) ) {
+    throw runtime_error( "a busy connection expired" );
+  }
+
+  //the expired connections' ports are handed out again.
+  for ( uint16_t port = 2000; port < 2005; port++ ) {
+    if ( not open( IPv4Header::PROTO_UDP, port ).has_value() ) {
+      throw runtime_error( "the ports of expired connections weren't reused" );
+    }
+  }
+
+  //TCP lasts longer, but not forever (a long gap between expire() calls catches up in one go).
+  napt.tick( 60000 );
+  napt.expire();
+  InternetDatagram tcp_reply = make_dgram( IPv4Header::PROTO_TCP, server, 80, tcp2.header.src, ports( tcp2 ).first );
+  if ( napt.translate_inbound( tcp_reply ) || napt.stats().active != 0 ) {
+    throw runtime_error( "connections outlived their timeout" );
+  }
+  (void)tcp1;
+
+  for ( const auto& bad : { [] {
+                             Napt::Config c = small_config();
+                             c.public_addresses = 0;
+                             return c;
+                           }(),
+                            [] {
+                              Napt::Config c = small_config();
+                              c.first_port = 3000;
+                              return c;
+                            }() } ) {
+    bool threw = false;
+    try {
+      const Napt n { bad };
+    } catch ( const runtime_error& ) {
+      threw = true;
+    }
+    if ( not threw ) {
+      throw runtime_error( "a bad NAPT config was accepted" );
+    }
+  }
+}
+
+EthernetFrame make_frame( const EthernetAddress& dst, const EthernetAddress& src, uint16_t type, vector<Buffer> payload )
+{
+  EthernetFrame frame;
+  frame.header.dst = dst;
+  frame.header.src = src;
+  frame.header.type = type;
+  frame.payload = std::move( payload );
+  return frame;
+}
+
+void learn( Router& router, size_t interface_num, const EthernetAddress& eth, const Address& addr, const string& own )
+{
+  ARPMessage arp;
+  arp.opcode = ARPMessage::OPCODE_REQUEST;
+  arp.sender_ethernet_address = eth;
+  arp.sender_ip_address = addr.ipv4_numeric();
+  arp.target_ip_address = ip( own );
+  router.interface( interface_num )
+    .recv_frame( make_frame( interface_num == 0 ? ROUTER_ETH0 : ROUTER_ETH1, eth, EthernetHeader::TYPE_ARP, serialize( arp ) ) );
+  while ( router.interface( interface_num ).maybe_send() ) {} // the ARP reply
+}
+
+// Routes one datagram in on `in`, returning what came out of `out` (if anything)
+optional<InternetDatagram> route_one( Router& router, size_t in, size_t out, const InternetDatagram& dgram )
+{
+  router.interface( in ).recv_frame(
+    make_frame( in == 0 ? ROUTER_ETH0 : ROUTER_ETH1, in == 0 ? INSIDE_ETH : UPSTREAM_ETH, EthernetHeader::TYPE_IPv4, serialize( dgram ) ) );
+  router.route();
+  optional<InternetDatagram> result;
+  while ( auto frame = router.interface( out ).maybe_send() ) {
+    InternetDatagram parsed;
+    if ( frame->header.type == EthernetHeader::TYPE_IPv4 && parse( parsed, frame->payload ) ) {
+      result = parsed;
+    }
+  }
+  return result;
+}
+
+void test_router()
+{
+  ostringstream discard;
+  auto* const old_cerr = cerr.rdbuf( discard.rdbuf() );
+  Router router;
+  router.add_interface( AsyncNetworkInterface { ROUTER_ETH0, Address { "192.168.0.1" } } );
+  router.add_interface( AsyncNetworkInterface { ROUTER_ETH1, Address { "203.0.113.2" } } );
+  router.add_route( ip( "192.168.0.0" ), 24, {}, 0 );
+  router.add_route( 0, 0, UPSTREAM, 1 );
+  cerr.rdbuf( old_cerr );
+  learn( router, 1, UPSTREAM_ETH, UPSTREAM, "203.0.113.2" );
+  learn( router, 0, INSIDE_ETH, Address { "192.168.0.5" }, "192.168.0.1" );
+
+  Napt::Config config = small_config();
+  config.public_address = ip( "203.0.113.2" );
+  config.public_addresses = 1;
+  router.enable_napt( 1, config );
+
+  const uint32_t host = ip( "192.168.0.5" );
+  const uint32_t server = ip( "93.184.216.34" );
+  const auto out = route_one( router, 0, 1, make_dgram( IPv4Header::PROTO_TCP, host, 51000, server, 443 ) );
+  if ( not out.has_value() || out->header.src != ip( "203.0.113.2" ) || out->header.ttl != IPv4Header::DEFAULT_TTL - 1 ) {
+    throw runtime_error( "the router didn't send the connection out from its public address" );
+  }
+  check_checksums( *out, "routed outbound" );
+
+  const auto back
+    = route_one( router, 1, 0, make_dgram( IPv4Header::PROTO_TCP, server, 443, out->header.src, ports( *out ).first ) );
+  if ( not back.has_value() || back->header.dst != host || ports( *back ).second != 51000 ) {
+    throw runtime_error( "the router didn't send the reply on to the inside host" );
+  }
+  check_checksums( *back, "routed inbound" );
+
+  //unsolicited traffic to the public address goes nowhere.
+  if ( route_one( router, 1, 0, make_dgram( IPv4Header::PROTO_UDP, server, 443, out->header.src, 2001 ) ).has_value() ) {
+    throw runtime_error( "the router let in traffic for an untracked connection" );
+  }
+
+  router.tick( 20000 );
+  if ( router.napt()->stats().active != 0 ) {
+    throw runtime_error( "Router::tick didn't expire the idle connection" );
+  }
+}
+
+// Lookups on one thread while another opens and expires connections
+void test_concurrent_expiry()
+{
+  Napt::Config config = small_config();
+  config.first_port = 1024;
+  config.last_port = UINT16_MAX;
+  config.max_mappings = 512; // small enough that worker 1's expiries make it compact
+  config.workers = 2;
+  Napt napt { config };
+  const uint32_t server = ip( "93.184.216.34" );
+
+  //worker 0 never expires anything, so its connections are there for the whole test.
+  vector<InternetDatagram> replies;
+  for ( uint16_t port = 1; port <= 64; port++ ) {
+    InternetDatagram dgram = make_dgram( IPv4Header::PROTO_UDP, ip( "192.168.0.9" ), port, server, 53 );
+    napt.translate_outbound( dgram );
+    replies.push_back( make_dgram( IPv4Header::PROTO_UDP, server, 53, dgram.header.src, ports( dgram ).first ) );
+  }
+
+  //worker 1 also keeps a few connections busy throughout, which must keep their public ports
+  //as the connections expiring around them leave tombstones to be cleared and compacted away.
+  atomic<bool> done { false };
+  bool steady_moved = false;
+  thread churn( [&] {
+    vector<uint16_t> steady_ports( 8 );
+    for ( uint16_t round = 0; round < 200; round++ ) {
+      for ( uint16_t port = 0; port < 16; port++ ) {
+        InternetDatagram dgram = make_dgram( IPv4Header::PROTO_UDP, ip( "192.168.1.9" ), round * 16 + port, server, 53 );
+        napt.translate_outbound( dgram, 1 );
+      }
+      for ( uint16_t i = 0; i < steady_ports.size(); i++ ) {
+        InternetDatagram dgram = make_dgram( IPv4Header::PROTO_UDP, ip( "192.168.2.9" ), i, server, 53 );
+        napt.translate_outbound( dgram, 1 );
+        if ( round == 0 ) {
+          steady_ports[i] = ports( dgram ).first;
+        }
+        steady_moved = steady_moved || ports( dgram ).first != steady_ports[i];
+      }
+      napt.tick( 1000 );
+      napt.expire( 1 );
+    }
+    done = true;
+  } );
+
+  size_t misses = 0;
+  while ( not done.load() ) {
+    for ( const auto& reply : replies ) {
+      InternetDatagram copy = reply;
+      misses += not napt.translate_inbound( copy );
+    }
+  }
+  churn.join();
+  if ( misses != 0 ) {
+    throw runtime_error( "lookups of live connections failed while another worker was expiring its own" );
+  }
+  if ( steady_moved ) {
+    throw runtime_error( "a busy connection changed public port while its neighbours expired" );
+  }
+  if ( napt.stats().expired == 0 ) {
+    throw runtime_error( "nothing expired" );
+  }
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    test_translation();
+    test_expiry_and_exhaustion();
+    test_router();
+    test_concurrent_expiry();
+  } catch ( const exception& e ) {
+    cerr << "\n\n\n";
+    cerr << "\033[31;1mError: " << e.what() << "\033[m\n";
+    return EXIT_FAILURE;
+  }
+
+  cout << "\033[32;1mNAPT translated, tracked and expired connections correctly.\033[m\n";
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,135 @@
+#include "router.hh"
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+constexpr uint32_t COVER = 0x0a000000;      // 10.0.0.0/8, always routed out interface 3
+constexpr uint32_t NEW_ROUTES = 0x14000000; // 20.0.0.0/8, filled in with /24s on interface 5 as the test runs
+constexpr size_t NUM_TOGGLED = 64;          // 10.k.0.0/16 for k < NUM_TOGGLED, flipping between interfaces 1 and 3
+
+// What a lookup may return at any moment, whichever version of the table it sees
+void check_lookup( const Router& router, uint32_t dst )
+{
+  const auto match = router.find_match( dst );
+  const string where = Address::from_ipv4_numeric( dst ).ip();
+
+  if ( ( dst >> 24 ) == ( COVER >> 24 ) ) {
+    //a /16 and its /8 are both always there (unless compression merged them), never neither.
+    if ( not match.has_value() ) {
+      throw runtime_error( "lookup of " + where + " found no route while routes were being changed" );
+    }
+    if ( match->first != 1 && match->first != 3 ) {
+      throw runtime_error( "lookup of " + where + " returned interface " + to_string( match->first ) );
+    }
+    if ( match->second != ( match->first == 1 ? 0x0b000001U : 0x0b000003U ) ) {
+      throw runtime_error( "lookup of " + where + " paired interface " + to_string( match->first )
+                           + " with the wrong next hop" );
+    }
+  } else if ( match.has_value() && ( match->first != 5 || match->second != dst ) ) {
+    throw runtime_error( "lookup of " + where + " returned a route that was never added" );
+  }
+}
+
+void test_concurrent_updates()
+{
+  Router router;
+
+  ostringstream discard;
+  auto* const old_cerr = cerr.rdbuf( discard.rdbuf() );
+
+  router.add_route( COVER, 8, Address::from_ipv4_numeric( 0x0b000003 ), 3 );
+  for ( uint32_t k = 0; k < NUM_TOGGLED; k++ ) {
+    router.add_route( COVER | ( k << 16 ), 16, Address::from_ipv4_numeric( 0x0b000001 ), 1 );
+  }
+
+  atomic<bool> done { false };
+  atomic<uint64_t> lookups { 0 };
+  vector<string> errors( thread::hardware_concurrency() > 4 ? 4 : 2 );
+
+  vector<thread> readers;
+  for ( size_t i = 0; i < errors.size(); i++ ) {
+    readers.emplace_back( [&, i] {
+      default_random_engine rd { random_device()() };
+      uniform_int_distribution<uint32_t> k_dist { 0, NUM_TOGGLED - 1 };
+      uniform_int_distribution<uint32_t> host_dist { 0, 0xffff };
+      uint64_t count = 0;
+      try {
+        while ( not done.load( memory_order_relaxed ) ) {
+          check_lookup( router, COVER | ( k_dist( rd ) << 16 ) | host_dist( rd ) );
+          check_lookup( router, NEW_ROUTES | ( host_dist( rd ) << 8 ) | ( host_dist( rd ) & 0xff ) );
+          count += 2;
+        }
+      } catch ( const exception& e ) {
+        errors[i] = e.what();
+      }
+      lookups += count;
+    } );
+  }
+
+  //One writer: flip the /16s back and forth, add new routes, and turn bloom lookup and compression on and off.
+  default_random_engine rd { random_device()() };
+  uniform_int_distribution<uint32_t> k_dist { 0, NUM_TOGGLED - 1 };
+  uniform_int_distribution<uint32_t> net_dist { 0, 0xffff };
+  size_t rounds = 0; // (two route changes each)
+  const auto stop = chrono::steady_clock::now() + chrono::seconds( 1 );
+  while ( chrono::steady_clock::now() < stop ) {
+    const uint32_t k = k_dist( rd );
+    const uint32_t interface_num = rounds % 2 ? 1 : 3;
+    router.add_route(
+      COVER | ( k << 16 ), 16, Address::from_ipv4_numeric( 0x0b000000 | interface_num ), interface_num );
+    router.add_route( NEW_ROUTES | ( net_dist( rd ) << 8 ), 24, {}, 5 );
+    if ( rounds % 97 == 0 ) {
+      router.set_bloom_lookup( rounds / 97 % 2 == 0 );
+    }
+    if ( rounds % 251 == 0 ) {
+      router.set_fib_compression( rounds / 251 % 2 == 0 );
+    }
+    rounds++;
+  }
+
+  done = true;
+  for ( auto& reader : readers ) {
+    reader.join();
+  }
+  cerr.rdbuf( old_cerr );
+
+  for ( const auto& error : errors ) {
+    if ( not error.empty() ) {
+      throw runtime_error( error );
+    }
+  }
+
+  //Once the writer is finished, every toggled /16 has settled and both copies agree.
+  for ( uint32_t k = 0; k < NUM_TOGGLED; k++ ) {
+    check_lookup( router, COVER | ( k << 16 ) | 1 );
+  }
+
+  cout << 2 * rounds << " route changes against " << lookups.load() << " concurrent lookups\n";
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    test_concurrent_updates();
+  } catch ( const exception& e ) {
+    cerr << "\n\n\n";
+    cerr << "\033[31;1mError: " << e.what() << "\033[m\n";
+    return EXIT_FAILURE;
+  }
+
+  cout << "\033[32;1mLookups stayed consistent while routes changed.\033[m\n";
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,257 @@
+#include "router.hh"
+
+#include <atomic>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+constexpr uint8_t PROTO_UDP = 17;
+const EthernetAddress INTERFACE_ETH = { 0x02, 0, 0, 0, 0, 0x01 };
+const EthernetAddress SENDER_ETH = { 0x02, 0, 0, 0, 0, 0x02 };
+
+uint32_t ip( const string& str )
+{
+  return Address { str }.ipv4_numeric();
+}
+
+// The test vectors from Microsoft's RSS specification
+void test_toeplitz()
+{
+  struct Vector
+  {
+    string src, dst;
+    uint16_t src_port, dst_port;
+    uint32_t ipv4_hash, tcp_hash;
+  };
+  const vector<Vector> vectors = {
+    { "66.9.149.187", "161.142.100.80", 2794, 1766, 0x323e8fc2, 0x51ccc178 },
+    { "199.92.111.2", "65.69.140.83", 14230, 4739, 0xd718262a, 0xc626b0ea },
+    { "24.19.198.95", "12.22.207.184", 12898, 38024, 0xd2d0a5de, 0x5c2b394a },
+    { "38.27.205.30", "209.142.163.6", 48228, 2217, 0x82989176, 0xafc7327f },
+    { "153.39.163.191", "202.188.127.2", 44251, 1303, 0x5d1809c5, 0x10e828a2 },
+  };
+
+  const ToeplitzHash hash;
+  for ( const auto& v : vectors ) {
+    if ( hash.ipv4( ip( v.src ), ip( v.dst ) ) != v.ipv4_hash
+         || hash.ipv4( ip( v.src ), ip( v.dst ), v.src_port, v.dst_port ) != v.tcp_hash ) {
+      throw runtime_error( "Toeplitz hash of " + v.src + " -> " + v.dst + " doesn't match the RSS test vector" );
+    }
+  }
+}
+
+// A UDP datagram whose payload is its ports and a per-flow sequence number
+EthernetFrame make_frame( uint32_t src, uint16_t src_port, uint32_t seq )
+{
+  InternetDatagram dgram;
+  dgram.header.src = src;
+  dgram.header.dst = ip( "10.0.0.1" );
+  dgram.header.proto = PROTO_UDP;
+  string payload;
+  for ( const uint32_t word : { ( static_cast<uint32_t>( src_port ) << 16 ) | 53U, seq } ) {
+    for ( int shift = 24; shift >= 0; shift -= 8 ) {
+      payload.push_back( static_cast<char>( word >> shift ) );
+    }
+  }
+  dgram.payload.emplace_back( std::move( payload ) );
+  dgram.header.len = static_cast<uint64_t>( dgram.header.hlen ) * 4 + dgram.payload.back().size();
+  dgram.header.compute_checksum();
+
+  EthernetFrame frame;
+  frame.header.dst = INTERFACE_ETH;
+  frame.header.src = SENDER_ETH;
+  frame.header.type = EthernetHeader::TYPE_IPv4;
+  frame.payload = serialize( dgram );
+  return frame;
+}
+
+// (flow, seq) from a datagram made by make_frame
+pair<uint64_t, uint32_t> flow_and_seq( const InternetDatagram& dgram )
+{
+  string payload;
+  for ( const auto& b : dgram.payload ) {
+    payload.append( b );
+  }
+  uint32_t seq = 0;
+  for ( size_t i = 4; i < 8; i++ ) {
+    seq = ( seq << 8 ) | static_cast<uint8_t>( payload.at( i ) );
+  }
+  const uint64_t port = ( static_cast<uint8_t>( payload.at( 0 ) ) << 8 ) | static_cast<uint8_t>( payload.at( 1 ) );
+  return { ( static_cast<uint64_t>( dgram.header.src ) << 16 ) | port, seq };
+}
+
+AsyncNetworkInterface make_interface()
+{
+  ostringstream discard;
+  auto* const old_cerr = cerr.rdbuf( discard.rdbuf() );
+  AsyncNetworkInterface interface { INTERFACE_ETH, Address { "10.0.0.1" } };
+  cerr.rdbuf( old_cerr );
+  return interface;
+}
+
+// Frames for `flows` flows, `per_flow` packets each, interleaved
+vector<EthernetFrame> make_traffic( size_t flows, size_t per_flow )
+{
+  default_random_engine rd { random_device()() };
+  uniform_int_distribution<uint32_t> addr_dist;
+  uniform_int_distribution<uint16_t> port_dist { 1024 };
+  vector<pair<uint32_t, uint16_t>> endpoints;
+  for ( size_t i = 0; i < flows; i++ ) {
+    endpoints.emplace_back( addr_dist( rd ), port_dist( rd ) );
+  }
+
+  vector<EthernetFrame> frames;
+  for ( uint32_t seq = 0; seq < per_flow; seq++ ) {
+    for ( const auto& [src, port] : endpoints ) {
+      frames.push_back( make_frame( src, port, seq ) );
+    }
+  }
+  return frames;
+}
+
+void test_steering()
+{
+  constexpr size_t queues = 4;
+  AsyncNetworkInterface interface = make_interface();
+  interface.set_receive_queues( queues );
+
+  const vector<EthernetFrame> frames = make_traffic( 64, 10 );
+  for ( const auto& frame : frames ) {
+    interface.recv_frame( frame );
+  }
+
+  size_t total_depth = 0;
+  for ( size_t q = 0; q < queues; q++ ) {
+    total_depth += interface.receive_queue_stats( q ).depth;
+  }
+  if ( total_depth != frames.size() ) {
+    throw runtime_error( "queue depth gauges add up to " + to_string( total_depth ) + ", expected "
+                         + to_string( frames.size() ) );
+  }
+
+  map<uint64_t, size_t> flow_queue;
+  InternetDatagram dgram;
+  for ( size_t q = 0; q < queues; q++ ) {
+    const size_t depth = interface.receive_queue_stats( q ).depth;
+    if ( depth == 0 ) {
+      throw runtime_error( "no flows were steered to queue " + to_string( q ) );
+    }
+
+    map<uint64_t, uint32_t> next_seq;
+    size_t received = 0;
+    while ( interface.maybe_receive( q, dgram ) ) {
+      received++;
+      if ( interface.queue_for( dgram ) != q ) {
+        throw runtime_error( "a datagram was queued somewhere other than where queue_for() steers it" );
+      }
+      const auto [flow, seq] = flow_and_seq( dgram );
+      if ( flow_queue.try_emplace( flow, q ).first->second != q ) {
+        throw runtime_error( "a flow was split across receive queues" );
+      }
+      if ( seq != next_seq[flow]++ ) {
+        throw runtime_error( "a flow's datagrams came out of its queue out of order" );
+      }
+    }
+    if ( received != depth ) {
+      throw runtime_error( "queue " + to_string( q ) + " gauge said " + to_string( depth ) + " but held "
+                           + to_string( received ) );
+    }
+  }
+
+  //A full queue drops, and counts the drops.
+  AsyncNetworkInterface small = make_interface();
+  small.set_receive_queues( 1, 8 );
+  for ( size_t i = 0; i < 20; i++ ) {
+    small.recv_frame( frames.at( i ) );
+  }
+  const auto stats = small.receive_queue_stats( 0 );
+  if ( stats.depth != 8 || stats.drops != 12 ) {
+    throw runtime_error( "a full queue reported depth " + to_string( stats.depth ) + " and "
+                         + to_string( stats.drops ) + " drops" );
+  }
+}
+
+// One thread receives frames while a worker per queue drains it
+void test_concurrent_workers()
+{
+  constexpr size_t queues = 4;
+  AsyncNetworkInterface interface = make_interface();
+  const vector<EthernetFrame> frames = make_traffic( 128, 40 );
+  interface.set_receive_queues( queues, frames.size() );
+
+  atomic<bool> done { false };
+  vector<string> errors( queues );
+  vector<size_t> received( queues );
+  vector<thread> workers;
+  for ( size_t q = 0; q < queues; q++ ) {
+    workers.emplace_back( [&, q] {
+      map<uint64_t, uint32_t> next_seq;
+      InternetDatagram dgram;
+      try {
+        while ( true ) {
+          const bool finished = done.load( memory_order_acquire );
+          if ( interface.maybe_receive( q, dgram ) ) {
+            received[q]++;
+            const auto [flow, seq] = flow_and_seq( dgram );
+            if ( seq != next_seq[flow]++ ) {
+              throw runtime_error( "worker " + to_string( q ) + " saw a flow out of order" );
+            }
+          } else if ( finished ) {
+            break;
+          } else {
+            this_thread::yield();
+          }
+        }
+      } catch ( const exception& e ) {
+        errors[q] = e.what();
+      }
+    } );
+  }
+
+  for ( const auto& frame : frames ) {
+    interface.recv_frame( frame );
+  }
+  done.store( true, memory_order_release );
+  for ( auto& worker : workers ) {
+    worker.join();
+  }
+
+  size_t total = 0;
+  for ( size_t q = 0; q < queues; q++ ) {
+    if ( not errors[q].empty() ) {
+      throw runtime_error( errors[q] );
+    }
+    total += received[q];
+  }
+  if ( total != frames.size() ) {
+    throw runtime_error( "workers received " + to_string( total ) + " of " + to_string( frames.size() )
+                         + " datagrams" );
+  }
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    test_toeplitz();
+    test_steering();
+    test_concurrent_workers();
+  } catch ( const exception& e ) {
+    cerr << "\n\n\n";
+    cerr << "\033[31;1mError: " << e.what() << "\033[m\n";
+    return EXIT_FAILURE;
+  }
+
+  cout << "\033[32;1mFlows were steered to stable receive queues and kept in order.\033[m\n";
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,272 @@
+#include "router.hh"
+
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+using EndReason = FlowTelemetry::EndReason;
+
+struct Exported
+{
+  FlowTelemetry::Record record {};
+  uint32_t sampling_interval {};
+  EndReason reason {};
+};
+
+// A local collector: decodes whatever IPFIX messages have arrived
+class Collector
+{
+  UDPSocket socket_ {};
+  uint32_t expected_sequence_ {};
+
+public:
+  bool saw_template = false;
+
+  Collector()
+  {
+    socket_.bind( Address { "127.0.0.1", 0 } );
+    socket_.set_blocking( false );
+  }
+
+  Address address() const { return socket_.local_address(); }
+
+  vector<Exported> receive()
+  {
+    vector<Exported> records;
+    Address from { "0" };
+    string message;
+    for ( socket_.recv( from, message ); not message.empty(); socket_.recv( from, message ) ) {
+      decode( message, records );
+    }
+    return records;
+  }
+
+private:
+  static uint64_t get( string_view bytes, size_t at, size_t n )
+  {
+    uint64_t value = 0;
+    for ( size_t i = 0; i < n; i++ ) {
+      value = ( value << 8 ) | static_cast<uint8_t>( bytes.at( at + i ) );
+    }
+    return value;
+  }
+
+  void decode( string_view message, vector<Exported>& records )
+  {
+    if ( get( message, 0, 2 ) != FlowTelemetry::IPFIX_VERSION || get( message, 2, 2 ) != message.size()
+         || message.size() > FlowTelemetry::MAX_MESSAGE ) {
+      throw runtime_error( "not a well-formed IPFIX message" );
+    }
+    if ( get( message, 8, 4 ) != expected_sequence_ ) {
+      throw runtime_error( "an IPFIX message's sequence number didn't count the records before it" );
+    }
+
+    size_t at = 16;
+    while ( at < message.size() ) {
+      const uint64_t set_id = get( message, at, 2 );
+      const uint64_t length = get( message, at + 2, 2 );
+      if ( set_id == 2 ) {
+        if ( get( message, at + 4, 2 ) != FlowTelemetry::TEMPLATE_ID || get( message, at + 6, 2 ) != 13 ) {
+          throw runtime_error( "unexpected template" );
+        }
+        saw_template = true;
+      } else if ( set_id == FlowTelemetry::TEMPLATE_ID ) {
+        if ( not saw_template ) {
+          throw runtime_error( "data arrived before its template" );
+        }
+        for ( size_t r = at + 4; r < at + length; r += 55 ) {
+          Exported e;
+          e.record.src = get( message, r, 4 );
+          e.record.dst = get( message, r + 4, 4 );
+          e.record.src_port = get( message, r + 8, 2 );
+          e.record.dst_port = get( message, r + 10, 2 );
+          e.record.proto = get( message, r + 12, 1 );
+          e.record.tos = get( message, r + 13, 1 );
+          e.record.interface = get( message, r + 14, 4 );
+          e.record.packets = get( message, r + 18, 8 );
+          e.record.bytes = get( message, r + 26, 8 );
+          e.record.first_ms = get( message, r + 34, 8 );
+          e.record.last_ms = get( message, r + 42, 8 );
+          e.sampling_interval = get( message, r + 50, 4 );
+          e.reason = static_cast<EndReason>( get( message, r + 54, 1 ) );
+          records.push_back( e );
+          expected_sequence_++;
+        }
+      } else {
+        throw runtime_error( "unexpected set " + to_string( set_id ) );
+      }
+      at += length;
+    }
+  }
+};
+
+InternetDatagram make_dgram( uint32_t src, uint16_t src_port, uint32_t dst, uint16_t dst_port, uint8_t proto, size_t size )
+{
+  InternetDatagram dgram;
+  dgram.header.src = src;
+  dgram.header.dst = dst;
+  dgram.header.proto = proto;
+  string segment( size, 0 );
+  segment[0] = static_cast<char>( src_port >> 8 );
+  segment[1] = static_cast<char>( src_port & 0xff );
+  segment[2] = static_cast<char>( dst_port >> 8 );
+  segment[3] = static_cast<char>( dst_port & 0xff );
+  dgram.payload.emplace_back( std::move( segment ) );
+  dgram.header.len = IPv4Header::LENGTH + size;
+  dgram.header.compute_checksum();
+  return dgram;
+}
+
+FlowTelemetry::Config config_for( const Collector& collector )
+{
+  FlowTelemetry::Config config;
+  config.collector = collector.address();
+  config.sampling_interval = 1;
+  return config;
+}
+
+void test_idle_export()
+{
+  Collector collector;
+  FlowTelemetry telemetry { config_for( collector ) };
+  const auto tcp = make_dgram( 0x0a000001, 40000, 0x08080808, 443, IPv4Header::PROTO_TCP, 100 );
+  const auto udp = make_dgram( 0x0a000002, 5353, 0x08080404, 53, IPv4Header::PROTO_UDP, 30 );
+  for ( size_t i = 0; i < 10; i++ ) {
+    telemetry.record( tcp, 1 );
+    if ( i % 2 ) {
+      telemetry.record( udp, 2 );
+    }
+    telemetry.tick( 100 );
+  }
+  if ( not collector.receive().empty() || telemetry.stats().flows != 2 ) {
+    throw runtime_error( "flows were exported while still active" );
+  }
+
+  telemetry.tick( 15'000 );
+  const vector<Exported> records = collector.receive();
+  if ( records.size() != 2 || not collector.saw_template || telemetry.stats().flows != 0 ) {
+    throw runtime_error( "expected both flows to be exported once idle" );
+  }
+  for ( const auto& e : records ) {
+    const bool is_tcp = e.record.proto == IPv4Header::PROTO_TCP;
+    const auto& r = e.record;
+    if ( is_tcp
+           ? ( r.src_port != 40000 || r.dst_port != 443 || r.packets != 10 || r.bytes != 1200 || r.interface != 1
+               || r.last_ms - r.first_ms != 900 )
+           : ( r.src_port != 5353 || r.dst_port != 53 || r.packets != 5 || r.bytes != 250 || r.interface != 2 ) ) {
+      throw runtime_error( "an exported flow had the wrong counts or key" );
+    }
+    if ( e.reason != EndReason::IDLE_TIMEOUT || e.sampling_interval != 1 ) {
+      throw runtime_error( "an idle flow wasn't marked as such" );
+    }
+  }
+}
+
+void test_active_timeout_and_eviction()
+{
+  Collector collector;
+  FlowTelemetry::Config config = config_for( collector );
+  config.active_timeout_ms = 1000;
+  config.inactive_timeout_ms = 5000;
+  config.max_flows = 4;
+  FlowTelemetry telemetry { config };
+
+  //a flow that never goes quiet is still reported every second.
+  const auto dgram = make_dgram( 0x0a000001, 1234, 0x08080808, 80, IPv4Header::PROTO_TCP, 20 );
+  for ( size_t i = 0; i < 35; i++ ) {
+    telemetry.record( dgram, 0 );
+    telemetry.tick( 100 );
+  }
+  telemetry.flush();
+  uint64_t packets = 0;
+  size_t active = 0;
+  for ( const auto& e : collector.receive() ) {
+    packets += e.record.packets;
+    active += e.reason == EndReason::ACTIVE_TIMEOUT;
+  }
+  if ( active != 3 || packets != 35 ) {
+    throw runtime_error( "a long flow should be reported every active timeout, with no sample lost" );
+  }
+
+  //six flows into room for four: the two least recently sampled make way.
+  for ( uint16_t port = 1; port <= 6; port++ ) {
+    telemetry.record( make_dgram( 0x0a000001, port, 0x08080808, 80, IPv4Header::PROTO_UDP, 20 ), 0 );
+  }
+  telemetry.tick( 0 );
+  const vector<Exported> evicted = collector.receive();
+  if ( evicted.size() != 2 || telemetry.stats().evicted != 2 || evicted[0].record.src_port != 1
+       || evicted[1].record.src_port != 2 || evicted[0].reason != EndReason::LACK_OF_RESOURCES ) {
+    throw runtime_error( "a full cache didn't evict its least recently sampled flows" );
+  }
+}
+
+void test_sampling_rate()
+{
+  FlowTelemetry::Config config;
+  config.sampling_interval = 100;
+  FlowTelemetry telemetry { config };
+  size_t sampled = 0;
+  for ( size_t i = 0; i < 1'000'000; i++ ) {
+    sampled += telemetry.sample_due();
+  }
+  if ( sampled < 9500 || sampled > 10500 ) {
+    throw runtime_error( "1-in-100 sampling took " + to_string( sampled ) + " of a million" );
+  }
+}
+
+void test_router()
+{
+  Collector collector;
+  Router router;
+  router.add_interface( AsyncNetworkInterface { { 2, 0, 0, 0, 0, 1 }, Address { "10.0.0.1" } } );
+  router.add_interface( AsyncNetworkInterface { { 2, 0, 0, 0, 0, 2 }, Address { "192.168.0.1" } } );
+  router.add_route( Address { "192.168.0.0" }.ipv4_numeric(), 16, {}, 1 );
+  router.enable_telemetry( config_for( collector ) );
+
+  const auto dgram = make_dgram( 0x0a000002, 999, 0xc0a80005, 80, IPv4Header::PROTO_TCP, 50 );
+  EthernetFrame frame;
+  frame.header = { { 2, 0, 0, 0, 0, 1 }, { 2, 0, 0, 0, 0, 9 }, EthernetHeader::TYPE_IPv4 };
+  frame.payload = serialize( dgram );
+  for ( size_t i = 0; i < 20; i++ ) {
+    router.interface( 0 ).recv_frame( frame );
+  }
+  router.route();
+  router.tick( 20'000 );
+
+  const vector<Exported> records = collector.receive();
+  if ( records.size() != 1 || records[0].record.packets != 20 || records[0].record.interface != 0
+       || records[0].record.dst != 0xc0a80005 ) {
+    throw runtime_error( "the router didn't export the flow it forwarded" );
+  }
+}
+
+} // namespace
+
+int main()
+{
+  //(interfaces and routes announce themselves on cerr)
+  ostringstream discard;
+  auto* const old_cerr = cerr.rdbuf( discard.rdbuf() );
+  try {
+    test_idle_export();
+    test_active_timeout_and_eviction();
+    test_sampling_rate();
+    test_router();
+    cerr.rdbuf( old_cerr );
+  } catch ( const exception& e ) {
+    cerr.rdbuf( old_cerr );
+    cerr << "\n\n\n";
+    cerr << "\033[31;1mError: " << e.what() << "\033[m\n";
+    return EXIT_FAILURE;
+  }
+
+  cout << "\033[32;1mSampled flows were aggregated, timed out and exported as IPFIX.\033[m\n";
+  return EXIT_SUCCESS;
+}
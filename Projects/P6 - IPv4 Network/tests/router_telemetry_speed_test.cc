@@ -0,0 +1,120 @@
+#include "router.hh"
+#include "traffic_generator.hh"
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+constexpr size_t DECISIONS = 100'000'000;
+constexpr size_t PACKETS = 200'000;
+constexpr size_t ROUNDS = 3;
+const EthernetAddress ROUTER_ETH = { 0x02, 0, 0, 0, 0, 0x10 };
+
+double seconds_since( chrono::steady_clock::time_point start )
+{
+  return chrono::duration<double>( chrono::steady_clock::now() - start ).count();
+}
+
+// Nanoseconds per forwarded frame, through a router with one route out of a resolved uplink
+double forward( const TrafficTrace& traffic, const FlowTelemetry::Config* telemetry )
+{
+  Router router;
+  ostringstream discard;
+  auto* const old_cerr = cerr.rdbuf( discard.rdbuf() );
+  router.add_interface( AsyncNetworkInterface { ROUTER_ETH, Address { "192.168.0.1" } } );
+  router.add_interface( AsyncNetworkInterface { ROUTER_ETH, Address { "100.64.0.1" } } );
+  router.add_route( 0, 0, Address { "100.64.0.2" }, 1 );
+  cerr.rdbuf( old_cerr );
+  if ( telemetry != nullptr ) {
+    router.enable_telemetry( *telemetry );
+  }
+
+  ARPMessage arp;
+  arp.opcode = ARPMessage::OPCODE_REQUEST;
+  arp.sender_ethernet_address = { 0x02, 0, 0, 0, 1, 0 };
+  arp.sender_ip_address = Address { "100.64.0.2" }.ipv4_numeric();
+  arp.target_ip_address = Address { "100.64.0.1" }.ipv4_numeric();
+  EthernetFrame out;
+  out.header = { ROUTER_ETH, arp.sender_ethernet_address, EthernetHeader::TYPE_ARP };
+  out.payload = serialize( arp );
+  router.interface( 1 ).recv_frame( out );
+
+  size_t forwarded = 0;
+  const auto start = chrono::steady_clock::now();
+  for ( size_t round = 0; round < ROUNDS; round++ ) {
+    for ( size_t i = 0; i < traffic.size(); i += 256 ) {
+      for ( size_t j = i; j < min( traffic.size(), i + 256 ); j++ ) {
+        router.interface( 0 ).recv_frame( traffic.frames()[j] );
+      }
+      router.route();
+      while ( router.interface( 1 ).maybe_send( out ) ) {
+        forwarded += out.header.type == EthernetHeader::TYPE_IPv4;
+      }
+    }
+    router.tick( 1000 );
+  }
+  const double seconds = seconds_since( start );
+  if ( forwarded != ROUNDS * traffic.size() ) {
+    throw runtime_error( "frames went missing" );
+  }
+  return seconds * 1e9 / static_cast<double>( forwarded );
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    //the decision alone.
+    FlowTelemetry::Config config;
+    config.sampling_interval = 1000;
+    config.collector = Address { "127.0.0.1", 9 }; // discard: nobody listens
+    FlowTelemetry telemetry { config };
+    size_t sampled = 0;
+    auto start = chrono::steady_clock::now();
+    for ( size_t i = 0; i < DECISIONS; i++ ) {
+      sampled += telemetry.sample_due();
+    }
+    const double decision_ns = seconds_since( start ) * 1e9 / DECISIONS;
+
+    TrafficConfig traffic_config;
+    traffic_config.packets = PACKETS;
+    traffic_config.flows = 50'000;
+    traffic_config.sizes = { { 64, 1 } };
+    traffic_config.ethernet_dst = ROUTER_ETH;
+    const TrafficTrace traffic { traffic_config };
+
+    const double off_ns = forward( traffic, nullptr );
+    const double sampled_ns = forward( traffic, &config );
+    config.sampling_interval = 1;
+    const double every_ns = forward( traffic, &config );
+
+    cout << "Flow telemetry:\n"
+         << fixed << setprecision( 2 ) << "  sampling decision:     " << setw( 7 ) << decision_ns << " ns ("
+         << sampled << " of " << DECISIONS << " sampled)\n"
+         << setprecision( 0 ) << "  forwarding, no export: " << setw( 7 ) << off_ns << " ns/packet\n"
+         << "  sampling 1 in 1000:    " << setw( 7 ) << sampled_ns << " ns/packet\n"
+         << "  sampling every packet: " << setw( 7 ) << every_ns << " ns/packet\n";
+
+    if ( decision_ns > 5 ) {
+      throw runtime_error( "the sampling decision took over 5 ns" );
+    }
+    if ( sampled < DECISIONS / 1000 * 9 / 10 || sampled > DECISIONS / 1000 * 11 / 10 ) {
+      throw runtime_error( "1-in-1000 sampling was off" );
+    }
+  } catch ( const exception& e ) {
+    cerr << "\n\n\n";
+    cerr << "\033[31;1mError: " << e.what() << "\033[m\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
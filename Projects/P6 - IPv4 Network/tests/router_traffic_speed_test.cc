@@ -0,0 +1,236 @@
+#include "router.hh"
+#include "traffic_generator.hh"
+
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <linux/perf_event.h>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+constexpr size_t PREFIXES = 100'000;
+constexpr size_t PACKETS = 200'000;
+constexpr size_t UPLINKS = 4;
+constexpr size_t BATCH = 256; // frames handed to the router between calls to route()
+const EthernetAddress ROUTER_ETH = { 0x02, 0, 0, 0, 0, 0x10 };
+const EthernetAddress SENDER_ETH = { 0x02, 0, 0, 0, 0, 0x20 };
+
+uint32_t uplink_address( size_t i )
+{
+  return 0x64400001 + static_cast<uint32_t>( i << 8 ); // 100.64.i.1
+}
+
+uint32_t uplink_next_hop( size_t i )
+{
+  return uplink_address( i ) + 1;
+}
+
+EthernetAddress uplink_next_hop_eth( size_t i )
+{
+  return { 0x02, 0, 0, 0, 1, static_cast<uint8_t>( i ) };
+}
+
+// A router with a full-table-sized FIB of `prefixes`, spread over UPLINKS uplinks whose next hops are
+// already resolved
+void setup( Router& router, const vector<pair<uint32_t, uint8_t>>& prefixes )
+{
+  ostringstream discard;
+  auto* const old_cerr = cerr.rdbuf( discard.rdbuf() );
+  router.add_interface( AsyncNetworkInterface { ROUTER_ETH, Address { "192.168.0.1" } } );
+  for ( size_t i = 0; i < UPLINKS; i++ ) {
+    router.add_interface( AsyncNetworkInterface { ROUTER_ETH, Address::from_ipv4_numeric( uplink_address( i ) ) } );
+  }
+  cerr.rdbuf( old_cerr );
+
+  RoutesByLength routes;
+  for ( size_t i = 0; i < prefixes.size(); i++ ) {
+    const auto [prefix, length] = prefixes[i];
+    const size_t uplink = i % UPLINKS;
+    routes[length].push_back(
+      { get_prefmask( length, prefix ), uplink_next_hop( uplink ), static_cast<uint32_t>( uplink + 1 ), 1 } );
+  }
+  router.load_routes( routes );
+
+  for ( size_t i = 0; i < UPLINKS; i++ ) {
+    ARPMessage arp;
+    arp.opcode = ARPMessage::OPCODE_REQUEST;
+    arp.sender_ethernet_address = uplink_next_hop_eth( i );
+    arp.sender_ip_address = uplink_next_hop( i );
+    arp.target_ip_address = uplink_address( i );
+    EthernetFrame frame;
+    frame.header = { ROUTER_ETH, uplink_next_hop_eth( i ), EthernetHeader::TYPE_ARP };
+    frame.payload = serialize( arp );
+    AsyncNetworkInterface& uplink = router.interface( i + 1 );
+    uplink.recv_frame( frame );
+    while ( uplink.maybe_send() ) {} // the ARP reply
+  }
+}
+
+// Counts this thread's data-TLB load misses, if the kernel lets us (in a container or VM it often won't)
+class TlbMisses
+{
+  int fd_ = -1;
+
+public:
+  TlbMisses()
+  {
+    perf_event_attr attr {};
+    attr.size = sizeof( attr );
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB | ( PERF_COUNT_HW_CACHE_OP_READ << 8 )
+                  | ( PERF_COUNT_HW_CACHE_RESULT_MISS << 16 );
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    fd_ = static_cast<int>( syscall( SYS_perf_event_open, &attr, 0, -1, -1, 0 ) );
+  }
+  ~TlbMisses()
+  {
+    if ( fd_ >= 0 ) {
+      close( fd_ );
+    }
+  }
+  TlbMisses( const TlbMisses& other ) = delete;
+  TlbMisses& operator=( const TlbMisses& other ) = delete;
+
+  void start()
+  {
+    if ( fd_ >= 0 ) {
+      ioctl( fd_, PERF_EVENT_IOC_RESET, 0 );
+      ioctl( fd_, PERF_EVENT_IOC_ENABLE, 0 );
+    }
+  }
+
+  optional<uint64_t> stop()
+  {
+    uint64_t count = 0;
+    if ( fd_ < 0 or ioctl( fd_, PERF_EVENT_IOC_DISABLE, 0 ) < 0 or ::read( fd_, &count, sizeof( count ) ) != sizeof( count ) ) {
+      return {};
+    }
+    return count;
+  }
+};
+
+// Anonymous memory the kernel has backed with transparent huge pages, in MiB
+size_t anon_huge_mib()
+{
+  ifstream rollup { "/proc/self/smaps_rollup" };
+  string line;
+  while ( getline( rollup, line ) ) {
+    if ( line.starts_with( "AnonHugePages:" ) ) {
+      return stoul( line.substr( 14 ) ) / 1024;
+    }
+  }
+  return 0;
+}
+
+// Pushes a precomputed trace through the router; returns the forwarding rate in Mpps
+double forward( Router& router, const TrafficTrace& trace )
+{
+  const vector<EthernetFrame>& frames = trace.frames();
+  AsyncNetworkInterface& ingress = router.interface( 0 );
+  EthernetFrame out;
+  size_t forwarded = 0;
+
+  const auto start = chrono::steady_clock::now();
+  for ( size_t i = 0; i < frames.size(); i += BATCH ) {
+    const size_t end = min( frames.size(), i + BATCH );
+    for ( size_t j = i; j < end; j++ ) {
+      ingress.recv_frame( frames[j] );
+    }
+    router.route();
+    for ( size_t u = 1; u <= UPLINKS; u++ ) {
+      while ( router.interface( u ).maybe_send( out ) ) {
+        forwarded++;
+      }
+    }
+  }
+  const double seconds = chrono::duration<double>( chrono::steady_clock::now() - start ).count();
+
+  if ( forwarded != frames.size() ) {
+    throw runtime_error( "only " + to_string( forwarded ) + " of " + to_string( frames.size() )
+                         + " frames were forwarded" );
+  }
+  return frames.size() / seconds / 1e6;
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    const auto prefixes = random_prefixes( PREFIXES, 458 );
+    Router router;
+    setup( router, prefixes );
+
+    TrafficConfig config;
+    config.prefixes = prefixes;
+    config.packets = PACKETS;
+    config.flows = 16384;
+    config.sizes = { { 64, 1 } };
+    config.ethernet_src = SENDER_ETH;
+    config.ethernet_dst = ROUTER_ETH;
+
+    cout << "Forwarding " << PACKETS << " precomputed 64-byte datagrams through a " << PREFIXES
+         << "-prefix FIB:\n";
+    double slowest = 1e9;
+    for ( const auto& [name, destinations] : { pair { "uniform", TrafficConfig::Destinations::UNIFORM },
+                                               pair { "zipf", TrafficConfig::Destinations::ZIPF },
+                                               pair { "locality", TrafficConfig::Destinations::LOCALITY } } ) {
+      config.destinations = destinations;
+      const auto start = chrono::steady_clock::now();
+      const TrafficTrace trace { config };
+      const double generate_s = chrono::duration<double>( chrono::steady_clock::now() - start ).count();
+
+      const double mpps = forward( router, trace );
+      slowest = min( slowest, mpps );
+      cout << "  " << setw( 9 ) << left << name << right << fixed << setprecision( 2 ) << setw( 6 ) << mpps
+           << " Mpps   (trace generated beforehand in " << setprecision( 0 ) << generate_s * 1000 << " ms)\n";
+    }
+
+    //the same FIB on huge pages, against the one on small pages, for the least cache-friendly destinations.
+    config.destinations = TrafficConfig::Destinations::UNIFORM;
+    const TrafficTrace uniform { config };
+    const size_t huge_before = anon_huge_mib();
+    Router huge;
+    const PageBacking backing = huge.enable_huge_pages();
+    setup( huge, prefixes );
+    const size_t huge_mib = anon_huge_mib() - min( huge_before, anon_huge_mib() );
+
+    TlbMisses tlb;
+    cout << "The same FIB on " << to_string( backing ) << " (" << huge_mib
+         << " MiB of it in transparent huge pages), uniform destinations:\n";
+    for ( const auto& [name, r] : { pair<const char*, Router*> { "small", &router }, pair<const char*, Router*> { "huge", &huge } } ) {
+      forward( *r, uniform ); // (warm up)
+      tlb.start();
+      const double mpps = forward( *r, uniform );
+      const optional<uint64_t> misses = tlb.stop();
+      slowest = min( slowest, mpps );
+      cout << "  " << setw( 9 ) << left << name << right << fixed << setprecision( 2 ) << setw( 6 ) << mpps
+           << " Mpps   dTLB load misses per packet: "
+           << ( misses ? to_string( static_cast<double>( *misses ) / PACKETS ) : string { "(can't be counted here)" } )
+           << "\n";
+    }
+
+    if ( slowest < 0.1 ) {
+      throw runtime_error( "the router forwarded at under 100k packets/s" );
+    }
+  } catch ( const exception& e ) {
+    cerr << "\n\n\n";
+    cerr << "\033[31;1mError: " << e.what() << "\033[m\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,226 @@
+#include "router.hh"
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+const EthernetAddress LAN_ETH = { 2, 0, 0, 0, 0, 1 };
+const EthernetAddress WAN_ETH = { 2, 0, 0, 0, 0, 2 };
+const EthernetAddress HOST_ETH = { 2, 0, 0, 0, 1, 5 };
+const uint32_t HOST_IP = 0xc0a80005; // 192.168.0.5
+
+void setup( Router& router )
+{
+  router.add_interface( AsyncNetworkInterface { LAN_ETH, Address { "10.0.0.1" } } );
+  router.add_interface( AsyncNetworkInterface { WAN_ETH, Address { "192.168.0.1" } } );
+  router.add_route( Address { "192.168.0.0" }.ipv4_numeric(), 16, {}, 1 );
+}
+
+EthernetFrame arp_frame( uint16_t opcode, const EthernetAddress& dst )
+{
+  ARPMessage arp;
+  arp.opcode = opcode;
+  arp.sender_ethernet_address = HOST_ETH;
+  arp.sender_ip_address = HOST_IP;
+  arp.target_ethernet_address = opcode == ARPMessage::OPCODE_REPLY ? WAN_ETH : EthernetAddress {};
+  arp.target_ip_address = Address { "192.168.0.1" }.ipv4_numeric();
+  EthernetFrame frame;
+  frame.header = { dst, HOST_ETH, EthernetHeader::TYPE_ARP };
+  frame.payload = serialize( arp );
+  return frame;
+}
+
+// Send one datagram from the LAN to the host
+void send_to_host( Router& router )
+{
+  InternetDatagram dgram;
+  dgram.header.src = Address { "10.0.0.2" }.ipv4_numeric();
+  dgram.header.dst = HOST_IP;
+  dgram.header.len = IPv4Header::LENGTH;
+  dgram.header.compute_checksum();
+  EthernetFrame frame;
+  frame.header = { LAN_ETH, { 2, 0, 0, 0, 2, 2 }, EthernetHeader::TYPE_IPv4 };
+  frame.payload = serialize( dgram );
+  router.interface( 0 ).recv_frame( frame );
+  router.route();
+}
+
+struct Sent
+{
+  size_t to_host {};      // IPv4 frames addressed to the host
+  size_t broadcast_arp {};
+  size_t unicast_arp {};  // ARP requests addressed to the host
+};
+
+Sent drain( Router& router )
+{
+  Sent sent;
+  EthernetFrame frame;
+  while ( router.interface( 1 ).maybe_send( frame ) ) {
+    const bool is_arp = frame.header.type == EthernetHeader::TYPE_ARP;
+    sent.to_host += not is_arp and frame.header.dst == HOST_ETH;
+    sent.broadcast_arp += is_arp and frame.header.dst == ETHERNET_BROADCAST;
+    sent.unicast_arp += is_arp and frame.header.dst == HOST_ETH;
+  }
+  return sent;
+}
+
+uint64_t wall_ms()
+{
+  return chrono::duration_cast<chrono::milliseconds>( chrono::system_clock::now().time_since_epoch() ).count();
+}
+
+void write_file( const string& path, const string& contents )
+{
+  ofstream { path } << contents;
+}
+
+void test_round_trip( const string& path )
+{
+  {
+    Router router;
+    setup( router );
+    router.interface( 1 ).recv_frame( arp_frame( ARPMessage::OPCODE_REPLY, WAN_ETH ) );
+    router.interface( 1 ).tick( 1000 );
+    router.save_neighbors( path );
+  }
+
+  //restored: the first datagram goes straight out, with a unicast check on the side.
+  Router router;
+  setup( router );
+  if ( router.load_neighbors( path ) != 1 || router.interface( 1 ).stale_neighbors() != 1 ) {
+    throw runtime_error( "the saved neighbour wasn't restored" );
+  }
+  const auto neighbors = router.interface( 1 ).neighbors();
+  if ( neighbors.size() != 1 || neighbors[0].ethernet_address != HOST_ETH || neighbors[0].ttl_ms > 29'000
+       || neighbors[0].ttl_ms < 25'000 ) {
+    throw runtime_error( "the restored entry didn't keep its time left" );
+  }
+  send_to_host( router );
+  send_to_host( router );
+  Sent sent = drain( router );
+  if ( sent.to_host != 2 || sent.broadcast_arp != 0 || sent.unicast_arp != 1 ) {
+    throw runtime_error( "a restored neighbour should be used at once and probed exactly once" );
+  }
+
+  //the host answers, and the entry is as good as a learned one.
+  router.interface( 1 ).recv_frame( arp_frame( ARPMessage::OPCODE_REPLY, WAN_ETH ) );
+  router.interface( 1 ).tick( 10'000 );
+  send_to_host( router );
+  sent = drain( router );
+  if ( router.interface( 1 ).stale_neighbors() != 0 || sent.to_host != 1 || sent.unicast_arp != 0 ) {
+    throw runtime_error( "the probe's reply didn't confirm the entry" );
+  }
+}
+
+void test_unanswered_probe( const string& path )
+{
+  Router router;
+  setup( router );
+  router.load_neighbors( path );
+  router.interface( 1 ).tick( 10'000 ); // (not probed yet, so not timing out either)
+  send_to_host( router );
+  drain( router );
+  router.interface( 1 ).tick( NetworkInterface::ARP_REQUEST_TIMEOUT_MS );
+  if ( router.interface( 1 ).stale_neighbors() != 0 || not router.interface( 1 ).neighbors().empty() ) {
+    throw runtime_error( "a neighbour that didn't answer its probe was kept" );
+  }
+  send_to_host( router );
+  const Sent sent = drain( router );
+  if ( sent.to_host != 0 || sent.broadcast_arp != 1 ) {
+    throw runtime_error( "a dropped neighbour wasn't resolved afresh" );
+  }
+}
+
+void test_filtering( const string& path )
+{
+  //taken 10 s ago: one entry ran out since, one has 10 s left, and two belong to interfaces that changed.
+  write_file( path,
+              "saved " + to_string( wall_ms() - 10'000 ) + "\n"
+                + "1 192.168.0.1 192.168.0.5 02:00:00:00:01:05 20000\n"
+                + "1 192.168.0.1 192.168.0.6 02:00:00:00:01:06 5000\n"
+                + "0 10.0.0.9 10.0.0.2 02:00:00:00:02:02 20000\n"
+                + "7 10.7.0.1 10.7.0.2 02:00:00:00:07:02 20000\n" );
+  Router router;
+  setup( router );
+  if ( router.load_neighbors( path ) != 1 || router.interface( 0 ).stale_neighbors() != 0 ) {
+    throw runtime_error( "expired or mismatched entries were restored" );
+  }
+  const auto neighbors = router.interface( 1 ).neighbors();
+  if ( neighbors.size() != 1 || neighbors[0].ip_address != HOST_IP || neighbors[0].ttl_ms > 10'000 ) {
+    throw runtime_error( "the restored entry didn't lose the time the router was down" );
+  }
+
+  //a neighbour heard from since isn't overwritten by the snapshot.
+  Router live;
+  setup( live );
+  live.interface( 1 ).recv_frame( arp_frame( ARPMessage::OPCODE_REQUEST, ETHERNET_BROADCAST ) );
+  if ( live.load_neighbors( path ) != 0 || live.interface( 1 ).stale_neighbors() != 0 ) {
+    throw runtime_error( "a snapshot overwrote a fresh entry" );
+  }
+}
+
+void test_malformed( const string& path )
+{
+  for ( const string& contents : vector<string> { "",
+                                   "not a snapshot\n",
+                                   "saved 0\n1 192.168.0.1 192.168.0.5 02:00:00:00:01 20000\n",
+                                   "saved 0\n1 192.168.0.1 192.168.0.5 02:00:00:00:01:05\n",
+                                   "saved 0\n1 192.168.0.1 192.168.0.5 02:00:00:00:01:05 20000 extra\n" } ) {
+    write_file( path, contents );
+    Router router;
+    setup( router );
+    try {
+      router.load_neighbors( path );
+    } catch ( const runtime_error& ) {
+      continue;
+    }
+    throw runtime_error( "a malformed snapshot was accepted: " + contents );
+  }
+
+  Router router;
+  setup( router );
+  try {
+    router.load_neighbors( path + ".missing" );
+  } catch ( const exception& ) {
+    return;
+  }
+  throw runtime_error( "a missing snapshot was accepted" );
+}
+
+} // namespace
+
+int main()
+{
+  const string path = filesystem::temp_directory_path() / ( "router_warm_restart_" + to_string( getpid() ) );
+  //(interfaces and routes announce themselves on cerr)
+  ostringstream discard;
+  auto* const old_cerr = cerr.rdbuf( discard.rdbuf() );
+  try {
+    test_round_trip( path );
+    test_unanswered_probe( path );
+    test_filtering( path );
+    test_malformed( path );
+    filesystem::remove( path );
+    cerr.rdbuf( old_cerr );
+  } catch ( const exception& e ) {
+    filesystem::remove( path );
+    cerr.rdbuf( old_cerr );
+    cerr << "\n\n\n";
+    cerr << "\033[31;1mError: " << e.what() << "\033[m\n";
+    return EXIT_FAILURE;
+  }
+
+  cout << "\033[32;1mNeighbour tables survived a restart and were revalidated lazily.\033[m\n";
+  return EXIT_SUCCESS;
+}
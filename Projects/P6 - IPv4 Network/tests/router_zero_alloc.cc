@@ -0,0 +1,167 @@
+#include "router.hh"
+
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+// Every heap allocation in the program goes through these, so the test can count them.
+namespace {
+size_t allocations = 0;
+}
+
+void* operator new( size_t size )
+{
+  allocations++;
+  if ( void* const p = malloc( size ? size : 1 ) ) { // NOLINT(*-no-malloc)
+    return p;
+  }
+  throw bad_alloc();
+}
+
+void operator delete( void* p ) noexcept
+{
+  free( p ); // NOLINT(*-no-malloc)
+}
+
+void operator delete( void* p, size_t /*size*/ ) noexcept
+{
+  free( p ); // NOLINT(*-no-malloc)
+}
+
+namespace {
+
+const EthernetAddress ROUTER_ETH0 = { 0x02, 0, 0, 0, 0, 0x10 };
+const EthernetAddress ROUTER_ETH1 = { 0x02, 0, 0, 0, 0, 0x11 };
+const EthernetAddress NEXT_HOP_ETH = { 0x02, 0, 0, 0, 0, 0x22 };
+const Address NEXT_HOP { "10.1.0.2" };
+
+InternetDatagram make_datagram()
+{
+  InternetDatagram dgram;
+  dgram.header.src = Address { "192.168.0.5" }.ipv4_numeric();
+  dgram.header.dst = Address { "10.2.3.4" }.ipv4_numeric();
+  dgram.header.ttl = 64;
+  dgram.payload.emplace_back( string( 200, 'x' ) );
+  dgram.header.len = static_cast<uint64_t>( dgram.header.hlen ) * 4 + dgram.payload.back().size();
+  dgram.header.compute_checksum();
+  return dgram;
+}
+
+EthernetFrame make_frame( const EthernetAddress& dst, const EthernetAddress& src, uint16_t type, vector<Buffer> payload )
+{
+  EthernetFrame frame;
+  frame.header.dst = dst;
+  frame.header.src = src;
+  frame.header.type = type;
+  frame.payload = std::move( payload );
+  return frame;
+}
+
+// A router with the next hop out of interface 1 already resolved
+void setup( Router& router )
+{
+  ostringstream discard;
+  auto* const old_cerr = cerr.rdbuf( discard.rdbuf() );
+  router.add_interface( AsyncNetworkInterface { ROUTER_ETH0, Address { "192.168.0.1" } } );
+  router.add_interface( AsyncNetworkInterface { ROUTER_ETH1, Address { "10.1.0.1" } } );
+  router.add_route( Address { "192.168.0.0" }.ipv4_numeric(), 16, {}, 0 );
+  router.add_route( Address { "10.0.0.0" }.ipv4_numeric(), 8, NEXT_HOP, 1 );
+  cerr.rdbuf( old_cerr );
+
+  //the next hop asks who the router is, which teaches the router the next hop's Ethernet address.
+  ARPMessage arp;
+  arp.opcode = ARPMessage::OPCODE_REQUEST;
+  arp.sender_ethernet_address = NEXT_HOP_ETH;
+  arp.sender_ip_address = NEXT_HOP.ipv4_numeric();
+  arp.target_ip_address = Address { "10.1.0.1" }.ipv4_numeric();
+  router.interface( 1 ).recv_frame(
+    make_frame( ETHERNET_BROADCAST, NEXT_HOP_ETH, EthernetHeader::TYPE_ARP, serialize( arp ) ) );
+  while ( router.interface( 1 ).maybe_send() ) {} // the ARP reply
+}
+
+void check_forwarded( const EthernetFrame& frame, const InternetDatagram& sent )
+{
+  InternetDatagram received;
+  if ( frame.header.dst != NEXT_HOP_ETH || frame.header.src != ROUTER_ETH1
+       || frame.header.type != EthernetHeader::TYPE_IPv4 || not parse( received, frame.payload ) ) {
+    throw runtime_error( "the router sent something other than the forwarded datagram" );
+  }
+
+  string payload;
+  for ( const auto& b : received.payload ) {
+    payload.append( b );
+  }
+  if ( received.header.ttl != sent.header.ttl - 1 || received.header.dst != sent.header.dst
+       || payload != string( 200, 'x' ) ) {
+    throw runtime_error( "the forwarded datagram doesn't match the one sent" );
+  }
+}
+
+// Forward `count` copies of the frame, and return the number of allocations that took
+size_t forward( Router& router, const EthernetFrame& in, EthernetFrame& out, size_t count )
+{
+  const size_t before = allocations;
+  for ( size_t i = 0; i < count; i++ ) {
+    router.interface( 0 ).recv_frame( in );
+    router.route();
+    if ( not router.interface( 1 ).maybe_send( out ) ) {
+      throw runtime_error( "the router didn't forward a datagram" );
+    }
+  }
+  return allocations - before;
+}
+
+void test_zero_alloc( const string& what, const EthernetFrame& in, const InternetDatagram& sent )
+{
+  Router router;
+  setup( router );
+
+  //The first packets fill the queues' slots with objects that own enough memory (every slot of
+  //every ring has to be used once); after that nothing should need allocating.
+  EthernetFrame out;
+  forward( router, in, out, 4 * AsyncNetworkInterface::DEFAULT_QUEUE_CAPACITY );
+  check_forwarded( out, sent );
+
+  constexpr size_t packets = 20000;
+  const size_t count = forward( router, in, out, packets );
+  check_forwarded( out, sent );
+  cout << what << ": " << count << " allocations forwarding " << packets << " packets\n";
+  if ( count != 0 ) {
+    throw runtime_error( what + ": steady-state forwarding made " + to_string( count ) + " heap allocations" );
+  }
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    const InternetDatagram dgram = make_datagram();
+
+    //as the other tests build frames: the IP header and payload in separate buffers.
+    test_zero_alloc( "frame from serialize()",
+                     make_frame( ROUTER_ETH0, NEXT_HOP_ETH, EthernetHeader::TYPE_IPv4, serialize( dgram ) ),
+                     dgram );
+
+    //as a frame read off a wire: one buffer, so the payload is a slice of it.
+    string wire;
+    for ( const auto& b : serialize( dgram ) ) {
+      wire.append( b );
+    }
+    test_zero_alloc( "frame in one buffer",
+                     make_frame( ROUTER_ETH0, NEXT_HOP_ETH, EthernetHeader::TYPE_IPv4, { Buffer { wire } } ),
+                     dgram );
+  } catch ( const exception& e ) {
+    cerr << "\n\n\n";
+    cerr << "\033[31;1mError: " << e.what() << "\033[m\n";
+    return EXIT_FAILURE;
+  }
+
+  cout << "\033[32;1mSteady-state forwarding made no allocations.\033[m\n";
+  return EXIT_SUCCESS;
+}
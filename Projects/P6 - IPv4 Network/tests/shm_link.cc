@@ -0,0 +1,269 @@
+#include "shm_link.hh"
+
+#include "exception.hh"
+
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+const EthernetAddress ETH_A = { 0x02, 0, 0, 0, 0, 0x0a };
+const EthernetAddress ETH_B = { 0x02, 0, 0, 0, 0, 0x0b };
+
+// A frame of `length` bytes in all, its payload in up to three Buffers, numbered by `seq`
+EthernetFrame make_frame( size_t length, uint32_t seq )
+{
+  EthernetFrame frame;
+  frame.header = { ETH_B, ETH_A, static_cast<uint16_t>( seq ) };
+  string payload( length - EthernetHeader::LENGTH, '\0' );
+  for ( size_t i = 0; i < payload.size(); i++ ) {
+    payload[i] = static_cast<char>( seq * 7 + i );
+  }
+  const size_t third = payload.size() / 3;
+  frame.payload.emplace_back( payload.substr( 0, third ) );
+  frame.payload.emplace_back( payload.substr( third, third ) );
+  frame.payload.emplace_back( payload.substr( 2 * third ) );
+  return frame;
+}
+
+string flatten( const vector<Buffer>& buffers )
+{
+  string out;
+  for ( const auto& b : buffers ) {
+    out.append( string_view { b } );
+  }
+  return out;
+}
+
+bool same( const EthernetFrame& a, const EthernetFrame& b )
+{
+  return a.header.dst == b.header.dst && a.header.src == b.header.src && a.header.type == b.header.type
+         && flatten( a.payload ) == flatten( b.payload );
+}
+
+void test_round_trip( FrameLink& a, FrameLink& b )
+{
+  EthernetFrame received;
+  uint32_t seq = 0;
+  for ( const size_t length : { size_t { 14 }, size_t { 15 }, size_t { 64 }, size_t { 1514 }, size_t { 2048 } } ) {
+    for ( auto [from, to] : { pair<FrameLink*, FrameLink*> { &a, &b }, { &b, &a } } ) {
+      const EthernetFrame sent = make_frame( length, ++seq );
+      if ( to->recv( received ) ) {
+        throw runtime_error( "a frame came out of a link before one was sent" );
+      }
+      if ( not from->send( sent ) || not to->recv( received ) || not same( sent, received ) ) {
+        throw runtime_error( "a " + to_string( length ) + "-byte frame didn't cross the link intact" );
+      }
+    }
+  }
+  if ( a.stats().sent != 5 || a.stats().received != 5 || b.stats().sent != 5 || b.stats().dropped != 0 ) {
+    throw runtime_error( "a link miscounted the frames it carried" );
+  }
+}
+
+void test_full_ring()
+{
+  auto [a, b] = ShmLink::make_pair( { .ring_slots = 8, .frame_size = 128 } );
+
+  //the ring holds 8 frames, and frames over 128 bytes don't fit a slot.
+  for ( uint32_t i = 0; i < 8; i++ ) {
+    if ( not a.send( make_frame( 128, i ) ) ) {
+      throw runtime_error( "a link with room refused a frame" );
+    }
+  }
+  if ( a.send( make_frame( 64, 8 ) ) ) {
+    throw runtime_error( "a full link took another frame" );
+  }
+  EthernetFrame received;
+  if ( not b.recv( received ) || not same( received, make_frame( 128, 0 ) ) ) {
+    throw runtime_error( "frames didn't come out of a full link in order" );
+  }
+  if ( a.send( make_frame( 129, 9 ) ) || not a.send( make_frame( 64, 10 ) ) ) {
+    throw runtime_error( "a link took a frame too big for its slots, or refused one after being drained" );
+  }
+  for ( uint32_t i = 1; i < 8; i++ ) {
+    if ( not b.recv( received ) || not same( received, make_frame( 128, i ) ) ) {
+      throw runtime_error( "frames didn't come out of a full link in order" );
+    }
+  }
+  if ( not b.recv( received ) || not same( received, make_frame( 64, 10 ) ) || b.recv( received ) ) {
+    throw runtime_error( "the ring went wrong after wrapping around" );
+  }
+  if ( a.stats().dropped != 2 ) {
+    throw runtime_error( "a link didn't count the frames it dropped" );
+  }
+
+  for ( const ShmLinkConfig bad : { ShmLinkConfig { .ring_slots = 6 },
+                                    ShmLinkConfig { .frame_size = 8 },
+                                    ShmLinkConfig { .ring_slots = 1 << 20, .frame_size = 1 << 16 } } ) {
+    try {
+      ShmLink::make_pair( bad );
+      throw logic_error( "a link with a bad configuration was made" );
+    } catch ( const runtime_error& ) {
+    }
+  }
+}
+
+// Rebuild an end from its descriptors, and refuse memory that isn't a link
+void test_attach()
+{
+  auto [a, b] = ShmLink::make_pair();
+  ShmLink copy_of_b { b.memory_fd().duplicate(), b.wakeup_fd().duplicate(), b.peer_wakeup_fd().duplicate(), b.side() };
+  const EthernetFrame sent = make_frame( 100, 1 );
+  EthernetFrame received;
+  if ( not a.send( sent ) || not copy_of_b.recv( received ) || not same( sent, received ) || b.recv( received ) ) {
+    throw runtime_error( "an end rebuilt from its descriptors didn't see the same rings" );
+  }
+
+  FileDescriptor junk { CheckSystemCall( "memfd_create", memfd_create( "junk", MFD_CLOEXEC ) ) };
+  CheckSystemCall( "ftruncate", ftruncate( junk.fd_num(), 65536 ) );
+  try {
+    const ShmLink bogus { std::move( junk ), a.wakeup_fd().duplicate(), b.wakeup_fd().duplicate(), 0 };
+    throw logic_error( "a link was attached to memory that isn't one" );
+  } catch ( const runtime_error& ) {
+  }
+}
+
+// A child process echoes frames back, sleeping on the eventfd whenever it runs dry
+void test_across_processes()
+{
+  constexpr uint32_t FRAMES = 20'000;
+  constexpr uint32_t WINDOW = 32;
+  auto [a, b] = ShmLink::make_pair( { .ring_slots = 64 } );
+
+  const pid_t child = CheckSystemCall( "fork", fork() );
+  if ( child == 0 ) {
+    EthernetFrame frame;
+    for ( uint32_t echoed = 0; echoed < FRAMES; ) {
+      if ( b.recv( frame ) ) {
+        echoed += b.send( frame );
+      } else if ( not b.wait( 5000 ) ) {
+        _exit( 1 );
+      }
+    }
+    _exit( 0 );
+  }
+
+  EthernetFrame received;
+  uint32_t sent = 0;
+  for ( uint32_t echoed = 0; echoed < FRAMES; ) {
+    while ( sent < FRAMES && sent - echoed < WINDOW ) {
+      a.send( make_frame( 60 + sent % 1400, sent ) );
+      sent++;
+    }
+    if ( a.recv( received ) ) {
+      if ( not same( received, make_frame( 60 + echoed % 1400, echoed ) ) ) {
+        throw runtime_error( "a frame came back from another process changed or out of order" );
+      }
+      echoed++;
+    } else if ( not a.wait( 5000 ) ) {
+      throw runtime_error( "the other process stopped echoing frames" );
+    }
+  }
+
+  int status = 0;
+  CheckSystemCall( "waitpid", waitpid( child, &status, 0 ) );
+  if ( not WIFEXITED( status ) || WEXITSTATUS( status ) != 0 ) {
+    throw runtime_error( "the echoing process failed" );
+  }
+  if ( a.wakeups_sent() + b.wakeups_sent() > 2 * FRAMES ) {
+    throw runtime_error( "the ends kicked each other's eventfds more than once a frame" );
+  }
+}
+
+// An idle receiver sleeps until a frame arrives, and a busy one is never kicked
+void test_wakeup()
+{
+  auto [a, b] = ShmLink::make_pair();
+  if ( b.wait( 0 ) || b.wait( 10 ) ) {
+    throw runtime_error( "waiting on an empty link said a frame was there" );
+  }
+
+  const pid_t child = CheckSystemCall( "fork", fork() );
+  if ( child == 0 ) {
+    usleep( 50'000 );
+    a.send( make_frame( 64, 1 ) );
+    _exit( 0 );
+  }
+  const bool woken = b.wait( 5000 );
+  CheckSystemCall( "waitpid", waitpid( child, nullptr, 0 ) );
+  EthernetFrame received;
+  if ( not woken || not b.recv( received ) || not same( received, make_frame( 64, 1 ) ) ) {
+    throw runtime_error( "a sleeping receiver wasn't woken by a frame" );
+  }
+
+  //nobody's waiting, so sending makes no system call.
+  for ( uint32_t i = 0; i < 100; i++ ) {
+    a.send( make_frame( 64, i ) );
+  }
+  if ( a.wakeups_sent() != 0 ) {
+    throw runtime_error( "a sender kicked a receiver that wasn't asleep" );
+  }
+}
+
+// Two interfaces joined by a link resolve each other with ARP, then exchange a datagram
+void test_interfaces( FrameLink& link_a, FrameLink& link_b )
+{
+  ostringstream discard;
+  auto* const old_cerr = cerr.rdbuf( discard.rdbuf() );
+  AsyncNetworkInterface a { ETH_A, Address { "10.0.0.1" } };
+  AsyncNetworkInterface b { ETH_B, Address { "10.0.0.2" } };
+  cerr.rdbuf( old_cerr );
+
+  InternetDatagram dgram;
+  dgram.header.src = Address { "10.0.0.1" }.ipv4_numeric();
+  dgram.header.dst = Address { "10.0.0.2" }.ipv4_numeric();
+  dgram.payload.emplace_back( string( 1000, 'x' ) );
+  dgram.header.len = static_cast<uint64_t>( dgram.header.hlen ) * 4 + 1000;
+  dgram.header.compute_checksum();
+  a.send_datagram( dgram, Address { "10.0.0.2" } );
+
+  //request, reply, then the datagram.
+  for ( int round = 0; round < 10; round++ ) {
+    link_a.wait( 100 );
+    link_a.pump( a );
+    link_b.wait( 100 );
+    link_b.pump( b );
+  }
+  InternetDatagram received;
+  if ( not b.maybe_receive( received ) || flatten( received.payload ) != string( 1000, 'x' ) ) {
+    throw runtime_error( "a datagram didn't get between interfaces over the link" );
+  }
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    auto [shm_a, shm_b] = ShmLink::make_pair();
+    test_round_trip( shm_a, shm_b );
+    auto [udp_a, udp_b] = UdpLink::make_pair();
+    test_round_trip( udp_a, udp_b );
+
+    test_full_ring();
+    test_attach();
+    test_across_processes();
+    test_wakeup();
+
+    auto [shm_c, shm_d] = ShmLink::make_pair();
+    test_interfaces( shm_c, shm_d );
+    auto [udp_c, udp_d] = UdpLink::make_pair();
+    test_interfaces( udp_c, udp_d );
+  } catch ( const exception& e ) {
+    cerr << "\n\n\n";
+    cerr << "\033[31;1mError: " << e.what() << "\033[m\n";
+    return EXIT_FAILURE;
+  }
+
+  cout << "\033[32;1mFrames crossed the shared-memory link intact, between processes too.\033[m\n";
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,109 @@
+#include "shm_link.hh"
+
+#include "exception.hh"
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+constexpr uint32_t FRAMES = 200'000;
+constexpr uint32_t WINDOW = 64; // frames in flight (well within both the ring and a socket buffer)
+
+struct Result
+{
+  double mpps {};
+  double gbps {};
+};
+
+// Frames go out to another process, which sends each one back; the sender keeps WINDOW in flight
+Result echo( FrameLink& near, FrameLink& far, size_t frame_length )
+{
+  EthernetFrame frame;
+  frame.header = { { 2, 0, 0, 0, 0, 2 }, { 2, 0, 0, 0, 0, 1 }, EthernetHeader::TYPE_IPv4 };
+  frame.payload.emplace_back( string( frame_length - EthernetHeader::LENGTH, 'x' ) );
+
+  const pid_t child = CheckSystemCall( "fork", fork() );
+  if ( child == 0 ) {
+    EthernetFrame echoed;
+    for ( uint32_t n = 0; n < FRAMES; ) {
+      if ( far.recv( echoed ) ) {
+        n += far.send( echoed );
+      } else if ( not far.wait( 5000 ) ) {
+        _exit( 1 );
+      }
+    }
+    _exit( 0 );
+  }
+
+  EthernetFrame received;
+  uint32_t sent = 0;
+  uint32_t returned = 0;
+  const auto start = chrono::steady_clock::now();
+  while ( returned < FRAMES ) {
+    while ( sent < FRAMES && sent - returned < WINDOW ) {
+      if ( not near.send( frame ) ) {
+        throw runtime_error( "a link dropped a frame with only " + to_string( WINDOW ) + " in flight" );
+      }
+      sent++;
+    }
+    if ( near.recv( received ) ) {
+      returned++;
+    } else if ( not near.wait( 5000 ) ) {
+      throw runtime_error( "frames stopped coming back" );
+    }
+  }
+  const double seconds = chrono::duration<double>( chrono::steady_clock::now() - start ).count();
+
+  int status = 0;
+  CheckSystemCall( "waitpid", waitpid( child, &status, 0 ) );
+  if ( not WIFEXITED( status ) || WEXITSTATUS( status ) != 0 || received.payload.empty()
+       || received.payload.front().size() != frame_length - EthernetHeader::LENGTH ) {
+    throw runtime_error( "the echoing process failed, or sent back the wrong frames" );
+  }
+
+  //both directions carry every frame.
+  const double frames_carried = 2.0 * FRAMES;
+  return { frames_carried / seconds / 1e6, frames_carried * frame_length * 8 / seconds / 1e9 };
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    cout << "Frames echoed between two processes, " << WINDOW << " in flight:\n";
+    double speedup_64 = 0;
+    for ( const size_t length : { size_t { 64 }, size_t { 1500 } } ) {
+      auto [udp_near, udp_far] = UdpLink::make_pair();
+      const Result udp = echo( udp_near, udp_far, length );
+      auto [shm_near, shm_far] = ShmLink::make_pair();
+      const Result shm = echo( shm_near, shm_far, length );
+
+      cout << fixed << setprecision( 2 ) << "  " << setw( 4 ) << length << "-byte frames:  UDP " << setw( 6 )
+           << udp.mpps << " Mpps " << setw( 6 ) << udp.gbps << " Gbit/s   shared memory " << setw( 6 ) << shm.mpps
+           << " Mpps " << setw( 6 ) << shm.gbps << " Gbit/s   (" << setprecision( 1 ) << shm.mpps / udp.mpps
+           << "x, " << shm_near.wakeups_sent() + shm_far.wakeups_sent() << " eventfd wakeups)\n";
+      if ( length == 64 ) {
+        speedup_64 = shm.mpps / udp.mpps;
+      }
+    }
+
+    if ( speedup_64 < 1.0 ) {
+      throw runtime_error( "small frames were slower over shared memory than over UDP" );
+    }
+  } catch ( const exception& e ) {
+    cerr << "\n\n\n";
+    cerr << "\033[31;1mError: " << e.what() << "\033[m\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
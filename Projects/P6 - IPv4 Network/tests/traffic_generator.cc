@@ -0,0 +1,259 @@
+#include "traffic_generator.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+// The first of `prefixes` a destination falls in
+size_t prefix_index( const vector<pair<uint32_t, uint8_t>>& prefixes, uint32_t dst )
+{
+  for ( size_t i = 0; i < prefixes.size(); i++ ) {
+    const uint32_t mask = prefixes[i].second == 0 ? 0 : UINT32_MAX << ( 32 - prefixes[i].second );
+    if ( ( dst & mask ) == prefixes[i].first ) {
+      return i;
+    }
+  }
+  throw runtime_error( "a destination fell outside every configured prefix" );
+}
+
+// 100 disjoint /16s: 10.0.0.0/16 ... 10.99.0.0/16
+vector<pair<uint32_t, uint8_t>> sixteens()
+{
+  vector<pair<uint32_t, uint8_t>> prefixes;
+  for ( uint32_t i = 0; i < 100; i++ ) {
+    prefixes.emplace_back( 0x0a000000 | ( i << 16 ), 16 );
+  }
+  return prefixes;
+}
+
+void test_deterministic()
+{
+  TrafficConfig config;
+  config.packets = 2000;
+  config.prefixes = random_prefixes( 100, 7 );
+  const TrafficTrace a { config };
+  const TrafficTrace b { config };
+  config.seed = 2;
+  const TrafficTrace c { config };
+
+  if ( a.size() != 2000 || a.frames().size() != 2000 ) {
+    throw runtime_error( "asked for 2000 packets" );
+  }
+  bool all_same = true;
+  bool any_different = false;
+  for ( size_t i = 0; i < a.size(); i++ ) {
+    const auto& x = a.datagrams()[i].header;
+    const auto& y = b.datagrams()[i].header;
+    const auto& z = c.datagrams()[i].header;
+    all_same = all_same && tie( x.src, x.dst, x.len, x.proto ) == tie( y.src, y.dst, y.len, y.proto );
+    any_different = any_different || x.dst != z.dst;
+  }
+  if ( not all_same || a.bytes() != b.bytes() ) {
+    throw runtime_error( "two traces from the same config differed" );
+  }
+  if ( not any_different ) {
+    throw runtime_error( "traces from different seeds were the same" );
+  }
+}
+
+void test_sizes_and_flows()
+{
+  TrafficConfig config;
+  config.packets = 24000;
+  config.flows = 50;
+  config.prefixes = sixteens();
+  const TrafficTrace trace { config };
+
+  map<uint16_t, size_t> sizes;
+  set<tuple<uint32_t, uint32_t, uint8_t>> flows;
+  uint64_t bytes = 0;
+  for ( const auto& dgram : trace.datagrams() ) {
+    sizes[dgram.header.len]++;
+    flows.emplace( dgram.header.src, dgram.header.dst, dgram.header.proto );
+    bytes += dgram.header.len;
+
+    size_t payload = 0;
+    for ( const auto& b : dgram.payload ) {
+      payload += b.size();
+    }
+    if ( payload + IPv4Header::LENGTH != dgram.header.len ) {
+      throw runtime_error( "a datagram's payload didn't match its length" );
+    }
+  }
+
+  //the IMIX is 7 : 4 : 1.
+  if ( sizes.size() != 3 || abs( static_cast<double>( sizes[40] ) / 14000 - 1 ) > 0.05
+       || abs( static_cast<double>( sizes[576] ) / 8000 - 1 ) > 0.05
+       || abs( static_cast<double>( sizes[1500] ) / 2000 - 1 ) > 0.1 ) {
+    throw runtime_error( "packet sizes weren't in the IMIX proportions" );
+  }
+  if ( bytes != trace.bytes() ) {
+    throw runtime_error( "bytes() didn't add up" );
+  }
+  if ( flows.size() > 50 || flows.size() < 45 ) {
+    throw runtime_error( "expected 50 flows, saw " + to_string( flows.size() ) );
+  }
+
+  //fixed sizes.
+  config.sizes = { { 64, 1 }, { 1500, 0 } };
+  const TrafficTrace fixed { config };
+  for ( const auto& dgram : fixed.datagrams() ) {
+    if ( dgram.header.len != 64 ) {
+      throw runtime_error( "a zero-weight size was used" );
+    }
+  }
+}
+
+// How many packets went to each prefix
+vector<size_t> prefix_counts( const TrafficConfig& config )
+{
+  vector<size_t> counts( config.prefixes.size() );
+  const TrafficTrace trace { config };
+  for ( const auto& dgram : trace.datagrams() ) {
+    counts[prefix_index( config.prefixes, dgram.header.dst )]++;
+  }
+  return counts;
+}
+
+void test_destinations()
+{
+  TrafficConfig config;
+  config.packets = 50000;
+  config.flows = 20000;
+  config.prefixes = sixteens();
+
+  //uniform: every prefix gets about 1%.
+  const vector<size_t> uniform = prefix_counts( config );
+  if ( ranges::min( uniform ) < 300 || ranges::max( uniform ) > 700 ) {
+    throw runtime_error( "uniform destinations weren't spread evenly over the prefixes" );
+  }
+
+  //Zipf (s = 1) over 100 prefixes: the first gets 1 / H(100) ~ 19%, the second half that.
+  config.destinations = TrafficConfig::Destinations::ZIPF;
+  const vector<size_t> zipf = prefix_counts( config );
+  const double first = static_cast<double>( zipf[0] ) / config.packets;
+  const double second = static_cast<double>( zipf[1] ) / config.packets;
+  if ( abs( first - 0.193 ) > 0.02 || abs( second - 0.096 ) > 0.015 || zipf[99] > zipf[0] / 50 ) {
+    throw runtime_error( "Zipf destinations weren't skewed 1/rank (top prefix had " + to_string( first ) + ")" );
+  }
+
+  //locality: most flows land in a /24 someone else already went to.
+  auto distinct_24s = [&] {
+    set<uint32_t> blocks;
+    const TrafficTrace trace { config };
+    for ( const auto& dgram : trace.datagrams() ) {
+      prefix_index( config.prefixes, dgram.header.dst );
+      blocks.insert( dgram.header.dst >> 8 );
+    }
+    return blocks.size();
+  };
+  config.destinations = TrafficConfig::Destinations::UNIFORM;
+  const size_t spread = distinct_24s();
+  config.destinations = TrafficConfig::Destinations::LOCALITY;
+  const size_t local = distinct_24s();
+  if ( local * 3 > spread ) {
+    throw runtime_error( "locality destinations covered " + to_string( local ) + " /24s, uniform "
+                         + to_string( spread ) );
+  }
+}
+
+void test_frames()
+{
+  TrafficConfig config;
+  config.packets = 500;
+  config.prefixes = random_prefixes( 1000, 3 );
+  config.ethernet_dst = { 2, 0, 0, 0, 0, 1 };
+  config.ethernet_src = { 2, 0, 0, 0, 0, 2 };
+  const TrafficTrace trace { config };
+
+  for ( const auto& [prefix, length] : config.prefixes ) {
+    if ( length > 32 || ( length < 32 && ( prefix & ( UINT32_MAX >> length ) ) != 0 ) ) {
+      throw runtime_error( "random_prefixes made a prefix with host bits set" );
+    }
+  }
+
+  for ( size_t i = 0; i < trace.size(); i++ ) {
+    const EthernetFrame& frame = trace.frames()[i];
+    const InternetDatagram& dgram = trace.datagrams()[i];
+    if ( frame.header.type != EthernetHeader::TYPE_IPv4 || frame.header.dst != config.ethernet_dst
+         || frame.header.src != config.ethernet_src ) {
+      throw runtime_error( "a frame had the wrong Ethernet header" );
+    }
+    InternetDatagram parsed;
+    if ( not parse( parsed, frame.payload ) ) {
+      throw runtime_error( "a frame didn't parse as IPv4 (bad checksum?)" );
+    }
+    if ( parsed.header.dst != dgram.header.dst || parsed.header.len != dgram.header.len ) {
+      throw runtime_error( "a frame didn't carry its datagram" );
+    }
+    prefix_index( config.prefixes, dgram.header.dst );
+  }
+}
+
+void test_bad_configs()
+{
+  auto rejects = []( const TrafficConfig& config ) {
+    try {
+      const TrafficTrace trace { config };
+    } catch ( const runtime_error& ) {
+      return true;
+    }
+    return false;
+  };
+
+  TrafficConfig config;
+  config.flows = 0;
+  if ( not rejects( config ) ) {
+    throw runtime_error( "no flows was accepted" );
+  }
+  config = {};
+  config.sizes = {};
+  if ( not rejects( config ) ) {
+    throw runtime_error( "no sizes was accepted" );
+  }
+  config = {};
+  config.sizes = { { 30, 1 } };
+  if ( not rejects( config ) ) {
+    throw runtime_error( "a 30-byte datagram was accepted" );
+  }
+  config = {};
+  config.sizes = { { 576, 1 }, { 1500, -1 } };
+  if ( not rejects( config ) ) {
+    throw runtime_error( "a negative weight was accepted" );
+  }
+  config = {};
+  config.prefixes = { { 0, 33 } };
+  if ( not rejects( config ) ) {
+    throw runtime_error( "a /33 was accepted" );
+  }
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    test_deterministic();
+    test_sizes_and_flows();
+    test_destinations();
+    test_frames();
+    test_bad_configs();
+  } catch ( const exception& e ) {
+    cerr << "\n\n\n";
+    cerr << "\033[31;1mError: " << e.what() << "\033[m\n";
+    return EXIT_FAILURE;
+  }
+
+  cout << "\033[32;1mGenerated traffic had the configured sizes, flows and destinations.\033[m\n";
+  return EXIT_SUCCESS;
+}
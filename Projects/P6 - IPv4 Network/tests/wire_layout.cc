@@ -0,0 +1,238 @@
+#include "arp_message.hh"
+#include "ethernet_frame.hh"
+#include "ipv4_datagram.hh"
+#include "wire_layout.hh"
+
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+// The old way: one byte at a time, most significant first
+template<typename T>
+void put( string& out, T value )
+{
+  for ( size_t i = sizeof( T ); i > 0; i-- ) {
+    out.push_back( static_cast<char>( value >> ( ( i - 1 ) * 8 ) ) );
+  }
+}
+
+void put( string& out, const EthernetAddress& address )
+{
+  out.append( address.begin(), address.end() );
+}
+
+string reference( const IPv4Header& h )
+{
+  string out;
+  put( out, static_cast<uint8_t>( ( h.ver << 4 ) | ( h.hlen & 0xf ) ) );
+  put( out, h.tos );
+  put( out, h.len );
+  put( out, h.id );
+  put( out, static_cast<uint16_t>( ( h.df ? 0x4000 : 0 ) | ( h.mf ? 0x2000 : 0 ) | ( h.offset & 0x1fff ) ) );
+  put( out, h.ttl );
+  put( out, h.proto );
+  put( out, h.cksum );
+  put( out, h.src );
+  put( out, h.dst );
+  return out;
+}
+
+string reference( const EthernetHeader& h )
+{
+  string out;
+  put( out, h.dst );
+  put( out, h.src );
+  put( out, h.type );
+  return out;
+}
+
+string reference( const ARPMessage& m )
+{
+  string out;
+  put( out, m.hardware_type );
+  put( out, m.protocol_type );
+  put( out, m.hardware_address_size );
+  put( out, m.protocol_address_size );
+  put( out, m.opcode );
+  put( out, m.sender_ethernet_address );
+  put( out, m.sender_ip_address );
+  put( out, m.target_ethernet_address );
+  put( out, m.target_ip_address );
+  return out;
+}
+
+string flatten( const vector<Buffer>& buffers )
+{
+  string out;
+  for ( const auto& b : buffers ) {
+    out.append( string_view { b } );
+  }
+  return out;
+}
+
+// The same bytes, cut into Buffers of `piece` bytes
+vector<Buffer> cut( const string& bytes, size_t piece )
+{
+  vector<Buffer> buffers;
+  for ( size_t i = 0; i < bytes.size(); i += piece ) {
+    buffers.emplace_back( bytes.substr( i, piece ) );
+  }
+  return buffers;
+}
+
+template<typename T>
+T random_integer( mt19937& rng )
+{
+  return static_cast<T>( uniform_int_distribution<uint64_t> {}( rng ) );
+}
+
+EthernetAddress random_address( mt19937& rng )
+{
+  EthernetAddress address;
+  for ( auto& b : address ) {
+    b = random_integer<uint8_t>( rng );
+  }
+  return address;
+}
+
+void test_ipv4( mt19937& rng )
+{
+  for ( size_t i = 0; i < 10'000; i++ ) {
+    IPv4Header h;
+    h.tos = random_integer<uint8_t>( rng );
+    h.len = random_integer<uint16_t>( rng ) | 20;
+    h.id = random_integer<uint16_t>( rng );
+    h.df = rng() & 1;
+    h.mf = rng() & 1;
+    h.offset = random_integer<uint16_t>( rng ); // (only the low 13 bits go on the wire)
+    h.ttl = random_integer<uint8_t>( rng );
+    h.proto = random_integer<uint8_t>( rng );
+    h.src = random_integer<uint32_t>( rng );
+    h.dst = random_integer<uint32_t>( rng );
+    h.compute_checksum();
+
+    const string wire = flatten( serialize( h ) );
+    if ( wire != reference( h ) ) {
+      throw runtime_error( "an IPv4 header serialized differently from the byte-at-a-time encoding" );
+    }
+
+    //parse it back, in one piece and split at every size.
+    IPv4Datagram dgram;
+    const string packet = wire + "payload";
+    for ( const size_t piece : { packet.size(), size_t { 1 }, size_t { 7 }, size_t { 19 } } ) {
+      if ( not parse( dgram, cut( packet, piece ) ) ) {
+        throw runtime_error( "a serialized IPv4 header didn't parse" );
+      }
+      const IPv4Header& p = dgram.header;
+      if ( p.tos != h.tos || p.len != h.len || p.id != h.id || p.df != h.df || p.mf != h.mf
+           || p.offset != ( h.offset & 0x1fff ) || p.ttl != h.ttl || p.proto != h.proto || p.cksum != h.cksum
+           || p.src != h.src || p.dst != h.dst || flatten( dgram.payload ) != "payload" ) {
+        throw runtime_error( "an IPv4 header didn't survive a round trip" );
+      }
+    }
+  }
+
+  //too short, or corrupted.
+  IPv4Header h;
+  h.compute_checksum();
+  string wire = flatten( serialize( h ) );
+  IPv4Header p;
+  if ( parse( p, { Buffer { wire.substr( 0, 19 ) } } ) ) {
+    throw runtime_error( "a truncated IPv4 header parsed" );
+  }
+  wire[8] = static_cast<char>( wire[8] ^ 1 );
+  if ( parse( p, { Buffer { wire } } ) ) {
+    throw runtime_error( "an IPv4 header with a bad checksum parsed" );
+  }
+}
+
+void test_ethernet_and_arp( mt19937& rng )
+{
+  for ( size_t i = 0; i < 10'000; i++ ) {
+    ARPMessage arp;
+    arp.opcode = ( rng() & 1 ) ? ARPMessage::OPCODE_REQUEST : ARPMessage::OPCODE_REPLY;
+    arp.sender_ethernet_address = random_address( rng );
+    arp.sender_ip_address = random_integer<uint32_t>( rng );
+    arp.target_ethernet_address = random_address( rng );
+    arp.target_ip_address = random_integer<uint32_t>( rng );
+
+    EthernetFrame frame;
+    frame.header = { random_address( rng ), random_address( rng ), EthernetHeader::TYPE_ARP };
+    frame.payload = serialize( arp );
+
+    const string wire = flatten( serialize( frame ) );
+    if ( wire != reference( frame.header ) + reference( arp ) ) {
+      throw runtime_error( "an ARP frame serialized differently from the byte-at-a-time encoding" );
+    }
+
+    for ( const size_t piece : { wire.size(), size_t { 5 }, size_t { 13 } } ) {
+      EthernetFrame parsed;
+      ARPMessage parsed_arp;
+      if ( not parse( parsed, cut( wire, piece ) ) || not parse( parsed_arp, parsed.payload ) ) {
+        throw runtime_error( "a serialized ARP frame didn't parse" );
+      }
+      if ( parsed.header.dst != frame.header.dst || parsed.header.src != frame.header.src
+           || parsed.header.type != frame.header.type || parsed_arp.opcode != arp.opcode
+           || parsed_arp.sender_ethernet_address != arp.sender_ethernet_address
+           || parsed_arp.sender_ip_address != arp.sender_ip_address
+           || parsed_arp.target_ethernet_address != arp.target_ethernet_address
+           || parsed_arp.target_ip_address != arp.target_ip_address ) {
+        throw runtime_error( "an ARP frame didn't survive a round trip" );
+      }
+    }
+  }
+
+  ARPMessage arp;
+  arp.opcode = ARPMessage::OPCODE_REQUEST;
+  string wire = flatten( serialize( arp ) );
+  if ( parse( arp, { Buffer { wire.substr( 0, ARPMessage::LENGTH - 1 ) } } ) ) {
+    throw runtime_error( "a truncated ARP message parsed" );
+  }
+  wire[7] = 3; // no such opcode
+  if ( parse( arp, { Buffer { wire } } ) ) {
+    throw runtime_error( "an unsupported ARP message parsed" );
+  }
+}
+
+// A layout the real headers don't use: a 64-bit field, and a byte only partly claimed
+void test_custom_layout()
+{
+  using Layout = wire::Layout<11, wire::Field<uint8_t, 0, 1, 3>, wire::Field<uint16_t, 1>, wire::Field<uint64_t, 3>>;
+  string out( Layout::LENGTH, '\xff' );
+  Layout::write( out.data(), 0xff, 0x1234, 0x0102030405060708 );
+  if ( out != string { "\x0e\x12\x34\x01\x02\x03\x04\x05\x06\x07\x08", 11 } ) {
+    throw runtime_error( "a custom layout was written wrongly" );
+  }
+  unsigned small = 0;
+  uint16_t middle = 0;
+  uint64_t large = 0;
+  Layout::read( out.data(), small, middle, large );
+  if ( small != 7 || middle != 0x1234 || large != 0x0102030405060708 ) {
+    throw runtime_error( "a custom layout was read wrongly" );
+  }
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    mt19937 rng { 458 };
+    test_ipv4( rng );
+    test_ethernet_and_arp( rng );
+    test_custom_layout();
+  } catch ( const exception& e ) {
+    cerr << "\n\n\n";
+    cerr << "\033[31;1mError: " << e.what() << "\033[m\n";
+    return EXIT_FAILURE;
+  }
+
+  cout << "\033[32;1mHeaders were laid out on the wire exactly as before.\033[m\n";
+  return EXIT_SUCCESS;
+}
@@ -1,6 +1,7 @@
 #include "arp_message.hh"
 
 #include <arpa/inet.h>
+#include <array>
 #include <iomanip>
 #include <sstream>
 
@@ -32,28 +33,25 @@ string ARPMessage::to_string() const
 
 void ARPMessage::parse( Parser& parser )
 {
-  parser.integer( hardware_type );
-  parser.integer( protocol_type );
-  parser.integer( hardware_address_size );
-  parser.integer( protocol_address_size );
-  parser.integer( opcode );
-
-  if ( not supported() ) {
-    parser.set_error();
+  array<char, LENGTH> scratch;
+  const char* const message = parser.contiguous( scratch );
+  if ( message == nullptr ) {
     return;
   }
+  Layout::read( message,
+                hardware_type,
+                protocol_type,
+                hardware_address_size,
+                protocol_address_size,
+                opcode,
+                sender_ethernet_address,
+                sender_ip_address,
+                target_ethernet_address,
+                target_ip_address );
 
-  // read sender addresses (Ethernet and IP)
-  for ( auto& b : sender_ethernet_address ) {
-    parser.integer( b );
-  }
-  parser.integer( sender_ip_address );
-
-  // read target addresses (Ethernet and IP)
-  for ( auto& b : target_ethernet_address ) {
-    parser.integer( b );
+  if ( not supported() ) {
+    parser.set_error();
   }
-  parser.integer( target_ip_address );
 }
 
 void ARPMessage::serialize( Serializer& serializer ) const
@@ -62,21 +60,14 @@ void ARPMessage::serialize( Serializer& serializer ) const
     throw runtime_error( "ARPMessage: unsupported field combination (must be Ethernet/IP, and request or reply)" );
   }
 
-  serializer.integer( hardware_type );
-  serializer.integer( protocol_type );
-  serializer.integer( hardware_address_size );
-  serializer.integer( protocol_address_size );
-  serializer.integer( opcode );
-
-  // read sender addresses (Ethernet and IP)
-  for ( const auto& b : sender_ethernet_address ) {
-    serializer.integer( b );
-  }
-  serializer.integer( sender_ip_address );
-
-  // read target addresses (Ethernet and IP)
-  for ( const auto& b : target_ethernet_address ) {
-    serializer.integer( b );
-  }
-  serializer.integer( target_ip_address );
+  Layout::write( serializer.append( LENGTH ),
+                 hardware_type,
+                 protocol_type,
+                 hardware_address_size,
+                 protocol_address_size,
+                 opcode,
+                 sender_ethernet_address,
+                 sender_ip_address,
+                 target_ethernet_address,
+                 target_ip_address );
 }
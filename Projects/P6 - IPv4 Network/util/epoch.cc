@@ -0,0 +1,79 @@
+#include "epoch.hh"
+
+#include <stdexcept>
+#include <thread>
+
+using namespace std;
+
+atomic<uint64_t> RcuEpoch::epoch_ { 1 };
+array<RcuEpoch::Slot, RcuEpoch::MAX_READER_THREADS> RcuEpoch::slots_ {};
+
+namespace {
+// A thread's claim on a reader slot, given back when the thread exits
+struct SlotClaim
+{
+  atomic<bool>* in_use = nullptr;
+  unsigned depth = 0; // nesting depth of this thread's read sections
+
+  SlotClaim() = default;
+  SlotClaim( const SlotClaim& other ) = delete;
+  SlotClaim& operator=( const SlotClaim& other ) = delete;
+  ~SlotClaim()
+  {
+    if ( in_use ) {
+      in_use->store( false, memory_order_release );
+    }
+  }
+};
+
+thread_local SlotClaim claim;
+thread_local atomic<uint64_t>* slot_epoch = nullptr;
+} // namespace
+
+RcuEpoch::Slot& RcuEpoch::thread_slot()
+{
+  for ( auto& slot : slots_ ) {
+    bool expected = false;
+    if ( slot.in_use.compare_exchange_strong( expected, true, memory_order_acquire ) ) {
+      claim.in_use = &slot.in_use;
+      return slot;
+    }
+  }
+  throw runtime_error( "RcuEpoch: more than " + to_string( MAX_READER_THREADS ) + " reader threads" );
+}
+
+RcuEpoch::ReadGuard::ReadGuard()
+{
+  if ( claim.depth++ > 0 ) {
+    return; // already pinned by an enclosing read section
+  }
+  if ( slot_epoch == nullptr ) {
+    slot_epoch = &thread_slot().epoch;
+  }
+
+  // The epoch value only needs to be roughly current (a stale one just makes a writer wait a
+  // little longer), but the slot store has to be visible before this thread reads any shared
+  // pointer, hence seq_cst on the store.
+  slot_epoch->store( epoch_.load( memory_order_relaxed ), memory_order_seq_cst );
+}
+
+RcuEpoch::ReadGuard::~ReadGuard()
+{
+  if ( --claim.depth == 0 ) {
+    slot_epoch->store( 0, memory_order_release );
+  }
+}
+
+void RcuEpoch::synchronize()
+{
+  const uint64_t target = epoch_.fetch_add( 1, memory_order_seq_cst ) + 1;
+
+  for ( auto& slot : slots_ ) {
+    // A reader that pinned an older epoch may have loaded the old version; wait for it to leave.
+    // Readers that pinned target or later started after the new version was published.
+    for ( uint64_t pinned = slot.epoch.load( memory_order_seq_cst ); pinned != 0 && pinned < target;
+          pinned = slot.epoch.load( memory_order_seq_cst ) ) {
+      this_thread::yield();
+    }
+  }
+}
@@ -1,5 +1,6 @@
 #include "ethernet_header.hh"
 
+#include <array>
 #include <iomanip>
 #include <sstream>
 
@@ -43,32 +44,14 @@ string EthernetHeader::to_string() const
 
 void EthernetHeader::parse( Parser& parser )
 {
-  // read destination address
-  for ( auto& b : dst ) {
-    parser.integer( b );
+  array<char, LENGTH> scratch;
+  const char* const header = parser.contiguous( scratch );
+  if ( header != nullptr ) {
+    Layout::read( header, dst, src, type );
   }
-
-  // read source address
-  for ( auto& b : src ) {
-    parser.integer( b );
-  }
-
-  // read frame type (e.g. IPv4, ARP, or something else)
-  parser.integer( type );
 }
 
 void EthernetHeader::serialize( Serializer& serializer ) const
 {
-  // write destination address
-  for ( const auto& b : dst ) {
-    serializer.integer( b );
-  }
-
-  // write source address
-  for ( const auto& b : src ) {
-    serializer.integer( b );
-  }
-
-  // write frame type (e.g. IPv4, ARP, or something else)
-  serializer.integer( type );
+  Layout::write( serializer.append( LENGTH ), dst, src, type );
 }
@@ -193,3 +193,11 @@ void FileDescriptor::set_blocking( bool blocking )
 
   internal_fd_->non_blocking_ = not blocking;
 }
+
+off_t FileDescriptor::size() const
+{
+  struct stat file_info
+  {};
+  CheckSystemCall( "fstat", fstat( fd_num(), &file_info ) );
+  return file_info.st_size;
+}
@@ -3,6 +3,7 @@
 #include "ethernet_header.hh"
 #include "ipv4_header.hh"
 #include "parser.hh"
+#include "wire_layout.hh"
 
 // [ARP](\ref rfc::rfc826) message
 struct ARPMessage
@@ -24,6 +25,18 @@ struct ARPMessage
   EthernetAddress target_ethernet_address {};
   uint32_t target_ip_address {};
 
+  // Where each field goes on the wire (in the order above)
+  using Layout = wire::Layout<LENGTH,
+                              wire::Field<uint16_t, 0>,  // hardware_type
+                              wire::Field<uint16_t, 2>,  // protocol_type
+                              wire::Field<uint8_t, 4>,   // hardware_address_size
+                              wire::Field<uint8_t, 5>,   // protocol_address_size
+                              wire::Field<uint16_t, 6>,  // opcode
+                              wire::Bytes<8, 6>,         // sender_ethernet_address
+                              wire::Field<uint32_t, 14>, // sender_ip_address
+                              wire::Bytes<18, 6>,        // target_ethernet_address
+                              wire::Field<uint32_t, 24>>; // target_ip_address
+
   // Return a string containing the ARP message in human-readable format
   std::string to_string() const;
 
@@ -2,22 +2,57 @@
 
 #include <memory>
 #include <string>
+#include <string_view>
 
 class Buffer
 {
-  std::shared_ptr<std::string> buffer_;
+  std::shared_ptr<std::string> buffer_ {}; // null for an empty Buffer, so those cost no allocation
+  size_t skip_ {};                         // bytes at the front of *buffer_ that aren't part of this Buffer
+
+  // The string itself, for writing: copied first if another Buffer shares it, so writes never
+  // show through anywhere else
+  std::string& mutable_string()
+  {
+    if ( not buffer_ ) {
+      buffer_ = std::make_shared<std::string>();
+    } else if ( not unique() ) {
+      buffer_ = std::make_shared<std::string>( buffer_->substr( skip_ ) );
+      skip_ = 0;
+    } else if ( skip_ ) {
+      buffer_->erase( 0, skip_ );
+      skip_ = 0;
+    }
+    return *buffer_;
+  }
 
 public:
   // NOLINTBEGIN(*-explicit-*)
 
-  Buffer( std::string str = {} ) : buffer_( make_shared<std::string>( std::move( str ) ) ) {}
-  operator std::string_view() const { return *buffer_; }
-  operator std::string&() { return *buffer_; }
+  Buffer( std::string str = {} )
+    : buffer_( str.empty() ? nullptr : std::make_shared<std::string>( std::move( str ) ) )
+  {}
+  operator std::string_view() const
+  {
+    return buffer_ ? std::string_view { *buffer_ }.substr( skip_ ) : std::string_view {};
+  }
+  operator std::string&() { return mutable_string(); }
 
   // NOLINTEND(*-explicit-*)
 
-  std::string&& release() { return std::move( *buffer_ ); }
-  size_t size() const { return buffer_->size(); }
-  size_t length() const { return buffer_->length(); }
-  bool empty() const { return buffer_->empty(); }
+  std::string&& release() { return std::move( mutable_string() ); }
+  size_t size() const { return buffer_ ? buffer_->size() - skip_ : 0; }
+  size_t length() const { return size(); }
+  bool empty() const { return size() == 0; }
+
+  // All but the first n bytes, sharing this Buffer's memory instead of copying it
+  Buffer suffix( size_t n ) const
+  {
+    Buffer ret;
+    ret.buffer_ = buffer_;
+    ret.skip_ = skip_ + n;
+    return ret;
+  }
+
+  // Whether this is the only Buffer holding its memory (so it can be overwritten in place)
+  bool unique() const { return buffer_.use_count() == 1; }
 };
@@ -44,4 +44,21 @@ public:
       add( x );
     }
   }
+
+  // A checksum patched for one 16-bit word it covers changing from old_word to new_word,
+  // without re-summing the data ([RFC 1624](\ref rfc::rfc1624) eqn. 3: HC' = ~(~HC + ~m + m'))
+  static uint16_t adjust( uint16_t cksum, uint16_t old_word, uint16_t new_word )
+  {
+    uint32_t sum = static_cast<uint16_t>( ~cksum ) + static_cast<uint16_t>( ~old_word ) + new_word;
+    sum = ( sum & 0xffff ) + ( sum >> 16 );
+    sum = ( sum & 0xffff ) + ( sum >> 16 );
+    return ~sum;
+  }
+
+  // The same, for a 32-bit value (e.g. an IPv4 address) covered as two words
+  static uint16_t adjust32( uint16_t cksum, uint32_t old_value, uint32_t new_value )
+  {
+    cksum = adjust( cksum, old_value >> 16, new_value >> 16 );
+    return adjust( cksum, static_cast<uint16_t>( old_value ), static_cast<uint16_t>( new_value ) );
+  }
 };
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Epoch-based read-copy-update.
+//
+// Readers wrap their accesses to shared data in a ReadGuard. A writer publishes a new
+// version (with an atomic pointer store), then calls synchronize(), which returns once
+// every reader that could still be looking at the old version has left its read section.
+// After that the old version can be freed or reused. Both the writer's store and the
+// readers' loads of the pointer must be seq_cst: with the guard's slot store and
+// synchronize()'s slot loads, that makes either the writer see the reader's slot or the
+// reader see the new version.
+//
+// Pinning costs a relaxed load of the global epoch and one store to a per-thread slot;
+// readers never take a lock and never wait for writers. Read sections nest. A thread must
+// not call synchronize() from inside its own read section (it would wait on itself).
+class RcuEpoch
+{
+public:
+  static constexpr size_t MAX_READER_THREADS = 256;
+
+  class ReadGuard
+  {
+  public:
+    ReadGuard();
+    ~ReadGuard();
+
+    ReadGuard( const ReadGuard& other ) = delete;
+    ReadGuard& operator=( const ReadGuard& other ) = delete;
+    ReadGuard( ReadGuard&& other ) = delete;
+    ReadGuard& operator=( ReadGuard&& other ) = delete;
+  };
+
+  // Wait until no reader is still inside a read section that began before this call
+  static void synchronize();
+
+private:
+  struct alignas( 64 ) Slot
+  {
+    std::atomic<uint64_t> epoch { 0 }; // epoch the thread pinned, 0 when it isn't reading
+    std::atomic<bool> in_use { false };
+  };
+
+  static std::atomic<uint64_t> epoch_;
+  static std::array<Slot, MAX_READER_THREADS> slots_;
+
+  static Slot& thread_slot();
+};
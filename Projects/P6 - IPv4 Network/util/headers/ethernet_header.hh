@@ -1,6 +1,7 @@
 #pragma once
 
 #include "parser.hh"
+#include "wire_layout.hh"
 
 #include <array>
 #include <cstdint>
@@ -26,6 +27,12 @@ struct EthernetHeader
   EthernetAddress src;
   uint16_t type;
 
+  // Where each field goes on the wire (in the order above)
+  using Layout = wire::Layout<LENGTH,
+                              wire::Bytes<0, 6>,        // dst
+                              wire::Bytes<6, 6>,        // src
+                              wire::Field<uint16_t, 12>>; // type
+
   // Return a string containing a header in human-readable format
   std::string to_string() const;
 
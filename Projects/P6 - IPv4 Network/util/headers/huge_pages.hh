@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <memory_resource>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// What kind of pages a piece of memory got
+enum class PageBacking
+{
+  HUGETLB,     // 2 MiB pages reserved from the hugetlbfs pool (MAP_HUGETLB)
+  TRANSPARENT, // normal pages that the kernel was asked to back with transparent huge pages
+  SMALL,       // 4 KiB pages
+};
+
+std::string to_string( PageBacking backing );
+
+// A memory resource that hands out memory backed by 2 MiB pages where it can, so a large table
+// that is read at random (like a FIB) needs one TLB entry per 2 MiB instead of one per 4 KiB.
+//
+// Memory comes from the hugetlbfs pool first (MAP_HUGETLB). If the pool is empty or missing,
+// it is mapped normally, aligned to 2 MiB, and marked for transparent huge pages (MADV_HUGEPAGE),
+// which the kernel backs with huge pages as it can; if transparent huge pages are switched off,
+// it stays on small pages. Small requests are carved out of shared 2 MiB chunks and only given
+// back when the resource is destroyed, so put a pool resource (e.g. std::pmr::synchronized_pool_resource)
+// in front of it to reuse freed memory; requests of CHUNK_SIZE / 4 and up get mappings of their own.
+//
+// Thread-safe. Must outlive everything allocated from it.
+class HugePageResource : public std::pmr::memory_resource
+{
+public:
+  static constexpr size_t HUGE_PAGE_SIZE = size_t { 2 } << 20;
+  static constexpr size_t CHUNK_SIZE = HUGE_PAGE_SIZE;
+
+  // Bytes mapped now, with each kind of backing
+  struct Stats
+  {
+    size_t hugetlb_bytes {};
+    size_t transparent_bytes {};
+    size_t small_bytes {};
+  };
+
+  // try_hugetlb: whether to try MAP_HUGETLB first (if not, go straight to transparent huge pages)
+  explicit HugePageResource( bool try_hugetlb = true );
+  ~HugePageResource() override;
+
+  HugePageResource( const HugePageResource& other ) = delete;
+  HugePageResource& operator=( const HugePageResource& other ) = delete;
+
+  Stats stats() const;
+
+  // The weakest backing of any memory mapped now (HUGETLB if there is none)
+  PageBacking backing() const;
+
+private:
+  struct Mapping
+  {
+    size_t length {};
+    PageBacking backing {};
+  };
+
+  mutable std::mutex mutex_ {};
+  bool try_hugetlb_;
+  std::unordered_map<void*, Mapping> mappings_ {}; // by start address
+  char* chunk_ {};                                 // where small requests are being carved from
+  size_t chunk_left_ {};
+  Stats stats_ {};
+
+  void* map( size_t length ); // a 2 MiB aligned mapping, recorded in mappings_
+  void unmap( void* addr );
+
+  void* do_allocate( size_t bytes, size_t alignment ) override;
+  void do_deallocate( void* p, size_t bytes, size_t alignment ) override;
+  bool do_is_equal( const std::pmr::memory_resource& other ) const noexcept override { return this == &other; }
+};
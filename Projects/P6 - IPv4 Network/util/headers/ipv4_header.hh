@@ -1,6 +1,7 @@
 #pragma once
 
 #include "parser.hh"
+#include "wire_layout.hh"
 
 #include <cstddef>
 #include <cstdint>
@@ -12,6 +13,7 @@ struct IPv4Header
   static constexpr size_t LENGTH = 20;        // IPv4 header length, not including options
   static constexpr uint8_t DEFAULT_TTL = 128; // A reasonable default TTL value
   static constexpr uint8_t PROTO_TCP = 6;     // Protocol number for TCP
+  static constexpr uint8_t PROTO_UDP = 17;    // Protocol number for UDP
 
   static constexpr uint64_t serialized_length() { return LENGTH; }
 
@@ -48,6 +50,22 @@ struct IPv4Header
   uint32_t src = 0;          // src address
   uint32_t dst = 0;          // dst address
 
+  // Where each field goes on the wire (in the order above)
+  using Layout = wire::Layout<LENGTH,
+                              wire::Field<uint8_t, 0, 4, 4>,   // ver
+                              wire::Field<uint8_t, 0, 0, 4>,   // hlen
+                              wire::Field<uint8_t, 1>,         // tos
+                              wire::Field<uint16_t, 2>,        // len
+                              wire::Field<uint16_t, 4>,        // id
+                              wire::Field<uint16_t, 6, 14, 1>, // df
+                              wire::Field<uint16_t, 6, 13, 1>, // mf
+                              wire::Field<uint16_t, 6, 0, 13>, // offset
+                              wire::Field<uint8_t, 8>,         // ttl
+                              wire::Field<uint8_t, 9>,         // proto
+                              wire::Field<uint16_t, 10>,       // cksum
+                              wire::Field<uint32_t, 12>,       // src
+                              wire::Field<uint32_t, 16>>;      // dst
+
   // Length of the payload
   uint16_t payload_length() const;
 
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "file_descriptor.hh"
+
+#include <cstddef>
+#include <span>
+
+// An owned memory mapping, unmapped on destruction
+class MMapRegion
+{
+  void* addr_ {};
+  size_t length_ {};
+
+public:
+  MMapRegion() = default;
+
+  // Take ownership of a mapping returned by [mmap(2)](\ref man2::mmap)
+  MMapRegion( void* addr, size_t length ) : addr_( addr ), length_( length ) {}
+
+  // Map a whole file read-only (pages are prefaulted, as the caller is about to read all of it)
+  static MMapRegion map_readonly( const FileDescriptor& fd );
+
+  // Map `length` bytes of a file read-write and shared with any other process that maps it
+  static MMapRegion map_shared( const FileDescriptor& fd, size_t length );
+
+  ~MMapRegion();
+
+  MMapRegion( const MMapRegion& other ) = delete;
+  MMapRegion& operator=( const MMapRegion& other ) = delete;
+  MMapRegion( MMapRegion&& other ) noexcept;
+  MMapRegion& operator=( MMapRegion&& other ) noexcept;
+
+  void* data() const { return addr_; }
+  size_t size() const { return length_; }
+  std::span<const std::byte> bytes() const { return { static_cast<const std::byte*>( addr_ ), length_ }; }
+};
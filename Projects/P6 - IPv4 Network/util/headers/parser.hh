@@ -1,12 +1,13 @@
 #pragma once
 
 #include "buffer.hh"
+#include "wire_layout.hh"
 
 #include <algorithm>
+#include <array>
 #include <concepts>
 #include <cstdint>
 #include <cstring>
-#include <deque>
 #include <numeric>
 #include <span>
 #include <stdexcept>
@@ -18,18 +19,20 @@ class Serializer;
 
 class Parser
 {
+  // A read position in the caller's list of Buffers (which must outlive the Parser)
   class BufferList
   {
+    std::span<const Buffer> buffers_ {};
+    size_t next_ {}; // index of the first Buffer not yet consumed
     uint64_t size_ {};
-    std::deque<Buffer> buffer_ {};
-    uint64_t skip_ {};
+    uint64_t skip_ {}; // bytes already consumed from buffers_[next_]
 
   public:
     // NOLINTNEXTLINE(*-explicit-*)
-    BufferList( const std::vector<Buffer>& buffers )
+    BufferList( const std::vector<Buffer>& buffers ) : buffers_( buffers )
     {
       for ( const auto& x : buffers ) {
-        append( x );
+        size_ += x.size();
       }
     }
 
@@ -39,41 +42,41 @@ class Parser
 
     std::string_view peek() const
     {
-      if ( buffer_.empty() ) {
+      if ( next_ == buffers_.size() ) {
         throw std::runtime_error( "peek on empty BufferList" );
       }
-      return std::string_view { buffer_.front() }.substr( skip_ );
+      return std::string_view { buffers_[next_] }.substr( skip_ );
     }
 
     void remove_prefix( uint64_t len )
     {
-      while ( len and not buffer_.empty() ) {
+      while ( len and next_ < buffers_.size() ) {
         const uint64_t to_pop_now = std::min( len, peek().size() );
         skip_ += to_pop_now;
         len -= to_pop_now;
         size_ -= to_pop_now;
-        if ( skip_ == buffer_.front().size() ) {
-          buffer_.pop_front();
+        if ( skip_ == buffers_[next_].size() ) {
+          next_++;
           skip_ = 0;
         }
       }
     }
 
+    // The rest of the input, as Buffers that share the input's memory (so nothing is copied,
+    // and if `out` already has the capacity, nothing is allocated either)
     void dump_all( std::vector<Buffer>& out )
     {
       out.clear();
       if ( empty() ) {
         return;
       }
-      std::string first_str = std::move( buffer_.front() );
-      if ( skip_ ) {
-        first_str = first_str.substr( skip_ );
-      }
-      out.emplace_back( std::move( first_str ) );
-      buffer_.pop_front();
-      for ( auto&& x : buffer_ ) {
-        out.emplace_back( std::move( x ) );
+      out.push_back( buffers_[next_].suffix( skip_ ) );
+      for ( size_t i = next_ + 1; i < buffers_.size(); i++ ) {
+        out.push_back( buffers_[i] );
       }
+      next_ = buffers_.size();
+      size_ = 0;
+      skip_ = 0;
     }
 
     void dump_all( Buffer& out )
@@ -85,16 +88,11 @@ class Parser
         return;
       }
 
-      out.release().clear();
+      std::string joined;
       for ( const auto& s : concat ) {
-        out.release().append( s );
+        joined.append( s );
       }
-    }
-
-    void append( Buffer str )
-    {
-      size_ += str.size();
-      buffer_.push_back( std::move( str ) );
+      out = std::move( joined );
     }
   };
 
@@ -110,6 +108,7 @@ class Parser
 
 public:
   explicit Parser( const std::vector<Buffer>& input ) : input_( input ) {}
+  explicit Parser( std::vector<Buffer>&& input ) = delete; // the Parser reads the Buffers in place
 
   const BufferList& input() const { return input_; }
 
@@ -154,6 +153,26 @@ public:
     }
   }
 
+  // The next N bytes, for a fixed-size header to be read from in place: a pointer into the input
+  // when they're in one Buffer (the usual case), otherwise copied into `scratch`. Null (and an
+  // error) if fewer than N bytes are left.
+  template<size_t N>
+  const char* contiguous( std::array<char, N>& scratch )
+  {
+    check_size( N );
+    if ( has_error() ) {
+      return nullptr;
+    }
+
+    const std::string_view view = input_.peek();
+    if ( view.size() >= N ) {
+      input_.remove_prefix( N );
+      return view.data();
+    }
+    string( scratch );
+    return scratch.data();
+  }
+
   void all_remaining( std::vector<Buffer>& out ) { input_.dump_all( out ); }
   void all_remaining( Buffer& out ) { input_.dump_all( out ); }
 };
@@ -161,21 +180,37 @@ public:
 class Serializer
 {
   std::vector<Buffer> output_ {};
-  std::string buffer_ {};
+  Buffer buffer_ {};
 
 public:
   Serializer() = default;
   explicit Serializer( std::string&& buffer ) : buffer_( std::move( buffer ) ) {}
 
+  // Serialize into the memory of a previous output: the vector keeps its capacity, and if nothing
+  // else holds its first Buffer, the new bytes are written over that Buffer's string.
+  explicit Serializer( std::vector<Buffer>&& recycled ) : output_( std::move( recycled ) )
+  {
+    if ( not output_.empty() and output_.front().unique() ) {
+      buffer_ = std::move( output_.front() );
+      static_cast<std::string&>( buffer_ ).clear();
+    }
+    output_.clear();
+  }
+
   template<std::unsigned_integral T>
   void integer( const T& val )
   {
-    constexpr uint64_t len = sizeof( T );
+    wire::store_big_endian( append( sizeof( T ) ), val );
+  }
 
-    for ( uint64_t i = 0; i < len; ++i ) {
-      const uint8_t byte_val = val >> ( ( len - i - 1 ) * 8 );
-      buffer_.push_back( byte_val );
-    }
+  // Room for the next `n` bytes, at the end of the Buffer being filled, for the caller to write
+  // (e.g. a whole header at once). Valid until the next call on the Serializer.
+  char* append( size_t n )
+  {
+    std::string& bytes = buffer_;
+    const size_t at = bytes.size();
+    bytes.resize( at + n );
+    return bytes.data() + at;
   }
 
   void buffer( const Buffer& buf )
@@ -193,14 +228,14 @@ public:
 
   void flush()
   {
-    output_.emplace_back( std::move( buffer_ ) );
-    buffer_.clear();
+    output_.push_back( std::move( buffer_ ) );
+    buffer_ = Buffer {};
   }
 
   std::vector<Buffer> output()
   {
     flush();
-    return output_;
+    return std::move( output_ );
   }
 };
 
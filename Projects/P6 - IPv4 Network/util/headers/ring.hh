@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstddef>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+// A FIFO queue stored in a circular array.
+//
+// Unlike std::queue, popping doesn't destroy the element: the object stays in its slot and is
+// handed out again by a later push_slot(), along with any memory it owns (a datagram's payload
+// vector, say). A queue that runs at a steady depth therefore stops allocating once it has
+// grown to that depth. The capacity doubles when the ring is full, and is always a power of 2.
+template<typename T>
+class Ring
+{
+  std::vector<T> slots_;
+  size_t head_ {};
+  size_t size_ {};
+
+  size_t mask() const { return slots_.size() - 1; }
+
+  void grow()
+  {
+    std::vector<T> bigger( slots_.size() * 2 );
+    for ( size_t i = 0; i < size_; i++ ) {
+      bigger[i] = std::move( slots_[( head_ + i ) & mask()] );
+    }
+    slots_ = std::move( bigger );
+    head_ = 0;
+  }
+
+public:
+  explicit Ring( size_t capacity = 16 ) : slots_()
+  {
+    size_t rounded = 1;
+    while ( rounded < capacity ) {
+      rounded *= 2;
+    }
+    slots_.resize( rounded );
+  }
+
+  bool empty() const { return size_ == 0; }
+  size_t size() const { return size_; }
+  size_t capacity() const { return slots_.size(); }
+
+  T& front()
+  {
+    if ( empty() ) {
+      throw std::runtime_error( "front() on empty Ring" );
+    }
+    return slots_[head_];
+  }
+
+  // Add a slot at the back and return it. It holds whatever object last used the slot
+  // (or a default-constructed one), which the caller is expected to overwrite.
+  T& push_slot()
+  {
+    if ( size_ == slots_.size() ) {
+      grow();
+    }
+    return slots_[( head_ + size_++ ) & mask()];
+  }
+
+  void push( T value ) { push_slot() = std::move( value ); }
+
+  // Take back the slot just added by push_slot() (e.g. when filling it in failed)
+  void unpush()
+  {
+    if ( empty() ) {
+      throw std::runtime_error( "unpush() on empty Ring" );
+    }
+    size_--;
+  }
+
+  // Remove the front element, leaving its object in the ring for reuse
+  void pop()
+  {
+    if ( empty() ) {
+      throw std::runtime_error( "pop() on empty Ring" );
+    }
+    head_ = ( head_ + 1 ) & mask();
+    size_--;
+  }
+
+  // Swap the front element into `out` and pop it. Whatever `out` held goes into the ring
+  // in exchange, so a caller that keeps passing the same object recycles memory both ways.
+  void pop_into( T& out )
+  {
+    using std::swap;
+    swap( out, front() );
+    pop();
+  }
+};
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+// A fixed-size FIFO for one producer thread and one consumer thread, like a NIC's descriptor
+// ring. Neither side locks. As with Ring, objects stay in their slots and are swapped with
+// the caller's rather than copied, so memory gets recycled in both directions. When the
+// ring is full, the producer has to drop (or hold on to) what it was going to push.
+template<typename T>
+class SpscRing
+{
+  std::vector<T> slots_;
+  size_t mask_;
+
+  alignas( 64 ) std::atomic<size_t> head_ { 0 }; // next slot to pop (written by the consumer)
+  alignas( 64 ) std::atomic<size_t> tail_ { 0 }; // next slot to push (written by the producer)
+
+public:
+  // The capacity is rounded up to a power of 2
+  explicit SpscRing( size_t capacity ) : slots_(), mask_()
+  {
+    size_t rounded = 1;
+    while ( rounded < capacity ) {
+      rounded *= 2;
+    }
+    slots_.resize( rounded );
+    mask_ = rounded - 1;
+  }
+
+  // Copying is only safe while no other thread is using either ring
+  SpscRing( const SpscRing& other )
+    : slots_( other.slots_ )
+    , mask_( other.mask_ )
+    , head_( other.head_.load( std::memory_order_acquire ) )
+    , tail_( other.tail_.load( std::memory_order_acquire ) )
+  {}
+
+  SpscRing& operator=( const SpscRing& other )
+  {
+    slots_ = other.slots_;
+    mask_ = other.mask_;
+    head_.store( other.head_.load( std::memory_order_acquire ), std::memory_order_release );
+    tail_.store( other.tail_.load( std::memory_order_acquire ), std::memory_order_release );
+    return *this;
+  }
+
+  size_t capacity() const { return slots_.size(); }
+
+  // Number of elements queued (a snapshot, if the other side is busy)
+  size_t size() const { return tail_.load( std::memory_order_acquire ) - head_.load( std::memory_order_acquire ); }
+  bool empty() const { return size() == 0; }
+
+  // Producer: swap `value` into the ring. Returns false (leaving `value` alone) if the ring is full.
+  bool push_swap( T& value )
+  {
+    const size_t tail = tail_.load( std::memory_order_relaxed );
+    if ( tail - head_.load( std::memory_order_acquire ) == slots_.size() ) {
+      return false;
+    }
+    using std::swap;
+    swap( value, slots_[tail & mask_] );
+    tail_.store( tail + 1, std::memory_order_release );
+    return true;
+  }
+
+  // Consumer: swap the front element into `out` and pop it. Returns false if the ring is empty.
+  bool pop_swap( T& out )
+  {
+    const size_t head = head_.load( std::memory_order_relaxed );
+    if ( head == tail_.load( std::memory_order_acquire ) ) {
+      return false;
+    }
+    using std::swap;
+    swap( out, slots_[head & mask_] );
+    head_.store( head + 1, std::memory_order_release );
+    return true;
+  }
+};
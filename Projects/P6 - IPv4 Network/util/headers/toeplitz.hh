@@ -0,0 +1,35 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+// The Toeplitz hash that NICs use for receive-side scaling (RSS): each set bit of the input
+// XORs in the 32 bits of the key starting at that bit position. Packets of one flow hash the
+// same, so they can be steered to the same receive queue.
+class ToeplitzHash
+{
+public:
+  static constexpr size_t KEY_LENGTH = 40;
+  using Key = std::array<uint8_t, KEY_LENGTH>;
+
+  // The key from Microsoft's RSS specification (whose published test vectors it reproduces)
+  static constexpr Key DEFAULT_KEY
+    = { 0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2, 0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3,
+        0x8f, 0xb0, 0xd0, 0xca, 0x2b, 0xcb, 0xae, 0x7b, 0x30, 0xb4, 0x77, 0xcb, 0x2d, 0xa3,
+        0x80, 0x30, 0xf2, 0x0c, 0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa };
+
+  explicit ToeplitzHash( const Key& key = DEFAULT_KEY ) : key_( key ) {}
+
+  // Hash up to KEY_LENGTH - 4 bytes of input (throws std::runtime_error if there are more)
+  uint32_t operator()( std::span<const uint8_t> input ) const;
+
+  // The usual RSS input for IPv4: source address, destination address, and, if there are
+  // L4 ports, source port and destination port, all in network byte order
+  uint32_t ipv4( uint32_t src, uint32_t dst ) const;
+  uint32_t ipv4( uint32_t src, uint32_t dst, uint16_t src_port, uint16_t dst_port ) const;
+
+private:
+  Key key_;
+};
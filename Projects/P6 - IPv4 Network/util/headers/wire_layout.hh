@@ -0,0 +1,150 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Compile-time descriptions of fixed-size wire formats.
+//
+// A header lists its fields once, as a Layout of Fields (big-endian integers at fixed byte
+// offsets, optionally narrowed to a run of bits within the integer) and Bytes (runs of raw
+// bytes). The Layout checks at compile time that no two fields share a bit and that every byte
+// of the header belongs to some field (bits no field claims, like a reserved flag, are zero), and
+// generates the code to read and write it: each field is one load or store of its whole width,
+// byte-swapped as needed, and a header is assembled in a local image and copied out in a single
+// write, so serializing a header has no loops and no branches on its contents.
+namespace wire {
+
+// Load and store big-endian integers at any alignment
+template<std::unsigned_integral T>
+constexpr T from_big_endian( T value )
+{
+  if constexpr ( sizeof( T ) == 1 or std::endian::native == std::endian::big ) {
+    return value;
+  } else if constexpr ( sizeof( T ) == 2 ) {
+    return __builtin_bswap16( value );
+  } else if constexpr ( sizeof( T ) == 4 ) {
+    return __builtin_bswap32( value );
+  } else {
+    static_assert( sizeof( T ) == 8 );
+    return __builtin_bswap64( value );
+  }
+}
+
+template<std::unsigned_integral T>
+T load_big_endian( const char* at )
+{
+  T value;
+  std::memcpy( &value, at, sizeof( T ) );
+  return from_big_endian( value );
+}
+
+template<std::unsigned_integral T>
+void store_big_endian( char* at, T value )
+{
+  value = from_big_endian( value ); // (the swap is its own inverse)
+  std::memcpy( at, &value, sizeof( T ) );
+}
+
+// A big-endian integer of type T at byte `Offset`. If `Bits` is less than T's width, the field is
+// only those bits of the integer, starting `Shift` bits from the least significant end, and other
+// Fields can share the rest.
+template<std::unsigned_integral T, size_t Offset, unsigned Shift = 0, unsigned Bits = 8 * sizeof( T )>
+struct Field
+{
+  static_assert( Bits > 0 and Shift + Bits <= 8 * sizeof( T ), "a field's bits must lie within its integer" );
+
+  using Word = T;
+  static constexpr size_t offset = Offset;
+  static constexpr size_t width = sizeof( T );
+  static constexpr bool whole = Bits == 8 * sizeof( T );
+  static constexpr uint64_t max = Bits == 64 ? UINT64_MAX : ( uint64_t { 1 } << Bits ) - 1;
+  static constexpr uint64_t mask = max << Shift; // the field's bits within the integer
+
+  // Writes the field into a header image, where its bytes start out zero
+  template<typename V>
+  static void put( char* image, const V& value )
+  {
+    const auto bits = static_cast<T>( ( static_cast<uint64_t>( value ) & max ) << Shift );
+    if constexpr ( whole ) {
+      store_big_endian( image + Offset, bits );
+    } else {
+      store_big_endian( image + Offset, static_cast<T>( load_big_endian<T>( image + Offset ) | bits ) );
+    }
+  }
+
+  template<typename V>
+  static void get( const char* header, V& value )
+  {
+    value = static_cast<V>( ( load_big_endian<T>( header + Offset ) >> Shift ) & max );
+  }
+};
+
+// `N` raw bytes at byte `Offset` (e.g. an Ethernet address)
+template<size_t Offset, size_t N>
+struct Bytes
+{
+  static constexpr size_t offset = Offset;
+  static constexpr size_t width = N;
+  static constexpr uint64_t mask = UINT64_MAX;
+
+  static void put( char* image, const std::array<uint8_t, N>& value ) { std::memcpy( image + Offset, value.data(), N ); }
+  static void get( const char* header, std::array<uint8_t, N>& value ) { std::memcpy( value.data(), header + Offset, N ); }
+};
+
+// A header of `Length` bytes, made of `Fields` in order
+template<size_t Length, typename... Fields>
+class Layout
+{
+  // No bit of the header may belong to two fields, and no byte to none.
+  static constexpr bool tiles()
+  {
+    std::array<uint8_t, Length> used {};
+    bool ok = true;
+    auto claim = [&]( size_t offset, size_t width, uint64_t mask ) {
+      if ( offset + width > Length ) {
+        ok = false;
+        return;
+      }
+      for ( size_t i = 0; i < width; i++ ) {
+        // byte i of a big-endian integer holds bits (width - 1 - i) * 8 and up
+        const auto bits = static_cast<uint8_t>( width > 8 ? 0xff : mask >> ( ( width - 1 - i ) * 8 ) );
+        ok = ok and ( used[offset + i] & bits ) == 0;
+        used[offset + i] |= bits;
+      }
+    };
+    ( claim( Fields::offset, Fields::width, Fields::mask ), ... );
+    for ( const uint8_t byte : used ) {
+      ok = ok and byte != 0;
+    }
+    return ok;
+  }
+
+  static_assert( tiles(), "a layout's fields mustn't overlap or leave bytes out" );
+
+public:
+  static constexpr size_t LENGTH = Length;
+
+  // Writes the header to `out` (LENGTH bytes), one value per field
+  template<typename... Values>
+  static void write( char* out, const Values&... values )
+  {
+    static_assert( sizeof...( Values ) == sizeof...( Fields ), "one value per field" );
+    alignas( 8 ) std::array<char, Length> image {};
+    ( Fields::put( image.data(), values ), ... );
+    std::memcpy( out, image.data(), Length );
+  }
+
+  // Reads the header from `in` (LENGTH bytes) into one variable per field
+  template<typename... Values>
+  static void read( const char* in, Values&... values )
+  {
+    static_assert( sizeof...( Values ) == sizeof...( Fields ), "one variable per field" );
+    ( Fields::get( in, values ), ... );
+  }
+};
+
+} // namespace wire
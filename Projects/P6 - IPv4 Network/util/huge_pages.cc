@@ -0,0 +1,161 @@
+#include "huge_pages.hh"
+
+#include "exception.hh"
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <stdexcept>
+#include <sys/mman.h>
+
+using namespace std;
+
+namespace {
+
+size_t round_up( size_t n, size_t multiple )
+{
+  return ( n + multiple - 1 ) / multiple * multiple;
+}
+
+// Whether the kernel will give transparent huge pages to regions that ask (mode "always" or "madvise")
+bool transparent_huge_pages_enabled()
+{
+  ifstream mode { "/sys/kernel/mm/transparent_hugepage/enabled" };
+  string line;
+  return getline( mode, line ) and line.find( "[never]" ) == string::npos;
+}
+
+} // namespace
+
+string to_string( PageBacking backing )
+{
+  switch ( backing ) {
+    case PageBacking::HUGETLB:
+      return "2 MiB pages (hugetlbfs)";
+    case PageBacking::TRANSPARENT:
+      return "transparent huge pages";
+    case PageBacking::SMALL:
+      return "4 KiB pages";
+  }
+  return "unknown";
+}
+
+HugePageResource::HugePageResource( bool try_hugetlb ) : try_hugetlb_( try_hugetlb ) {}
+
+HugePageResource::~HugePageResource()
+{
+  for ( const auto& [addr, mapping] : mappings_ ) {
+    if ( munmap( addr, mapping.length ) < 0 ) {
+      // don't throw an exception from the destructor
+      cerr << "Exception destructing HugePageResource: " << unix_error { "munmap" }.what() << endl;
+    }
+  }
+}
+
+void* HugePageResource::map( size_t length )
+{
+  if ( try_hugetlb_ ) {
+    void* addr = mmap( nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0 );
+    if ( addr != MAP_FAILED ) {
+      mappings_[addr] = { length, PageBacking::HUGETLB };
+      stats_.hugetlb_bytes += length;
+      return addr;
+    }
+    try_hugetlb_ = false; // (the pool is empty or missing; don't pay for the failed call every time)
+  }
+
+  //map 2 MiB more than needed, and trim it to a 2 MiB boundary so the kernel can use whole huge pages.
+  void* const raw = mmap( nullptr, length + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+  if ( raw == MAP_FAILED ) {
+    throw unix_error { "mmap" };
+  }
+  const auto start = reinterpret_cast<uintptr_t>( raw );     // NOLINT(*-reinterpret-cast)
+  const uintptr_t aligned = round_up( start, HUGE_PAGE_SIZE );
+  if ( aligned > start ) {
+    CheckSystemCall( "munmap", munmap( raw, aligned - start ) );
+  }
+  if ( aligned + length < start + length + HUGE_PAGE_SIZE ) {
+    CheckSystemCall( "munmap",
+                     munmap( reinterpret_cast<void*>( aligned + length ), // NOLINT(*-reinterpret-cast, *-int-to-ptr)
+                             start + HUGE_PAGE_SIZE - aligned ) );
+  }
+  void* const addr = reinterpret_cast<void*>( aligned ); // NOLINT(*-reinterpret-cast, *-int-to-ptr)
+
+  const bool transparent = transparent_huge_pages_enabled() and madvise( addr, length, MADV_HUGEPAGE ) == 0;
+  mappings_[addr] = { length, transparent ? PageBacking::TRANSPARENT : PageBacking::SMALL };
+  ( transparent ? stats_.transparent_bytes : stats_.small_bytes ) += length;
+  return addr;
+}
+
+void HugePageResource::unmap( void* addr )
+{
+  const auto it = mappings_.find( addr );
+  if ( it == mappings_.end() ) {
+    throw runtime_error( "HugePageResource: freeing memory it didn't map" );
+  }
+  CheckSystemCall( "munmap", munmap( addr, it->second.length ) );
+  switch ( it->second.backing ) {
+    case PageBacking::HUGETLB:
+      stats_.hugetlb_bytes -= it->second.length;
+      break;
+    case PageBacking::TRANSPARENT:
+      stats_.transparent_bytes -= it->second.length;
+      break;
+    case PageBacking::SMALL:
+      stats_.small_bytes -= it->second.length;
+      break;
+  }
+  mappings_.erase( it );
+}
+
+void* HugePageResource::do_allocate( size_t bytes, size_t alignment )
+{
+  const lock_guard lock { mutex_ };
+  if ( alignment > HUGE_PAGE_SIZE ) {
+    throw bad_alloc {};
+  }
+  bytes = max<size_t>( bytes, 1 );
+
+  if ( bytes >= CHUNK_SIZE / 4 ) {
+    return map( round_up( bytes, HUGE_PAGE_SIZE ) );
+  }
+
+  //carve it from the current chunk, starting a new one if it doesn't fit. (a new chunk is 2 MiB aligned)
+  size_t skip = round_up( reinterpret_cast<uintptr_t>( chunk_ ), alignment ) // NOLINT(*-reinterpret-cast)
+                - reinterpret_cast<uintptr_t>( chunk_ );                     // NOLINT(*-reinterpret-cast)
+  if ( chunk_ == nullptr or skip + bytes > chunk_left_ ) {
+    chunk_ = static_cast<char*>( map( CHUNK_SIZE ) );
+    chunk_left_ = CHUNK_SIZE;
+    skip = 0;
+  }
+  char* const p = chunk_ + skip;
+  chunk_ += skip + bytes;
+  chunk_left_ -= skip + bytes;
+  return p;
+}
+
+void HugePageResource::do_deallocate( void* p, size_t bytes, size_t /* alignment */ )
+{
+  if ( max<size_t>( bytes, 1 ) < CHUNK_SIZE / 4 ) {
+    return; // (part of a chunk, reclaimed when the resource goes)
+  }
+  const lock_guard lock { mutex_ };
+  unmap( p );
+}
+
+HugePageResource::Stats HugePageResource::stats() const
+{
+  const lock_guard lock { mutex_ };
+  return stats_;
+}
+
+PageBacking HugePageResource::backing() const
+{
+  const lock_guard lock { mutex_ };
+  if ( stats_.small_bytes ) {
+    return PageBacking::SMALL;
+  }
+  return stats_.transparent_bytes ? PageBacking::TRANSPARENT : PageBacking::HUGETLB;
+}
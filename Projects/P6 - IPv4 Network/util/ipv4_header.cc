@@ -11,25 +11,12 @@ using namespace std;
 // Parse from string.
 void IPv4Header::parse( Parser& parser )
 {
-  uint8_t first_byte {};
-  parser.integer( first_byte );
-  ver = first_byte >> 4;    // version
-  hlen = first_byte & 0x0f; // header length
-  parser.integer( tos );    // type of service
-  parser.integer( len );
-  parser.integer( id );
-
-  uint16_t fo_val {};
-  parser.integer( fo_val );
-  df = static_cast<bool>( fo_val & 0x4000 ); // don't fragment
-  mf = static_cast<bool>( fo_val & 0x2000 ); // more fragments
-  offset = fo_val & 0x1fff;                  // offset
-
-  parser.integer( ttl );
-  parser.integer( proto );
-  parser.integer( cksum );
-  parser.integer( src );
-  parser.integer( dst );
+  array<char, LENGTH> scratch;
+  const char* const header = parser.contiguous( scratch );
+  if ( header == nullptr ) {
+    return;
+  }
+  Layout::read( header, ver, hlen, tos, len, id, df, mf, offset, ttl, proto, cksum, src, dst );
 
   if ( ver != 4 ) {
     parser.set_error();
@@ -57,22 +44,7 @@ void IPv4Header::serialize( Serializer& serializer ) const
     throw runtime_error( "wrong IP version" );
   }
 
-  const uint8_t first_byte = ( static_cast<uint32_t>( ver ) << 4 ) | ( hlen & 0xfU );
-  serializer.integer( first_byte ); // version and header length
-  serializer.integer( tos );
-  serializer.integer( len );
-  serializer.integer( id );
-
-  const uint16_t fo_val = ( df ? 0x4000U : 0 ) | ( mf ? 0x2000U : 0 ) | ( offset & 0x1fffU );
-  serializer.integer( fo_val );
-
-  serializer.integer( ttl );
-  serializer.integer( proto );
-
-  serializer.integer( cksum );
-
-  serializer.integer( src );
-  serializer.integer( dst );
+  Layout::write( serializer.append( LENGTH ), ver, hlen, tos, len, id, df, mf, offset, ttl, proto, cksum, src, dst );
 }
 
 uint16_t IPv4Header::payload_length() const
@@ -102,14 +74,23 @@ uint32_t IPv4Header::pseudo_checksum() const
 
 void IPv4Header::compute_checksum()
 {
-  cksum = 0;
-  Serializer s;
-  serialize( s );
+  // consistency check (the same one serialize() makes)
+  if ( ver != 4 ) {
+    throw runtime_error( "wrong IP version" );
+  }
 
-  // calculate checksum -- taken over header only
-  InternetChecksum check;
-  check.add( s.output() );
-  cksum = check.value();
+  // calculate checksum -- taken over header only. Summed a 16-bit word at a time straight from
+  // the fields (the bytes serialize() would write, with cksum as zero), so nothing is allocated.
+  const uint16_t fo_val = ( df ? 0x4000U : 0 ) | ( mf ? 0x2000U : 0 ) | ( offset & 0x1fffU );
+  uint32_t sum = ( ( ( static_cast<uint32_t>( ver ) << 4 ) | ( hlen & 0xfU ) ) << 8 ) | tos;
+  sum += len;
+  sum += id;
+  sum += fo_val;
+  sum += ( static_cast<uint32_t>( ttl ) << 8 ) | proto;
+  sum += ( src >> 16 ) + static_cast<uint16_t>( src );
+  sum += ( dst >> 16 ) + static_cast<uint16_t>( dst );
+
+  cksum = InternetChecksum { sum }.value();
 }
 
 std::string IPv4Header::to_string() const
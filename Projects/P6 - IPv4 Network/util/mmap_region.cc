@@ -0,0 +1,54 @@
+#include "mmap_region.hh"
+
+#include "exception.hh"
+
+#include <iostream>
+#include <sys/mman.h>
+#include <utility>
+
+using namespace std;
+
+MMapRegion MMapRegion::map_readonly( const FileDescriptor& fd )
+{
+  const auto length = static_cast<size_t>( fd.size() );
+  if ( length == 0 ) {
+    return {}; // mmap refuses empty mappings
+  }
+
+  void* addr = mmap( nullptr, length, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd.fd_num(), 0 );
+  if ( addr == MAP_FAILED ) {
+    throw unix_error { "mmap" };
+  }
+  return { addr, length };
+}
+
+MMapRegion MMapRegion::map_shared( const FileDescriptor& fd, size_t length )
+{
+  void* addr = mmap( nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd.fd_num(), 0 );
+  if ( addr == MAP_FAILED ) {
+    throw unix_error { "mmap" };
+  }
+  return { addr, length };
+}
+
+MMapRegion::~MMapRegion()
+{
+  if ( addr_ and munmap( addr_, length_ ) < 0 ) {
+    // don't throw an exception from the destructor
+    cerr << "Exception destructing MMapRegion: " << unix_error { "munmap" }.what() << endl;
+  }
+}
+
+MMapRegion::MMapRegion( MMapRegion&& other ) noexcept
+  : addr_( exchange( other.addr_, nullptr ) ), length_( exchange( other.length_, 0 ) )
+{}
+
+MMapRegion& MMapRegion::operator=( MMapRegion&& other ) noexcept
+{
+  if ( this != &other ) {
+    MMapRegion old { std::move( *this ) };
+    addr_ = exchange( other.addr_, nullptr );
+    length_ = exchange( other.length_, 0 );
+  }
+  return *this;
+}
@@ -0,0 +1,50 @@
+#include "toeplitz.hh"
+
+#include <stdexcept>
+
+using namespace std;
+
+uint32_t ToeplitzHash::operator()( span<const uint8_t> input ) const
+{
+  if ( input.size() > KEY_LENGTH - 4 ) {
+    throw runtime_error( "Toeplitz hash input is longer than the key allows" );
+  }
+
+  // `window` holds the 32 key bits starting at the current input bit, plus the next 8 below them
+  uint64_t window = 0;
+  for ( size_t i = 0; i < 5; i++ ) {
+    window = ( window << 8 ) | key_[i];
+  }
+
+  uint32_t hash = 0;
+  for ( size_t i = 0; i < input.size(); i++ ) {
+    for ( int bit = 7; bit >= 0; bit-- ) {
+      if ( input[i] & ( 1U << bit ) ) {
+        hash ^= static_cast<uint32_t>( window >> ( bit + 1 ) );
+      }
+    }
+    const uint8_t next_key_byte = i + 5 < KEY_LENGTH ? key_[i + 5] : 0;
+    window = ( ( window << 8 ) | next_key_byte ) & 0xff'ffff'ffffULL;
+  }
+  return hash;
+}
+
+uint32_t ToeplitzHash::ipv4( uint32_t src, uint32_t dst ) const
+{
+  const array<uint8_t, 8> input = { static_cast<uint8_t>( src >> 24 ), static_cast<uint8_t>( src >> 16 ),
+                                    static_cast<uint8_t>( src >> 8 ),  static_cast<uint8_t>( src ),
+                                    static_cast<uint8_t>( dst >> 24 ), static_cast<uint8_t>( dst >> 16 ),
+                                    static_cast<uint8_t>( dst >> 8 ),  static_cast<uint8_t>( dst ) };
+  return ( *this )( input );
+}
+
+uint32_t ToeplitzHash::ipv4( uint32_t src, uint32_t dst, uint16_t src_port, uint16_t dst_port ) const
+{
+  const array<uint8_t, 12> input
+    = { static_cast<uint8_t>( src >> 24 ),     static_cast<uint8_t>( src >> 16 ), static_cast<uint8_t>( src >> 8 ),
+        static_cast<uint8_t>( src ),           static_cast<uint8_t>( dst >> 24 ), static_cast<uint8_t>( dst >> 16 ),
+        static_cast<uint8_t>( dst >> 8 ),      static_cast<uint8_t>( dst ),       static_cast<uint8_t>( src_port >> 8 ),
+        static_cast<uint8_t>( src_port ),      static_cast<uint8_t>( dst_port >> 8 ),
+        static_cast<uint8_t>( dst_port ) };
+  return ( *this )( input );
+}